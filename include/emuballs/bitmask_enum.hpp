@@ -1,5 +1,7 @@
 #pragma once
 
+#include <type_traits>
+
 // https://www.justsoftwaresolutions.co.uk/cplusplus/using-enum-classes-as-bitfields.html
 
 template<typename E>
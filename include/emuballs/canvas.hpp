@@ -21,6 +21,7 @@
 #include "emuballs/color.hpp"
 #include "emuballs/dptr.hpp"
 #include "emuballs/export.h"
+#include "emuballs/memory.hpp"
 #include <vector>
 
 namespace Emuballs
@@ -28,6 +29,22 @@ namespace Emuballs
 class EMUBALLS_API Canvas
 {
 public:
+	/**
+	 * What the canvas shows, for sources that only redraw
+	 * what changed since their previous draw.
+	 */
+	struct DrawnFrame
+	{
+		/**
+		 * Id unique to the source and the layout of its frame;
+		 * 0 when nothing was drawn. Sources redraw everything,
+		 * changeSize() included, when the id isn't theirs.
+		 */
+		uint64_t source = 0;
+		/** Source's own marker of the moment of the draw. */
+		uint64_t generation = 0;
+	};
+
 	Canvas();
 	Canvas(const Canvas &other) = delete;
 	Canvas &operator=(const Canvas &other) = delete;
@@ -39,7 +56,8 @@ public:
 	/**
 	 * Draw a whole picture on screen.
 	 *
-	 * The default implementation is inefficient and will just drawPixel() in loops.
+	 * The default implementation converts the picture row by row
+	 * with convertRow() and passes each row to drawRow().
 	 *
 	 * @param x
 	 *     Starting x position from top-left corner.
@@ -50,17 +68,55 @@ public:
 	 * @param height
 	 *     Height of picture in pixels.
 	 * @param bitsPerPixel
-	 *     Bit depth of the picture.
+	 *     Bit depth of the picture: 16 for little-endian RGB565,
+	 *     24 for blue, green, red bytes and 32 for little-endian
+	 *     0xXXRRGGBB. The top byte of 32-bit pixels is ignored.
 	 * @param pitch
-	 *     How many bytes are per row of pixels.
+	 *     How many bytes are per row of pixels. Values smaller than
+	 *     the row itself mean the rows are tightly packed.
 	 * @param pixels
 	 *     Pixel data.
 	 */
 	virtual void drawPicture(int32_t x, int32_t y, int32_t width, int32_t height,
 		int32_t bitsPerPixel, int32_t pitch, const std::vector<uint8_t> &pixels);
+	/**
+	 * Draw a whole picture that is split into spans, like a frame
+	 * buffer viewed straight in the emulated memory.
+	 *
+	 * Parameters are the same as in drawPicture(); the pixel data
+	 * is the concatenation of the `spans`. The default implementation
+	 * converts the rows in place and only gathers the rows that
+	 * cross the span boundaries. drawPicture() draws through here.
+	 */
+	virtual void drawSpans(int32_t x, int32_t y, int32_t width, int32_t height,
+		int32_t bitsPerPixel, int32_t pitch, const std::vector<MemorySpan> &spans);
+	/**
+	 * Draw a row of 0xAARRGGBB pixels.
+	 *
+	 * The default implementation will just drawPixel() in a loop.
+	 * Canvases backed by a 32-bit image should copy the row instead.
+	 */
+	virtual void drawRow(int32_t x, int32_t y, int32_t width, const uint32_t *rgb32);
 	virtual void drawPixel(int32_t x, int32_t y, const Color &color) = 0;
 	virtual void changeSize(int32_t width, int32_t height, BitDepth depth) = 0;
 
+	const DrawnFrame &drawnFrame() const;
+	/**
+	 * Set by the source after a draw. Reset it to a default
+	 * DrawnFrame to have the next draw repaint everything.
+	 */
+	void setDrawnFrame(const DrawnFrame &frame);
+
+	/**
+	 * Convert a row of `width` pixels of `bitsPerPixel` depth
+	 * to 0xAARRGGBB, using the widest SIMD instructions
+	 * the host CPU has.
+	 *
+	 * @throw std::logic_error if the bit depth is not supported.
+	 */
+	static void convertRow(int32_t bitsPerPixel, const uint8_t *row,
+		int32_t width, uint32_t *rgb32);
+
 private:
 	DPtr<Canvas> d;
 };
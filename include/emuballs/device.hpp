@@ -23,15 +23,20 @@
 #include <functional>
 #include <memory>
 #include <list>
+#include <ostream>
 #include <string>
+#include <vector>
 
 namespace Emuballs
 {
 
 class Canvas;
+class Fuzzer;
+struct FuzzTarget;
 class Memory;
 class Programmer;
 class RegisterSet;
+class SymbolTable;
 
 class EMUBALLS_API Device
 {
@@ -44,8 +49,9 @@ public:
 	/**
 	 * Make the machine run.
 	 *
-	 * Each cycle is execution of 1 opcode + 1 cycle of GPU, whereas
-	 * GPU only collects the mailbox.
+	 * Each cycle is execution of 1 opcode. Peripherals, such as the GPU
+	 * mailbox, are serviced in between the opcodes only when they
+	 * have something to do.
 	 *
 	 * @param cycles
 	 *     If Device is to be run in an auto-run mode, it will be beneficial
@@ -53,11 +59,173 @@ public:
 	 *     returning from cycle(). For step-by-step mode this should be 1.
 	 */
 	virtual void cycle(uint32_t cycles) = 0;
+	/**
+	 * Draw the display on the `canvas`. Only what changed since
+	 * the previous draw on the same canvas is redrawn; see
+	 * Canvas::drawnFrame().
+	 */
 	virtual void draw(Canvas &canvas) = 0;
+	/**
+	 * Fast hash of the displayed pixels, computed straight from the
+	 * guest memory without converting them, for comparing screens
+	 * against golden values. It depends only on the frame size, bit
+	 * depth and the pixels as the guest stored them, so it's the same
+	 * on every host. 0 when nothing is displayed yet.
+	 *
+	 * The hash of the whole frame is cached until the frame buffer is
+	 * written again, so it's cheap to poll between cycle() calls.
+	 */
+	virtual uint64_t frameHash() = 0;
+	/**
+	 * Hash of a region of the display, clipped to its size.
+	 */
+	virtual uint64_t frameHash(int32_t x, int32_t y, int32_t width, int32_t height) = 0;
 	virtual Memory &memory() = 0;
 	virtual void reset() = 0;
 	virtual RegisterSet &registers() = 0;
 
+	/**
+	 * Record every executed instruction into a binary trace file,
+	 * which can be decoded with TraceReader. Tracing that is not
+	 * started costs nothing.
+	 *
+	 * @throw std::runtime_error if the file can't be opened.
+	 */
+	virtual void startTrace(const std::string &path) = 0;
+	/**
+	 * Write out the remaining trace and close the file.
+	 */
+	virtual void stopTrace() = 0;
+
+	/**
+	 * Log every nondeterministic input, such as the system timer
+	 * reads, along with the instruction count at which it was taken.
+	 * Start recording right after the program is loaded, so that
+	 * the replay can start from the same state.
+	 *
+	 * @throw std::runtime_error if the file can't be opened.
+	 */
+	virtual void startRecording(const std::string &path) = 0;
+	/**
+	 * Feed the inputs from a log made by startRecording() instead
+	 * of taking them from the host, reproducing the recorded run
+	 * exactly. From then on, cycle() throws ReplayError if the
+	 * run diverges from the log or goes past its end.
+	 *
+	 * @throw std::runtime_error if the file can't be opened.
+	 * @throw ReplayError if the file is not an input log.
+	 */
+	virtual void startReplay(const std::string &path) = 0;
+	/**
+	 * Go back to taking the inputs from the host.
+	 */
+	virtual void stopRecordReplay() = 0;
+
+	/**
+	 * Attribute executed instructions to guest functions.
+	 *
+	 * @param samplePeriod
+	 *     Self costs are sampled every that many instructions;
+	 *     1 counts every instruction. Call edges are always exact.
+	 */
+	virtual void startProfile(uint32_t samplePeriod) = 0;
+	/**
+	 * Stop profiling and write the profile in callgrind format,
+	 * naming functions with `symbols` when they're known.
+	 * Writes nothing if profiling wasn't started.
+	 */
+	virtual void stopProfile(std::ostream &callgrind, const SymbolTable &symbols) = 0;
+
+	/**
+	 * Run the loaded program until the target's snapshot address
+	 * and return a Fuzzer that starts every input from there.
+	 * The Device must not be used otherwise while the Fuzzer exists.
+	 * Guest time is virtual from then on, until reset(), so that
+	 * every input sees the same time and the same peripherals.
+	 *
+	 * @throw std::runtime_error if the snapshot address
+	 *        is not reached within the warmup budget.
+	 */
+	virtual std::unique_ptr<Fuzzer> fuzz(const FuzzTarget &target) = 0;
+
+	/**
+	 * Keep checkpoints of the execution, so that it can be moved
+	 * back with stepBack() and runBackToBreakpoint().
+	 * Checkpoints are dropped on reset().
+	 *
+	 * @param interval
+	 *     Instructions between checkpoints; going back replays
+	 *     up to that many instructions.
+	 * @param memoryBudget
+	 *     Bytes the checkpoints may take; the oldest ones are
+	 *     dropped when exceeded, limiting how far back the
+	 *     execution can go.
+	 */
+	virtual void startCheckpoints(uint64_t interval, size_t memoryBudget) = 0;
+	virtual void stopCheckpoints() = 0;
+	/**
+	 * Move the execution `instructions` back, but not past
+	 * the oldest checkpoint. The inputs, such as the timer reads,
+	 * are the same as in the original run.
+	 *
+	 * @return Instructions actually stepped back; 0 if
+	 *         checkpoints weren't started.
+	 */
+	virtual uint64_t stepBack(uint64_t instructions) = 0;
+	/**
+	 * Move the execution back to the most recent point where
+	 * the next instruction was at one of the `breakpoints`.
+	 * If there's none, the execution is moved back to the oldest
+	 * checkpoint.
+	 *
+	 * @return true if a breakpoint was found.
+	 */
+	virtual bool runBackToBreakpoint(const std::vector<uint32_t> &breakpoints) = 0;
+
+	/**
+	 * How the cores of a multi-core device are run; single-core
+	 * devices ignore this. Cores are synchronised every `quantum`
+	 * instructions. Deterministic interleaving runs the cores one
+	 * after another on the thread calling cycle(), making the runs
+	 * reproducible; otherwise each core runs on its own thread.
+	 *
+	 * Tracing, input recording and replay, checkpoints and fuzzing
+	 * are not supported on multi-core devices and throw
+	 * std::runtime_error.
+	 */
+	virtual void setCoreScheduling(uint32_t quantum, bool deterministic) = 0;
+
+	/**
+	 * In virtual time the guest clocks are computed from the amount
+	 * of executed instructions, one instruction taking one cycle of
+	 * a `clockRate` Hz CPU, where 0 picks the clock rate of the real
+	 * device. Runs are then reproducible and the guest doesn't wait
+	 * on the host clock. Otherwise, which is the default, guest time
+	 * follows the wall clock of the host.
+	 *
+	 * The setting survives reset().
+	 */
+	virtual void setVirtualTime(bool enabled, uint64_t clockRate) = 0;
+	/**
+	 * Guest time elapsed since reset(), in microseconds.
+	 */
+	virtual uint64_t guestTime() = 0;
+
+	/**
+	 * In virtual time, fast-forward the loops that busy-wait on
+	 * the system timer: guest time is moved straight to when the
+	 * wait ends instead of running all the iterations. Skipping
+	 * is suspended while tracing, profiling, keeping checkpoints
+	 * or fuzzing, and on multi-core devices.
+	 *
+	 * The setting survives reset().
+	 */
+	virtual void setIdleLoopSkipping(bool enabled) = 0;
+	/**
+	 * Instructions skipped by the idle loop skipping since reset().
+	 */
+	virtual uint64_t skippedInstructions() = 0;
+
 	Programmer &programmer();
 
 protected:
@@ -34,6 +34,30 @@ public:
 
 /////////////////////////
 
+class EMUBALLS_API TraceFormatError : public std::runtime_error
+{
+public:
+	using runtime_error::runtime_error;
+};
+
+/////////////////////////
+
+class EMUBALLS_API SymbolLoadError : public std::runtime_error
+{
+public:
+	using runtime_error::runtime_error;
+};
+
+/////////////////////////
+
+class EMUBALLS_API ReplayError : public std::runtime_error
+{
+public:
+	using runtime_error::runtime_error;
+};
+
+/////////////////////////
+
 class EMUBALLS_API ProgramRuntimeError : public std::runtime_error
 {
 public:
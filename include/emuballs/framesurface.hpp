@@ -0,0 +1,84 @@
+/*
+ * Copyright 2017 Zalewa <zalewapl@gmail.com>.
+ *
+ * This file is part of Emuballs.
+ *
+ * Emuballs is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Emuballs is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with Emuballs.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#pragma once
+
+#include "emuballs/canvas.hpp"
+#include "emuballs/dptr.hpp"
+#include "emuballs/export.h"
+#include <cstdint>
+#include <vector>
+
+namespace Emuballs
+{
+
+/**
+ * Canvas that hands the completed draws over to another thread,
+ * like a GUI or an encoder, without either side waiting for
+ * the other.
+ *
+ * Frames are triple buffered. Device::draw() paints the back frame
+ * and end() publishes it by swapping it with the middle one, which
+ * is a single atomic exchange. The reader swaps the middle frame
+ * with the front one in latest() when a newer one was published.
+ * Neither side ever sees a frame the other is writing, so there's
+ * no tearing, and the reader never copies the guest memory.
+ *
+ * Each frame remembers its own Canvas::DrawnFrame, so the device
+ * only redraws what changed since that frame was drawn, even though
+ * the frames are drawn in turns.
+ *
+ * One thread may draw and one thread may read at a time.
+ */
+class EMUBALLS_API FrameSurface : public Canvas
+{
+public:
+	struct Frame
+	{
+		int32_t width = 0;
+		int32_t height = 0;
+		/** 0xAARRGGBB pixels, `width` per row. */
+		std::vector<uint32_t> pixels;
+		/**
+		 * Number of the publication, counting from 1;
+		 * 0 when nothing was published yet.
+		 */
+		uint64_t sequence = 0;
+	};
+
+	FrameSurface();
+	virtual ~FrameSurface();
+
+	void begin() override;
+	void end() override;
+	void drawRow(int32_t x, int32_t y, int32_t width, const uint32_t *rgb32) override;
+	void drawPixel(int32_t x, int32_t y, const Color &color) override;
+	void changeSize(int32_t width, int32_t height, BitDepth depth) override;
+
+	/**
+	 * The most recently published frame. It stays as it is until
+	 * the next call; frames published in between are skipped,
+	 * which shows as a gap in Frame::sequence.
+	 */
+	const Frame &latest();
+
+private:
+	DPtr<FrameSurface> d;
+};
+
+}
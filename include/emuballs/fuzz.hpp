@@ -0,0 +1,105 @@
+/*
+ * Copyright 2017 Zalewa <zalewapl@gmail.com>.
+ *
+ * This file is part of Emuballs.
+ *
+ * Emuballs is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Emuballs is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with Emuballs.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#pragma once
+
+#include "emuballs/export.h"
+#include <cstdint>
+#include <string>
+
+namespace Emuballs
+{
+
+/**
+ * Describes a piece of guest code to fuzz, typically a parser
+ * called with a buffer.
+ */
+struct EMUBALLS_API FuzzTarget
+{
+	/**
+	 * Snapshot is taken when the execution first reaches this
+	 * address; every input starts from there.
+	 */
+	uint32_t snapshotAddress = 0;
+	/** Instructions allowed for reaching the snapshot address. */
+	uint64_t warmupBudget = 100000000;
+	/**
+	 * Input is copied to this address, truncated to
+	 * `inputCapacity` bytes.
+	 */
+	uint32_t inputAddress = 0;
+	uint32_t inputCapacity = 0;
+	/** Register to receive the input length; none if empty. */
+	std::string inputLengthRegister;
+	/** Register to receive the input address; none if empty. */
+	std::string inputAddressRegister;
+	/** Execution of an input ends when it reaches this address. */
+	uint32_t returnAddress = 0;
+	/** Instructions allowed per input; running out is a hang. */
+	uint64_t budget = 1000000;
+};
+
+enum class FuzzOutcome : int
+{
+	/** Execution reached the return address. */
+	Returned,
+	/** Budget ran out before the return address was reached. */
+	Hang,
+	/** Guest executed an illegal instruction or a bad access. */
+	Crash,
+	/**
+	 * Execution stopped at a breakpoint or a watchpoint set
+	 * on the machine before reaching the return address.
+	 */
+	Stopped
+};
+
+struct EMUBALLS_API FuzzResult
+{
+	FuzzOutcome outcome;
+	/** Instructions executed for the input. */
+	uint64_t executed;
+	/** Crash or stop description. */
+	std::string error;
+};
+
+/**
+ * Fork-server style fuzzing harness, obtained from Device::fuzz().
+ *
+ * Each run() starts from the snapshot taken at the target's
+ * snapshot address. Only memory pages dirtied by the previous run
+ * are restored, so thousands of runs per second are possible.
+ */
+class EMUBALLS_API Fuzzer
+{
+public:
+	virtual ~Fuzzer();
+
+	/**
+	 * Record edge coverage of every run into `map`, which can be
+	 * the shared memory bitmap of a coverage-guided fuzzer like AFL.
+	 * The map is not cleared by the Fuzzer.
+	 *
+	 * @param size
+	 *     Must be a power of two; nullptr `map` disables coverage.
+	 */
+	virtual void setCoverageMap(uint8_t *map, size_t size) = 0;
+	virtual FuzzResult run(const uint8_t *input, size_t length) = 0;
+};
+
+}
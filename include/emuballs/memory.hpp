@@ -32,6 +32,24 @@ typedef size_t memsize;
 typedef std::function<void(memsize, Access)> memobserver;
 typedef uint32_t memobserver_id;
 
+struct MemWatchHit
+{
+	/** Id returned by Memory::watch(). */
+	memobserver_id id;
+	memsize address;
+	Access access;
+};
+typedef std::function<void(const MemWatchHit&)> memwatchlistener;
+
+/**
+ * Read-only view of a piece of Memory that is continuous on the host.
+ */
+struct MemorySpan
+{
+	const uint8_t *data;
+	memsize length;
+};
+
 class EMUBALLS_API Memory
 {
 public:
@@ -73,13 +91,105 @@ public:
 	 * within a Page. Pages break continuity.
 	 */
 	uint8_t *ptr(memsize address);
+	const uint8_t *ptr(memsize address) const;
 	memsize pageSize() const;
 	memsize size() const;
 
+	/**
+	 * Views of the memory at `address`, one per page, that cover
+	 * `length` bytes or up to the end of the Memory. Nothing is copied
+	 * and no pages are allocated; pages that were never written are
+	 * viewed as zeros. The views stay valid for as long as the Memory
+	 * lives, but only the views of already allocated pages see
+	 * later writes, so get fresh spans for each use.
+	 */
+	std::vector<MemorySpan> spans(memsize address, memsize length) const;
+
+	/**
+	 * Pages written since the last clearDirtyPages(), in the order
+	 * of the first write. Getting a non-const ptr() counts as a write.
+	 */
+	const std::vector<memsize> &dirtyPages() const;
+	void clearDirtyPages();
+	/**
+	 * Bring back the contents of the dirty pages from `snapshot`,
+	 * which is typically a copy of this Memory made right after
+	 * clearDirtyPages(), and clear the dirty pages. Pages that
+	 * the snapshot doesn't have are zeroed. Only the dirty pages
+	 * are copied, so the cost depends on what was written, not
+	 * on the size of the Memory.
+	 */
+	void restoreDirtyPages(const Memory &snapshot);
+
+	/**
+	 * Write generations tell what changed since some moment without
+	 * disturbing dirtyPages(), so any number of readers can use them,
+	 * also from other threads than the writer.
+	 *
+	 * Every write stamps its page with the current generation.
+	 * advanceWriteGeneration() starts a new generation and returns
+	 * the one that ended. Pages whose pageWriteGeneration() is at
+	 * least that value may have changed since the call; this includes
+	 * writes that raced with the call itself.
+	 */
+	uint64_t advanceWriteGeneration();
+	/**
+	 * @return Generation of the last write to the page under
+	 *     `address`, or 0 if the page was never written.
+	 */
+	uint64_t pageWriteGeneration(memsize address) const;
+	/**
+	 * Addresses of the pages whose write generation is at least
+	 * `generation`, in ascending order; cheaper than asking for
+	 * each page with pageWriteGeneration().
+	 */
+	std::vector<memsize> pagesWrittenSince(uint64_t generation) const;
+
+	/**
+	 * Make the Memory safe to be used by several threads at once,
+	 * like by the cores of a multi-core device. Page allocation,
+	 * dirty pages and observers are then serialized; the contents
+	 * of the pages are not, same as on the real hardware.
+	 * Switch only while no other thread uses the Memory.
+	 */
+	void setConcurrent(bool concurrent);
+	bool isConcurrent() const;
+	/**
+	 * Atomically replace the `size` bytes at `address` with `value`
+	 * if they still hold `expected`, even against other threads.
+	 *
+	 * @param size
+	 *     1, 2, 4 or 8; `address` must be aligned to it.
+	 * @return true if `value` was stored.
+	 * @throw std::invalid_argument on bad size or alignment.
+	 */
+	bool compareExchange(memsize address, int size, uint64_t expected, uint64_t value);
+
 	// TODO: this pattern will probably fit in a separate class.
 	memobserver_id observe(memsize address, memsize length, memobserver observer, Access events);
 	void unobserve(memobserver_id id);
 
+	/**
+	 * Watchpoint is an observer without its own callback. All
+	 * watchpoint hits are reported to the watch listener instead.
+	 *
+	 * Observers and watchpoints only cost anything on accesses to the
+	 * pages they cover. Accesses to other pages are filtered out
+	 * with a single bit test.
+	 *
+	 * @return Id of the watchpoint; ids are shared with observe().
+	 */
+	memobserver_id watch(memsize address, memsize length, Access events);
+	void unwatch(memobserver_id id);
+	void setWatchListener(memwatchlistener listener);
+
+	/**
+	 * Access listener is notified of every tracked access,
+	 * regardless of the observed pages. It's meant for tracing
+	 * and should be left unset otherwise.
+	 */
+	void setAccessListener(memobserver listener);
+
 private:
 	friend class TrackedMemory;
 
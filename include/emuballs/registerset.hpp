@@ -20,9 +20,11 @@
 
 #include "emuballs/dptr.hpp"
 #include "emuballs/export.h"
+#include <cstdint>
 #include <list>
 #include <string>
 #include <map>
+#include <vector>
 
 namespace Emuballs
 {
@@ -76,6 +78,13 @@ public:
 	 */
 	virtual RegVal reg(const std::string &name) const;
 
+	/**
+	 * Values of all registers in the order of registers(), without
+	 * building their names, so that they're cheap to poll.
+	 * `values` is resized to fit; its storage is reused.
+	 */
+	virtual void values(std::vector<uint32_t> &values) const;
+
 private:
 	DPtr<RegisterSet> d;
 };
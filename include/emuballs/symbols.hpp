@@ -0,0 +1,78 @@
+/*
+ * Copyright 2017 Zalewa <zalewapl@gmail.com>.
+ *
+ * This file is part of Emuballs.
+ *
+ * Emuballs is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Emuballs is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with Emuballs.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#pragma once
+
+#include "emuballs/dptr.hpp"
+#include "emuballs/export.h"
+#include <cstdint>
+#include <istream>
+#include <string>
+
+namespace Emuballs
+{
+
+struct EMUBALLS_API Symbol
+{
+	std::string name;
+	uint32_t address;
+	/** 0 if unknown; symbol then spans until the next one. */
+	uint32_t size;
+};
+
+/**
+ * Guest symbols, used to name addresses in profiles.
+ */
+class EMUBALLS_API SymbolTable
+{
+public:
+	SymbolTable();
+	SymbolTable(const SymbolTable &other);
+	const SymbolTable &operator=(const SymbolTable &other);
+	virtual ~SymbolTable();
+
+	/**
+	 * Load function symbols and code labels from
+	 * a 32-bit little endian ELF file.
+	 *
+	 * @throw SymbolLoadError
+	 */
+	static SymbolTable fromElf(std::istream &elf);
+
+	void add(const Symbol &symbol);
+	bool empty() const;
+	size_t size() const;
+
+	/**
+	 * Symbol that contains the address.
+	 *
+	 * @return nullptr if there's none.
+	 */
+	const Symbol *find(uint32_t address) const;
+
+	/**
+	 * Symbol name, with an offset if the address is not at the
+	 * symbol's start, or hex address if there's no symbol.
+	 */
+	std::string name(uint32_t address) const;
+
+private:
+	DPtr<SymbolTable> d;
+};
+
+}
@@ -0,0 +1,89 @@
+/*
+ * Copyright 2017 Zalewa <zalewapl@gmail.com>.
+ *
+ * This file is part of Emuballs.
+ *
+ * Emuballs is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Emuballs is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with Emuballs.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#pragma once
+
+#include "emuballs/dptr.hpp"
+#include "emuballs/export.h"
+#include <cstdint>
+#include <istream>
+#include <utility>
+#include <vector>
+
+namespace Emuballs
+{
+
+/**
+ * Index under which CPSR is reported in TraceEntry::registers.
+ */
+constexpr int TRACE_CPSR_INDEX = 16;
+
+struct EMUBALLS_API TraceMemAccess
+{
+	uint32_t address;
+	bool write;
+};
+
+/**
+ * Single executed instruction, as recorded in a trace file.
+ */
+struct EMUBALLS_API TraceEntry
+{
+	/** Address of the instruction. */
+	uint32_t address;
+	/** Instruction word. */
+	uint32_t instruction;
+	/**
+	 * Registers that changed their values, with their new values.
+	 * Register index TRACE_CPSR_INDEX denotes CPSR.
+	 */
+	std::vector<std::pair<int, uint32_t>> registers;
+	/**
+	 * Memory touched by the instruction. Block transfers are
+	 * reported as a single access at their lowest address.
+	 */
+	std::vector<TraceMemAccess> memory;
+};
+
+/**
+ * Decodes trace files written by Device::startTrace().
+ */
+class EMUBALLS_API TraceReader
+{
+public:
+	/**
+	 * @throw TraceFormatError if stream is not a trace.
+	 */
+	TraceReader(std::istream &input);
+	TraceReader(const TraceReader &other) = delete;
+	TraceReader &operator=(const TraceReader &other) = delete;
+	virtual ~TraceReader();
+
+	/**
+	 * Read next entry.
+	 *
+	 * @return false on end of trace.
+	 * @throw TraceFormatError if the trace is truncated mid-entry.
+	 */
+	bool next(TraceEntry &entry);
+
+private:
+	DPtr<TraceReader> d;
+};
+
+}
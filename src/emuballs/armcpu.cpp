@@ -20,9 +20,25 @@
 
 namespace Emuballs { namespace Arm {
 
+const RegisterSet::Layout RegisterSet::LAYOUTS[NUM_BANKS] = {
+	// User & System
+	{{0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15}},
+	// FIQ
+	{{0, 1, 2, 3, 4, 5, 6, 7, 16, 17, 18, 19, 20, 21, 22, 15}},
+	// IRQ
+	{{0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 23, 24, 15}},
+	// Supervisor
+	{{0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 25, 26, 15}},
+	// Abort
+	{{0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 27, 28, 15}},
+	// Undefined
+	{{0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 29, 30, 15}},
+};
+
 RegisterSet::RegisterSet()
 {
-	regs.resize(16, 0);
+	slots.fill(0);
+	switchBank(Bank::User);
 	resetPcChanged();
 }
 
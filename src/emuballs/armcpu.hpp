@@ -18,10 +18,12 @@
  */
 #pragma once
 
+#include <array>
 #include <bitset>
+#include <cstdint>
 #include <limits>
 #include <stdexcept>
-#include <vector>
+#include <string>
 
 
 namespace Emuballs
@@ -42,9 +44,96 @@ constexpr regval REGVAL_HIGHBIT = 0x80000000;
 
 typedef uint32_t cpumode;
 
+/**
+ * CPU modes as encoded in the lowest 5 bits of CPSR.
+ */
+enum CpuMode : cpumode
+{
+	MODE_USER = 0x10,
+	MODE_FIQ = 0x11,
+	MODE_IRQ = 0x12,
+	MODE_SUPERVISOR = 0x13,
+	MODE_ABORT = 0x17,
+	MODE_UNDEFINED = 0x1b,
+	MODE_SYSTEM = 0x1f
+};
+
+/**
+ * CPSR bits other than the mode and the condition flags.
+ */
+constexpr regval PSR_THUMB = 1 << 5;
+constexpr regval PSR_FIQ_DISABLE = 1 << 6;
+constexpr regval PSR_IRQ_DISABLE = 1 << 7;
+constexpr regval PSR_ABORT_DISABLE = 1 << 8;
+
+/**
+ * Exception vectors; the high vectors of CP15 aren't supported.
+ */
+enum ExceptionVector : uint32_t
+{
+	VECTOR_RESET = 0x00,
+	VECTOR_UNDEFINED = 0x04,
+	VECTOR_SOFTWARE_INTERRUPT = 0x08,
+	VECTOR_PREFETCH_ABORT = 0x0c,
+	VECTOR_DATA_ABORT = 0x10,
+	VECTOR_IRQ = 0x18,
+	VECTOR_FIQ = 0x1c
+};
+
+/**
+ * Register banks. User and System modes share the same bank.
+ * Modes that aren't valid ARM modes fall back to the User bank.
+ */
+enum class Bank : int
+{
+	User = 0,
+	Fiq,
+	Irq,
+	Supervisor,
+	Abort,
+	Undefined
+};
+
+constexpr auto NUM_BANKS = 6;
+
+inline Bank bankForMode(cpumode mode)
+{
+	switch (mode)
+	{
+	case MODE_FIQ:
+		return Bank::Fiq;
+	case MODE_IRQ:
+		return Bank::Irq;
+	case MODE_SUPERVISOR:
+		return Bank::Supervisor;
+	case MODE_ABORT:
+		return Bank::Abort;
+	case MODE_UNDEFINED:
+		return Bank::Undefined;
+	default:
+		return Bank::User;
+	}
+}
+
+/**
+ * ARM register file.
+ *
+ * All registers of all banks are stored inline in one flat array:
+ * r0-r15 of User mode come first, then r8-r14 of FIQ, then pairs of
+ * r13-r14 for IRQ, Supervisor, Abort and Undefined modes.
+ *
+ * The registers visible in the current mode are resolved through a
+ * layout table that maps r0-r15 to storage slots. Switching the mode
+ * only swaps the pointer to the layout table; no register values are
+ * copied. Layout tables are static, so the whole RegisterSet remains
+ * trivially copyable.
+ */
 class RegisterSet
 {
 public:
+	static constexpr auto NUM_SLOTS = NUM_CPU_REGS + 7 + 4 * 2;
+	typedef std::array<uint8_t, NUM_CPU_REGS> Layout;
+
 	RegisterSet();
 
 	// Aliases to set() and operator[] should all be inline.
@@ -67,25 +156,51 @@ public:
 		return (*this)[14];
 	}
 
+	// pc is never banked and can skip the layout lookup.
 	inline void pc(const regval &value)
 	{
-		set(15, value);
+		pcChanged = true;
+		slots[15] = value;
 	}
 	inline const regval &pc() const
 	{
-		return (*this)[15];
+		return slots[15];
 	}
 
 	void set(int idx, const regval &value)
 	{
-		if (idx == 15)
-			pcChanged = true;
-		regs[idx] = value;
+		pcChanged |= (idx == 15);
+		slots[(*layout)[idx]] = value;
 	}
 
 	const regval &operator[](int idx) const
 	{
-		return regs[idx];
+		return slots[(*layout)[idx]];
+	}
+
+	/**
+	 * Access register of a specific bank, regardless of the
+	 * currently active one.
+	 */
+	const regval &banked(Bank bank, int idx) const
+	{
+		return slots[LAYOUTS[static_cast<int>(bank)][idx]];
+	}
+
+	void setBanked(Bank bank, int idx, const regval &value)
+	{
+		pcChanged |= (idx == 15);
+		slots[LAYOUTS[static_cast<int>(bank)][idx]] = value;
+	}
+
+	inline Bank bank() const
+	{
+		return static_cast<Bank>(layout - LAYOUTS);
+	}
+
+	inline void switchBank(Bank bank)
+	{
+		layout = &LAYOUTS[static_cast<int>(bank)];
 	}
 
 	inline void resetPcChanged()
@@ -99,7 +214,10 @@ public:
 	}
 
 private:
-	std::vector<regval> regs;
+	static const Layout LAYOUTS[NUM_BANKS];
+
+	std::array<regval, NUM_SLOTS> slots;
+	const Layout *layout;
 	bool pcChanged;
 };
 
@@ -224,12 +342,16 @@ public:
 
 	/**
 	 * @brief SPSR flags for selected cpumode.
+	 *
+	 * Modes that share a register bank share the SPSR, too.
+	 * User and System modes have no SPSR on the real hardware;
+	 * here they get a scratch one.
 	 */
 	const Flags &flagsSpsr(cpumode mode) const
 	{
 		if (mode >= 32)
 			throw std::out_of_range("cpumode must be <= 31, was: " + std::to_string(mode));
-		return _storedFlags[mode];
+		return _storedFlags[static_cast<int>(bankForMode(mode))];
 	}
 
 	Flags &flagsSpsr(cpumode mode)
@@ -237,6 +359,46 @@ public:
 		return const_cast<Flags&>( static_cast<const Cpu&>(*this).flagsSpsr(mode) );
 	}
 
+	/**
+	 * @brief Store whole CPSR and switch the register bank
+	 *        if the cpumode changed.
+	 *
+	 * Use this instead of `flags().store()` whenever mode bits
+	 * may be affected.
+	 */
+	void cpsr(regval value)
+	{
+		_flags.store(value);
+		_regs.switchBank(bankForMode(_flags.cpuMode()));
+	}
+
+	/**
+	 * @brief Change cpumode, keeping the remaining CPSR bits.
+	 */
+	void switchMode(cpumode mode)
+	{
+		cpsr((_flags.dump() & ~0x1fu) | (mode & 0x1f));
+	}
+
+	/**
+	 * @brief Enter an exception as the hardware does.
+	 *
+	 * CPSR is saved to the SPSR of `mode`, the CPU switches to
+	 * `mode` in ARM state with IRQs masked (and FIQs, for FIQ mode)
+	 * and continues from the `vector` with the banked lr set to
+	 * `returnAddress`. Caller is responsible for flushing the
+	 * prefetched instructions.
+	 */
+	void enterException(cpumode mode, uint32_t vector, regval returnAddress)
+	{
+		regval saved = _flags.dump();
+		regval masked = PSR_IRQ_DISABLE | (mode == MODE_FIQ ? PSR_FIQ_DISABLE : 0);
+		flagsSpsr(mode).store(saved);
+		cpsr((saved & ~(0x1fu | PSR_THUMB)) | masked | (mode & 0x1f));
+		_regs.lr(returnAddress);
+		_regs.pc(vector);
+	}
+
 	const RegisterSet &regs() const
 	{
 		return _regs;
@@ -249,7 +411,7 @@ public:
 
 private:
 	Flags _flags;
-	Flags _storedFlags[32];
+	Flags _storedFlags[NUM_BANKS];
 	RegisterSet _regs;
 };
 
@@ -21,10 +21,17 @@
 #include "emuballs/canvas.hpp"
 #include "emuballs/color.hpp"
 
+#include "byte_ring.hpp"
+#include "framehash.hpp"
 #include "memory.hpp"
 
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
 #include <cstddef>
-#include <functional>
+#include <mutex>
+#include <stdexcept>
+#include <thread>
 using namespace Emuballs;
 using namespace Emuballs::Arm;
 
@@ -130,6 +137,22 @@ struct FrameBufferInfo
 	uint32_t size; // out
 };
 
+/**
+ * Source ids for Canvas::DrawnFrame; unique across all GPUs.
+ */
+static std::atomic<uint64_t> nextFrameSource {1};
+
+/**
+ * Mail on its way to or from the GPU worker, along with
+ * the frame buffer info that the message points at.
+ */
+struct Envelope
+{
+	uint32_t mail;
+	memsize infoAddress;
+	FrameBufferInfo info;
+};
+
 }
 }
 
@@ -140,14 +163,42 @@ DClass<Gpu>
 {
 public:
 	constexpr static const memsize INVALID_ADDRESS = static_cast<memsize>(-1);
+	static const size_t QUEUE_LENGTH = 8;
 
 	Memory *memory;
 	memsize mailboxAddress = INVALID_ADDRESS;
 	memsize frameBufferPointerEnd = INVALID_ADDRESS;
 	memobserver_id observerId = 0;
-	bool hasMail = false;
 	bool isInit = false;
+	bool threaded = true;
 	std::shared_ptr<FrameBufferInfo> frameBufferInfo;
+	/** Changes along with the frame buffer. */
+	std::atomic<uint64_t> frameSource {0};
+	/**
+	 * Hash of the whole frame, reused until the frame buffer
+	 * pages are written again.
+	 */
+	uint64_t cachedHash = 0;
+	uint64_t cachedHashSource = 0;
+	uint64_t cachedHashSince = 0;
+
+	/**
+	 * Both the CPU and the GPU worker flip the status bits,
+	 * so it's kept here and only copied to the mailbox in
+	 * the memory when the CPU accesses it.
+	 */
+	std::atomic<uint32_t> status {0};
+	/**
+	 * Set when a reply filled up the queue and the write
+	 * readiness is left to deliver().
+	 */
+	std::atomic<bool> writeWithheld {false};
+	ByteRing requests {QUEUE_LENGTH * sizeof(Envelope)};
+	ByteRing replies {QUEUE_LENGTH * sizeof(Envelope)};
+	std::thread worker;
+	std::mutex wakeLock;
+	std::condition_variable wake;
+	bool workerQuit = false;
 
 	void init()
 	{
@@ -156,26 +207,13 @@ public:
 		if (frameBufferPointerEnd == INVALID_ADDRESS)
 			throw std::logic_error("Frame Buffer pointer end not set");
 		observe();
-		Mailbox mailbox;
+		Mailbox mailbox = {};
 		mailbox.readReady(false);
 		mailbox.writeReady(true);
+		status = mailbox.status;
 		writeMailbox(mailbox);
 	}
 
-	Mailbox readMailbox()
-	{
-		MemoryStreamReader reader(*memory, mailboxAddress);
-		Mailbox mailbox;
-		mailbox.read = Mail(reader.readUint32());
-		reader.skip(sizeof(mailbox.reserved));
-		mailbox.poll = reader.readUint32();
-		mailbox.sender = reader.readUint32();
-		mailbox.status = reader.readUint32();
-		mailbox.configuration = reader.readUint32();
-		mailbox.write = Mail(reader.readUint32());
-		return mailbox;
-	}
-
 	void writeMailbox(const Mailbox &mailbox)
 	{
 		MemoryStreamWriter writer(*memory, mailboxAddress);
@@ -188,6 +226,21 @@ public:
 		writer.writeUint32(mailbox.write);
 	}
 
+	bool statusBit(StatusBit bit) const
+	{
+		// 0 - enabled, 1 - disabled
+		return (status & static_cast<uint32_t>(bit)) == 0;
+	}
+
+	void statusBit(StatusBit bit, bool enable)
+	{
+		// 0 - enabled, 1 - disabled
+		if (enable)
+			status.fetch_and(~static_cast<uint32_t>(bit));
+		else
+			status.fetch_or(static_cast<uint32_t>(bit));
+	}
+
 	FrameBufferInfo readFrameBufferInfo(memsize address)
 	{
 		MemoryStreamReader reader(*memory, address);
@@ -225,7 +278,7 @@ public:
 		unobserve();
 		observerId = memory->observe(mailboxAddress, sizeof(Mailbox),
 			[this](memsize m, Access event){this->pickupMail(m, event);},
-			Access::Write | Access::Read);
+			Access::Write | Access::PreRead | Access::Read);
 	}
 
 	void unobserve()
@@ -239,44 +292,85 @@ public:
 
 	void pickupMail(memsize address, Access event)
 	{
-		// Unatomic and excessive just to write 1 bit.
-		// Would cause undefined behavior if GPU and CPU
-		// were to run on separate threads.
-		//
 		// Unknown: how the actual hardware behaves if CPU
 		// writes to mailbox when write flag is unready?
-		Mailbox mail = readMailbox();
-		size_t addressAligned = address & (~static_cast<decltype(address)>(0b11));
-		if (event == Access::Write && mail.isWriteReady())
+		memsize addressAligned = address & (~static_cast<decltype(address)>(0b11));
+		if (event == Access::PreRead)
 		{
-			size_t writeOffset = offsetof(decltype(mail), write);
-			size_t writeAddress = mailboxAddress + writeOffset;
-			if (addressAligned == writeAddress)
-			{
-				mail.writeReady(false);
-				hasMail = true;
-			}
+			deliver();
 		}
-		if (event == Access::Read)
+		else if (event == Access::Write
+			&& addressAligned == mailboxAddress + offsetof(Mailbox, write))
 		{
-			size_t readOffset = offsetof(decltype(mail), read);
-			size_t readAddress = mailboxAddress + readOffset;
-			if (addressAligned == readAddress)
-			{
-				mail.readReady(false);
-			}
+			post();
+		}
+		else if (event == Access::Read
+			&& addressAligned == mailboxAddress + offsetof(Mailbox, read))
+		{
+			statusBit(StatusBit::ReadReady, false);
+			deliver();
 		}
-		writeMailbox(mail);
 	}
 
-	Mail readMessage(const Mail &message)
+	/**
+	 * CPU side; hands the mail over to the GPU.
+	 */
+	void post()
 	{
+		if (!statusBit(StatusBit::WriteReady))
+			return;
+		statusBit(StatusBit::WriteReady, false);
+		Envelope envelope;
+		envelope.mail = memory->word(mailboxAddress + offsetof(Mailbox, write));
 		// 0x40000000 is a special cache flag, so let's filter
 		// it out and all bits above it.
 		// https://www.cl.cam.ac.uk/projects/raspberrypi/tutorials/os/screen01.html
-		memsize frameBufferAddress = message.message & 0x3fffffff;
+		envelope.infoAddress = Mail(envelope.mail).message & 0x3fffffff;
+		envelope.info = readFrameBufferInfo(envelope.infoAddress);
+		if (threaded)
+		{
+			if (!worker.joinable())
+				worker = std::thread([this]() { work(); });
+			requests.write(reinterpret_cast<const uint8_t*>(&envelope), sizeof(envelope));
+			std::lock_guard<std::mutex> lock(wakeLock);
+			wake.notify_one();
+		}
+		else
+		{
+			reply(envelope);
+		}
+		deliver();
+	}
+
+	/**
+	 * CPU side; moves the oldest reply, if any, to the mailbox
+	 * once the previous one was read, and updates the status.
+	 */
+	void deliver()
+	{
+		Envelope envelope;
+		if (!statusBit(StatusBit::ReadReady)
+			&& replies.read(reinterpret_cast<uint8_t*>(&envelope), sizeof(envelope)) != 0)
+		{
+			writeFrameBufferInfo(envelope.infoAddress, envelope.info);
+			frameBufferInfo.reset(new FrameBufferInfo(envelope.info));
+			frameSource = nextFrameSource++;
+			memory->putWord(mailboxAddress + offsetof(Mailbox, read), envelope.mail);
+			memory->putWord(mailboxAddress + offsetof(Mailbox, poll), envelope.mail);
+			statusBit(StatusBit::ReadReady, true);
+			if (writeWithheld.exchange(false))
+				statusBit(StatusBit::WriteReady, true);
+		}
+		memory->putWord(mailboxAddress + offsetof(Mailbox, status), status);
+	}
 
-		FrameBufferInfo frameBufferInfo = readFrameBufferInfo(frameBufferAddress);
+	/**
+	 * GPU side; doesn't touch the memory, so that it can run
+	 * on the worker thread.
+	 */
+	void reply(Envelope envelope)
+	{
+		FrameBufferInfo &frameBufferInfo = envelope.info;
 		uint32_t bytesPerPixel = frameBufferInfo.bitDepth / 8;
 		if ((frameBufferInfo.bitDepth % 8) != 0)
 			bytesPerPixel++;
@@ -286,26 +380,155 @@ public:
 		// for now let's pick an arbitrary place.
 		frameBufferInfo.size = frameBufferInfo.pitch * frameBufferInfo.virtualHeight;
 		frameBufferInfo.pointer = frameBufferPointerEnd - frameBufferInfo.size;
-		writeFrameBufferInfo(frameBufferAddress, frameBufferInfo);
-		this->frameBufferInfo.reset(new FrameBufferInfo(frameBufferInfo));
 
-		Mail response;
-		response.channel = message.channel;
+		Mail response = envelope.mail;
 		response.message = 0;
-		return response;
+		envelope.mail = response;
+		// CPU can't post more than one mail at a time and write
+		// readiness only comes back while there's room for the
+		// next reply, so the queue never overflows.
+		replies.write(reinterpret_cast<const uint8_t*>(&envelope), sizeof(envelope));
+		if (replies.capacity() - replies.size() >= sizeof(envelope))
+			statusBit(StatusBit::WriteReady, true);
+		else
+			writeWithheld = true;
+	}
+
+	void work()
+	{
+		Envelope envelope;
+		while (true)
+		{
+			if (requests.read(reinterpret_cast<uint8_t*>(&envelope), sizeof(envelope)) != 0)
+			{
+				reply(envelope);
+				continue;
+			}
+			std::unique_lock<std::mutex> lock(wakeLock);
+			if (workerQuit)
+				return;
+			if (requests.empty())
+				wake.wait(lock);
+		}
+	}
+
+	void stopWorker()
+	{
+		if (!worker.joinable())
+			return;
+		{
+			std::lock_guard<std::mutex> lock(wakeLock);
+			workerQuit = true;
+		}
+		wake.notify_one();
+		worker.join();
+		workerQuit = false;
+	}
+
+	static bool isDrawable(uint32_t bitDepth)
+	{
+		switch (static_cast<BitDepth>(bitDepth))
+		{
+		case BitDepth::HighColor:
+		case BitDepth::TrueColor:
+		case BitDepth::Rgba32:
+			return true;
+		default:
+			return false;
+		}
+	}
+
+	/**
+	 * Draw the rows on the pages written since the `since` write
+	 * generation, or all rows if it's 0.
+	 */
+	void drawFrame(Canvas &canvas, uint64_t since)
+	{
+		const FrameBufferInfo &fbInfo = *frameBufferInfo;
+		if (fbInfo.pitch == 0 || fbInfo.virtualHeight == 0)
+			return;
+		if (since == 0)
+		{
+			drawRows(canvas, 0, fbInfo.virtualHeight);
+			return;
+		}
+		const memsize begin = fbInfo.pointer;
+		const memsize end = begin + fbInfo.size;
+		const memsize pageSize = memory->pageSize();
+		// Adjacent dirty pages are merged into a single rectangle.
+		uint32_t dirtyFrom = 0;
+		uint32_t dirtyTo = 0;
+		for (memsize page = begin - begin % pageSize; page < end; page += pageSize)
+		{
+			if (memory->pageWriteGeneration(page) < since)
+				continue;
+			uint32_t first = (std::max(page, begin) - begin) / fbInfo.pitch;
+			uint32_t last = (std::min(page + pageSize, end) - 1 - begin) / fbInfo.pitch;
+			last = std::min(last, fbInfo.virtualHeight - 1);
+			if (dirtyTo > dirtyFrom && first <= dirtyTo)
+			{
+				dirtyTo = std::max(dirtyTo, last + 1);
+				continue;
+			}
+			drawRows(canvas, dirtyFrom, dirtyTo - dirtyFrom);
+			dirtyFrom = first;
+			dirtyTo = last + 1;
+		}
+		drawRows(canvas, dirtyFrom, dirtyTo - dirtyFrom);
+	}
+
+	bool isWrittenSince(uint64_t since) const
+	{
+		const FrameBufferInfo &fbInfo = *frameBufferInfo;
+		const memsize pageSize = memory->pageSize();
+		const memsize end = fbInfo.pointer + fbInfo.size;
+		for (memsize page = fbInfo.pointer - fbInfo.pointer % pageSize; page < end; page += pageSize)
+		{
+			if (memory->pageWriteGeneration(page) >= since)
+				return true;
+		}
+		return false;
+	}
+
+	uint64_t hash(int32_t x, int32_t y, int32_t width, int32_t height) const
+	{
+		const FrameBufferInfo &fbInfo = *frameBufferInfo;
+		const int32_t frameWidth = fbInfo.virtualWidth;
+		const int32_t frameHeight = fbInfo.virtualHeight;
+		const int32_t left = std::max(x, 0);
+		const int32_t top = std::max(y, 0);
+		// Summed wide, so that huge sizes clip instead of overflowing.
+		const int32_t right = static_cast<int32_t>(
+			std::min<int64_t>(static_cast<int64_t>(x) + width, frameWidth));
+		const int32_t bottom = static_cast<int32_t>(
+			std::min<int64_t>(static_cast<int64_t>(y) + height, frameHeight));
+		const uint32_t bytesPerPixel = (fbInfo.bitDepth + 7) / 8;
+		const uint32_t rowSize = right > left ? (right - left) * bytesPerPixel : 0;
+		const uint32_t rows = bottom > top ? bottom - top : 0;
+		FrameHash hash((static_cast<uint64_t>(rowSize) << 32)
+			| (static_cast<uint64_t>(rows) << 8) | fbInfo.bitDepth);
+		for (uint32_t row = 0; row < rows && rowSize > 0; ++row)
+		{
+			memsize address = fbInfo.pointer + (top + row) * fbInfo.pitch + left * bytesPerPixel;
+			for (const MemorySpan &span : memory->spans(address, rowSize))
+				hash.update(span.data, span.length);
+		}
+		return hash.digest();
 	}
 
-	void drawRgb16(Canvas &canvas)
+	void drawRows(Canvas &canvas, uint32_t y, uint32_t rows)
 	{
-		auto &fbInfo = frameBufferInfo;
-		std::vector<uint8_t> frameBuffer = memory->chunk(fbInfo->pointer, fbInfo->size);
-		canvas.drawPicture(0, 0, fbInfo->virtualWidth, fbInfo->virtualHeight,
-			16, fbInfo->pitch, frameBuffer);
+		if (rows == 0)
+			return;
+		const FrameBufferInfo &fbInfo = *frameBufferInfo;
+		// The canvas reads straight from the guest pages.
+		canvas.drawSpans(0, y, fbInfo.virtualWidth, rows, fbInfo.bitDepth, fbInfo.pitch,
+			memory->spans(fbInfo.pointer + y * fbInfo.pitch, rows * fbInfo.pitch));
 	}
 
 };
 
-DPointered(Gpu)
+DPointeredNoCopy(Gpu)
 }
 
 Gpu::Gpu(Memory &memory)
@@ -315,6 +538,7 @@ Gpu::Gpu(Memory &memory)
 
 Gpu::~Gpu()
 {
+	d->stopWorker();
 	d->unobserve();
 }
 
@@ -325,16 +549,7 @@ void Gpu::cycle()
 		d->init();
 		d->isInit = true;
 	}
-	if (d->hasMail)
-	{
-		Mailbox mailbox = d->readMailbox();
-		Mail response = d->readMessage(mailbox.write);
-		d->hasMail = false;
-		mailbox.read = response;
-		mailbox.writeReady(true);
-		mailbox.readReady(true);
-		d->writeMailbox(mailbox);
-	}
+	d->deliver();
 }
 
 void Gpu::draw(Canvas &canvas)
@@ -343,17 +558,47 @@ void Gpu::draw(Canvas &canvas)
 		return;
 
 	auto &fbInfo = d->frameBufferInfo;
+	const uint64_t source = d->frameSource;
+	Canvas::DrawnFrame drawn = canvas.drawnFrame();
+	const bool full = drawn.source != source;
 
 	canvas.begin();
-	canvas.changeSize(fbInfo->virtualWidth, fbInfo->virtualHeight,
-		static_cast<BitDepth>(fbInfo->bitDepth));
-	if (fbInfo->bitDepth == static_cast<int>(BitDepth::HighColor))
+	if (full)
 	{
-		d->drawRgb16(canvas);
+		canvas.changeSize(fbInfo->virtualWidth, fbInfo->virtualHeight,
+			static_cast<BitDepth>(fbInfo->bitDepth));
 	}
+	const uint64_t since = full ? 0 : drawn.generation;
+	drawn.source = source;
+	drawn.generation = d->memory->advanceWriteGeneration();
+	if (d->isDrawable(fbInfo->bitDepth))
+		d->drawFrame(canvas, since);
+	canvas.setDrawnFrame(drawn);
 	canvas.end();
 }
 
+uint64_t Gpu::frameHash()
+{
+	if (d->frameBufferInfo == nullptr)
+		return 0;
+	const uint64_t source = d->frameSource;
+	if (d->cachedHashSource != source || d->isWrittenSince(d->cachedHashSince))
+	{
+		d->cachedHashSince = d->memory->advanceWriteGeneration();
+		d->cachedHash = d->hash(0, 0, d->frameBufferInfo->virtualWidth,
+			d->frameBufferInfo->virtualHeight);
+		d->cachedHashSource = source;
+	}
+	return d->cachedHash;
+}
+
+uint64_t Gpu::frameHash(int32_t x, int32_t y, int32_t width, int32_t height)
+{
+	if (d->frameBufferInfo == nullptr)
+		return 0;
+	return d->hash(x, y, width, height);
+}
+
 void Gpu::setFrameBufferPointerEnd(memsize address)
 {
 	if (d->isInit)
@@ -367,3 +612,41 @@ void Gpu::setMailboxAddress(memsize address)
 		throw std::logic_error("cannot change GPU mailbox address after init");
 	d->mailboxAddress = address;
 }
+
+void Gpu::setThreaded(bool threaded)
+{
+	if (!threaded)
+		d->stopWorker();
+	d->threaded = threaded;
+}
+
+bool Gpu::isThreaded() const
+{
+	return d->threaded;
+}
+
+Gpu::State Gpu::state()
+{
+	if (d->threaded)
+		throw std::logic_error("cannot take the state of a threaded GPU");
+	State state { d->status, d->writeWithheld, {}, d->frameBufferInfo, d->frameSource };
+	// Ring can't be peeked, so the replies are taken out
+	// and put back as they were.
+	state.replies.resize(d->replies.size());
+	d->replies.read(state.replies.data(), state.replies.size());
+	d->replies.write(state.replies.data(), state.replies.size());
+	return state;
+}
+
+void Gpu::restore(const State &state)
+{
+	if (d->threaded)
+		throw std::logic_error("cannot restore the state of a threaded GPU");
+	d->status = state.status;
+	d->writeWithheld = state.writeWithheld;
+	std::vector<uint8_t> discarded(d->replies.size());
+	d->replies.read(discarded.data(), discarded.size());
+	d->replies.write(state.replies.data(), state.replies.size());
+	d->frameBufferInfo = state.frameBufferInfo;
+	d->frameSource = state.frameSource;
+}
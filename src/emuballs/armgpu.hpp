@@ -21,6 +21,9 @@
 #include "emuballs/memory.hpp"
 
 #include "dptr_impl.hpp"
+#include <cstdint>
+#include <memory>
+#include <vector>
 
 namespace Emuballs
 {
@@ -31,16 +34,73 @@ class Memory;
 namespace Arm
 {
 
+struct FrameBufferInfo;
+
 class Gpu
 {
 public:
+	/**
+	 * Mailbox and frame buffer state kept outside of the memory.
+	 */
+	struct State
+	{
+		uint32_t status;
+		bool writeWithheld;
+		/** Replies not yet moved to the mailbox. */
+		std::vector<uint8_t> replies;
+		std::shared_ptr<FrameBufferInfo> frameBufferInfo;
+		uint64_t frameSource;
+	};
+
 	Gpu(Memory &memory);
 	~Gpu();
 
 	void cycle();
+	/**
+	 * Redraw the parts of the frame buffer that were written since
+	 * the previous draw on the same `canvas`, as told by its
+	 * Canvas::drawnFrame(), or the whole frame buffer if the canvas
+	 * shows something else. Each run of dirty rows is drawn as
+	 * one rectangle.
+	 */
 	void draw(Canvas &canvas);
+	/**
+	 * Hash of the frame buffer pixels as the guest stored them,
+	 * computed straight from the memory; 0 if there's no frame
+	 * buffer yet. Only the visible pixels count, not the padding
+	 * up to the pitch. The whole frame hash is cached until
+	 * the frame buffer is written again.
+	 */
+	uint64_t frameHash();
+	/**
+	 * Hash of a region of the frame buffer, clipped to the frame.
+	 */
+	uint64_t frameHash(int32_t x, int32_t y, int32_t width, int32_t height);
 	void setFrameBufferPointerEnd(memsize address);
 	void setMailboxAddress(memsize address);
+	/**
+	 * Threaded GPU handles the mail on its own worker thread and
+	 * the CPU keeps running meanwhile; the reply shows up in the
+	 * mailbox once the CPU polls it after the worker is done.
+	 * Otherwise the mail is handled right away, on the thread that
+	 * posts it, which keeps the runs reproducible.
+	 *
+	 * Threaded by default.
+	 */
+	void setThreaded(bool threaded);
+	bool isThreaded() const;
+
+	/**
+	 * Mail may be in flight on the worker thread, so the state
+	 * can only be taken when the GPU is not threaded.
+	 *
+	 * @throw std::logic_error if the GPU is threaded.
+	 */
+	State state();
+	/**
+	 * @throw std::logic_error if the GPU is threaded.
+	 */
+	void restore(const State &state);
 
 private:
 	DPtr<Gpu> d;
@@ -21,8 +21,12 @@
 #include "emuballs/errors.hpp"
 
 #include "array_queue.hpp"
+#include "coverage.hpp"
 #include "opdecoder.hpp"
+#include "profiler.hpp"
+#include "trace.hpp"
 
+#include <atomic>
 #include <queue>
 #include <sstream>
 
@@ -42,7 +46,7 @@ public:
 		prefetchedInstructions.clear();
 	}
 
-	void setMemoryPtr(Memory *memory)
+	void setMemoryPtr(const Memory *memory)
 	{
 		this->memory = memory;
 	}
@@ -52,11 +56,16 @@ public:
 		this->regs = &cpu->regs();
 	}
 
+	size_t size() const
+	{
+		return prefetchedInstructions.size();
+	}
+
 private:
 	ArrayQueue<uint32_t, PREFETCH_INSTRUCTIONS> prefetchedInstructions;
-	Memory *memory;
+	const Memory *memory;
 	RegisterSet *regs;
-	uint8_t *memptr = nullptr;
+	const uint8_t *memptr = nullptr;
 	memsize membase = -1;
 
 	void collect()
@@ -71,7 +80,7 @@ private:
 				memptr = memory->ptr(membase);
 				pageOffset = pc - membase;
 			}
-			uint32_t instruction = *reinterpret_cast<uint32_t*>(memptr + pageOffset);
+			uint32_t instruction = *reinterpret_cast<const uint32_t*>(memptr + pageOffset);
 			prefetchedInstructions.push(instruction);
 			regs->pc(pc + INSTRUCTION_SIZE);
 		}
@@ -82,6 +91,56 @@ private:
 		return prefetchedInstructions.pop();
 	}
 };
+
+/**
+ * Flag that can be raised from another thread, like when
+ * a peripheral is poked by a different core.
+ */
+class StopFlag
+{
+public:
+	StopFlag()
+	{
+	}
+
+	StopFlag(const StopFlag &other)
+		: flag(other.flag.load(std::memory_order_relaxed))
+	{
+	}
+
+	StopFlag &operator=(const StopFlag &other)
+	{
+		flag.store(other.flag.load(std::memory_order_relaxed), std::memory_order_relaxed);
+		return *this;
+	}
+
+	StopFlag &operator=(bool value)
+	{
+		flag.store(value, std::memory_order_relaxed);
+		return *this;
+	}
+
+	operator bool() const
+	{
+		return flag.load(std::memory_order_relaxed);
+	}
+
+private:
+	std::atomic<bool> flag {false};
+};
+
+/**
+ * Local exclusive monitor. STREX succeeds when the monitor is
+ * armed for the same address and the memory still holds the value
+ * loaded by LDREX, which is checked with an atomic compare-exchange.
+ */
+struct ExclusiveMonitor
+{
+	bool armed = false;
+	memsize address;
+	int size;
+	uint64_t value;
+};
 }
 
 DClass<Emuballs::Arm::Machine>
@@ -89,6 +148,20 @@ DClass<Emuballs::Arm::Machine>
 public:
 	Emuballs::Arm::OpDecoder decoder;
 	Emuballs::Arm::Prefetch prefetch;
+	Emuballs::Arm::BreakpointMap breakpoints;
+	Emuballs::MemWatchHit lastWatchHit = {};
+	Emuballs::Arm::StopFlag stopRequested;
+	Emuballs::Arm::ExclusiveMonitor exclusive;
+	bool watchHit = false;
+	bool irq = false;
+	bool waiting = false;
+	std::function<void(uint64_t)> idleHandler;
+	uint64_t instructions = 0;
+	uint64_t stopAt = UINT64_MAX;
+	Emuballs::Memory *sharedMemory = nullptr;
+	Emuballs::TraceRecorder *trace = nullptr;
+	Emuballs::Profiler *profiler = nullptr;
+	Emuballs::EdgeCoverage *coverage = nullptr;
 };
 
 DPointered(Emuballs::Arm::Machine);
@@ -100,11 +173,21 @@ Emuballs::Arm::Machine::Machine()
 	adjustPointers();
 }
 
+Emuballs::Arm::Machine::Machine(Memory &sharedMemory)
+{
+	d->sharedMemory = &sharedMemory;
+	adjustPointers();
+}
+
 Emuballs::Arm::Machine::Machine(const Machine &other)
 {
 	this->_cpu = other._cpu;
-	this->_memory = other._memory;
+	this->_ownMemory = other._ownMemory;
 	this->d = other.d;
+	d->trace = nullptr;
+	d->profiler = nullptr;
+	d->coverage = nullptr;
+	d->idleHandler = nullptr;
 	adjustPointers();
 }
 
@@ -121,17 +204,35 @@ Emuballs::Arm::Machine &Emuballs::Arm::Machine::operator=(Machine other)
 
 void Emuballs::Arm::Machine::adjustPointers() noexcept
 {
+	_memory = d->sharedMemory != nullptr ? d->sharedMemory : &_ownMemory;
 	d->prefetch.setCpuPtr(&_cpu);
-	d->prefetch.setMemoryPtr(&_memory);
+	d->prefetch.setMemoryPtr(_memory);
+	// Listeners of a shared memory belong to its owner.
+	if (d->sharedMemory != nullptr)
+		return;
+	_memory->setWatchListener([this](const MemWatchHit &hit) {
+			d->lastWatchHit = hit;
+			d->watchHit = true;
+			requestStop();
+		});
+	if (d->trace != nullptr)
+	{
+		_memory->setAccessListener([this](memsize address, Access access) {
+				d->trace->memoryAccess(address, access);
+			});
+	}
+	else
+	{
+		_memory->setAccessListener(nullptr);
+	}
 }
 
-void Emuballs::Arm::Machine::cycle()
+inline uint32_t Emuballs::Arm::Machine::step()
 {
 	// Prefetch instructions and get next instruction to execute.
 	auto instruction = d->prefetch.next();
 	RegisterSet &regs = cpu().regs();
 	regval pc = regs.pc();
-	bool pcWasChanged = false;
 	// Decode opcode.
 	Opcode* opcode;
 	try
@@ -147,11 +248,440 @@ void Emuballs::Arm::Machine::cycle()
 	// Execute opcode.
 	regs.resetPcChanged();
 	opcode->execute(*this);
-	pcWasChanged = regs.wasPcChanged();
 	// Flush prefetched instructions if pc register changed due to opcode
 	// execution.
-	if (pcWasChanged)
+	if (regs.wasPcChanged())
 	{
 		d->prefetch.flush();
 	}
+	return instruction;
+}
+
+namespace Emuballs { namespace Arm
+{
+namespace
+{
+/*
+ * Hooks observe every instruction executed by run() and cycle().
+ * Each combination of hooks gets its own instantiation of the run
+ * loop, so the loop without hooks doesn't pay for them.
+ */
+template<class... Hooks>
+class HookChain;
+
+template<>
+class HookChain<>
+{
+public:
+	void before(const Machine &) {}
+	void after(const Machine &, uint32_t) {}
+};
+
+template<class First, class... Rest>
+class HookChain<First, Rest...>
+{
+public:
+	HookChain(First first, Rest... rest)
+		: first(first), rest {rest...}
+	{
+	}
+
+	void before(const Machine &machine)
+	{
+		first.before(machine);
+		rest.before(machine);
+	}
+
+	void after(const Machine &machine, uint32_t instruction)
+	{
+		first.after(machine, instruction);
+		rest.after(machine, instruction);
+	}
+
+private:
+	First first;
+	HookChain<Rest...> rest;
+};
+
+class TraceHook
+{
+public:
+	TraceHook(TraceRecorder &recorder)
+		: recorder(recorder)
+	{
+	}
+
+	void before(const Machine &machine)
+	{
+		address = machine.nextInstructionAddress();
+		registers = traceRegisters(machine.cpu());
+	}
+
+	void after(const Machine &machine, uint32_t instruction)
+	{
+		recorder.instruction(address, instruction, registers,
+			traceRegisters(machine.cpu()), machine.cpu().regs().wasPcChanged());
+	}
+
+private:
+	TraceRecorder &recorder;
+	memsize address;
+	TraceRegisters registers;
+
+	static TraceRegisters traceRegisters(const Cpu &cpu)
+	{
+		TraceRegisters regs;
+		for (int idx = 0; idx < 16; ++idx)
+			regs[idx] = cpu.regs()[idx];
+		regs[TRACE_CPSR_INDEX] = cpu.flags().dump();
+		return regs;
+	}
+};
+
+class ProfileHook
+{
+public:
+	ProfileHook(Profiler &profiler)
+		: profiler(profiler)
+	{
+	}
+
+	void before(const Machine &machine)
+	{
+		address = machine.nextInstructionAddress();
+	}
+
+	void after(const Machine &machine, uint32_t instruction)
+	{
+		const RegisterSet &regs = machine.cpu().regs();
+		profiler.instruction(address, instruction, regs.wasPcChanged(), regs.pc());
+	}
+
+private:
+	Profiler &profiler;
+	memsize address;
+};
+
+class CoverageHook
+{
+public:
+	CoverageHook(EdgeCoverage &coverage)
+		: coverage(coverage)
+	{
+	}
+
+	void before(const Machine &)
+	{
+	}
+
+	void after(const Machine &machine, uint32_t instruction)
+	{
+		if (machine.cpu().regs().wasPcChanged())
+			coverage.enter(machine.cpu().regs().pc());
+		else if (isConditionalBranch(instruction))
+			coverage.enter(machine.nextInstructionAddress());
+	}
+
+private:
+	EdgeCoverage &coverage;
+
+	static bool isConditionalBranch(uint32_t code)
+	{
+		uint32_t condition = code >> 28;
+		if (condition >= 0xe)
+			return false;
+		// B, BL, BX
+		return (code & 0x0e000000) == 0x0a000000
+			|| (code & 0x0ffffff0) == 0x012fff10;
+	}
+};
+
+struct HookTargets
+{
+	TraceRecorder *trace;
+	Profiler *profiler;
+	EdgeCoverage *coverage;
+};
+
+template<class Action, class... Hooks>
+auto withCoverageHook(Action &action, const HookTargets &targets, Hooks... hooks)
+{
+	if (targets.coverage != nullptr)
+	{
+		HookChain<Hooks..., CoverageHook> chain {hooks..., CoverageHook(*targets.coverage)};
+		return action(chain);
+	}
+	HookChain<Hooks...> chain {hooks...};
+	return action(chain);
+}
+
+template<class Action, class... Hooks>
+auto withProfileHook(Action &action, const HookTargets &targets, Hooks... hooks)
+{
+	if (targets.profiler != nullptr)
+		return withCoverageHook(action, targets, hooks..., ProfileHook(*targets.profiler));
+	return withCoverageHook(action, targets, hooks...);
+}
+
+template<class Action>
+auto withTraceHook(Action &action, const HookTargets &targets)
+{
+	if (targets.trace != nullptr)
+		return withProfileHook(action, targets, TraceHook(*targets.trace));
+	return withProfileHook(action, targets);
+}
+}
+}}
+
+template<class Action>
+auto Emuballs::Arm::Machine::withHook(Action action)
+{
+	HookTargets targets { d->trace, d->profiler, d->coverage };
+	return withTraceHook(action, targets);
+}
+
+inline void Emuballs::Arm::Machine::takeIrq()
+{
+	if (_cpu.flags().dump() & PSR_IRQ_DISABLE)
+		return;
+	// lr points 4 bytes past the interrupted instruction, so
+	// the handler returns with `subs pc, lr, #4`.
+	_cpu.enterException(MODE_IRQ, VECTOR_IRQ,
+		nextInstructionAddress() + INSTRUCTION_SIZE);
+	d->prefetch.flush();
+}
+
+template<class Hook>
+inline void Emuballs::Arm::Machine::advance(Hook &hook)
+{
+	if (d->irq)
+		takeIrq();
+	hook.before(*this);
+	uint32_t instruction = step();
+	++d->instructions;
+	hook.after(*this, instruction);
+}
+
+void Emuballs::Arm::Machine::cycle()
+{
+	if (d->waiting)
+	{
+		sleep(1, StopReason::Budget);
+		return;
+	}
+	withHook([this](auto &hook) { advance(hook); });
+}
+
+Emuballs::Arm::RunResult Emuballs::Arm::Machine::run(uint64_t maxInstructions,
+	const StopConditions &stop)
+{
+	return withHook([&](auto &hook) { return runLoop(maxInstructions, stop, hook); });
+}
+
+template<class Hook>
+Emuballs::Arm::RunResult Emuballs::Arm::Machine::runLoop(uint64_t maxInstructions,
+	const StopConditions &stop, Hook &hook)
+{
+	d->stopRequested = false;
+	d->watchHit = false;
+	uint64_t executed = 0;
+	StopReason budgetReason = StopReason::Budget;
+	uint64_t untilStop = d->stopAt > d->instructions ? d->stopAt - d->instructions : 0;
+	if (untilStop < maxInstructions)
+	{
+		maxInstructions = untilStop;
+		budgetReason = StopReason::Requested;
+	}
+	if (d->waiting)
+		return sleep(maxInstructions, budgetReason);
+	const BreakpointMap &breakpoints = d->breakpoints;
+	bool checkBreakpoints = !breakpoints.empty() || !stop.breakpoints.empty();
+	bool checkPcRange = stop.hasPcRange();
+	if (!checkBreakpoints && !checkPcRange)
+	{
+		while (executed < maxInstructions)
+		{
+			advance(hook);
+			++executed;
+			if (d->stopRequested)
+				return RunResult { requestedStopReason(), executed };
+		}
+		return RunResult { budgetReason, executed };
+	}
+
+	while (executed < maxInstructions)
+	{
+		memsize address = nextInstructionAddress();
+		if (checkPcRange && (address < stop.pcRangeBegin || address >= stop.pcRangeEnd))
+			return RunResult { StopReason::PcRangeExit, executed };
+		if (checkBreakpoints && executed > 0
+			&& (breakpoints.contains(address) || stop.breakpoints.contains(address)))
+		{
+			return RunResult { StopReason::Breakpoint, executed };
+		}
+		advance(hook);
+		++executed;
+		if (d->stopRequested)
+			return RunResult { requestedStopReason(), executed };
+	}
+	return RunResult { budgetReason, executed };
+}
+
+Emuballs::Arm::StopReason Emuballs::Arm::Machine::requestedStopReason() const
+{
+	return d->watchHit ? StopReason::Watchpoint : StopReason::Requested;
+}
+
+Emuballs::Arm::RunResult Emuballs::Arm::Machine::sleep(uint64_t instructions,
+	StopReason reason)
+{
+	if (instructions > 0 && d->idleHandler)
+		d->idleHandler(instructions);
+	d->instructions += instructions;
+	return RunResult { reason, instructions };
+}
+
+void Emuballs::Arm::Machine::requestStop()
+{
+	d->stopRequested = true;
+}
+
+void Emuballs::Arm::Machine::requestStopAt(uint64_t instructionCount)
+{
+	d->stopAt = instructionCount;
+}
+
+uint64_t Emuballs::Arm::Machine::requestedStopAt() const
+{
+	return d->stopAt;
+}
+
+void Emuballs::Arm::Machine::setIrq(bool raised)
+{
+	d->irq = raised;
+	if (raised)
+		d->waiting = false;
+}
+
+bool Emuballs::Arm::Machine::isIrqRaised() const
+{
+	return d->irq;
+}
+
+void Emuballs::Arm::Machine::waitForInterrupt()
+{
+	if (d->irq)
+		return;
+	d->waiting = true;
+	// Let run() sleep through the rest of its budget.
+	requestStop();
+}
+
+bool Emuballs::Arm::Machine::isWaitingForInterrupt() const
+{
+	return d->waiting;
+}
+
+void Emuballs::Arm::Machine::setIdleHandler(std::function<void(uint64_t)> handler)
+{
+	d->idleHandler = std::move(handler);
+}
+
+Emuballs::memsize Emuballs::Arm::Machine::nextInstructionAddress() const
+{
+	return cpu().regs().pc() - d->prefetch.size() * INSTRUCTION_SIZE;
+}
+
+uint64_t Emuballs::Arm::Machine::instructionCount() const
+{
+	return d->instructions;
+}
+
+Emuballs::Arm::BreakpointMap &Emuballs::Arm::Machine::breakpoints()
+{
+	return d->breakpoints;
+}
+
+const Emuballs::Arm::BreakpointMap &Emuballs::Arm::Machine::breakpoints() const
+{
+	return d->breakpoints;
+}
+
+Emuballs::memobserver_id Emuballs::Arm::Machine::addWatchpoint(memsize address,
+	memsize length, Access events)
+{
+	return _memory->watch(address, length, events);
+}
+
+void Emuballs::Arm::Machine::removeWatchpoint(memobserver_id id)
+{
+	_memory->unwatch(id);
+}
+
+const Emuballs::MemWatchHit &Emuballs::Arm::Machine::lastWatchpointHit() const
+{
+	return d->lastWatchHit;
+}
+
+void Emuballs::Arm::Machine::setTraceRecorder(TraceRecorder *recorder)
+{
+	d->trace = recorder;
+	adjustPointers();
+}
+
+void Emuballs::Arm::Machine::setProfiler(Profiler *profiler)
+{
+	d->profiler = profiler;
+}
+
+void Emuballs::Arm::Machine::setCoverage(EdgeCoverage *coverage)
+{
+	d->coverage = coverage;
+}
+
+Emuballs::Arm::Cpu Emuballs::Arm::Machine::cpuSnapshot() const
+{
+	Cpu cpu = _cpu;
+	cpu.regs().pc(nextInstructionAddress());
+	return cpu;
+}
+
+void Emuballs::Arm::Machine::restoreCpu(const Cpu &cpu, uint64_t instructionCount)
+{
+	_cpu = cpu;
+	d->exclusive.armed = false;
+	d->prefetch.flush();
+	d->waiting = false;
+	d->instructions = instructionCount;
+	d->stopRequested = false;
+	d->watchHit = false;
+}
+
+void Emuballs::Arm::Machine::restore(const Machine &snapshot)
+{
+	_memory->restoreDirtyPages(*snapshot._memory);
+	restoreCpu(snapshot.cpuSnapshot(), snapshot.d->instructions);
+}
+
+void Emuballs::Arm::Machine::markExclusive(memsize address, int size, uint64_t value)
+{
+	d->exclusive.armed = true;
+	d->exclusive.address = address;
+	d->exclusive.size = size;
+	d->exclusive.value = value;
+}
+
+bool Emuballs::Arm::Machine::storeExclusive(memsize address, int size, uint64_t value)
+{
+	ExclusiveMonitor &monitor = d->exclusive;
+	bool armed = monitor.armed && monitor.address == address && monitor.size == size;
+	monitor.armed = false;
+	if (!armed)
+		return false;
+	return memory().compareExchange(address, size, monitor.value, value);
+}
+
+void Emuballs::Arm::Machine::clearExclusive()
+{
+	d->exclusive.armed = false;
 }
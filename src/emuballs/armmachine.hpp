@@ -19,19 +19,92 @@
 #pragma once
 
 #include "armcpu.hpp"
+#include "breakpoints.hpp"
 #include "memory.hpp"
 #include "dptr_impl.hpp"
+#include <cstdint>
+#include <functional>
+#include <limits>
 
 namespace Emuballs
 {
 
+class EdgeCoverage;
+class Profiler;
+class TraceRecorder;
+
 namespace Arm
 {
 
+enum class StopReason : int
+{
+	/** Instruction budget was exhausted. */
+	Budget,
+	/** Next instruction to execute is at a breakpoint address. */
+	Breakpoint,
+	/** Last executed instruction hit a memory watchpoint. */
+	Watchpoint,
+	/** Next instruction to execute is outside of the allowed PC range. */
+	PcRangeExit,
+	/**
+	 * Stop was requested through Machine::requestStop(), or
+	 * the instruction count set by Machine::requestStopAt()
+	 * was reached.
+	 */
+	Requested
+};
+
+/**
+ * Conditions under which Machine::run() will stop before
+ * exhausting its instruction budget.
+ *
+ * All addresses refer to the address of the next instruction to be
+ * executed, not to the prefetched value of pc.
+ */
+struct StopConditions
+{
+	/**
+	 * Stop before executing instruction under any of these addresses.
+	 * Breakpoint on the very first instruction is ignored, so that
+	 * the run can be resumed from a breakpoint.
+	 *
+	 * These are checked in addition to Machine::breakpoints().
+	 */
+	BreakpointMap breakpoints;
+	/**
+	 * Stop when next instruction address leaves the
+	 * [pcRangeBegin, pcRangeEnd) range.
+	 */
+	memsize pcRangeBegin = 0;
+	memsize pcRangeEnd = std::numeric_limits<memsize>::max();
+
+	bool hasPcRange() const
+	{
+		return pcRangeBegin != 0 || pcRangeEnd != std::numeric_limits<memsize>::max();
+	}
+};
+
+struct RunResult
+{
+	StopReason reason;
+	/**
+	 * Amount of instructions executed, including the ones
+	 * slept through while waiting for an interrupt.
+	 */
+	uint64_t executed;
+};
+
 class Machine
 {
 public:
 	Machine();
+	/**
+	 * Machine working on a memory owned by someone else,
+	 * like a secondary core of a multi-core device. Copies share
+	 * the same memory. Watchpoints and tracing need the listeners
+	 * of the memory, which stay with the owner.
+	 */
+	explicit Machine(Memory &sharedMemory);
 	Machine(const Machine &other);
 	Machine(Machine && other) noexcept;
 	Machine &operator=(Machine other);
@@ -41,7 +114,7 @@ public:
 
 	swap(a.d, b.d);
 	swap(a._cpu, b._cpu);
-	swap(a._memory, b._memory);
+	swap(a._ownMemory, b._ownMemory);
 	a.adjustPointers();
 	b.adjustPointers();
 }
@@ -58,27 +131,179 @@ public:
 
 	TrackedMemory memory()
 	{
-		return TrackedMemory(_memory);
+		return TrackedMemory(*_memory);
 	}
 
 	Memory &untrackedMemory()
 	{
-		return _memory;
+		return *_memory;
 	}
 
 	const Memory &untrackedMemory() const
 	{
-		return _memory;
+		return *_memory;
 	}
 
+	/**
+	 * Execute exactly one instruction.
+	 */
 	void cycle();
 
+	/**
+	 * Execute up to `maxInstructions` in a tight loop, stopping
+	 * earlier if any of the `stop` conditions is met.
+	 */
+	RunResult run(uint64_t maxInstructions,
+		const StopConditions &stop = StopConditions());
+
+	/**
+	 * Make the current run() return after the instruction
+	 * that is being executed. Meant to be called from memory
+	 * observers of peripherals that need to be serviced.
+	 */
+	void requestStop();
+	/**
+	 * Make run() return before instructionCount() exceeds
+	 * `instructionCount`, until called again; UINT64_MAX lifts it.
+	 * It costs nothing per instruction, as only the budget of
+	 * run() gets cut.
+	 */
+	void requestStopAt(uint64_t instructionCount);
+	/**
+	 * Instruction count last set by requestStopAt().
+	 */
+	uint64_t requestedStopAt() const;
+
+	/**
+	 * Level of the IRQ input. While it's raised, the IRQ exception
+	 * is taken before the next instruction, unless CPSR masks it.
+	 * Raising it also wakes the core up from waitForInterrupt(),
+	 * masked or not.
+	 */
+	void setIrq(bool raised);
+	bool isIrqRaised() const;
+	/**
+	 * Sleep until the IRQ input is raised, as WFI does; returns
+	 * at once if it's raised already. A sleeping core executes
+	 * nothing, but run() and cycle() still consume their budget
+	 * and advance the instructionCount(), so that time passes.
+	 */
+	void waitForInterrupt();
+	bool isWaitingForInterrupt() const;
+	/**
+	 * Called with the amount of instructions that a sleeping core
+	 * is about to let pass, before they're counted. A device that
+	 * runs in real time can block the host thread for as long
+	 * instead of spinning. Copies of the Machine don't call it.
+	 */
+	void setIdleHandler(std::function<void(uint64_t)> handler);
+
+	/**
+	 * Address of the instruction that will be executed next.
+	 */
+	memsize nextInstructionAddress() const;
+
+	/**
+	 * Amount of instructions executed since the Machine was created.
+	 */
+	uint64_t instructionCount() const;
+
+	/**
+	 * Persistent execution breakpoints checked by every run().
+	 */
+	BreakpointMap &breakpoints();
+	const BreakpointMap &breakpoints() const;
+
+	/**
+	 * Stop run() after an instruction accesses watched memory.
+	 *
+	 * Only accesses done by the executed program are caught,
+	 * as untrackedMemory() doesn't notify anyone.
+	 */
+	memobserver_id addWatchpoint(memsize address, memsize length, Access events);
+	void removeWatchpoint(memobserver_id id);
+	/**
+	 * Most recent watchpoint hit; valid after run()
+	 * returned StopReason::Watchpoint.
+	 */
+	const MemWatchHit &lastWatchpointHit() const;
+
+	/**
+	 * Record every executed instruction into `recorder`;
+	 * nullptr stops the recording. The recorder must outlive
+	 * the recording. Copies of the Machine don't record.
+	 *
+	 * Execution without a recorder doesn't pay for tracing
+	 * as run() picks a separate loop then.
+	 */
+	void setTraceRecorder(TraceRecorder *recorder);
+
+	/**
+	 * Account every executed instruction in `profiler`; nullptr
+	 * stops the profiling. Same rules as for the trace recorder
+	 * apply.
+	 */
+	void setProfiler(Profiler *profiler);
+
+	/**
+	 * Record control flow edges of executed code into `coverage`;
+	 * nullptr stops the recording. Same rules as for the trace
+	 * recorder apply.
+	 */
+	void setCoverage(EdgeCoverage *coverage);
+
+	/**
+	 * Bring back the state of `snapshot`, which must be a copy of
+	 * this Machine made after `untrackedMemory().clearDirtyPages()`.
+	 * Only the memory pages dirtied since then are copied, which
+	 * makes it much cheaper than assigning the snapshot. Breakpoints
+	 * and the opcode cache are kept.
+	 */
+	void restore(const Machine &snapshot);
+
+	/**
+	 * Copy of the Cpu with pc pointing at the next instruction
+	 * to execute, as expected by restoreCpu().
+	 */
+	Cpu cpuSnapshot() const;
+	/**
+	 * Resume execution from a cpuSnapshot(), setting the
+	 * instructionCount() to the one from when it was taken.
+	 * Memory and the IRQ input are not touched; a core waiting
+	 * for an interrupt is woken up.
+	 */
+	void restoreCpu(const Cpu &cpu, uint64_t instructionCount);
+
+	/**
+	 * Arm the local exclusive monitor, as LDREX does, remembering
+	 * the `value` that was loaded.
+	 */
+	void markExclusive(memsize address, int size, uint64_t value);
+	/**
+	 * Store `value` if the monitor is armed for `address` and no
+	 * one changed the loaded value in the meantime, atomically even
+	 * against the other cores. The monitor is cleared either way.
+	 *
+	 * @return true if `value` was stored.
+	 */
+	bool storeExclusive(memsize address, int size, uint64_t value);
+	void clearExclusive();
+
 private:
 	Cpu _cpu;
-	Memory _memory;
+	Memory _ownMemory;
+	Memory *_memory = nullptr;
 	DPtr<Machine> d;
 
 	void adjustPointers() noexcept;
+	inline uint32_t step();
+	template<class Action> auto withHook(Action action);
+	template<class Hook> inline void advance(Hook &hook);
+	template<class Hook> RunResult runLoop(uint64_t maxInstructions,
+		const StopConditions &stop, Hook &hook);
+	StopReason requestedStopReason() const;
+	inline void takeIrq();
+	RunResult sleep(uint64_t instructions, StopReason reason);
 };
 
 } // namespace Arm
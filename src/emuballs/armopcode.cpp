@@ -46,7 +46,8 @@ public:
 		lt,
 		gt,
 		le,
-		al
+		al,
+		nv
 	};
 
 	static bool met(uint8_t condition, const Flags &flags)
@@ -96,10 +97,20 @@ Opcode::Opcode(uint32_t code)
 	this->m_code = code;
 }
 
+Opcode::Opcode(uint32_t code, bool unconditional)
+{
+	this->m_code = code;
+	this->m_unconditional = unconditional;
+}
+
 void Opcode::execute(Machine &machine)
 {
 	auto condition = (m_code >> 28) & 0xf;
-	if (Conditional::met(condition, machine.cpu().flags()))
+	if (condition == Conditional::nv && m_unconditional)
+	{
+		run(machine);
+	}
+	else if (Conditional::met(condition, machine.cpu().flags()))
 	{
 		run(machine);
 	}
@@ -46,10 +46,17 @@ public:
 	virtual void validate();
 
 protected:
+	/**
+	 * Opcode from the unconditional instruction space,
+	 * whose condition field is 0b1111.
+	 */
+	Opcode(uint32_t code, bool unconditional);
+
 	virtual void run(Machine &machine) = 0;
 
 private:
 	uint32_t m_code;
+	bool m_unconditional = false;
 };
 
 typedef std::shared_ptr<Opcode> OpcodePtr;
@@ -113,7 +113,13 @@ protected:
 		if (writeRd())
 			cpu.regs().set(rd, endval);
 		if (condition)
-			adjustFlags(machine, endval);
+		{
+			// Exception return, like `subs pc, lr, #4`.
+			if (rd == 15 && writeRd())
+				cpu.cpsr(cpu.flagsSpsr().dump());
+			else
+				adjustFlags(machine, endval);
+		}
 	}
 
 	virtual regval calculate() = 0;
@@ -128,7 +134,7 @@ private:
 	uint32_t precalculatedImmediateOp2;
 
 	// Register operand 2.
-	bool useRegisterToShift;
+	bool useRegisterToShift = false;
 	int rm;
 	int rs;
 	int immediateShiftAmount;
@@ -360,7 +366,12 @@ public:
 protected:
 	Flags &psr(Machine &machine)
 	{
-		return code() & (1 << 22) ? machine.cpu().flagsSpsr() : machine.cpu().flags();
+		return isSpsr() ? machine.cpu().flagsSpsr() : machine.cpu().flags();
+	}
+
+	bool isSpsr() const
+	{
+		return code() & (1 << 22);
 	}
 };
 
@@ -408,7 +419,10 @@ protected:
 			mask |= 0xff000000;
 		regval currentFlags = flags.dump() & ~mask;
 		regval newFlags = currentFlags | (value & mask);
-		flags.store(newFlags);
+		if (isSpsr())
+			flags.store(newFlags);
+		else
+			machine.cpu().cpsr(newFlags);
 	}
 
 private:
@@ -24,6 +24,7 @@
 #include "memory.hpp"
 #include "shift.hpp"
 #include <algorithm>
+#include <atomic>
 
 namespace Emuballs
 {
@@ -532,8 +533,7 @@ public:
 		rn = (code >> 16) & 0xf;
 		load = code & (1 << 20);
 		writeBack = code & (1 << 21);
-		// TODO: psr when I know what this is.
-		// psr = code() & (1 << 22);
+		psr = code & (1 << 22);
 		up = code & (1 << 23);
 		preIndexing = code & (1 << 24);
 
@@ -564,17 +564,25 @@ protected:
 		#error("big endian not supported")
 		#endif
 		TrackedMemory memory = machine.memory();
+		// With the S bit, ldm that loads pc returns from an exception,
+		// while the others transfer the User mode registers.
+		bool userBank = psr && !(load && loadsPc());
 		if (load)
 		{
 			memory.chunk(address + startOffset, length,
 				reinterpret_cast<uint8_t*>(values.data()));
 			for (unsigned i = 0; i < registers.size(); ++i)
-				regs.set(registers[i], values[i]);
+			{
+				if (userBank)
+					regs.setBanked(Bank::User, registers[i], values[i]);
+				else
+					regs.set(registers[i], values[i]);
+			}
 		}
 		else
 		{
 			for (unsigned i = 0; i < registers.size(); ++i)
-				values[i] = regs[registers[i]];
+				values[i] = userBank ? regs.banked(Bank::User, registers[i]) : regs[registers[i]];
 			memory.putChunk(address + startOffset,
 				reinterpret_cast<uint8_t*>(values.data()),
 				length);
@@ -582,13 +590,14 @@ protected:
 
 		if (writeBack)
 			regs.set(rn, address + (up ? this->length : -this->length));
+		if (psr && !userBank)
+			machine.cpu().cpsr(machine.cpu().flagsSpsr().dump());
 	}
 
 private:
 	bool load;
 	bool writeBack;
-	// TODO: psr when I know what this is.
-	// bool psr = code() & (1 << 22);
+	bool psr;
 	bool up;
 	bool preIndexing;
 	int rn;
@@ -610,6 +619,11 @@ private:
 			return sizeof(regval);
 	}
 
+	bool loadsPc() const
+	{
+		return !registers.empty() && registers.back() == 15;
+	}
+
 	std::vector<int> determineRegisters()
 	{
 		std::bitset<16> registerBits = std::bitset<16>(code() & 0xffff);
@@ -681,6 +695,9 @@ public:
 protected:
 	void run(Machine &machine)
 	{
+		Cpu &cpu = machine.cpu();
+		cpu.enterException(MODE_SUPERVISOR, VECTOR_SOFTWARE_INTERRUPT,
+			cpu.regs().pc() - PREFETCH_SIZE + INSTRUCTION_SIZE);
 	}
 };
 
@@ -731,6 +748,188 @@ protected:
 	}
 };
 
+/**
+ * LDREX, STREX and their byte, halfword and doubleword variants.
+ */
+class LoadStoreExclusive : public Opcode
+{
+public:
+	LoadStoreExclusive(uint32_t code)
+		: Opcode(code)
+	{
+		load = code & (1 << 20);
+		static const int SIZES[] = { 4, 8, 1, 2 };
+		size = SIZES[(code >> 21) & 0b11];
+		rn = (code >> 16) & 0xf;
+		if (load)
+		{
+			rt = (code >> 12) & 0xf;
+		}
+		else
+		{
+			rd = (code >> 12) & 0xf;
+			rt = code & 0xf;
+		}
+	}
+
+protected:
+	void validate() override
+	{
+		if (rn == 15 || rt == 15 || (!load && rd == 15))
+			throw IllegalOpcodeError("ldrex/strex: register musn't be r15");
+		if (!load && (rd == rn || rd == rt || (size == 8 && rd == rt + 1)))
+			throw IllegalOpcodeError("strex: status register must differ from the others");
+		if (size == 8 && (rt % 2 != 0 || rt == 14))
+			throw IllegalOpcodeError("ldrexd/strexd: register must be even and not r14");
+	}
+
+	void run(Machine &machine) override
+	{
+		RegisterSet &regs = machine.cpu().regs();
+		memsize address = regs[rn];
+		if (address % size != 0)
+			throw ProgramRuntimeError("ldrex/strex: unaligned address");
+		if (load)
+		{
+			uint64_t value = read(machine, address);
+			machine.markExclusive(address, size, value);
+			regs.set(rt, static_cast<regval>(value));
+			if (size == 8)
+				regs.set(rt + 1, static_cast<regval>(value >> 32));
+		}
+		else
+		{
+			uint64_t value = regs[rt];
+			if (size == 8)
+				value |= static_cast<uint64_t>(regs[rt + 1]) << 32;
+			bool stored = machine.storeExclusive(address, size, value);
+			regs.set(rd, stored ? 0 : 1);
+		}
+	}
+
+private:
+	bool load;
+	int size;
+	int rn;
+	int rt;
+	int rd = 0;
+
+	uint64_t read(Machine &machine, memsize address) const
+	{
+		switch (size)
+		{
+		case 1:
+			return machine.memory().byte(address);
+		case 2:
+			return machine.memory().byte(address)
+				| (machine.memory().byte(address + 1) << 8);
+		case 4:
+			return machine.memory().word(address);
+		default:
+			return machine.memory().dword(address);
+		}
+	}
+};
+
+class ClearExclusive : public Opcode
+{
+public:
+	ClearExclusive(uint32_t code)
+		: Opcode(code, true)
+	{
+	}
+
+protected:
+	void run(Machine &machine) override
+	{
+		machine.clearExclusive();
+	}
+};
+
+/**
+ * DMB, DSB and ISB. Make the memory accesses of this core
+ * visible to the cores running on the other host threads.
+ */
+class Barrier : public Opcode
+{
+public:
+	Barrier(uint32_t code)
+		: Opcode(code, true)
+	{
+	}
+
+protected:
+	void run(Machine &) override
+	{
+		std::atomic_thread_fence(std::memory_order_seq_cst);
+	}
+};
+
+/**
+ * WFI, either as the ARMv6K hint or as the CP15 c7 operation
+ * of ARMv6.
+ */
+class WaitForInterrupt : public Opcode
+{
+public:
+	using Opcode::Opcode;
+protected:
+	void run(Machine &machine) override
+	{
+		machine.waitForInterrupt();
+	}
+};
+
+/**
+ * NOP, YIELD, WFE and SEV. There's no one to yield to and
+ * WFE may return spuriously, so all of them do nothing.
+ */
+class Hint : public Opcode
+{
+public:
+	using Opcode::Opcode;
+protected:
+	void run(Machine &) override
+	{
+	}
+};
+
+/**
+ * CPS; changes the interrupt masks and the mode. It's
+ * a NOP in User mode.
+ */
+class ChangeProcessorState : public Opcode
+{
+public:
+	ChangeProcessorState(uint32_t code)
+		: Opcode(code, true)
+	{
+	}
+
+protected:
+	void run(Machine &machine) override
+	{
+		Cpu &cpu = machine.cpu();
+		if (cpu.flags().cpuMode() == MODE_USER)
+			return;
+		regval cpsr = cpu.flags().dump();
+		// A, I and F bits of the opcode match the ones in CPSR.
+		regval masks = code() & (PSR_ABORT_DISABLE | PSR_IRQ_DISABLE | PSR_FIQ_DISABLE);
+		switch ((code() >> 18) & 0b11)
+		{
+		case 0b10:
+			cpsr &= ~masks;
+			break;
+		case 0b11:
+			cpsr |= masks;
+			break;
+		}
+		if (code() & (1 << 17))
+			cpsr = (cpsr & ~0x1fu) | (code() & 0x1f);
+		cpu.cpsr(cpsr);
+	}
+};
+
 } // namespace OpcodeImpl
 
 using namespace OpcodeImpl;
@@ -740,9 +939,20 @@ static bool isBxMagic(uint32_t code)
 	return (code & 0x0ffffff0) == 0x012fff10;
 }
 
+static bool isHint(uint32_t code)
+{
+	return (code & 0x0fffff00) == 0x0320f000;
+}
+
+static bool isCp15WaitForInterrupt(uint32_t code)
+{
+	// mcr p15, 0, rd, c7, c0, 4
+	return (code & 0x0fff0fff) == 0x0e070f90;
+}
+
 static bool isDataProcessingPsrTransfer(uint32_t code)
 {
-	if (isBxMagic(code))
+	if (isBxMagic(code) || isHint(code))
 		return false;
 	if ((code & (0b111 << 25)) == (0b1 << 25))
 		return true;
@@ -776,6 +986,45 @@ static bool isMultiplyLong(uint32_t code)
 	return (code & 0x0f8000f0) == 0x00800090;
 }
 
+OpcodePtr opcodeSynchronization(uint32_t code)
+{
+	if ((code & 0x0f800ff0) == 0x01800f90)
+	{
+		bool load = code & (1 << 20);
+		if (!load || (code & 0xf) == 0xf)
+			return OpcodePtr(new LoadStoreExclusive(code));
+	}
+	if (code == 0xf57ff01f)
+	{
+		return OpcodePtr(new ClearExclusive(code));
+	}
+	uint32_t barrier = code & 0xfffffff0;
+	if (barrier == 0xf57ff040 || barrier == 0xf57ff050 || barrier == 0xf57ff060)
+	{
+		return OpcodePtr(new Barrier(code));
+	}
+	return nullptr;
+}
+
+OpcodePtr opcodeProcessorState(uint32_t code)
+{
+	if (isHint(code))
+	{
+		if ((code & 0xff) == 3)
+			return OpcodePtr(new WaitForInterrupt(code));
+		return OpcodePtr(new Hint(code));
+	}
+	if (isCp15WaitForInterrupt(code))
+	{
+		return OpcodePtr(new WaitForInterrupt(code));
+	}
+	if ((code & 0xfff1fe20) == 0xf1000000)
+	{
+		return OpcodePtr(new ChangeProcessorState(code));
+	}
+	return nullptr;
+}
+
 OpcodePtr opcodeDataProcessingPsrTransfer(uint32_t code)
 {
 	if (isDataProcessingPsrTransfer(code))
@@ -898,6 +1147,8 @@ OpcodePtr opcodeCoprocessorDataOperation(uint32_t code)
 
 OpcodePtr opcodeCoprocessorRegisterTransfer(uint32_t code)
 {
+	if (isCp15WaitForInterrupt(code))
+		return nullptr;
 	if (((code & 0x0f000010) == 0x0e000010) ||
 		((code & 0x0d600000) == 0x0c400000))
 	{
@@ -27,6 +27,8 @@ namespace Arm
 
 {
 
+OpcodePtr opcodeSynchronization(uint32_t code);
+OpcodePtr opcodeProcessorState(uint32_t code);
 OpcodePtr opcodeDataProcessingPsrTransfer(uint32_t code);
 OpcodePtr opcodeMultiply(uint32_t code);
 OpcodePtr opcodeMultiplyLong(uint32_t code);
@@ -45,6 +47,8 @@ OpcodePtr opcodeByteReverse(uint32_t code);
 
 const OpFactory factories[] =
 {
+	opcodeSynchronization,
+	opcodeProcessorState,
 	opcodeDataProcessingPsrTransfer,
 	opcodeMultiply,
 	opcodeMultiplyLong,
@@ -77,3 +77,11 @@ void NamedRegisterSet::setReg(const std::string &name, const RegVal &value)
 	}
 	throw UnknownRegisterError("unknown register " + name);
 }
+
+void NamedRegisterSet::values(std::vector<uint32_t> &values) const
+{
+	auto &regs = d->machine->cpu().regs();
+	values.resize(NUM_CPU_REGS);
+	for (int i = 0; i < NUM_CPU_REGS; ++i)
+		values[i] = regs[i];
+}
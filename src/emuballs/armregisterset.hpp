@@ -39,6 +39,8 @@ public:
 
 	void setReg(const std::string &name, const RegVal &val);
 
+	void values(std::vector<uint32_t> &values) const;
+
 private:
 	DPtr<NamedRegisterSet> d;
 };
@@ -0,0 +1,166 @@
+/*
+ * Copyright 2017 Zalewa <zalewapl@gmail.com>.
+ *
+ * This file is part of Emuballs.
+ *
+ * Emuballs is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Emuballs is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with Emuballs.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#pragma once
+
+#include "armcpu.hpp"
+#include "emuballs/memory.hpp"
+#include <bitset>
+#include <map>
+#include <vector>
+
+namespace Emuballs
+{
+
+namespace Arm
+{
+
+/**
+ * Set of execution breakpoint addresses, optimized for the
+ * "is there a breakpoint under this address?" query.
+ *
+ * Addresses are grouped into code pages of the same size as the
+ * pages of the OpDecoder. Each page holds a bitmap with one bit
+ * per instruction. The last looked-up page is cached, so checking
+ * an address on the same page as the previous one costs a single
+ * bit test, and a page without breakpoints costs one comparison.
+ *
+ * Addresses are rounded down to INSTRUCTION_SIZE alignment.
+ */
+class BreakpointMap
+{
+public:
+	BreakpointMap()
+	{
+	}
+
+	BreakpointMap(const BreakpointMap &other)
+		: pages(other.pages), _size(other._size)
+	{
+		// The cache isn't copied, as it would point to the pages
+		// of `other`; it starts empty and fills on the first lookup.
+	}
+
+	BreakpointMap &operator=(const BreakpointMap &other)
+	{
+		pages = other.pages;
+		_size = other._size;
+		invalidateCache();
+		return *this;
+	}
+
+	void insert(memsize address)
+	{
+		PageBits &bits = pages[pageAddress(address)];
+		if (!bits.test(slot(address)))
+		{
+			bits.set(slot(address));
+			++_size;
+		}
+		invalidateCache();
+	}
+
+	void erase(memsize address)
+	{
+		auto it = pages.find(pageAddress(address));
+		if (it == pages.end() || !it->second.test(slot(address)))
+			return;
+		it->second.reset(slot(address));
+		--_size;
+		if (it->second.none())
+			pages.erase(it);
+		invalidateCache();
+	}
+
+	void clear()
+	{
+		pages.clear();
+		_size = 0;
+		invalidateCache();
+	}
+
+	bool empty() const
+	{
+		return _size == 0;
+	}
+
+	size_t size() const
+	{
+		return _size;
+	}
+
+	bool contains(memsize address) const
+	{
+		memsize page = pageAddress(address);
+		if (page != cachedPageAddress)
+		{
+			auto it = pages.find(page);
+			cachedPage = it != pages.end() ? &it->second : nullptr;
+			cachedPageAddress = page;
+		}
+		return cachedPage != nullptr && cachedPage->test(slot(address));
+	}
+
+	std::vector<memsize> addresses() const
+	{
+		std::vector<memsize> result;
+		for (auto &page : pages)
+		{
+			for (size_t i = 0; i < SLOTS; ++i)
+			{
+				if (page.second.test(i))
+					result.push_back(page.first + i * INSTRUCTION_SIZE);
+			}
+		}
+		return result;
+	}
+
+private:
+	static const memsize PAGE_OFFSET_MASK = 0xffff;
+	static const memsize PAGE_MASK = ~PAGE_OFFSET_MASK;
+	static const size_t SLOTS = (PAGE_OFFSET_MASK + 1) / INSTRUCTION_SIZE;
+	/** Page-aligned addresses can't have this offset. */
+	static const memsize NO_PAGE = 1;
+
+	typedef std::bitset<SLOTS> PageBits;
+
+	std::map<memsize, PageBits> pages;
+	size_t _size = 0;
+	mutable memsize cachedPageAddress = NO_PAGE;
+	mutable const PageBits *cachedPage = nullptr;
+
+	static memsize pageAddress(memsize address)
+	{
+		return address & PAGE_MASK;
+	}
+
+	static size_t slot(memsize address)
+	{
+		return (address & PAGE_OFFSET_MASK) / INSTRUCTION_SIZE;
+	}
+
+	void invalidateCache()
+	{
+		cachedPageAddress = NO_PAGE;
+		cachedPage = nullptr;
+	}
+};
+
+}
+
+}
@@ -0,0 +1,125 @@
+/*
+ * Copyright 2017 Zalewa <zalewapl@gmail.com>.
+ *
+ * This file is part of Emuballs.
+ *
+ * Emuballs is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Emuballs is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with Emuballs.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <cstring>
+#include <stdexcept>
+#include <vector>
+
+namespace Emuballs
+{
+
+/**
+ * Lock-free single-producer single-consumer byte ring.
+ *
+ * One thread may write() while another thread read()s, without any
+ * locking. Each write() is published atomically, so the reader never
+ * sees a half-written record.
+ *
+ * Capacity is rounded up to a power of two.
+ */
+class ByteRing
+{
+public:
+	ByteRing(size_t capacity)
+	{
+		size_t size = 1;
+		while (size < capacity)
+			size <<= 1;
+		buffer.resize(size);
+		mask = size - 1;
+	}
+
+	ByteRing(const ByteRing &other) = delete;
+	ByteRing &operator=(const ByteRing &other) = delete;
+
+	size_t capacity() const
+	{
+		return buffer.size();
+	}
+
+	/**
+	 * Producer side. Puts the whole `length` or nothing.
+	 *
+	 * @return false if there isn't enough free space.
+	 */
+	bool write(const uint8_t *data, size_t length)
+	{
+		size_t head = _head.load(std::memory_order_relaxed);
+		size_t tail = _tail.load(std::memory_order_acquire);
+		if (capacity() - (head - tail) < length)
+			return false;
+		size_t offset = head & mask;
+		size_t first = std::min(length, capacity() - offset);
+		std::memcpy(&buffer[offset], data, first);
+		std::memcpy(&buffer[0], data + first, length - first);
+		_head.store(head + length, std::memory_order_release);
+		return true;
+	}
+
+	/**
+	 * Consumer side. Takes up to `maxLength` bytes.
+	 *
+	 * @return Amount of bytes taken.
+	 */
+	size_t read(uint8_t *data, size_t maxLength)
+	{
+		size_t tail = _tail.load(std::memory_order_relaxed);
+		size_t head = _head.load(std::memory_order_acquire);
+		size_t length = std::min(maxLength, head - tail);
+		size_t offset = tail & mask;
+		size_t first = std::min(length, capacity() - offset);
+		std::memcpy(data, &buffer[offset], first);
+		std::memcpy(data + first, &buffer[0], length - first);
+		_tail.store(tail + length, std::memory_order_release);
+		return length;
+	}
+
+	/**
+	 * Amount of bytes waiting to be read. The other side may
+	 * change it at any time, but the producer can only see
+	 * too much and the consumer too little.
+	 */
+	size_t size() const
+	{
+		return _head.load(std::memory_order_acquire)
+			- _tail.load(std::memory_order_acquire);
+	}
+
+	bool empty() const
+	{
+		return _head.load(std::memory_order_acquire)
+			== _tail.load(std::memory_order_acquire);
+	}
+
+private:
+	std::vector<uint8_t> buffer;
+	size_t mask;
+	// Free-running counters; only their difference matters.
+	// Padded apart so that producer and consumer
+	// don't fight over the same cache line.
+	std::atomic<size_t> _head {0};
+	char padding[64];
+	std::atomic<size_t> _tail {0};
+};
+
+}
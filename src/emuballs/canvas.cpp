@@ -20,35 +20,75 @@
 
 #include "emuballs/color.hpp"
 #include "dptr_impl.hpp"
+#include "pixelconv.hpp"
+#include <algorithm>
 #include <sstream>
+#include <stdexcept>
 
 namespace Emuballs
 {
+namespace
+{
+PixelConv::RowConverter rowConverter(int32_t bitsPerPixel)
+{
+	static const PixelConv::Simd simd = PixelConv::detectSimd();
+	static const PixelConv::RowConverter rgb565 = PixelConv::rgb565(simd);
+	static const PixelConv::RowConverter rgb888 = PixelConv::rgb888(simd);
+	static const PixelConv::RowConverter xrgb8888 = PixelConv::xrgb8888(simd);
+	switch (static_cast<BitDepth>(bitsPerPixel))
+	{
+	case BitDepth::HighColor:
+		return rgb565;
+	case BitDepth::TrueColor:
+		return rgb888;
+	case BitDepth::Rgba32:
+		return xrgb8888;
+	default:
+	{
+		std::stringstream ss;
+		ss << "unhandled bitsPerPixel " << bitsPerPixel;
+		throw std::logic_error(ss.str());
+	}
+	}
+}
+}
+
 DClass<Canvas>
 {
 public:
-	void drawPicture16(Canvas &canvas, int32_t x, int32_t y, int32_t width, int32_t height, const std::vector<uint8_t> &pixels)
-	{
-		int32_t pitch = 0;
-		for (int32_t yPixel = 0; yPixel < height; ++yPixel)
-		{
-			for (int32_t xPixel = 0; xPixel < width; ++xPixel)
-			{
-				uint8_t rawcolor[2];
-				rawcolor[1] = pixels[pitch];
-				rawcolor[0] = pixels[pitch + 1];
+	Canvas::DrawnFrame drawnFrame;
+	std::vector<uint32_t> row;
+	/** Rows that cross the span boundaries are gathered here. */
+	std::vector<uint8_t> gathered;
+	size_t span = 0;
+	size_t spanStart = 0;
 
-				canvas.drawPixel(x + xPixel, y + yPixel, Color(
-						(((rawcolor[0] & 0b11111000) >> 3) * 255) / 31,
-						((((rawcolor[0] & 0b111) << 3) | ((rawcolor[1] & 0b11100000) >> 5)) * 255) / 63,
-						(rawcolor[1] & 0b11111) * 255 / 31
-						)
-					);
+	/**
+	 * Pointer to `length` bytes at `offset` of the `spans`, or nullptr
+	 * if they end sooner. Offsets must grow between the calls.
+	 */
+	const uint8_t *bytesAt(const std::vector<MemorySpan> &spans,
+		size_t offset, size_t length)
+	{
+		while (span < spans.size() && offset >= spanStart + spans[span].length)
+			spanStart += spans[span++].length;
+		if (span == spans.size())
+			return nullptr;
+		size_t skip = offset - spanStart;
+		if (skip + length <= spans[span].length)
+			return spans[span].data + skip;
 
-				pitch += 2;
-			}
+		gathered.resize(length);
+		size_t copied = 0;
+		for (size_t next = span; next < spans.size() && copied < length; ++next)
+		{
+			size_t count = std::min(spans[next].length - skip, length - copied);
+			std::copy(spans[next].data + skip, spans[next].data + skip + count,
+				gathered.begin() + copied);
+			copied += count;
+			skip = 0;
 		}
-
+		return copied == length ? gathered.data() : nullptr;
 	}
 };
 
@@ -60,17 +100,55 @@ Canvas::~Canvas() {}
 void Canvas::drawPicture(int32_t x, int32_t y, int32_t width, int32_t height,
 	int32_t bitsPerPixel, int32_t pitch, const std::vector<uint8_t> &pixels)
 {
-	switch (static_cast<BitDepth>(bitsPerPixel))
-	{
-	case BitDepth::HighColor:
-		d->drawPicture16(*this, x, y, width, height, pixels);
-		break;
-	default:
+	drawSpans(x, y, width, height, bitsPerPixel, pitch,
+		{MemorySpan {pixels.data(), pixels.size()}});
+}
+
+void Canvas::drawSpans(int32_t x, int32_t y, int32_t width, int32_t height,
+	int32_t bitsPerPixel, int32_t pitch, const std::vector<MemorySpan> &spans)
+{
+	PixelConv::RowConverter convert = rowConverter(bitsPerPixel);
+	if (width <= 0 || height <= 0)
+		return;
+	const size_t rowSize = static_cast<size_t>(width) * bitsPerPixel / 8;
+	const size_t stride = std::max(rowSize, static_cast<size_t>(std::max(pitch, 0)));
+	d->row.resize(width);
+	d->span = 0;
+	d->spanStart = 0;
+	for (int32_t yPixel = 0; yPixel < height; ++yPixel)
 	{
-		std::stringstream ss;
-		ss << "unhandled bitsPerPixel " << bitsPerPixel;
-		throw std::logic_error(ss.str());
+		const uint8_t *row = d->bytesAt(spans, yPixel * stride, rowSize);
+		if (row == nullptr)
+			break;
+		convert(row, width, d->row.data());
+		drawRow(x, y + yPixel, width, d->row.data());
 	}
+}
+
+void Canvas::drawRow(int32_t x, int32_t y, int32_t width, const uint32_t *rgb32)
+{
+	for (int32_t xPixel = 0; xPixel < width; ++xPixel)
+	{
+		uint32_t pixel = rgb32[xPixel];
+		drawPixel(x + xPixel, y, Color(
+				(pixel >> 16) & 0xff, (pixel >> 8) & 0xff, pixel & 0xff,
+				(pixel >> 24) & 0xff));
 	}
 }
+
+const Canvas::DrawnFrame &Canvas::drawnFrame() const
+{
+	return d->drawnFrame;
+}
+
+void Canvas::setDrawnFrame(const DrawnFrame &frame)
+{
+	d->drawnFrame = frame;
+}
+
+void Canvas::convertRow(int32_t bitsPerPixel, const uint8_t *row,
+	int32_t width, uint32_t *rgb32)
+{
+	rowConverter(bitsPerPixel)(row, width, rgb32);
+}
 }
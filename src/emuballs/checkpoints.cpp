@@ -0,0 +1,286 @@
+/*
+ * Copyright 2017 Zalewa <zalewapl@gmail.com>.
+ *
+ * This file is part of Emuballs.
+ *
+ * Emuballs is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Emuballs is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with Emuballs.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include "checkpoints.hpp"
+
+#include "inputlog.hpp"
+#include <algorithm>
+#include <deque>
+#include <map>
+#include <set>
+#include <vector>
+
+using namespace Emuballs;
+
+namespace Emuballs
+{
+DClass<Checkpoints>
+{
+public:
+	struct Checkpoint
+	{
+		uint64_t instructions;
+		Arm::Cpu cpu;
+		/**
+		 * Pages written since the previous checkpoint,
+		 * as they were at this checkpoint.
+		 */
+		std::map<memsize, std::vector<uint8_t>> pages;
+		std::function<void()> restorePeripherals;
+		bool waiting;
+	};
+
+	Arm::Machine *machine;
+	InputLog *inputs;
+	std::function<void()> service;
+	PeripheralSaver savePeripherals;
+	uint64_t interval;
+	size_t memoryBudget;
+	size_t memoryUsed = 0;
+	/**
+	 * Memory as it was at the oldest checkpoint.
+	 */
+	Memory base;
+	std::deque<Checkpoint> checkpoints;
+
+	uint64_t nextCheckpoint() const
+	{
+		return checkpoints.back().instructions + interval;
+	}
+
+	Checkpoint snapshot() const
+	{
+		return Checkpoint { machine->instructionCount(), machine->cpuSnapshot(), {},
+			savePeripherals ? savePeripherals() : nullptr,
+			machine->isWaitingForInterrupt() };
+	}
+
+	void take()
+	{
+		Memory &memory = machine->untrackedMemory();
+		Checkpoint checkpoint = snapshot();
+		for (memsize address : memory.dirtyPages())
+		{
+			auto &bytes = checkpoint.pages[address];
+			bytes.resize(memory.pageSize());
+			memory.chunk(address, memory.pageSize(), bytes.data());
+			memoryUsed += bytes.size();
+		}
+		memory.clearDirtyPages();
+		checkpoints.push_back(std::move(checkpoint));
+		while (memoryUsed > memoryBudget && checkpoints.size() > 1)
+			mergeOldest();
+	}
+
+	void mergeOldest()
+	{
+		checkpoints.pop_front();
+		for (auto &page : checkpoints.front().pages)
+		{
+			base.putChunk(page.first, page.second.data(), page.second.size());
+			memoryUsed -= page.second.size();
+		}
+		checkpoints.front().pages.clear();
+		inputs->forget(checkpoints.front().instructions);
+	}
+
+	/**
+	 * Index of the most recent checkpoint taken
+	 * at or before `instructions`.
+	 */
+	size_t find(uint64_t instructions) const
+	{
+		size_t index = checkpoints.size() - 1;
+		while (index > 0 && checkpoints[index].instructions > instructions)
+			--index;
+		return index;
+	}
+
+	void pageAt(size_t index, memsize address, std::vector<uint8_t> &bytes) const
+	{
+		for (; index > 0; --index)
+		{
+			auto it = checkpoints[index].pages.find(address);
+			if (it != checkpoints[index].pages.end())
+			{
+				bytes = it->second;
+				return;
+			}
+		}
+		base.chunk(address, bytes.size(), bytes.data());
+	}
+
+	void restore(size_t index)
+	{
+		Memory &memory = machine->untrackedMemory();
+		std::set<memsize> pages(memory.dirtyPages().begin(), memory.dirtyPages().end());
+		for (size_t later = index + 1; later < checkpoints.size(); ++later)
+		{
+			for (auto &page : checkpoints[later].pages)
+			{
+				pages.insert(page.first);
+				memoryUsed -= page.second.size();
+			}
+		}
+		checkpoints.erase(checkpoints.begin() + index + 1, checkpoints.end());
+
+		std::vector<uint8_t> bytes(memory.pageSize());
+		for (memsize address : pages)
+		{
+			pageAt(index, address, bytes);
+			memory.putChunk(address, bytes.data(), bytes.size());
+		}
+		memory.clearDirtyPages();
+
+		const Checkpoint &checkpoint = checkpoints[index];
+		machine->restoreCpu(checkpoint.cpu, checkpoint.instructions);
+		if (checkpoint.restorePeripherals)
+			checkpoint.restorePeripherals();
+		// After the peripherals, as they drive the IRQ line.
+		if (checkpoint.waiting)
+			machine->waitForInterrupt();
+		inputs->rewind(checkpoint.instructions);
+	}
+
+	/**
+	 * Run until the instruction count reaches `instructions`,
+	 * regardless of breakpoints.
+	 */
+	void forward(uint64_t instructions, Checkpoints &self)
+	{
+		while (machine->instructionCount() < instructions)
+			self.run(instructions - machine->instructionCount());
+	}
+};
+
+DPointeredNoCopy(Checkpoints);
+}
+
+Checkpoints::Checkpoints(Arm::Machine &machine, InputLog &inputs,
+	std::function<void()> service, uint64_t interval, size_t memoryBudget,
+	PeripheralSaver savePeripherals)
+{
+	d->machine = &machine;
+	d->inputs = &inputs;
+	d->service = service;
+	d->savePeripherals = std::move(savePeripherals);
+	d->interval = std::max<uint64_t>(interval, 1);
+	d->memoryBudget = memoryBudget;
+
+	machine.untrackedMemory().clearDirtyPages();
+	d->base = machine.untrackedMemory();
+	d->checkpoints.push_back(d->snapshot());
+	inputs.startHistory();
+}
+
+Checkpoints::~Checkpoints()
+{
+	d->inputs->stopHistory();
+}
+
+Arm::RunResult Checkpoints::run(uint64_t maxInstructions, const Arm::StopConditions &stop)
+{
+	Arm::Machine &machine = *d->machine;
+	uint64_t executed = 0;
+	while (executed < maxInstructions)
+	{
+		if (executed > 0)
+		{
+			// Machine ignores the breakpoint on the first
+			// instruction, but this one wasn't resumed from.
+			memsize next = machine.nextInstructionAddress();
+			if (stop.breakpoints.contains(next) || machine.breakpoints().contains(next))
+				return Arm::RunResult { Arm::StopReason::Breakpoint, executed };
+		}
+		uint64_t chunk = std::min(maxInstructions - executed,
+			d->nextCheckpoint() - machine.instructionCount());
+		Arm::RunResult result = machine.run(chunk, stop);
+		executed += result.executed;
+		if (result.reason == Arm::StopReason::Requested)
+			d->service();
+		if (machine.instructionCount() >= d->nextCheckpoint())
+			d->take();
+		if (result.reason != Arm::StopReason::Budget
+			&& result.reason != Arm::StopReason::Requested)
+		{
+			return Arm::RunResult { result.reason, executed };
+		}
+	}
+	return Arm::RunResult { Arm::StopReason::Budget, executed };
+}
+
+uint64_t Checkpoints::stepBack(uint64_t instructions)
+{
+	uint64_t now = d->machine->instructionCount();
+	uint64_t target = now - std::min(instructions, now - oldest());
+	d->restore(d->find(target));
+	d->forward(target, *this);
+	return now - target;
+}
+
+bool Checkpoints::runBackToBreakpoint(const Arm::BreakpointMap &breakpoints)
+{
+	Arm::Machine &machine = *d->machine;
+	Arm::StopConditions stop;
+	stop.breakpoints = breakpoints;
+	uint64_t end = machine.instructionCount();
+	while (end > oldest())
+	{
+		size_t index = d->find(end - 1);
+		uint64_t start = d->checkpoints[index].instructions;
+		d->restore(index);
+
+		bool found = breakpoints.contains(machine.nextInstructionAddress());
+		uint64_t hit = start;
+		while (machine.instructionCount() < end)
+		{
+			Arm::RunResult result = run(end - machine.instructionCount(), stop);
+			if (result.reason == Arm::StopReason::Breakpoint
+				&& machine.instructionCount() < end
+				&& breakpoints.contains(machine.nextInstructionAddress()))
+			{
+				found = true;
+				hit = machine.instructionCount();
+			}
+		}
+		if (found)
+		{
+			d->restore(d->find(hit));
+			d->forward(hit, *this);
+			return true;
+		}
+		end = start;
+	}
+	d->restore(0);
+	return false;
+}
+
+uint64_t Checkpoints::oldest() const
+{
+	return d->checkpoints.front().instructions;
+}
+
+size_t Checkpoints::size() const
+{
+	return d->checkpoints.size();
+}
+
+size_t Checkpoints::memoryUsed() const
+{
+	return d->memoryUsed;
+}
@@ -0,0 +1,109 @@
+/*
+ * Copyright 2017 Zalewa <zalewapl@gmail.com>.
+ *
+ * This file is part of Emuballs.
+ *
+ * Emuballs is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Emuballs is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with Emuballs.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#pragma once
+
+#include "armmachine.hpp"
+#include "dptr_impl.hpp"
+#include "peripherals.hpp"
+#include <cstdint>
+#include <functional>
+
+namespace Emuballs
+{
+
+class InputLog;
+
+/**
+ * Periodic checkpoints of a Machine that allow to move
+ * the execution back in time.
+ *
+ * A checkpoint is the Cpu state, the state of the peripherals and
+ * the memory pages written since the previous checkpoint, so its cost
+ * depends on what the program writes, not on the memory size. When the checkpoints exceed the
+ * memory budget, the oldest ones are merged into the base copy of
+ * the memory. Going back restores the nearest checkpoint and runs
+ * forward to the requested instruction, with the nondeterministic
+ * inputs served from the InputLog history.
+ *
+ * The Machine's dirty pages are used for tracking the writes,
+ * so checkpoints can't be combined with a ForkServer.
+ */
+class Checkpoints
+{
+public:
+	/**
+	 * Takes the first checkpoint at the current state
+	 * and starts the input history.
+	 *
+	 * @param service
+	 *     Called when a run is stopped by Machine::requestStop().
+	 * @param interval
+	 *     Instructions between checkpoints.
+	 * @param memoryBudget
+	 *     Bytes the page deltas may take; the base copy
+	 *     of the memory is not counted.
+	 * @param savePeripherals
+	 *     Called at every checkpoint; the peripherals are put back
+	 *     with what it returns when the checkpoint is restored.
+	 */
+	Checkpoints(Arm::Machine &machine, InputLog &inputs,
+		std::function<void()> service, uint64_t interval, size_t memoryBudget,
+		PeripheralSaver savePeripherals = nullptr);
+	~Checkpoints();
+
+	/**
+	 * Run the Machine, taking the checkpoints as they're due.
+	 * Breakpoints and watchpoints in `stop` end the run;
+	 * requested stops are serviced and the run continues.
+	 */
+	Arm::RunResult run(uint64_t maxInstructions,
+		const Arm::StopConditions &stop = Arm::StopConditions());
+
+	/**
+	 * Move the execution `instructions` back, but not past
+	 * the oldest checkpoint.
+	 *
+	 * @return Instructions actually stepped back.
+	 */
+	uint64_t stepBack(uint64_t instructions);
+	/**
+	 * Move the execution back to the most recent point at which
+	 * the next instruction was at one of the `breakpoints`, or
+	 * to the oldest checkpoint if there's none.
+	 *
+	 * @return true if a breakpoint was found.
+	 */
+	bool runBackToBreakpoint(const Arm::BreakpointMap &breakpoints);
+
+	/**
+	 * Instruction count of the oldest checkpoint;
+	 * the execution can't go back past it.
+	 */
+	uint64_t oldest() const;
+	size_t size() const;
+	/**
+	 * Bytes taken by the page deltas.
+	 */
+	size_t memoryUsed() const;
+
+private:
+	DPtr<Checkpoints> d;
+};
+
+}
@@ -0,0 +1,82 @@
+/*
+ * Copyright 2017 Zalewa <zalewapl@gmail.com>.
+ *
+ * This file is part of Emuballs.
+ *
+ * Emuballs is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Emuballs is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with Emuballs.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#pragma once
+
+#include "emuballs/memory.hpp"
+#include <cstdint>
+#include <stdexcept>
+
+namespace Emuballs
+{
+
+/**
+ * AFL-style edge coverage.
+ *
+ * Entering a basic block bumps a counter in a caller-owned map at
+ * `(hash(previous block) >> 1) ^ hash(block)`, just like the
+ * instrumentation of coverage-guided fuzzers does, so the map can
+ * be shared with them directly. Counters wrap from 255 to 1, never to 0, so a hit edge
+ * stays visible.
+ */
+class EdgeCoverage
+{
+public:
+	/**
+	 * @param size
+	 *     Must be a power of two; AFL uses 65536.
+	 */
+	EdgeCoverage(uint8_t *map, size_t size)
+		: map(map), mask(size - 1)
+	{
+		if (size == 0 || (size & (size - 1)) != 0)
+			throw std::invalid_argument("coverage map size must be a power of two");
+	}
+
+	/**
+	 * Record entering basic block that starts at `address`.
+	 */
+	void enter(memsize address)
+	{
+		uint32_t current = location(address);
+		uint8_t &counter = map[(current ^ previous) & mask];
+		counter = counter == 0xff ? 1 : counter + 1;
+		previous = current >> 1;
+	}
+
+	/**
+	 * Forget the previous location; call before each execution.
+	 */
+	void reset()
+	{
+		previous = 0;
+	}
+
+private:
+	uint8_t *map;
+	size_t mask;
+	uint32_t previous = 0;
+
+	static uint32_t location(memsize address)
+	{
+		uint32_t hash = static_cast<uint32_t>(address >> 2) * 0x9e3779b1u;
+		return hash ^ (hash >> 16);
+	}
+};
+
+}
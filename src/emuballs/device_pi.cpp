@@ -21,9 +21,22 @@
 #include "armmachine.hpp"
 #include "armregisterset.hpp"
 #include "armgpu.hpp"
+#include "checkpoints.hpp"
+#include "forkserver.hpp"
+#include "idleloop.hpp"
+#include "inputlog.hpp"
+#include "interrupts_pi.hpp"
+#include "profiler.hpp"
 #include "programmer_pi.hpp"
+#include "scheduler.hpp"
+#include "smp.hpp"
 #include "timer_pi.hpp"
+#include "trace.hpp"
+#include <chrono>
+#include <fstream>
 #include <memory>
+#include <stdexcept>
+#include <thread>
 
 using namespace Emuballs;
 using namespace Emuballs::Pi;
@@ -37,6 +50,10 @@ PiDef::PiDef()
 	gpuFrameBufferPointerEnd = 0x20000000;
 	gpuMailboxAddress = 0x2000B880;
 	systemTimerAddress = 0x20003000;
+	interruptControllerAddress = 0x2000B200;
+	cores = 1;
+	coreMailboxAddress = 0x4000008c;
+	clockRate = 700000000;
 }
 
 namespace Emuballs
@@ -45,14 +62,125 @@ DClass<PiDevice>
 {
 public:
 	Arm::Machine machine;
+	Scheduler scheduler;
+	InputLog inputs;
 	std::unique_ptr<Arm::Gpu> gpu;
 	std::unique_ptr<Arm::NamedRegisterSet> regs;
+	std::unique_ptr<Pi::InterruptController> interrupts;
 	std::unique_ptr<Pi::Timer> timer;
+	std::ofstream traceFile;
+	std::unique_ptr<TraceRecorder> trace;
+	std::unique_ptr<Profiler> profiler;
+	std::unique_ptr<Checkpoints> checkpoints;
+	std::fstream inputLogFile;
+	std::vector<std::unique_ptr<Arm::Machine>> secondaryCores;
+	std::unique_ptr<Smp> smp;
 	PiDef definition;
+	bool deterministicCores = false;
+	bool fuzzing = false;
+	bool virtualTime = false;
+	uint64_t clockRate = 0;
+	bool idleLoopSkipping = false;
+	std::unique_ptr<IdleLoopSkipper> idleLoopSkipper;
+	/** Skipped by the skippers dropped since reset. */
+	uint64_t skippedBefore = 0;
 
 	PrivData()
+		: scheduler(machine), inputs([this]() { return machine.instructionCount(); })
 	{
 	}
+
+	void requireSingleCore(const std::string &feature)
+	{
+		if (smp != nullptr)
+			throw std::runtime_error(feature + " is not supported on multi-core devices");
+	}
+
+	/**
+	 * Mail handled on the GPU thread is answered after a varying
+	 * amount of instructions, so the GPU stays on the CPU thread
+	 * whenever the run must be reproducible.
+	 */
+	void updateGpuThreading()
+	{
+		if (gpu == nullptr)
+			return;
+		bool reproducible = inputs.isRecording() || inputs.isReplaying()
+			|| checkpoints != nullptr || deterministicCores || fuzzing;
+		gpu->setThreaded(!reproducible);
+	}
+
+	/**
+	 * Peripheral state that isn't in the memory; the GPU must
+	 * not be threaded.
+	 */
+	std::function<void()> savePeripherals()
+	{
+		auto interruptsState = interrupts->state();
+		auto timerState = timer->state();
+		auto gpuState = gpu->state();
+		auto schedulerState = scheduler.state();
+		return [this, interruptsState, timerState, gpuState, schedulerState]() {
+			interrupts->restore(interruptsState);
+			timer->restore(timerState);
+			gpu->restore(gpuState);
+			scheduler.restore(schedulerState);
+		};
+	}
+
+	uint64_t guestClockRate() const
+	{
+		return clockRate != 0 ? clockRate : definition.clockRate;
+	}
+
+	/**
+	 * On the wall clock, the guest waiting for an interrupt
+	 * is let to sleep in real time, sparing the host CPU.
+	 * Otherwise there's no reason for the host to wait.
+	 */
+	void idle(uint64_t instructions)
+	{
+		if (virtualTime || fuzzing || inputs.isReplaying())
+			return;
+		uint64_t rate = guestClockRate();
+		std::this_thread::sleep_for(std::chrono::microseconds(
+				(instructions / rate) * 1000000 + (instructions % rate) * 1000000 / rate));
+	}
+
+	/**
+	 * Fuzzing needs every input to see the same time,
+	 * so it always runs in virtual time.
+	 */
+	void updateTimeSource()
+	{
+		if (virtualTime || fuzzing)
+		{
+			timer->useVirtualTime([this]() { return machine.instructionCount(); },
+				guestClockRate());
+		}
+		else
+		{
+			timer->useWallClock();
+		}
+		updateIdleLoopSkipping();
+	}
+
+	void updateIdleLoopSkipping()
+	{
+		bool enabled = idleLoopSkipping && virtualTime && trace == nullptr
+			&& profiler == nullptr && checkpoints == nullptr && !fuzzing
+			&& smp == nullptr;
+		if (enabled && idleLoopSkipper == nullptr)
+		{
+			idleLoopSkipper.reset(new IdleLoopSkipper(machine, scheduler,
+					definition.systemTimerAddress + 4, 8));
+		}
+		else if (!enabled && idleLoopSkipper != nullptr)
+		{
+			skippedBefore += idleLoopSkipper->skipped();
+			idleLoopSkipper.reset();
+		}
+	}
 };
 
 DPointeredNoCopy(PiDevice);
@@ -61,15 +189,51 @@ DPointeredNoCopy(PiDevice);
 PiDevice::PiDevice(const PiDef &definition)
 {
 	d->definition = definition;
+	if (definition.cores > 1)
+	{
+		Memory &memory = d->machine.untrackedMemory();
+		std::vector<Arm::Machine*> cores = { &d->machine };
+		for (int core = 1; core < definition.cores; ++core)
+		{
+			d->secondaryCores.emplace_back(new Arm::Machine(memory));
+			cores.push_back(d->secondaryCores.back().get());
+		}
+		d->smp.reset(new Smp(cores, [this]() { d->scheduler.dispatch(); }));
+		for (int core = 1; core < definition.cores; ++core)
+		{
+			memsize mailbox = definition.coreMailboxAddress + core * 0x10;
+			memory.observe(mailbox, 4, [this, core](memsize address, Access) {
+					uint32_t start = d->machine.untrackedMemory().word(address & ~3);
+					if (start != 0)
+						d->smp->start(core, start);
+				}, Access::Write);
+		}
+	}
+	d->machine.setIdleHandler([this](uint64_t instructions) { d->idle(instructions); });
 	reset();
 }
 
 void PiDevice::cycle(uint32_t cycles)
 {
-	for (uint32_t i = 0; i < cycles; ++i)
+	if (d->smp != nullptr)
+	{
+		d->smp->run(cycles);
+		return;
+	}
+	// GPU answers the mail on its own; cycling it only
+	// hands over the replies that the CPU didn't poll for.
+	d->gpu->cycle();
+	// Peripherals aren't polled; the run is only interrupted
+	// when one of their events is due.
+	uint64_t remaining = cycles;
+	while (remaining > 0)
 	{
-		d->machine.cycle();
-		d->gpu->cycle();
+		if (d->checkpoints != nullptr)
+		{
+			remaining -= d->checkpoints->run(remaining).executed;
+			continue;
+		}
+		remaining -= d->scheduler.run(remaining).executed;
 	}
 }
 
@@ -78,6 +242,16 @@ void PiDevice::draw(Canvas &canvas)
 	d->gpu->draw(canvas);
 }
 
+uint64_t PiDevice::frameHash()
+{
+	return d->gpu->frameHash();
+}
+
+uint64_t PiDevice::frameHash(int32_t x, int32_t y, int32_t width, int32_t height)
+{
+	return d->gpu->frameHash(x, y, width, height);
+}
+
 Memory &PiDevice::memory()
 {
 	return d->machine.untrackedMemory();
@@ -85,16 +259,39 @@ Memory &PiDevice::memory()
 
 void PiDevice::reset()
 {
+	stopCheckpoints();
+	if (d->smp != nullptr)
+		d->smp->reset();
+	d->idleLoopSkipper.reset();
+	d->skippedBefore = 0;
+	d->scheduler.clear();
 	d->gpu.reset(new Arm::Gpu(d->machine.untrackedMemory()));
 	d->gpu->setFrameBufferPointerEnd(d->definition.gpuFrameBufferPointerEnd);
 	d->gpu->setMailboxAddress(d->definition.gpuMailboxAddress);
+	d->fuzzing = false;
+	d->updateGpuThreading();
+	d->gpu->cycle();
 
+	d->timer.reset();
+	d->interrupts.reset(new Pi::InterruptController(
+			d->machine.untrackedMemory(),
+			d->definition.interruptControllerAddress,
+			[this](bool raised) { d->machine.setIrq(raised); }));
 	d->timer.reset(new Emuballs::Pi::Timer(
 			d->machine.untrackedMemory(),
-			d->definition.systemTimerAddress));
+			d->definition.systemTimerAddress,
+			d->inputs));
+	d->timer->connectCompares(d->scheduler, d->guestClockRate(),
+		[this](int channel, bool raised) {
+			d->interrupts->setLine(InterruptController::SYSTEM_TIMER_MATCH + channel, raised);
+		});
+	d->updateTimeSource();
 
 	d->regs.reset(new Arm::NamedRegisterSet(d->machine));
-	d->machine.cpu().regs().pc(0x8000);
+	// Also wakes the core up if it was waiting for an interrupt.
+	Arm::Cpu cpu = d->machine.cpuSnapshot();
+	cpu.regs().pc(0x8000);
+	d->machine.restoreCpu(cpu, d->machine.instructionCount());
 	setProgrammer(std::shared_ptr<Programmer>(new ProgrammerPi(*this)));
 }
 
@@ -103,6 +300,160 @@ RegisterSet &PiDevice::registers()
 	return *d->regs;
 }
 
+void PiDevice::startTrace(const std::string &path)
+{
+	stopTrace();
+	d->requireSingleCore("tracing");
+	d->traceFile.open(path, std::ios::out | std::ios::binary | std::ios::trunc);
+	if (!d->traceFile.is_open())
+		throw std::runtime_error("cannot open trace file: " + path);
+	d->trace.reset(new TraceRecorder(d->traceFile));
+	d->machine.setTraceRecorder(d->trace.get());
+	d->updateIdleLoopSkipping();
+}
+
+void PiDevice::stopTrace()
+{
+	d->machine.setTraceRecorder(nullptr);
+	d->trace.reset();
+	if (d->traceFile.is_open())
+		d->traceFile.close();
+	d->updateIdleLoopSkipping();
+}
+
+void PiDevice::startRecording(const std::string &path)
+{
+	stopRecordReplay();
+	d->requireSingleCore("input recording");
+	d->inputLogFile.open(path, std::ios::out | std::ios::binary | std::ios::trunc);
+	if (!d->inputLogFile.is_open())
+		throw std::runtime_error("cannot open input log: " + path);
+	d->inputs.record(d->inputLogFile);
+	d->updateGpuThreading();
+}
+
+void PiDevice::startReplay(const std::string &path)
+{
+	stopRecordReplay();
+	d->requireSingleCore("input replay");
+	d->inputLogFile.open(path, std::ios::in | std::ios::binary);
+	if (!d->inputLogFile.is_open())
+		throw std::runtime_error("cannot open input log: " + path);
+	d->inputs.replay(d->inputLogFile);
+	d->updateGpuThreading();
+}
+
+void PiDevice::stopRecordReplay()
+{
+	d->inputs.stop();
+	if (d->inputLogFile.is_open())
+		d->inputLogFile.close();
+	d->updateGpuThreading();
+}
+
+void PiDevice::startProfile(uint32_t samplePeriod)
+{
+	d->profiler.reset(new Profiler(d->machine.nextInstructionAddress(), samplePeriod));
+	d->machine.setProfiler(d->profiler.get());
+	d->updateIdleLoopSkipping();
+}
+
+void PiDevice::stopProfile(std::ostream &callgrind, const SymbolTable &symbols)
+{
+	if (d->profiler == nullptr)
+		return;
+	d->machine.setProfiler(nullptr);
+	d->profiler->writeCallgrind(callgrind, symbols);
+	d->profiler.reset();
+	d->updateIdleLoopSkipping();
+}
+
+std::unique_ptr<Fuzzer> PiDevice::fuzz(const FuzzTarget &target)
+{
+	d->requireSingleCore("fuzzing");
+	stopCheckpoints();
+	d->fuzzing = true;
+	d->updateGpuThreading();
+	d->updateTimeSource();
+	return std::unique_ptr<Fuzzer>(new ForkServer(d->machine, *d->regs,
+			[this]() { d->scheduler.dispatch(); }, target,
+			[this]() { return d->savePeripherals(); }));
+}
+
+void PiDevice::startCheckpoints(uint64_t interval, size_t memoryBudget)
+{
+	stopCheckpoints();
+	d->requireSingleCore("reverse execution");
+	// First checkpoint takes the GPU state already.
+	d->gpu->setThreaded(false);
+	d->checkpoints.reset(new Checkpoints(d->machine, d->inputs,
+			[this]() { d->scheduler.dispatch(); }, interval, memoryBudget,
+			[this]() { return d->savePeripherals(); }));
+	d->updateGpuThreading();
+	d->updateIdleLoopSkipping();
+}
+
+void PiDevice::stopCheckpoints()
+{
+	d->checkpoints.reset();
+	d->updateGpuThreading();
+	d->updateIdleLoopSkipping();
+}
+
+uint64_t PiDevice::stepBack(uint64_t instructions)
+{
+	if (d->checkpoints == nullptr)
+		return 0;
+	return d->checkpoints->stepBack(instructions);
+}
+
+bool PiDevice::runBackToBreakpoint(const std::vector<uint32_t> &breakpoints)
+{
+	if (d->checkpoints == nullptr)
+		return false;
+	Arm::BreakpointMap map;
+	for (uint32_t address : breakpoints)
+		map.insert(address);
+	return d->checkpoints->runBackToBreakpoint(map);
+}
+
+void PiDevice::setCoreScheduling(uint32_t quantum, bool deterministic)
+{
+	if (d->smp == nullptr)
+		return;
+	d->deterministicCores = deterministic;
+	d->updateGpuThreading();
+	d->smp->setQuantum(quantum);
+	d->smp->setInterleaving(deterministic ?
+		Smp::Interleaving::Deterministic : Smp::Interleaving::Threaded);
+}
+
+void PiDevice::setVirtualTime(bool enabled, uint64_t clockRate)
+{
+	d->virtualTime = enabled;
+	d->clockRate = clockRate;
+	d->updateTimeSource();
+}
+
+uint64_t PiDevice::guestTime()
+{
+	return d->timer->now();
+}
+
+void PiDevice::setIdleLoopSkipping(bool enabled)
+{
+	d->idleLoopSkipping = enabled;
+	d->updateIdleLoopSkipping();
+}
+
+uint64_t PiDevice::skippedInstructions()
+{
+	uint64_t skipped = d->skippedBefore;
+	if (d->idleLoopSkipper != nullptr)
+		skipped += d->idleLoopSkipper->skipped();
+	return skipped;
+}
+
 ///////////////////////////////////////////////////////////////////////////
 
 std::list<DeviceFactory> Emuballs::Pi::listPiDevices()
@@ -131,7 +482,12 @@ std::list<DeviceFactory> Emuballs::Pi::listPiDevices()
 		def.actLedGpio = 47;
 		def.ledOnIfPullDown = false;
 		def.gpioAddress = 0x3f200000;
+		def.gpuFrameBufferPointerEnd = 0x3f000000;
 		def.gpuMailboxAddress = 0x3f00b880;
+		def.systemTimerAddress = 0x3f003000;
+		def.interruptControllerAddress = 0x3f00b200;
+		def.cores = 4;
+		def.clockRate = 900000000;
 		return DevicePtr(new PiDevice(def));
 	};
 
@@ -37,6 +37,16 @@ struct PiDef
 	uint32_t gpuFrameBufferPointerEnd;
 	uint32_t gpuMailboxAddress;
 	uint32_t systemTimerAddress;
+	uint32_t interruptControllerAddress;
+	int cores;
+	/**
+	 * Mailbox through which the boot core starts the others;
+	 * core N starts at the address written to
+	 * `coreMailboxAddress + N * 0x10`.
+	 */
+	uint32_t coreMailboxAddress;
+	/** Hz; used in virtual time. */
+	uint64_t clockRate;
 
 	PiDef();
 };
@@ -48,9 +58,28 @@ public:
 
 	void cycle(uint32_t cycles) override;
 	void draw(Canvas &canvas) override;
+	uint64_t frameHash() override;
+	uint64_t frameHash(int32_t x, int32_t y, int32_t width, int32_t height) override;
 	Memory &memory() override;
 	void reset() override;
 	RegisterSet &registers() override;
+	void startTrace(const std::string &path) override;
+	void stopTrace() override;
+	void startRecording(const std::string &path) override;
+	void startReplay(const std::string &path) override;
+	void stopRecordReplay() override;
+	void startProfile(uint32_t samplePeriod) override;
+	void stopProfile(std::ostream &callgrind, const SymbolTable &symbols) override;
+	std::unique_ptr<Fuzzer> fuzz(const FuzzTarget &target) override;
+	void startCheckpoints(uint64_t interval, size_t memoryBudget) override;
+	void stopCheckpoints() override;
+	uint64_t stepBack(uint64_t instructions) override;
+	bool runBackToBreakpoint(const std::vector<uint32_t> &breakpoints) override;
+	void setCoreScheduling(uint32_t quantum, bool deterministic) override;
+	void setVirtualTime(bool enabled, uint64_t clockRate) override;
+	uint64_t guestTime() override;
+	void setIdleLoopSkipping(bool enabled) override;
+	uint64_t skippedInstructions() override;
 
 private:
 	DPtr<PiDevice> d;
@@ -0,0 +1,180 @@
+/*
+ * Copyright 2017 Zalewa <zalewapl@gmail.com>.
+ *
+ * This file is part of Emuballs.
+ *
+ * Emuballs is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Emuballs is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with Emuballs.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include "forkserver.hpp"
+
+#include "emuballs/registerset.hpp"
+#include "emuballs/regval.hpp"
+#include "armmachine.hpp"
+#include "coverage.hpp"
+
+#include <algorithm>
+#include <memory>
+#include <sstream>
+#include <stdexcept>
+
+using namespace Emuballs;
+
+namespace
+{
+std::string hex(memsize value)
+{
+	std::stringstream ss;
+	ss << "0x" << std::hex << value;
+	return ss.str();
+}
+}
+
+namespace Emuballs
+{
+DClass<ForkServer>
+{
+public:
+	Arm::Machine *machine;
+	RegisterSet *regs;
+	std::function<void()> service;
+	FuzzTarget target;
+	Arm::Machine snapshot;
+	std::function<void()> restorePeripherals;
+	bool waiting = false;
+	std::unique_ptr<EdgeCoverage> coverage;
+	Arm::StopConditions stop;
+
+	/**
+	 * Run until a breakpoint in `stop`, or until budget runs out.
+	 */
+	Arm::RunResult run(uint64_t budget)
+	{
+		uint64_t executed = 0;
+		while (executed < budget)
+		{
+			Arm::RunResult result = machine->run(budget - executed, stop);
+			executed += result.executed;
+			if (result.reason == Arm::StopReason::Requested)
+				service();
+			else if (result.reason != Arm::StopReason::Budget)
+				return Arm::RunResult { result.reason, executed };
+		}
+		return Arm::RunResult { Arm::StopReason::Budget, executed };
+	}
+};
+
+DPointeredNoCopy(ForkServer);
+}
+
+Fuzzer::~Fuzzer()
+{
+}
+
+ForkServer::ForkServer(Arm::Machine &machine, RegisterSet &regs,
+	std::function<void()> service, const FuzzTarget &target,
+	PeripheralSaver savePeripherals)
+{
+	d->machine = &machine;
+	d->regs = &regs;
+	d->service = service;
+	d->target = target;
+
+	if (machine.nextInstructionAddress() != target.snapshotAddress)
+	{
+		d->stop.breakpoints.insert(target.snapshotAddress);
+		Arm::RunResult result = d->run(target.warmupBudget);
+		if (result.reason != Arm::StopReason::Breakpoint
+			|| machine.nextInstructionAddress() != target.snapshotAddress)
+		{
+			std::stringstream ss;
+			ss << "fuzz snapshot address 0x" << std::hex << target.snapshotAddress
+				<< " not reached";
+			throw std::runtime_error(ss.str());
+		}
+	}
+	machine.untrackedMemory().clearDirtyPages();
+	d->snapshot = machine;
+	if (savePeripherals)
+		d->restorePeripherals = savePeripherals();
+	d->waiting = machine.isWaitingForInterrupt();
+	d->stop.breakpoints.clear();
+	d->stop.breakpoints.insert(target.returnAddress);
+}
+
+ForkServer::~ForkServer()
+{
+	d->machine->setCoverage(nullptr);
+}
+
+void ForkServer::setCoverageMap(uint8_t *map, size_t size)
+{
+	d->machine->setCoverage(nullptr);
+	d->coverage.reset(map != nullptr ? new EdgeCoverage(map, size) : nullptr);
+	d->machine->setCoverage(d->coverage.get());
+}
+
+FuzzResult ForkServer::run(const uint8_t *input, size_t length)
+{
+	const FuzzTarget &target = d->target;
+	d->machine->restore(d->snapshot);
+	if (d->restorePeripherals)
+		d->restorePeripherals();
+	// After the peripherals, as they drive the IRQ line.
+	if (d->waiting)
+		d->machine->waitForInterrupt();
+	if (d->coverage != nullptr)
+		d->coverage->reset();
+
+	length = std::min<size_t>(length, target.inputCapacity);
+	d->machine->untrackedMemory().putChunk(target.inputAddress, input, length);
+	if (!target.inputLengthRegister.empty())
+		d->regs->setReg(target.inputLengthRegister, static_cast<uint32_t>(length));
+	if (!target.inputAddressRegister.empty())
+		d->regs->setReg(target.inputAddressRegister, target.inputAddress);
+
+	FuzzResult result { FuzzOutcome::Returned, 0, std::string() };
+	try
+	{
+		Arm::RunResult run = d->run(target.budget);
+		result.executed = run.executed;
+		switch (run.reason)
+		{
+		case Arm::StopReason::Budget:
+			result.outcome = FuzzOutcome::Hang;
+			break;
+		case Arm::StopReason::Breakpoint:
+			if (d->machine->nextInstructionAddress() != target.returnAddress)
+			{
+				result.outcome = FuzzOutcome::Stopped;
+				result.error = "breakpoint at " + hex(d->machine->nextInstructionAddress());
+			}
+			break;
+		case Arm::StopReason::Watchpoint:
+			result.outcome = FuzzOutcome::Stopped;
+			result.error = "watchpoint hit at " + hex(d->machine->lastWatchpointHit().address);
+			break;
+		default:
+			result.outcome = FuzzOutcome::Stopped;
+			result.error = "stopped at " + hex(d->machine->nextInstructionAddress());
+			break;
+		}
+	}
+	catch (const std::exception &e)
+	{
+		result.outcome = FuzzOutcome::Crash;
+		result.error = e.what();
+		result.executed = d->machine->instructionCount() - d->snapshot.instructionCount();
+	}
+	return result;
+}
@@ -0,0 +1,68 @@
+/*
+ * Copyright 2017 Zalewa <zalewapl@gmail.com>.
+ *
+ * This file is part of Emuballs.
+ *
+ * Emuballs is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Emuballs is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with Emuballs.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#pragma once
+
+#include "emuballs/fuzz.hpp"
+#include "dptr_impl.hpp"
+#include "peripherals.hpp"
+#include <functional>
+
+namespace Emuballs
+{
+
+class RegisterSet;
+
+namespace Arm
+{
+class Machine;
+}
+
+/**
+ * Fuzzer working directly on a Machine.
+ */
+class ForkServer : public Fuzzer
+{
+public:
+	/**
+	 * Runs `machine` until the snapshot address and takes
+	 * the snapshot. `machine` and `regs` are used by the ForkServer
+	 * for as long as it exists.
+	 *
+	 * @param service
+	 *     Called when a run is stopped by Machine::requestStop(),
+	 *     for the peripherals to do their job.
+	 * @param savePeripherals
+	 *     Called along with the snapshot; the peripherals are put
+	 *     back with what it returns before every input.
+	 * @throw std::runtime_error if the snapshot address
+	 *        is not reached within the warmup budget.
+	 */
+	ForkServer(Arm::Machine &machine, RegisterSet &regs,
+		std::function<void()> service, const FuzzTarget &target,
+		PeripheralSaver savePeripherals = nullptr);
+	~ForkServer();
+
+	void setCoverageMap(uint8_t *map, size_t size) override;
+	FuzzResult run(const uint8_t *input, size_t length) override;
+
+private:
+	DPtr<ForkServer> d;
+};
+
+}
@@ -0,0 +1,107 @@
+/*
+ * Copyright 2017 Zalewa <zalewapl@gmail.com>.
+ *
+ * This file is part of Emuballs.
+ *
+ * Emuballs is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Emuballs is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with Emuballs.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+
+namespace Emuballs
+{
+
+/**
+ * Streaming 64-bit hash of frame buffer contents; fast, not
+ * cryptographic.
+ *
+ * Input is taken 8 bytes at a time as little-endian words, so the
+ * digest is the same on all hosts and doesn't depend on how the
+ * input is split between the update() calls. Digests are compared
+ * against stored golden values, so the algorithm must not change.
+ */
+class FrameHash
+{
+public:
+	explicit FrameHash(uint64_t seed = 0)
+		: state(seed ^ 0x9e3779b97f4a7c15ull)
+	{
+	}
+
+	void update(const uint8_t *bytes, size_t length)
+	{
+		total += length;
+		if (tailSize > 0)
+		{
+			size_t count = length < 8 - tailSize ? length : 8 - tailSize;
+			std::memcpy(tail + tailSize, bytes, count);
+			tailSize += count;
+			bytes += count;
+			length -= count;
+			if (tailSize < 8)
+				return;
+			mix(load(tail));
+			tailSize = 0;
+		}
+		for (; length >= 8; bytes += 8, length -= 8)
+			mix(load(bytes));
+		std::memcpy(tail, bytes, length);
+		tailSize = length;
+	}
+
+	uint64_t digest() const
+	{
+		FrameHash last = *this;
+		if (tailSize > 0)
+		{
+			std::memset(last.tail + tailSize, 0, 8 - tailSize);
+			last.mix(load(last.tail));
+		}
+		uint64_t hash = last.state ^ total;
+		hash ^= hash >> 30;
+		hash *= 0xbf58476d1ce4e5b9ull;
+		hash ^= hash >> 27;
+		hash *= 0x94d049bb133111ebull;
+		hash ^= hash >> 31;
+		return hash;
+	}
+
+private:
+	uint64_t state;
+	uint64_t total = 0;
+	uint8_t tail[8];
+	size_t tailSize = 0;
+
+	static uint64_t load(const uint8_t *bytes)
+	{
+		#ifdef EMUBALLS_BIG_ENDIAN
+		#error("big endian not supported")
+		#endif
+		uint64_t word;
+		std::memcpy(&word, bytes, sizeof(word));
+		return word;
+	}
+
+	void mix(uint64_t word)
+	{
+		word *= 0xbf58476d1ce4e5b9ull;
+		word ^= word >> 31;
+		state = ((state ^ word) << 27 | (state ^ word) >> 37) * 0x94d049bb133111ebull;
+	}
+};
+
+}
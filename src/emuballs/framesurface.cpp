@@ -0,0 +1,108 @@
+/*
+ * Copyright 2017 Zalewa <zalewapl@gmail.com>.
+ *
+ * This file is part of Emuballs.
+ *
+ * Emuballs is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Emuballs is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with Emuballs.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include "emuballs/framesurface.hpp"
+
+#include "emuballs/color.hpp"
+#include "dptr_impl.hpp"
+#include <algorithm>
+#include <array>
+#include <atomic>
+
+namespace Emuballs
+{
+
+DClass<FrameSurface>
+{
+public:
+	/// Marks the middle frame as not taken by the reader yet.
+	static constexpr uint8_t FRESH = 0x80;
+
+	std::array<FrameSurface::Frame, 3> frames;
+	std::array<Canvas::DrawnFrame, 3> drawn;
+	uint64_t published = 0;
+
+	/// Frame being drawn; drawing thread only.
+	uint8_t back = 0;
+	/// Last published frame, possibly FRESH.
+	std::atomic<uint8_t> middle{1};
+	/// Frame the reader holds; reading thread only.
+	uint8_t front = 2;
+
+	FrameSurface::Frame &backFrame()
+	{
+		return frames[back];
+	}
+};
+
+DPointeredNoCopy(FrameSurface);
+
+FrameSurface::FrameSurface() {}
+FrameSurface::~FrameSurface() {}
+
+void FrameSurface::begin()
+{
+}
+
+void FrameSurface::end()
+{
+	d->drawn[d->back] = drawnFrame();
+	d->backFrame().sequence = ++d->published;
+	// Release the drawn frame and acquire the one the reader is
+	// done with, if it took one since, or the unread one otherwise.
+	d->back = d->middle.exchange(d->back | PrivData<FrameSurface>::FRESH,
+		std::memory_order_acq_rel) & ~PrivData<FrameSurface>::FRESH;
+	// The next draw brings this frame up to date.
+	setDrawnFrame(d->drawn[d->back]);
+}
+
+void FrameSurface::drawRow(int32_t x, int32_t y, int32_t width, const uint32_t *rgb32)
+{
+	Frame &frame = d->backFrame();
+	std::copy(rgb32, rgb32 + width,
+		frame.pixels.begin() + static_cast<size_t>(y) * frame.width + x);
+}
+
+void FrameSurface::drawPixel(int32_t x, int32_t y, const Color &color)
+{
+	Frame &frame = d->backFrame();
+	frame.pixels[static_cast<size_t>(y) * frame.width + x] = 0xff000000 |
+		static_cast<uint32_t>(color.r) << 16 |
+		static_cast<uint32_t>(color.g) << 8 |
+		static_cast<uint32_t>(color.b);
+}
+
+void FrameSurface::changeSize(int32_t width, int32_t height, BitDepth)
+{
+	Frame &frame = d->backFrame();
+	frame.width = width;
+	frame.height = height;
+	frame.pixels.assign(static_cast<size_t>(width) * height, 0xff000000);
+}
+
+const FrameSurface::Frame &FrameSurface::latest()
+{
+	if (d->middle.load(std::memory_order_relaxed) & PrivData<FrameSurface>::FRESH)
+	{
+		d->front = d->middle.exchange(d->front, std::memory_order_acq_rel);
+		d->front &= ~PrivData<FrameSurface>::FRESH;
+	}
+	return d->frames[d->front];
+}
+
+}
@@ -0,0 +1,266 @@
+/*
+ * Copyright 2017 Zalewa <zalewapl@gmail.com>.
+ *
+ * This file is part of Emuballs.
+ *
+ * Emuballs is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Emuballs is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with Emuballs.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include "idleloop.hpp"
+
+#include "armmachine.hpp"
+#include "scheduler.hpp"
+#include <algorithm>
+#include <set>
+#include <unordered_map>
+
+using namespace Emuballs;
+
+const uint64_t IdleLoopSkipper::MAX_LOOP_LENGTH;
+const uint64_t IdleLoopSkipper::MAX_SKIP;
+
+namespace Emuballs
+{
+/**
+ * Instruction that keeps reading the counter.
+ */
+struct CounterReadSite
+{
+	uint64_t lastRead = 0;
+	uint64_t period = 0;
+	int repeats = 0;
+};
+
+DClass<IdleLoopSkipper>
+{
+public:
+	/** Loop must read the counter the same way this many times. */
+	static const int MIN_REPEATS = 3;
+
+	Arm::Machine *machine;
+	Scheduler *scheduler;
+	memsize counterAddress;
+	memsize counterLength;
+	memobserver_id observerId = Memory::NO_OBSERVER;
+	Scheduler::event_id pending = Scheduler::NO_EVENT;
+	std::unordered_map<memsize, CounterReadSite> sites;
+	/** Loops that turned out not to be idle. */
+	std::set<memsize> rejected;
+	bool trying = false;
+	uint64_t skipped = 0;
+
+	void counterRead()
+	{
+		if (trying)
+			return;
+		uint64_t now = machine->instructionCount();
+		memsize address = machine->nextInstructionAddress();
+		CounterReadSite &site = sites[address];
+		uint64_t period = now - site.lastRead;
+		if (period == site.period && period > 0 && period <= IdleLoopSkipper::MAX_LOOP_LENGTH)
+		{
+			if (++site.repeats == MIN_REPEATS && rejected.count(address) == 0
+				&& pending == Scheduler::NO_EVENT)
+			{
+				pending = scheduler->post([this, period]() {
+						pending = Scheduler::NO_EVENT;
+						skip(period);
+					});
+			}
+		}
+		else
+		{
+			site.repeats = 0;
+		}
+		site.lastRead = now;
+		site.period = period;
+		if (sites.size() > 64)
+			sites.clear();
+	}
+
+	/**
+	 * Only instructions that can be undone by restoring the Cpu are
+	 * tried: data processing that doesn't write pc, loads of the
+	 * counter with immediate offset and no writeback, and branches
+	 * without link. Encodings are checked directly, as the opcodes
+	 * don't tell what they touch.
+	 */
+	bool isRevertible(memsize address) const
+	{
+		const Memory &memory = machine->untrackedMemory();
+		const Arm::RegisterSet &regs = machine->cpu().regs();
+		uint32_t code = memory.word(address);
+		if ((code >> 28) == 0xf)
+			return false;
+		uint32_t rd = (code >> 12) & 0xf;
+		uint32_t rn = (code >> 16) & 0xf;
+		switch ((code >> 25) & 0b111)
+		{
+		case 0b000:
+			// Multiplies, swaps and the extra loads and stores.
+			if ((code & 0x90) == 0x90)
+				return false;
+			// PSR transfers and BX.
+			if ((code & 0x01900000) == 0x01000000)
+				return false;
+			return rd != 15;
+		case 0b001:
+			if ((code & 0x01900000) == 0x01000000)
+				return false;
+			return rd != 15;
+		case 0b010:
+		{
+			bool load = (code & (1 << 20)) != 0;
+			bool preIndexed = (code & (1 << 24)) != 0;
+			bool writeback = (code & (1 << 21)) != 0;
+			if (!load || !preIndexed || writeback || rd == 15 || rn == 15)
+				return false;
+			uint32_t offset = code & 0xfff;
+			uint32_t base = regs[rn];
+			memsize target = (code & (1 << 23)) ? base + offset : base - offset;
+			return target >= counterAddress && target < counterAddress + counterLength;
+		}
+		case 0b101:
+			return (code & (1 << 24)) == 0;
+		default:
+			return false;
+		}
+	}
+
+	/**
+	 * Run one iteration on trial, starting with `cpu` at
+	 * `instructionCount`.
+	 *
+	 * @return true if it came back to where it started.
+	 */
+	bool tryIteration(const Arm::Cpu &cpu, uint64_t instructionCount,
+		uint64_t period, Arm::Cpu *result = nullptr)
+	{
+		machine->restoreCpu(cpu, instructionCount);
+		memsize start = machine->nextInstructionAddress();
+		for (uint64_t i = 0; i < period; ++i)
+		{
+			if (!isRevertible(machine->nextInstructionAddress()))
+				return false;
+			machine->cycle();
+		}
+		if (result != nullptr)
+			*result = machine->cpuSnapshot();
+		return machine->nextInstructionAddress() == start;
+	}
+
+	/**
+	 * Would the loop still go on if `iterations` were skipped?
+	 * The iteration right after the skip decides on the counter
+	 * read before the skip, so it's the one after that which tells.
+	 */
+	bool staysAfterSkipping(const Arm::Cpu &start, uint64_t now,
+		uint64_t period, uint64_t iterations)
+	{
+		Arm::Cpu next;
+		uint64_t skipped = now + iterations * period;
+		return tryIteration(start, skipped, period, &next)
+			&& tryIteration(next, skipped + period, period);
+	}
+
+	static bool sameState(const Arm::Cpu &a, const Arm::Cpu &b)
+	{
+		for (int reg = 0; reg < Arm::NUM_CPU_REGS; ++reg)
+		{
+			if (a.regs()[reg] != b.regs()[reg])
+				return false;
+		}
+		return a.flags().dump() == b.flags().dump();
+	}
+
+	void skip(uint64_t period)
+	{
+		const Arm::Cpu start = machine->cpuSnapshot();
+		const uint64_t now = machine->instructionCount();
+		memsize address = machine->nextInstructionAddress();
+		uint64_t limit = std::min(IdleLoopSkipper::MAX_SKIP, scheduler->nextEvent() - now);
+		uint64_t maxIterations = limit / period;
+		// Interrupt would be taken in the middle of the trials.
+		if (maxIterations == 0 || machine->isIrqRaised())
+			return;
+
+		trying = true;
+		// Running the iteration twice at the same time must end
+		// the same, or else it carries some state along.
+		Arm::Cpu once, twice;
+		bool idle = tryIteration(start, now, period, &once)
+			&& tryIteration(once, now, period, &twice)
+			&& sameState(once, twice);
+		uint64_t iterations = 0;
+		if (idle)
+		{
+			// Find the first iteration that leaves the loop;
+			// the ones before it stay.
+			uint64_t stays = 0;
+			uint64_t leaves = 1;
+			while (leaves < maxIterations && staysAfterSkipping(start, now, period, leaves))
+			{
+				stays = leaves;
+				leaves = std::min(leaves * 2, maxIterations);
+			}
+			if (leaves == maxIterations && staysAfterSkipping(start, now, period, leaves))
+				stays = leaves;
+			else
+			{
+				while (leaves - stays > 1)
+				{
+					uint64_t middle = stays + (leaves - stays) / 2;
+					if (staysAfterSkipping(start, now, period, middle))
+						stays = middle;
+					else
+						leaves = middle;
+				}
+			}
+			iterations = stays;
+		}
+		else
+		{
+			rejected.insert(address);
+		}
+		trying = false;
+
+		machine->restoreCpu(start, now + iterations * period);
+		skipped += iterations * period;
+	}
+};
+
+DPointeredNoCopy(IdleLoopSkipper);
+}
+
+IdleLoopSkipper::IdleLoopSkipper(Arm::Machine &machine, Scheduler &scheduler,
+	memsize counterAddress, memsize counterLength)
+{
+	d->machine = &machine;
+	d->scheduler = &scheduler;
+	d->counterAddress = counterAddress;
+	d->counterLength = counterLength;
+	d->observerId = machine.untrackedMemory().observe(counterAddress, counterLength,
+		[this](memsize, Access) { d->counterRead(); }, Access::PreRead);
+}
+
+IdleLoopSkipper::~IdleLoopSkipper()
+{
+	if (d->pending != Scheduler::NO_EVENT)
+		d->scheduler->cancel(d->pending);
+	d->machine->untrackedMemory().unobserve(d->observerId);
+}
+
+uint64_t IdleLoopSkipper::skipped() const
+{
+	return d->skipped;
+}
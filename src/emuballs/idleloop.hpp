@@ -0,0 +1,74 @@
+/*
+ * Copyright 2017 Zalewa <zalewapl@gmail.com>.
+ *
+ * This file is part of Emuballs.
+ *
+ * Emuballs is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Emuballs is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with Emuballs.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#pragma once
+
+#include "emuballs/memory.hpp"
+#include "dptr_impl.hpp"
+#include <cstdint>
+
+namespace Emuballs
+{
+
+class Scheduler;
+
+namespace Arm
+{
+class Machine;
+}
+
+/**
+ * Fast-forwards busy-waits on a timer counter that is computed
+ * from the instruction count, as in the virtual time of Pi::Timer.
+ *
+ * A loop is suspected when the same instruction keeps reading the
+ * counter every few instructions. It is then run on trial, without
+ * keeping the results, to confirm that it only reads the counter
+ * and computes in registers, and that it carries no state from
+ * one iteration to the next other than what it reads from the
+ * counter. The iterations that wouldn't leave the loop are skipped
+ * by moving the instruction count forward, up to the next event of
+ * the Scheduler. Execution then goes on as if they had run.
+ *
+ * Trial runs go through the Machine, so it must not be traced,
+ * profiled or covered while this is in use.
+ */
+class IdleLoopSkipper
+{
+public:
+	/** Longest loop that is considered, in instructions. */
+	static const uint64_t MAX_LOOP_LENGTH = 16;
+	/** Most instructions skipped at once. */
+	static const uint64_t MAX_SKIP = 1ull << 36;
+
+	IdleLoopSkipper(Arm::Machine &machine, Scheduler &scheduler,
+		memsize counterAddress, memsize counterLength);
+	IdleLoopSkipper(const IdleLoopSkipper &other) = delete;
+	IdleLoopSkipper &operator=(const IdleLoopSkipper &other) = delete;
+	~IdleLoopSkipper();
+
+	/**
+	 * Instructions that were skipped instead of being executed.
+	 */
+	uint64_t skipped() const;
+
+private:
+	DPtr<IdleLoopSkipper> d;
+};
+
+}
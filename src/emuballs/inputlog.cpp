@@ -0,0 +1,294 @@
+/*
+ * Copyright 2017 Zalewa <zalewapl@gmail.com>.
+ *
+ * This file is part of Emuballs.
+ *
+ * Emuballs is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Emuballs is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with Emuballs.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include "inputlog.hpp"
+
+#include "emuballs/errors.hpp"
+
+#include <algorithm>
+#include <cstring>
+#include <deque>
+#include <map>
+#include <sstream>
+
+using namespace Emuballs;
+
+namespace
+{
+/*
+ * Log layout:
+ *
+ * Header:
+ *   char[8] magic "EMUINPUT"
+ *   u8      version
+ *
+ * Event:
+ *   varint  instructions retired since the previous event
+ *   u8      InputSource
+ *   varint  zigzag of the difference to the previous
+ *           value from the same source
+ */
+const char MAGIC[8] = {'E', 'M', 'U', 'I', 'N', 'P', 'U', 'T'};
+const uint8_t VERSION = 1;
+
+void putVarint(std::ostream &out, uint64_t value)
+{
+	while (value >= 0x80)
+	{
+		out.put(static_cast<char>((value & 0x7f) | 0x80));
+		value >>= 7;
+	}
+	out.put(static_cast<char>(value));
+}
+
+bool getVarint(std::istream &in, uint64_t &value)
+{
+	value = 0;
+	for (int shift = 0; shift < 64; shift += 7)
+	{
+		int byte = in.get();
+		if (byte == std::char_traits<char>::eof())
+			return false;
+		value |= static_cast<uint64_t>(byte & 0x7f) << shift;
+		if ((byte & 0x80) == 0)
+			return true;
+	}
+	throw ReplayError("input log is corrupt");
+}
+
+uint64_t zigzag(int64_t value)
+{
+	return (static_cast<uint64_t>(value) << 1) ^ static_cast<uint64_t>(value >> 63);
+}
+
+int64_t unzigzag(uint64_t value)
+{
+	return static_cast<int64_t>(value >> 1) ^ -static_cast<int64_t>(value & 1);
+}
+}
+
+namespace Emuballs
+{
+DClass<InputLog>
+{
+public:
+	enum class Mode
+	{
+		Live,
+		Record,
+		Replay
+	};
+
+	std::function<uint64_t()> instructionCounter;
+	Mode mode = Mode::Live;
+	std::ostream *output = nullptr;
+	std::istream *input = nullptr;
+	uint64_t lastInstructions = 0;
+	std::map<InputSource, uint64_t> lastValues;
+
+	struct HistoryEvent
+	{
+		uint64_t instructions;
+		InputSource source;
+		uint64_t value;
+	};
+	bool keepHistory = false;
+	std::deque<HistoryEvent> history;
+	/**
+	 * Next event to be served from the history after a rewind;
+	 * history.size() when running past the history end.
+	 */
+	size_t historyCursor = 0;
+
+	void start(Mode mode)
+	{
+		this->mode = mode;
+		lastInstructions = instructionCounter();
+		lastValues.clear();
+	}
+
+	void record(InputSource source, uint64_t value)
+	{
+		uint64_t instructions = instructionCounter();
+		uint64_t &lastValue = lastValues[source];
+		putVarint(*output, instructions - lastInstructions);
+		output->put(static_cast<char>(source));
+		putVarint(*output, zigzag(value - lastValue));
+		lastInstructions = instructions;
+		lastValue = value;
+	}
+
+	uint64_t replay(InputSource source)
+	{
+		uint64_t instructions = instructionCounter();
+		uint64_t instructionsDelta;
+		if (!getVarint(*input, instructionsDelta))
+		{
+			throw ReplayError("input log ended; instruction "
+				+ std::to_string(instructions));
+		}
+		int loggedSource = input->get();
+		uint64_t valueDelta;
+		if (loggedSource == std::char_traits<char>::eof() || !getVarint(*input, valueDelta))
+			throw ReplayError("input log is truncated");
+
+		uint64_t loggedInstructions = lastInstructions + instructionsDelta;
+		if (loggedInstructions != instructions
+			|| loggedSource != static_cast<int>(source))
+		{
+			std::stringstream ss;
+			ss << "replay diverged; input " << static_cast<int>(source)
+				<< " taken at instruction " << instructions
+				<< " but logged input " << loggedSource
+				<< " was taken at instruction " << loggedInstructions;
+			throw ReplayError(ss.str());
+		}
+		uint64_t &lastValue = lastValues[source];
+		lastValue += unzigzag(valueDelta);
+		lastInstructions = instructions;
+		return lastValue;
+	}
+};
+
+DPointeredNoCopy(InputLog);
+}
+
+InputLog::InputLog(std::function<uint64_t()> instructionCounter)
+{
+	d->instructionCounter = instructionCounter;
+}
+
+InputLog::~InputLog()
+{
+	stop();
+}
+
+void InputLog::record(std::ostream &output)
+{
+	stop();
+	output.write(MAGIC, sizeof(MAGIC));
+	output.put(static_cast<char>(VERSION));
+	d->output = &output;
+	d->start(PrivData<InputLog>::Mode::Record);
+}
+
+void InputLog::replay(std::istream &input)
+{
+	stop();
+	char magic[sizeof(MAGIC)];
+	input.read(magic, sizeof(magic));
+	if (input.gcount() != sizeof(magic) || std::memcmp(magic, MAGIC, sizeof(MAGIC)) != 0)
+		throw ReplayError("not an input log");
+	int version = input.get();
+	if (version != VERSION)
+		throw ReplayError("unsupported input log version " + std::to_string(version));
+	d->input = &input;
+	d->start(PrivData<InputLog>::Mode::Replay);
+}
+
+void InputLog::stop()
+{
+	if (d->output != nullptr)
+		d->output->flush();
+	d->output = nullptr;
+	d->input = nullptr;
+	d->mode = PrivData<InputLog>::Mode::Live;
+}
+
+bool InputLog::isRecording() const
+{
+	return d->mode == PrivData<InputLog>::Mode::Record;
+}
+
+bool InputLog::isReplaying() const
+{
+	return d->mode == PrivData<InputLog>::Mode::Replay;
+}
+
+void InputLog::startHistory()
+{
+	d->keepHistory = true;
+}
+
+void InputLog::stopHistory()
+{
+	d->keepHistory = false;
+	d->history.clear();
+	d->historyCursor = 0;
+}
+
+void InputLog::rewind(uint64_t instructions)
+{
+	auto &history = d->history;
+	d->historyCursor = std::lower_bound(history.begin(), history.end(), instructions,
+		[](const PrivData<InputLog>::HistoryEvent &event, uint64_t instructions) {
+			return event.instructions < instructions;
+		}) - history.begin();
+}
+
+void InputLog::forget(uint64_t instructions)
+{
+	auto &history = d->history;
+	while (!history.empty() && history.front().instructions < instructions
+		&& d->historyCursor > 0)
+	{
+		history.pop_front();
+		--d->historyCursor;
+	}
+}
+
+size_t InputLog::historySize() const
+{
+	return d->history.size();
+}
+
+uint64_t InputLog::input(InputSource source, uint64_t live)
+{
+	auto &history = d->history;
+	if (d->historyCursor < history.size())
+	{
+		const auto &event = history[d->historyCursor];
+		if (event.instructions == d->instructionCounter() && event.source == source)
+		{
+			++d->historyCursor;
+			return event.value;
+		}
+		// Rewound run went a different way; the rest
+		// of the history is no longer its future.
+		history.erase(history.begin() + d->historyCursor, history.end());
+	}
+
+	uint64_t value = live;
+	switch (d->mode)
+	{
+	case PrivData<InputLog>::Mode::Record:
+		d->record(source, live);
+		break;
+	case PrivData<InputLog>::Mode::Replay:
+		value = d->replay(source);
+		break;
+	default:
+		break;
+	}
+	if (d->keepHistory)
+	{
+		history.push_back({ d->instructionCounter(), source, value });
+		d->historyCursor = history.size();
+	}
+	return value;
+}
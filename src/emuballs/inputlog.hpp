@@ -0,0 +1,113 @@
+/*
+ * Copyright 2017 Zalewa <zalewapl@gmail.com>.
+ *
+ * This file is part of Emuballs.
+ *
+ * Emuballs is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Emuballs is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with Emuballs.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#pragma once
+
+#include "dptr_impl.hpp"
+#include <cstdint>
+#include <functional>
+#include <istream>
+#include <ostream>
+
+namespace Emuballs
+{
+
+/**
+ * Peripherals that feed nondeterministic inputs
+ * into the emulation.
+ */
+enum class InputSource : uint8_t
+{
+	SystemTimer = 1,
+};
+
+/**
+ * Funnel for all nondeterministic inputs, making runs reproducible.
+ *
+ * Peripherals pass each input they take from the host through
+ * input(). In record mode the inputs are logged along with the
+ * instruction count at which they were taken. In replay mode the
+ * logged inputs are returned instead of the host ones, and the
+ * instruction counts and sources are verified, so that divergence
+ * is caught as soon as it happens.
+ *
+ * Log is a stream of small varint-encoded deltas.
+ *
+ * Independently of the mode, inputs can be kept in a history,
+ * which lets execution be rewound and run again with the same
+ * inputs.
+ */
+class InputLog
+{
+public:
+	/**
+	 * @param instructionCounter
+	 *     Returns the amount of instructions retired so far.
+	 */
+	InputLog(std::function<uint64_t()> instructionCounter);
+	~InputLog();
+
+	/**
+	 * Start logging into `output`, which must outlive the recording.
+	 */
+	void record(std::ostream &output);
+	/**
+	 * Start replaying from `input`, which must outlive the replay.
+	 *
+	 * @throw ReplayError if `input` is not an input log.
+	 */
+	void replay(std::istream &input);
+	/**
+	 * Go back to taking the live inputs.
+	 */
+	void stop();
+
+	bool isRecording() const;
+	bool isReplaying() const;
+
+	/**
+	 * Start keeping the inputs in the history.
+	 */
+	void startHistory();
+	/**
+	 * Stop keeping the inputs and drop the history.
+	 */
+	void stopHistory();
+	/**
+	 * Execution was moved back to `instructions`; the inputs that
+	 * are taken again are served from the history, until the run
+	 * passes the end of the history or goes a different way.
+	 */
+	void rewind(uint64_t instructions);
+	/**
+	 * Drop the history of inputs taken before `instructions`.
+	 */
+	void forget(uint64_t instructions);
+	size_t historySize() const;
+
+	/**
+	 * @return `live` or, when replaying, the logged input.
+	 * @throw ReplayError if the run diverged from the log.
+	 */
+	uint64_t input(InputSource source, uint64_t live);
+
+private:
+	DPtr<InputLog> d;
+};
+
+}
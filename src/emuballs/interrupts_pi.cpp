@@ -0,0 +1,175 @@
+/*
+ * Copyright 2017 Zalewa <zalewapl@gmail.com>.
+ *
+ * This file is part of Emuballs.
+ *
+ * Emuballs is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Emuballs is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with Emuballs.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include "interrupts_pi.hpp"
+
+#include <cstddef>
+#include <stdexcept>
+#include <string>
+
+using namespace Emuballs;
+using namespace Emuballs::Pi;
+
+namespace Emuballs
+{
+namespace Pi
+{
+
+struct IrqRegisters
+{
+	uint32_t basicPending;
+	uint32_t pending[2];
+	uint32_t fiqControl;
+	uint32_t enable[2];
+	uint32_t enableBasic;
+	uint32_t disable[2];
+	uint32_t disableBasic;
+};
+
+}
+
+DClass<Emuballs::Pi::InterruptController>
+{
+public:
+	static const uint32_t PENDING_1 = 1 << 8;
+	static const uint32_t PENDING_2 = 1 << 9;
+
+	Memory *memory;
+	memsize address;
+	memobserver_id observerId = Memory::NO_OBSERVER;
+	std::function<void(bool)> irqLine;
+	uint64_t lines = 0;
+	uint64_t enabled = 0;
+	uint32_t enabledBasic = 0;
+	bool irq = false;
+
+	memsize reg(size_t offset) const
+	{
+		return address + offset;
+	}
+
+	uint32_t half(uint64_t bits, int index) const
+	{
+		return static_cast<uint32_t>(bits >> (32 * index));
+	}
+
+	uint64_t pending() const
+	{
+		return lines & enabled;
+	}
+
+	/**
+	 * Apply whatever the guest wrote. Enable registers read back
+	 * the enabled lines and disable registers read back 0, so
+	 * the registers that weren't written don't change anything.
+	 */
+	void written()
+	{
+		for (int index = 0; index < 2; ++index)
+		{
+			uint64_t enable = memory->word(reg(offsetof(IrqRegisters, enable) + index * 4));
+			uint64_t disable = memory->word(reg(offsetof(IrqRegisters, disable) + index * 4));
+			enabled |= enable << (32 * index);
+			enabled &= ~(disable << (32 * index));
+		}
+		enabledBasic |= memory->word(reg(offsetof(IrqRegisters, enableBasic)));
+		enabledBasic &= ~memory->word(reg(offsetof(IrqRegisters, disableBasic)));
+		update();
+	}
+
+	void update()
+	{
+		uint64_t pendingLines = pending();
+		uint32_t basic = 0;
+		if (half(pendingLines, 0) != 0)
+			basic |= PENDING_1;
+		if (half(pendingLines, 1) != 0)
+			basic |= PENDING_2;
+		memory->putWord(reg(offsetof(IrqRegisters, basicPending)), basic);
+		for (int index = 0; index < 2; ++index)
+		{
+			memory->putWord(reg(offsetof(IrqRegisters, pending) + index * 4),
+				half(pendingLines, index));
+			memory->putWord(reg(offsetof(IrqRegisters, enable) + index * 4),
+				half(enabled, index));
+			memory->putWord(reg(offsetof(IrqRegisters, disable) + index * 4), 0);
+		}
+		memory->putWord(reg(offsetof(IrqRegisters, enableBasic)), enabledBasic);
+		memory->putWord(reg(offsetof(IrqRegisters, disableBasic)), 0);
+
+		bool raised = pendingLines != 0;
+		if (raised != irq)
+		{
+			irq = raised;
+			irqLine(raised);
+		}
+	}
+};
+
+DPointeredNoCopy(Emuballs::Pi::InterruptController);
+
+}
+
+InterruptController::InterruptController(Memory &memory, memsize address,
+	std::function<void(bool)> irqLine)
+{
+	d->memory = &memory;
+	d->address = address;
+	d->irqLine = std::move(irqLine);
+	d->observerId = memory.observe(address, sizeof(IrqRegisters),
+		[this](memsize, Access) { d->written(); }, Access::Write);
+	d->update();
+	d->irqLine(false);
+}
+
+InterruptController::~InterruptController()
+{
+	if (d->observerId != Memory::NO_OBSERVER)
+		d->memory->unobserve(d->observerId);
+}
+
+void InterruptController::setLine(int irq, bool raised)
+{
+	if (irq < 0 || irq >= NUM_IRQS)
+		throw std::out_of_range("no such interrupt line: " + std::to_string(irq));
+	uint64_t bit = 1ull << irq;
+	uint64_t lines = raised ? d->lines | bit : d->lines & ~bit;
+	if (lines == d->lines)
+		return;
+	d->lines = lines;
+	d->update();
+}
+
+bool InterruptController::isPending() const
+{
+	return d->pending() != 0;
+}
+
+InterruptController::State InterruptController::state() const
+{
+	return State { d->lines, d->enabled, d->enabledBasic };
+}
+
+void InterruptController::restore(const State &state)
+{
+	d->lines = state.lines;
+	d->enabled = state.enabled;
+	d->enabledBasic = state.enabledBasic;
+	d->update();
+	d->irqLine(d->irq);
+}
@@ -0,0 +1,87 @@
+/*
+ * Copyright 2017 Zalewa <zalewapl@gmail.com>.
+ *
+ * This file is part of Emuballs.
+ *
+ * Emuballs is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Emuballs is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with Emuballs.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#pragma once
+
+#include "dptr_impl.hpp"
+#include "emuballs/memory.hpp"
+#include <cstdint>
+#include <functional>
+
+namespace Emuballs
+{
+
+namespace Pi
+{
+
+/**
+ * Interrupt controller of the BCM2835, as seen by the ARM.
+ *
+ * Peripherals drive the levels of the GPU interrupt lines and
+ * the guest picks which of them reach the IRQ input of the CPU
+ * through the enable and disable registers. Pending registers
+ * show the lines that are both raised and enabled.
+ *
+ * The ARM-side sources of the basic registers and the routing
+ * to FIQ are not modelled; FIQ control only keeps its value.
+ */
+class InterruptController
+{
+public:
+	static const int NUM_IRQS = 64;
+	/** GPU lines of the system timer compares 0-3. */
+	static const int SYSTEM_TIMER_MATCH = 0;
+
+	struct State
+	{
+		uint64_t lines;
+		uint64_t enabled;
+		uint32_t enabledBasic;
+	};
+
+	/**
+	 * @param address Address of the "IRQ basic pending" register.
+	 * @param irqLine Follows the IRQ input of the CPU.
+	 */
+	InterruptController(Memory &memory, memsize address,
+		std::function<void(bool)> irqLine);
+	InterruptController(const InterruptController &other) = delete;
+	InterruptController &operator=(const InterruptController &other) = delete;
+	~InterruptController();
+
+	void setLine(int irq, bool raised);
+	/**
+	 * Any enabled line is raised.
+	 */
+	bool isPending() const;
+
+	State state() const;
+	/**
+	 * Put the lines and the enabled sets back, rewrite
+	 * the registers and drive the IRQ line to match, even
+	 * if the controller thinks it's there already.
+	 */
+	void restore(const State &state);
+
+private:
+	DPtr<InterruptController> d;
+};
+
+}
+
+}
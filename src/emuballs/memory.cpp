@@ -21,6 +21,7 @@
 #include <algorithm>
 #include <list>
 #include <map>
+#include <mutex>
 
 #include "dptr_impl.hpp"
 
@@ -68,7 +69,6 @@ struct MemObserveZone
 			|| (lesser <= end && greater >= end);
 	}
 
-private:
 	void validate() const
 	{
 		if (length == 0)
@@ -80,11 +80,46 @@ private:
 
 //////////////////////////////////////////////////////////////////////
 
+namespace
+{
+template<class T>
+bool compareExchangeAtomic(T *target, T expected, T value)
+{
+	#ifdef EMUBALLS_BIG_ENDIAN
+	#error("big endian not supported")
+	#endif
+	return __atomic_compare_exchange_n(target, &expected, value,
+		false, __ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST);
+}
+}
+
 namespace Emuballs
 {
 
 static const int WORD_SIZE = 4;
 
+/**
+ * Mutex that stays with its owner when the owner is copied.
+ */
+template<class Mutex>
+struct OwnMutex
+{
+	mutable Mutex mutex;
+
+	OwnMutex()
+	{
+	}
+
+	OwnMutex(const OwnMutex &)
+	{
+	}
+
+	OwnMutex &operator=(const OwnMutex &)
+	{
+		return *this;
+	}
+};
+
 DClass<Emuballs::Memory>
 {
 public:
@@ -94,28 +129,74 @@ public:
 	Emuballs::Page falsePage;
 	Emuballs::memobserver_id observeId;
 	std::list<Emuballs::MemObserveZone> observers;
+	std::list<Emuballs::MemObserveZone> watches;
+	Emuballs::memwatchlistener watchListener;
+	Emuballs::memobserver accessListener;
+	/**
+	 * Bit per page; set if any observer or watch covers that page.
+	 */
+	std::vector<uint64_t> observedPages;
+	/**
+	 * Addresses of the dirty pages, in the order of the first write.
+	 */
+	std::vector<Emuballs::memsize> dirtyPages;
+	/**
+	 * Stamped on the pages as they're written; only
+	 * accessed atomically, as the readers of the stamps
+	 * may run on other threads.
+	 */
+	uint64_t writeGeneration = 1;
+	/**
+	 * In concurrent mode the page map, the dirty pages and the
+	 * observers are guarded by the locks.
+	 */
+	bool concurrent = false;
+	OwnMutex<std::mutex> pagesLock;
+	OwnMutex<std::recursive_mutex> observersLock;
+
+	std::unique_lock<std::mutex> lockPages() const
+	{
+		std::unique_lock<std::mutex> lock(pagesLock.mutex, std::defer_lock);
+		if (concurrent)
+			lock.lock();
+		return lock;
+	}
+
+	std::unique_lock<std::recursive_mutex> lockObservers() const
+	{
+		std::unique_lock<std::recursive_mutex> lock(observersLock.mutex, std::defer_lock);
+		if (concurrent)
+			lock.lock();
+		return lock;
+	}
 
 	const Emuballs::Page &page(Emuballs::memsize address) const
 	{
-		if (address >= size)
-			throw std::out_of_range("address too big");
-		Emuballs::memsize page = pageAddress(address);
-		auto it = pages.find(page);
-		if (it != pages.end())
-		{
-			return it->second;
-		}
-		else
+		auto lock = lockPages();
+		return findPage(address);
+	}
+
+	/**
+	 * Page for writing; marks it dirty.
+	 */
+	Emuballs::Page &writablePage(Emuballs::memsize address)
+	{
+		auto lock = lockPages();
+		auto &p = const_cast<Emuballs::Page&>(findPage(address));
+		if (!p.dirty)
 		{
-			allocatePage(page);
-			return pages[page];
+			p.dirty = true;
+			dirtyPages.push_back(pageAddress(address));
 		}
+		stampGeneration(p);
+		return p;
 	}
 
-
-	Emuballs::Page &page(Emuballs::memsize address)
+	void stampGeneration(Emuballs::Page &p)
 	{
-		return const_cast<Emuballs::Page&>( static_cast<const PrivData<Emuballs::Memory> &>(*this).page(address) );
+		__atomic_store_n(&p.generation,
+			__atomic_load_n(&writeGeneration, __ATOMIC_RELAXED),
+			__ATOMIC_RELAXED);
 	}
 
 	Emuballs::memsize pageAddress(Emuballs::memsize memAddress) const
@@ -130,9 +211,27 @@ public:
 
 	bool isPageAllocated(Emuballs::memsize address) const
 	{
+		auto lock = lockPages();
 		return pages.find(pageAddress(address)) != pages.end();
 	}
 
+	const Emuballs::Page &findPage(Emuballs::memsize address) const
+	{
+		if (address >= size)
+			throw std::out_of_range("address too big");
+		Emuballs::memsize page = pageAddress(address);
+		auto it = pages.find(page);
+		if (it != pages.end())
+		{
+			return it->second;
+		}
+		else
+		{
+			allocatePage(page);
+			return pages[page];
+		}
+	}
+
 	void allocatePage(Emuballs::memsize address) const
 	{
 		pages[pageAddress(address)] = Emuballs::Page(pageSize);
@@ -148,19 +247,100 @@ public:
 				observer.observer(address, event);
 			}
 		}
+		for (Emuballs::MemObserveZone &watch : this->watches)
+		{
+			if ((watch.events & event) != 0
+				&& watch.isInZone(address))
+			{
+				notifyWatch(watch, address, event);
+			}
+		}
 	}
 
 	void execObserversInRange(Emuballs::memsize address, Emuballs::memsize length,
 		Emuballs::Access event)
 	{
+		Emuballs::memsize end = address + length - 1;
 		for (Emuballs::MemObserveZone &observer : this->observers)
 		{
 			if ((observer.events & event) != 0
-				&& observer.isRangeColliding(address, length))
+				&& observer.isRangeColliding(address, end))
 			{
 				observer.observer(address, event);
 			}
 		}
+		for (Emuballs::MemObserveZone &watch : this->watches)
+		{
+			if ((watch.events & event) != 0
+				&& watch.isRangeColliding(address, end))
+			{
+				notifyWatch(watch, std::max(address, watch.address), event);
+			}
+		}
+	}
+
+	void notifyWatch(const Emuballs::MemObserveZone &watch,
+		Emuballs::memsize address, Emuballs::Access event)
+	{
+		if (watchListener)
+			watchListener(Emuballs::MemWatchHit { watch.id, address, event });
+	}
+
+	bool isPageObserved(Emuballs::memsize address) const
+	{
+		Emuballs::memsize index = address / pageSize;
+		Emuballs::memsize word = index / 64;
+		if (word >= observedPages.size())
+			return false;
+		return (observedPages[word] >> (index % 64)) & 1;
+	}
+
+	bool isRangeObserved(Emuballs::memsize address, Emuballs::memsize length) const
+	{
+		if (observedPages.empty())
+			return false;
+		Emuballs::memsize last = address + (length > 0 ? length - 1 : 0);
+		for (Emuballs::memsize page = pageAddress(address); page <= last; page += pageSize)
+		{
+			if (isPageObserved(page))
+				return true;
+			if (page + pageSize < page)
+				break;
+		}
+		return false;
+	}
+
+	void updateObservedPages()
+	{
+		observedPages.clear();
+		for (auto *zones : { &observers, &watches })
+		{
+			for (const Emuballs::MemObserveZone &zone : *zones)
+			{
+				Emuballs::memsize first = zone.address / pageSize;
+				Emuballs::memsize last = zone.end() / pageSize;
+				for (Emuballs::memsize index = first; index <= last; ++index)
+				{
+					Emuballs::memsize word = index / 64;
+					if (word >= observedPages.size())
+						observedPages.resize(word + 1, 0);
+					observedPages[word] |= static_cast<uint64_t>(1) << (index % 64);
+				}
+			}
+		}
+	}
+
+	void removeZone(std::list<Emuballs::MemObserveZone> &zones, Emuballs::memobserver_id id)
+	{
+		for (auto it = zones.begin(); it != zones.end(); ++it)
+		{
+			if (it->id == id)
+			{
+				zones.erase(it);
+				updateObservedPages();
+				break;
+			}
+		}
 	}
 };
 
@@ -188,13 +368,23 @@ std::vector<memsize> Memory::allocatedPages() const
 
 void Memory::execObservers(memsize address, memsize length, Access events)
 {
+	if (d->accessListener)
+		d->accessListener(address, events);
 	if (length <= 1)
 	{
-		d->execObservers(address, events);
+		if (d->isPageObserved(address))
+		{
+			auto lock = d->lockObservers();
+			d->execObservers(address, events);
+		}
 	}
 	else
 	{
-		d->execObserversInRange(address, length, events);
+		if (d->isRangeObserved(address, length))
+		{
+			auto lock = d->lockObservers();
+			d->execObserversInRange(address, length, events);
+		}
 	}
 }
 
@@ -214,7 +404,7 @@ memsize Memory::putChunk(memsize address, const uint8_t *begin, memsize length)
 	{
 		memsize insertCount = std::min(d->pageSize - currentPageOffset, length - offset);
 		totalInsertCount += insertCount;
-		Page &p = d->page(currentPageAddress);
+		Page &p = d->writablePage(currentPageAddress);
 		p.setContents(currentPageOffset,
 			begin + offset,
 			begin + offset + insertCount);
@@ -265,7 +455,7 @@ memsize Memory::chunk(memsize address, memsize length, uint8_t *begin) const
 
 void Memory::putByte(memsize address, uint8_t value)
 {
-	d->page(address)[d->pageOffset(address)] = value;
+	d->writablePage(address)[d->pageOffset(address)] = value;
 }
 
 uint8_t Memory::byte(memsize address) const
@@ -275,14 +465,14 @@ uint8_t Memory::byte(memsize address) const
 
 void Memory::putWord(memsize address, uint32_t value)
 {
-	Page *p = &d->page(address);
+	Page *p = &d->writablePage(address);
 	memsize offset = d->pageOffset(address);
 	memsize currentAddress = address;
 	for (int i = 0; i < WORD_SIZE; ++i, ++offset, ++currentAddress)
 	{
 		if (offset >= p->size())
 		{
-			p = &d->page(currentAddress);
+			p = &d->writablePage(currentAddress);
 			offset = d->pageOffset(currentAddress);
 		}
 		(*p)[offset] = static_cast<uint8_t>(value >> (8 * i));
@@ -336,10 +526,133 @@ uint64_t Memory::dword(memsize address) const
 }
 
 uint8_t *Memory::ptr(memsize address)
+{
+	return d->writablePage(address).contents().data() + d->pageOffset(address);
+}
+
+const uint8_t *Memory::ptr(memsize address) const
 {
 	return d->page(address).contents().data() + d->pageOffset(address);
 }
 
+std::vector<MemorySpan> Memory::spans(memsize address, memsize length) const
+{
+	std::vector<MemorySpan> spans;
+	if (address >= size())
+		return spans;
+	if (address + length > size())
+		length = size() - address;
+
+	auto lock = d->lockPages();
+	memsize currentPageAddress = d->pageAddress(address);
+	memsize currentPageOffset = d->pageOffset(address);
+	memsize remainingLength = length;
+	while (remainingLength > 0)
+	{
+		memsize spanLength = std::min(remainingLength, d->pageSize - currentPageOffset);
+		auto it = d->pages.find(currentPageAddress);
+		const Page &p = it != d->pages.end() ? it->second : d->falsePage;
+		spans.push_back({p.contents().data() + currentPageOffset, spanLength});
+		remainingLength -= spanLength;
+		currentPageAddress += d->pageSize;
+		currentPageOffset = 0;
+	}
+	return spans;
+}
+
+const std::vector<memsize> &Memory::dirtyPages() const
+{
+	return d->dirtyPages;
+}
+
+void Memory::clearDirtyPages()
+{
+	for (memsize address : d->dirtyPages)
+		d->pages[address].dirty = false;
+	d->dirtyPages.clear();
+}
+
+void Memory::restoreDirtyPages(const Memory &snapshot)
+{
+	if (snapshot.pageSize() != pageSize())
+		throw std::invalid_argument("snapshot must have the same page size");
+	for (memsize address : d->dirtyPages)
+	{
+		d->stampGeneration(d->pages[address]);
+		auto &bytes = d->pages[address].contents();
+		auto original = snapshot.d->pages.find(address);
+		if (original != snapshot.d->pages.end())
+			std::copy(original->second.contents().begin(), original->second.contents().end(), bytes.begin());
+		else
+			std::fill(bytes.begin(), bytes.end(), 0);
+	}
+	clearDirtyPages();
+}
+
+uint64_t Memory::advanceWriteGeneration()
+{
+	return __atomic_fetch_add(&d->writeGeneration, 1, __ATOMIC_RELAXED);
+}
+
+uint64_t Memory::pageWriteGeneration(memsize address) const
+{
+	auto lock = d->lockPages();
+	auto it = d->pages.find(d->pageAddress(address));
+	if (it == d->pages.end())
+		return 0;
+	return __atomic_load_n(&it->second.generation, __ATOMIC_RELAXED);
+}
+
+std::vector<memsize> Memory::pagesWrittenSince(uint64_t generation) const
+{
+	auto lock = d->lockPages();
+	std::vector<memsize> pages;
+	for (auto &pair : d->pages)
+	{
+		if (__atomic_load_n(&pair.second.generation, __ATOMIC_RELAXED) >= generation)
+			pages.push_back(pair.first);
+	}
+	return pages;
+}
+
+void Memory::setConcurrent(bool concurrent)
+{
+	d->concurrent = concurrent;
+}
+
+bool Memory::isConcurrent() const
+{
+	return d->concurrent;
+}
+
+bool Memory::compareExchange(memsize address, int size, uint64_t expected, uint64_t value)
+{
+	if (size != 1 && size != 2 && size != 4 && size != 8)
+		throw std::invalid_argument("compare-exchange size must be 1, 2, 4 or 8");
+	if (address % size != 0)
+		throw std::invalid_argument("compare-exchange address must be aligned to its size");
+	// Aligned access of up to 8 bytes never crosses a page
+	// as long as the page size is a multiple of 8.
+	if (pageSize() % 8 != 0)
+		throw std::logic_error("compare-exchange needs page size to be a multiple of 8");
+	uint8_t *target = ptr(address);
+	switch (size)
+	{
+	case 1:
+		return compareExchangeAtomic(reinterpret_cast<uint8_t*>(target),
+			static_cast<uint8_t>(expected), static_cast<uint8_t>(value));
+	case 2:
+		return compareExchangeAtomic(reinterpret_cast<uint16_t*>(target),
+			static_cast<uint16_t>(expected), static_cast<uint16_t>(value));
+	case 4:
+		return compareExchangeAtomic(reinterpret_cast<uint32_t*>(target),
+			static_cast<uint32_t>(expected), static_cast<uint32_t>(value));
+	default:
+		return compareExchangeAtomic(reinterpret_cast<uint64_t*>(target),
+			expected, value);
+	}
+}
+
 memsize Memory::pageSize() const
 {
 	return d->pageSize;
@@ -360,20 +673,46 @@ memobserver_id Memory::observe(memsize address, memsize length, memobserver obse
 		.observer = observer,
 		.events = events
 	};
+	observerDescriptor.validate();
 	d->observers.emplace_back(observerDescriptor);
+	d->updateObservedPages();
 	return id;
 }
 
 void Memory::unobserve(memobserver_id id)
 {
-	for (auto it = d->observers.begin(); it != d->observers.end(); ++it)
-	{
-		if (it->id == id)
-		{
-			d->observers.erase(it);
-			break;
-		}
-	}
+	d->removeZone(d->observers, id);
+}
+
+memobserver_id Memory::watch(memsize address, memsize length, Access events)
+{
+	memobserver_id id = d->observeId++;
+	MemObserveZone watchDescriptor {
+		.id = id,
+		.address = address,
+		.length = length,
+		.observer = nullptr,
+		.events = events
+	};
+	watchDescriptor.validate();
+	d->watches.emplace_back(watchDescriptor);
+	d->updateObservedPages();
+	return id;
+}
+
+void Memory::unwatch(memobserver_id id)
+{
+	d->removeZone(d->watches, id);
+}
+
+void Memory::setWatchListener(memwatchlistener listener)
+{
+	d->watchListener = listener;
+}
+
+void Memory::setAccessListener(memobserver listener)
+{
+	d->accessListener = listener;
 }
 
 //////////////////////////////////////////////////////////////////////
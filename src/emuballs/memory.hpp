@@ -19,6 +19,7 @@
 #pragma once
 
 #include <cstdint>
+#include <stdexcept>
 #include <vector>
 #include "emuballs/memory.hpp"
 
@@ -73,6 +74,11 @@ public:
 		return bytes.size();
 	}
 
+	/** Written to since Memory::clearDirtyPages(). */
+	bool dirty = false;
+	/** Memory write generation of the last write. */
+	uint64_t generation = 0;
+
 private:
 	std::vector<uint8_t> bytes;
 };
@@ -185,6 +191,14 @@ public:
 		return ret;
 	}
 
+	bool compareExchange(memsize address, int size, uint64_t expected, uint64_t value)
+	{
+		bool stored = memory.compareExchange(address, size, expected, value);
+		if (stored)
+			memory.execObservers(address, 0, Access::Write);
+		return stored;
+	}
+
 private:
 	Memory &memory;
 };
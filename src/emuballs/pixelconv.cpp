@@ -0,0 +1,286 @@
+/*
+ * Copyright 2017 Zalewa <zalewapl@gmail.com>.
+ *
+ * This file is part of Emuballs.
+ *
+ * Emuballs is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Emuballs is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with Emuballs.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include "pixelconv.hpp"
+
+#include <cstring>
+
+#if defined(__GNUC__) && defined(__SSE2__)
+#define EMUBALLS_PIXELCONV_X86 1
+#include <immintrin.h>
+#endif
+
+using namespace Emuballs;
+using namespace Emuballs::PixelConv;
+
+namespace
+{
+/*
+ * Components are scaled up as `component * 255 / max`. SIMD kernels
+ * have no integer division, so they get the same results from
+ * a multiplication and a shift:
+ *
+ *   x * 255 / 31 == (x * 1053) >> 7, for x in [0, 31]
+ *   x * 255 / 63 == (x * 259 + 3) >> 6, for x in [0, 63]
+ *
+ * None of the products overflows 16 bits.
+ */
+constexpr uint16_t SCALE_5 = 1053;
+constexpr int SHIFT_5 = 7;
+constexpr uint16_t SCALE_6 = 259;
+constexpr uint16_t ROUND_6 = 3;
+constexpr int SHIFT_6 = 6;
+
+inline uint32_t rgb565Pixel(uint16_t pixel)
+{
+	uint32_t r = ((pixel >> 11) & 0x1f) * 255 / 31;
+	uint32_t g = ((pixel >> 5) & 0x3f) * 255 / 63;
+	uint32_t b = (pixel & 0x1f) * 255 / 31;
+	return 0xff000000 | (r << 16) | (g << 8) | b;
+}
+
+void rgb565Scalar(const uint8_t *row, int32_t width, uint32_t *rgb32)
+{
+	for (int32_t x = 0; x < width; ++x)
+	{
+		uint16_t pixel;
+		std::memcpy(&pixel, row + x * 2, sizeof(pixel));
+		rgb32[x] = rgb565Pixel(pixel);
+	}
+}
+
+void rgb888Scalar(const uint8_t *row, int32_t width, uint32_t *rgb32)
+{
+	for (int32_t x = 0; x < width; ++x, row += 3)
+	{
+		rgb32[x] = 0xff000000 | (static_cast<uint32_t>(row[2]) << 16)
+			| (static_cast<uint32_t>(row[1]) << 8) | row[0];
+	}
+}
+
+void xrgb8888Scalar(const uint8_t *row, int32_t width, uint32_t *rgb32)
+{
+	for (int32_t x = 0; x < width; ++x)
+	{
+		uint32_t pixel;
+		std::memcpy(&pixel, row + x * 4, sizeof(pixel));
+		rgb32[x] = 0xff000000 | pixel;
+	}
+}
+
+#ifdef EMUBALLS_PIXELCONV_X86
+void rgb565Sse2(const uint8_t *row, int32_t width, uint32_t *rgb32)
+{
+	const __m128i mask5 = _mm_set1_epi16(0x1f);
+	const __m128i mask6 = _mm_set1_epi16(0x3f);
+	const __m128i scale5 = _mm_set1_epi16(SCALE_5);
+	const __m128i scale6 = _mm_set1_epi16(SCALE_6);
+	const __m128i round6 = _mm_set1_epi16(ROUND_6);
+	const __m128i alpha = _mm_set1_epi16(static_cast<int16_t>(0xff00));
+	int32_t x = 0;
+	for (; x + 8 <= width; x += 8)
+	{
+		__m128i pixels = _mm_loadu_si128(reinterpret_cast<const __m128i*>(row + x * 2));
+		__m128i r = _mm_srli_epi16(pixels, 11);
+		__m128i g = _mm_and_si128(_mm_srli_epi16(pixels, 5), mask6);
+		__m128i b = _mm_and_si128(pixels, mask5);
+		r = _mm_srli_epi16(_mm_mullo_epi16(r, scale5), SHIFT_5);
+		g = _mm_srli_epi16(_mm_add_epi16(_mm_mullo_epi16(g, scale6), round6), SHIFT_6);
+		b = _mm_srli_epi16(_mm_mullo_epi16(b, scale5), SHIFT_5);
+		// Little-endian 0xAARRGGBB is B, G, R, A in memory.
+		__m128i bg = _mm_or_si128(b, _mm_slli_epi16(g, 8));
+		__m128i ra = _mm_or_si128(r, alpha);
+		_mm_storeu_si128(reinterpret_cast<__m128i*>(rgb32 + x), _mm_unpacklo_epi16(bg, ra));
+		_mm_storeu_si128(reinterpret_cast<__m128i*>(rgb32 + x + 4), _mm_unpackhi_epi16(bg, ra));
+	}
+	rgb565Scalar(row + x * 2, width - x, rgb32 + x);
+}
+
+__attribute__((target("avx2")))
+void rgb565Avx2(const uint8_t *row, int32_t width, uint32_t *rgb32)
+{
+	const __m256i mask5 = _mm256_set1_epi16(0x1f);
+	const __m256i mask6 = _mm256_set1_epi16(0x3f);
+	const __m256i scale5 = _mm256_set1_epi16(SCALE_5);
+	const __m256i scale6 = _mm256_set1_epi16(SCALE_6);
+	const __m256i round6 = _mm256_set1_epi16(ROUND_6);
+	const __m256i alpha = _mm256_set1_epi16(static_cast<int16_t>(0xff00));
+	int32_t x = 0;
+	for (; x + 16 <= width; x += 16)
+	{
+		__m256i pixels = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(row + x * 2));
+		__m256i r = _mm256_srli_epi16(pixels, 11);
+		__m256i g = _mm256_and_si256(_mm256_srli_epi16(pixels, 5), mask6);
+		__m256i b = _mm256_and_si256(pixels, mask5);
+		r = _mm256_srli_epi16(_mm256_mullo_epi16(r, scale5), SHIFT_5);
+		g = _mm256_srli_epi16(_mm256_add_epi16(_mm256_mullo_epi16(g, scale6), round6), SHIFT_6);
+		b = _mm256_srli_epi16(_mm256_mullo_epi16(b, scale5), SHIFT_5);
+		__m256i bg = _mm256_or_si256(b, _mm256_slli_epi16(g, 8));
+		__m256i ra = _mm256_or_si256(r, alpha);
+		// Unpacking works within the 128-bit lanes, which
+		// leaves pixels 0-3, 8-11 in `low` and 4-7, 12-15 in `high`.
+		__m256i low = _mm256_unpacklo_epi16(bg, ra);
+		__m256i high = _mm256_unpackhi_epi16(bg, ra);
+		_mm256_storeu_si256(reinterpret_cast<__m256i*>(rgb32 + x),
+			_mm256_permute2x128_si256(low, high, 0x20));
+		_mm256_storeu_si256(reinterpret_cast<__m256i*>(rgb32 + x + 8),
+			_mm256_permute2x128_si256(low, high, 0x31));
+	}
+	rgb565Sse2(row + x * 2, width - x, rgb32 + x);
+}
+
+/*
+ * Spreads 4 pixels of 3 bytes into 4 words; the top bytes are
+ * zeroed and ORed with the alpha afterwards.
+ */
+#define RGB888_SHUFFLE \
+	0, 1, 2, -1, 3, 4, 5, -1, 6, 7, 8, -1, 9, 10, 11, -1
+
+__attribute__((target("ssse3")))
+void rgb888Ssse3(const uint8_t *row, int32_t width, uint32_t *rgb32)
+{
+	const __m128i shuffle = _mm_setr_epi8(RGB888_SHUFFLE);
+	const __m128i alpha = _mm_set1_epi32(static_cast<int32_t>(0xff000000));
+	int32_t x = 0;
+	// 4 pixels are 12 bytes, but the load takes 16.
+	for (; (x + 4) * 3 + 4 <= width * 3; x += 4)
+	{
+		__m128i pixels = _mm_loadu_si128(reinterpret_cast<const __m128i*>(row + x * 3));
+		pixels = _mm_or_si128(_mm_shuffle_epi8(pixels, shuffle), alpha);
+		_mm_storeu_si128(reinterpret_cast<__m128i*>(rgb32 + x), pixels);
+	}
+	rgb888Scalar(row + x * 3, width - x, rgb32 + x);
+}
+
+__attribute__((target("avx2")))
+void rgb888Avx2(const uint8_t *row, int32_t width, uint32_t *rgb32)
+{
+	const __m256i shuffle = _mm256_setr_epi8(RGB888_SHUFFLE, RGB888_SHUFFLE);
+	const __m256i alpha = _mm256_set1_epi32(static_cast<int32_t>(0xff000000));
+	int32_t x = 0;
+	// Shuffles don't cross the 128-bit lanes, so each lane
+	// gets its own 4 pixels.
+	for (; (x + 8) * 3 + 4 <= width * 3; x += 8)
+	{
+		__m128i low = _mm_loadu_si128(reinterpret_cast<const __m128i*>(row + x * 3));
+		__m128i high = _mm_loadu_si128(reinterpret_cast<const __m128i*>(row + x * 3 + 12));
+		__m256i pixels = _mm256_inserti128_si256(_mm256_castsi128_si256(low), high, 1);
+		pixels = _mm256_or_si256(_mm256_shuffle_epi8(pixels, shuffle), alpha);
+		_mm256_storeu_si256(reinterpret_cast<__m256i*>(rgb32 + x), pixels);
+	}
+	rgb888Ssse3(row + x * 3, width - x, rgb32 + x);
+}
+
+#undef RGB888_SHUFFLE
+
+void xrgb8888Sse2(const uint8_t *row, int32_t width, uint32_t *rgb32)
+{
+	const __m128i alpha = _mm_set1_epi32(static_cast<int32_t>(0xff000000));
+	int32_t x = 0;
+	for (; x + 4 <= width; x += 4)
+	{
+		__m128i pixels = _mm_loadu_si128(reinterpret_cast<const __m128i*>(row + x * 4));
+		_mm_storeu_si128(reinterpret_cast<__m128i*>(rgb32 + x), _mm_or_si128(pixels, alpha));
+	}
+	xrgb8888Scalar(row + x * 4, width - x, rgb32 + x);
+}
+
+__attribute__((target("avx2")))
+void xrgb8888Avx2(const uint8_t *row, int32_t width, uint32_t *rgb32)
+{
+	const __m256i alpha = _mm256_set1_epi32(static_cast<int32_t>(0xff000000));
+	int32_t x = 0;
+	for (; x + 8 <= width; x += 8)
+	{
+		__m256i pixels = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(row + x * 4));
+		_mm256_storeu_si256(reinterpret_cast<__m256i*>(rgb32 + x), _mm256_or_si256(pixels, alpha));
+	}
+	xrgb8888Sse2(row + x * 4, width - x, rgb32 + x);
+}
+#endif
+}
+
+Simd PixelConv::detectSimd()
+{
+#ifdef EMUBALLS_PIXELCONV_X86
+	__builtin_cpu_init();
+	if (__builtin_cpu_supports("avx2"))
+		return Simd::Avx2;
+	if (__builtin_cpu_supports("ssse3"))
+		return Simd::Ssse3;
+	return Simd::Sse2;
+#else
+	return Simd::Scalar;
+#endif
+}
+
+RowConverter PixelConv::rgb565(Simd simd)
+{
+	switch (simd)
+	{
+	case Simd::Scalar:
+		return rgb565Scalar;
+#ifdef EMUBALLS_PIXELCONV_X86
+	case Simd::Sse2:
+	case Simd::Ssse3:
+		return rgb565Sse2;
+	case Simd::Avx2:
+		return rgb565Avx2;
+#endif
+	default:
+		return nullptr;
+	}
+}
+
+RowConverter PixelConv::rgb888(Simd simd)
+{
+	switch (simd)
+	{
+	case Simd::Scalar:
+		return rgb888Scalar;
+#ifdef EMUBALLS_PIXELCONV_X86
+	case Simd::Sse2:
+		// Needs byte shuffles.
+		return rgb888Scalar;
+	case Simd::Ssse3:
+		return rgb888Ssse3;
+	case Simd::Avx2:
+		return rgb888Avx2;
+#endif
+	default:
+		return nullptr;
+	}
+}
+
+RowConverter PixelConv::xrgb8888(Simd simd)
+{
+	switch (simd)
+	{
+	case Simd::Scalar:
+		return xrgb8888Scalar;
+#ifdef EMUBALLS_PIXELCONV_X86
+	case Simd::Sse2:
+	case Simd::Ssse3:
+		return xrgb8888Sse2;
+	case Simd::Avx2:
+		return xrgb8888Avx2;
+#endif
+	default:
+		return nullptr;
+	}
+}
@@ -0,0 +1,69 @@
+/*
+ * Copyright 2017 Zalewa <zalewapl@gmail.com>.
+ *
+ * This file is part of Emuballs.
+ *
+ * Emuballs is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Emuballs is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with Emuballs.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#pragma once
+
+#include <cstdint>
+
+namespace Emuballs
+{
+
+/**
+ * Kernels that convert rows of frame buffer pixels to 0xAARRGGBB.
+ *
+ * All kernels of one pixel format give the same results; they
+ * only differ in the instruction set they need.
+ */
+namespace PixelConv
+{
+
+enum class Simd : int
+{
+	Scalar,
+	Sse2,
+	Ssse3,
+	Avx2
+};
+
+typedef void (*RowConverter)(const uint8_t *row, int32_t width, uint32_t *rgb32);
+
+/**
+ * Widest instruction set supported by both the build and the
+ * host CPU.
+ */
+Simd detectSimd();
+
+/**
+ * Converter of little-endian RGB565 pixels for the `simd`
+ * instruction set, or nullptr if the build lacks it.
+ */
+RowConverter rgb565(Simd simd);
+/**
+ * Converter of 24-bit pixels stored as blue, green and red bytes,
+ * that is little-endian 0xRRGGBB. Output is opaque.
+ */
+RowConverter rgb888(Simd simd);
+/**
+ * Converter of little-endian 0xXXRRGGBB pixels. The unused top
+ * byte is ignored and the output is opaque.
+ */
+RowConverter xrgb8888(Simd simd);
+
+}
+
+}
@@ -0,0 +1,124 @@
+/*
+ * Copyright 2017 Zalewa <zalewapl@gmail.com>.
+ *
+ * This file is part of Emuballs.
+ *
+ * Emuballs is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Emuballs is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with Emuballs.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include "profiler.hpp"
+
+#include <algorithm>
+#include <set>
+
+using namespace Emuballs;
+
+namespace
+{
+bool isCall(uint32_t code)
+{
+	// BL <label>
+	if ((code & 0x0f000000) == 0x0b000000 && (code & 0xf0000000) != 0xf0000000)
+		return true;
+	// BLX <label>
+	if ((code & 0xfe000000) == 0xfa000000)
+		return true;
+	// BLX <Rm>
+	return (code & 0x0ffffff0) == 0x012fff30;
+}
+}
+
+Profiler::Profiler(memsize entry, uint32_t samplePeriod)
+	: root(entry), samplePeriod(std::max<uint32_t>(samplePeriod, 1))
+{
+	countdown = this->samplePeriod;
+}
+
+void Profiler::sample(memsize address)
+{
+	costs[currentFunction()][address] += samplePeriod;
+}
+
+void Profiler::branch(memsize address, uint32_t code, memsize target)
+{
+	if (isCall(code))
+	{
+		if (stack.size() >= MAX_DEPTH)
+			return;
+		++edges[EdgeKey(currentFunction(), address, target)].calls;
+		stack.push_back(Frame { target, address, address + 4, _executed });
+		return;
+	}
+	// Look for a return; it may unwind more than one frame if
+	// some function left without returning through its caller.
+	for (size_t depth = stack.size(); depth > 0; --depth)
+	{
+		if (stack[depth - 1].returnAddress != target)
+			continue;
+		while (stack.size() >= depth)
+		{
+			Frame frame = stack.back();
+			stack.pop_back();
+			edges[EdgeKey(currentFunction(), frame.callSite, frame.function)].inclusive
+				+= _executed - frame.start;
+		}
+		return;
+	}
+}
+
+void Profiler::writeCallgrind(std::ostream &out, const SymbolTable &symbols) const
+{
+	std::map<EdgeKey, Edge> edges = this->edges;
+	for (size_t depth = stack.size(); depth > 0; --depth)
+	{
+		const Frame &frame = stack[depth - 1];
+		memsize caller = depth > 1 ? stack[depth - 2].function : root;
+		edges[EdgeKey(caller, frame.callSite, frame.function)].inclusive
+			+= _executed - frame.start;
+	}
+
+	std::set<memsize> functions;
+	for (const auto &cost : costs)
+		functions.insert(cost.first);
+	for (const auto &edge : edges)
+		functions.insert(std::get<0>(edge.first));
+
+	out << "# callgrind format" << std::endl;
+	out << "version: 1" << std::endl;
+	out << "creator: emuballs" << std::endl;
+	out << "positions: instr" << std::endl;
+	out << "events: Ir" << std::endl;
+	out << "summary: " << _executed << std::endl;
+	out << std::hex << std::showbase;
+	for (memsize function : functions)
+	{
+		out << std::endl << "fn=" << symbols.name(function) << std::endl;
+		auto functionCosts = costs.find(function);
+		if (functionCosts != costs.end())
+		{
+			for (const auto &cost : functionCosts->second)
+				out << cost.first << " " << std::dec << cost.second << std::hex << std::endl;
+		}
+		for (auto edge = edges.lower_bound(EdgeKey(function, 0, 0));
+			edge != edges.end() && std::get<0>(edge->first) == function; ++edge)
+		{
+			memsize callSite = std::get<1>(edge->first);
+			memsize callee = std::get<2>(edge->first);
+			out << "cfn=" << symbols.name(callee) << std::endl;
+			out << "calls=" << std::dec << edge->second.calls << std::hex
+				<< " " << callee << std::endl;
+			out << callSite << " " << std::dec << edge->second.inclusive << std::hex << std::endl;
+		}
+	}
+	out << std::dec << std::noshowbase;
+}
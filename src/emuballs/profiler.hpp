@@ -0,0 +1,122 @@
+/*
+ * Copyright 2017 Zalewa <zalewapl@gmail.com>.
+ *
+ * This file is part of Emuballs.
+ *
+ * Emuballs is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Emuballs is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with Emuballs.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#pragma once
+
+#include "emuballs/memory.hpp"
+#include "emuballs/symbols.hpp"
+#include <cstdint>
+#include <map>
+#include <ostream>
+#include <tuple>
+#include <vector>
+
+namespace Emuballs
+{
+
+/**
+ * Attributes executed guest instructions to guest functions.
+ *
+ * Functions are identified by their entry addresses. Calls are
+ * recognized by BL/BLX; returns by any branch to the return address
+ * of a call that is still on the shadow stack, which catches
+ * `mov pc, lr`, `bx lr` and `pop {..., pc}` alike.
+ *
+ * Call edges and their inclusive costs are always exact. Self costs
+ * come from samples taken every `samplePeriod` instructions, so
+ * a bigger period makes the profiling cheaper but coarser.
+ */
+class Profiler
+{
+public:
+	/** Calls nested deeper than that are not tracked. */
+	static const size_t MAX_DEPTH = 4096;
+
+	/**
+	 * @param entry
+	 *     Address of the function that is running when
+	 *     the profiling starts.
+	 */
+	Profiler(memsize entry, uint32_t samplePeriod = 1);
+
+	/**
+	 * Account instruction that was just executed.
+	 *
+	 * @param target
+	 *     New pc, if the instruction changed it.
+	 */
+	void instruction(memsize address, uint32_t code, bool pcChanged, memsize target)
+	{
+		++_executed;
+		if (--countdown == 0)
+		{
+			countdown = samplePeriod;
+			sample(address);
+		}
+		if (pcChanged)
+			branch(address, code, target);
+	}
+
+	uint64_t executed() const
+	{
+		return _executed;
+	}
+
+	/**
+	 * Write profile in callgrind format. Calls that didn't
+	 * return yet are accounted up to now.
+	 */
+	void writeCallgrind(std::ostream &out, const SymbolTable &symbols) const;
+
+private:
+	struct Frame
+	{
+		memsize function;
+		memsize callSite;
+		memsize returnAddress;
+		uint64_t start;
+	};
+
+	struct Edge
+	{
+		uint64_t calls = 0;
+		uint64_t inclusive = 0;
+	};
+
+	/** caller function, call site, callee function */
+	typedef std::tuple<memsize, memsize, memsize> EdgeKey;
+
+	memsize root;
+	uint32_t samplePeriod;
+	uint32_t countdown;
+	uint64_t _executed = 0;
+	std::vector<Frame> stack;
+	/** function -> instruction address -> cost */
+	std::map<memsize, std::map<memsize, uint64_t>> costs;
+	std::map<EdgeKey, Edge> edges;
+
+	memsize currentFunction() const
+	{
+		return stack.empty() ? root : stack.back().function;
+	}
+
+	void sample(memsize address);
+	void branch(memsize address, uint32_t code, memsize target);
+};
+
+}
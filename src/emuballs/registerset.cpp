@@ -105,3 +105,10 @@ RegVal RegisterSet::reg(const std::string &name) const
 	}
 	throw UnknownRegisterError("unknown register " + name);
 }
+
+void RegisterSet::values(std::vector<uint32_t> &values) const
+{
+	values.clear();
+	for (const auto &reg : registers())
+		values.push_back(reg.value());
+}
@@ -0,0 +1,192 @@
+/*
+ * Copyright 2017 Zalewa <zalewapl@gmail.com>.
+ *
+ * This file is part of Emuballs.
+ *
+ * Emuballs is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Emuballs is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with Emuballs.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include "scheduler.hpp"
+
+#include <map>
+#include <queue>
+#include <vector>
+
+using namespace Emuballs;
+
+namespace Emuballs
+{
+struct ScheduledEvent
+{
+	uint64_t when;
+	Scheduler::event_id id;
+
+	bool operator>(const ScheduledEvent &other) const
+	{
+		return when != other.when ? when > other.when : id > other.id;
+	}
+};
+
+DClass<Scheduler>
+{
+public:
+	Arm::Machine *machine;
+	/**
+	 * Min-heap of the events; cancelled ones stay in it
+	 * until they reach the top, but lose their handler.
+	 */
+	std::priority_queue<ScheduledEvent, std::vector<ScheduledEvent>,
+		std::greater<ScheduledEvent>> queue;
+	std::map<Scheduler::event_id, Scheduler::Handler> handlers;
+	Scheduler::event_id nextId = Scheduler::NO_EVENT + 1;
+	/**
+	 * An event earlier than the deadline of the current run
+	 * was scheduled, so the run was stopped to move it.
+	 */
+	bool deadlineMoved = false;
+
+	void dropCancelled()
+	{
+		while (!queue.empty() && handlers.count(queue.top().id) == 0)
+			queue.pop();
+	}
+
+	void updateDeadline()
+	{
+		dropCancelled();
+		machine->requestStopAt(queue.empty() ? UINT64_MAX : queue.top().when);
+	}
+};
+
+DPointeredNoCopy(Scheduler);
+}
+
+Scheduler::Scheduler(Arm::Machine &machine)
+{
+	d->machine = &machine;
+}
+
+Scheduler::~Scheduler()
+{
+	d->machine->requestStopAt(UINT64_MAX);
+}
+
+Scheduler::event_id Scheduler::schedule(uint64_t instructionCount, Handler handler)
+{
+	event_id id = d->nextId++;
+	uint64_t deadline = nextEvent();
+	d->queue.push(ScheduledEvent { instructionCount, id });
+	d->handlers[id] = std::move(handler);
+	if (instructionCount < deadline)
+	{
+		d->machine->requestStopAt(instructionCount);
+		// The run that is going on, if any, had its budget cut
+		// to the old deadline; it has to stop and start over
+		// to pick up the new one.
+		d->machine->requestStop();
+		d->deadlineMoved = true;
+	}
+	return id;
+}
+
+Scheduler::event_id Scheduler::scheduleIn(uint64_t instructions, Handler handler)
+{
+	return schedule(d->machine->instructionCount() + instructions, std::move(handler));
+}
+
+Scheduler::event_id Scheduler::post(Handler handler)
+{
+	return schedule(d->machine->instructionCount(), std::move(handler));
+}
+
+void Scheduler::cancel(event_id id)
+{
+	d->handlers.erase(id);
+	d->updateDeadline();
+}
+
+void Scheduler::clear()
+{
+	d->handlers.clear();
+	d->updateDeadline();
+}
+
+uint64_t Scheduler::nextEvent() const
+{
+	d->dropCancelled();
+	return d->queue.empty() ? UINT64_MAX : d->queue.top().when;
+}
+
+void Scheduler::dispatch()
+{
+	uint64_t now = d->machine->instructionCount();
+	while (nextEvent() <= now)
+	{
+		event_id id = d->queue.top().id;
+		d->queue.pop();
+		auto it = d->handlers.find(id);
+		Handler handler = std::move(it->second);
+		d->handlers.erase(it);
+		handler();
+	}
+	d->updateDeadline();
+}
+
+Arm::RunResult Scheduler::run(uint64_t maxInstructions, const Arm::StopConditions &stop)
+{
+	Arm::RunResult result { Arm::StopReason::Budget, 0 };
+	dispatch();
+	while (result.executed < maxInstructions)
+	{
+		d->deadlineMoved = false;
+		Arm::RunResult step = d->machine->run(maxInstructions - result.executed, stop);
+		result.executed += step.executed;
+		result.reason = step.reason;
+		bool eventDue = nextEvent() <= d->machine->instructionCount();
+		// Sleeping core lets the time pass until the next event.
+		bool asleep = d->machine->isWaitingForInterrupt();
+		if (step.reason != Arm::StopReason::Requested
+			|| !(eventDue || asleep || d->deadlineMoved))
+		{
+			break;
+		}
+		dispatch();
+	}
+	return result;
+}
+
+Scheduler::State Scheduler::state() const
+{
+	State state { {}, d->nextId };
+	auto queue = d->queue;
+	for (; !queue.empty(); queue.pop())
+	{
+		auto it = d->handlers.find(queue.top().id);
+		if (it != d->handlers.end())
+			state.events.push_back(Event { queue.top().when, it->first, it->second });
+	}
+	return state;
+}
+
+void Scheduler::restore(const State &state)
+{
+	d->queue = decltype(d->queue)();
+	d->handlers.clear();
+	for (const Event &event : state.events)
+	{
+		d->queue.push(ScheduledEvent { event.when, event.id });
+		d->handlers[event.id] = event.handler;
+	}
+	d->nextId = state.nextId;
+	d->updateDeadline();
+}
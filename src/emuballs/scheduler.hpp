@@ -0,0 +1,131 @@
+/*
+ * Copyright 2017 Zalewa <zalewapl@gmail.com>.
+ *
+ * This file is part of Emuballs.
+ *
+ * Emuballs is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Emuballs is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with Emuballs.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#pragma once
+
+#include "armmachine.hpp"
+#include "dptr_impl.hpp"
+#include <cstdint>
+#include <functional>
+#include <vector>
+
+namespace Emuballs
+{
+
+/**
+ * Peripheral events of a device, due at given instruction counts
+ * of its Machine.
+ *
+ * Instead of being polled after every instruction, peripherals
+ * schedule their next event, or post() one from a memory observer.
+ * The Machine runs uninterrupted until the earliest event is due
+ * and the events are dispatched between the runs.
+ *
+ * Everything must be called from the thread that runs the Machine.
+ * Events are not rewound along with the Machine on their own;
+ * whoever moves the Machine back in time must restore() them too.
+ */
+class Scheduler
+{
+public:
+	typedef uint64_t event_id;
+	typedef std::function<void()> Handler;
+
+	static const event_id NO_EVENT = 0;
+
+	struct Event
+	{
+		uint64_t when;
+		event_id id;
+		Handler handler;
+	};
+
+	/**
+	 * Pending events; the handlers are kept as they are, so they
+	 * must still be valid when the state is restored.
+	 */
+	struct State
+	{
+		std::vector<Event> events;
+		event_id nextId;
+	};
+
+	Scheduler(Arm::Machine &machine);
+	~Scheduler();
+
+	/**
+	 * Call `handler` once the Machine's instructionCount()
+	 * reaches `instructionCount`. Events due at the same count
+	 * are dispatched in the order they were scheduled.
+	 *
+	 * If the event is due before the deadline of the Machine's
+	 * current run, the run returns StopReason::Requested after
+	 * the instruction that is being executed, so that it can be
+	 * started again with the new deadline. run() does so on its own.
+	 */
+	event_id schedule(uint64_t instructionCount, Handler handler);
+	/**
+	 * Call `handler` after `instructions` more instructions.
+	 */
+	event_id scheduleIn(uint64_t instructions, Handler handler);
+	/**
+	 * Call `handler` right after the instruction that is being
+	 * executed; meant for memory observers.
+	 */
+	event_id post(Handler handler);
+	/**
+	 * Drop the event if it wasn't dispatched yet.
+	 */
+	void cancel(event_id id);
+	/**
+	 * Drop all events.
+	 */
+	void clear();
+
+	/**
+	 * Instruction count at which the earliest event is due;
+	 * UINT64_MAX if there are none.
+	 */
+	uint64_t nextEvent() const;
+	/**
+	 * Dispatch all events that are due. This is the service
+	 * to call whenever Machine::run() returns StopReason::Requested.
+	 */
+	void dispatch();
+	/**
+	 * Run the Machine for up to `maxInstructions`, dispatching
+	 * the events as they come due. Stops early for any other
+	 * reason than an event or the Machine starting to wait
+	 * for an interrupt.
+	 */
+	Arm::RunResult run(uint64_t maxInstructions,
+		const Arm::StopConditions &stop = Arm::StopConditions());
+
+	State state() const;
+	/**
+	 * Replace all events with the saved ones. Event ids are
+	 * restored too, so the ids held by the peripherals that
+	 * were restored along stay valid.
+	 */
+	void restore(const State &state);
+
+private:
+	DPtr<Scheduler> d;
+};
+
+}
@@ -0,0 +1,318 @@
+/*
+ * Copyright 2017 Zalewa <zalewapl@gmail.com>.
+ *
+ * This file is part of Emuballs.
+ *
+ * Emuballs is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Emuballs is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with Emuballs.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include "smp.hpp"
+
+#include "armmachine.hpp"
+#include <algorithm>
+#include <condition_variable>
+#include <exception>
+#include <memory>
+#include <mutex>
+#include <stdexcept>
+#include <thread>
+
+using namespace Emuballs;
+
+namespace Emuballs
+{
+DClass<Smp>
+{
+public:
+	struct Core
+	{
+		Arm::Machine *machine;
+		bool running = false;
+		std::thread thread;
+		std::exception_ptr error;
+	};
+
+	std::vector<std::unique_ptr<Core>> cores;
+	std::function<void()> service;
+	uint64_t quantum = Smp::DEFAULT_QUANTUM;
+	Smp::Interleaving interleaving = Smp::Interleaving::Threaded;
+
+	std::mutex startMutex;
+	std::vector<std::pair<size_t, memsize>> pendingStarts;
+
+	std::mutex quantumMutex;
+	std::condition_variable quantumStarted;
+	std::condition_variable quantumFinished;
+	uint64_t generation = 0;
+	uint64_t quantumBudget = 0;
+	size_t busyWorkers = 0;
+	size_t workers = 0;
+	bool quit = false;
+
+	Memory &memory()
+	{
+		return cores.front()->machine->untrackedMemory();
+	}
+
+	void applyPendingStarts()
+	{
+		std::vector<std::pair<size_t, memsize>> starts;
+		{
+			std::lock_guard<std::mutex> lock(startMutex);
+			starts.swap(pendingStarts);
+		}
+		for (auto &start : starts)
+		{
+			Core &core = *cores[start.first];
+			if (core.running)
+				continue;
+			Arm::Cpu cpu = core.machine->cpuSnapshot();
+			cpu.regs().pc(start.second);
+			core.machine->restoreCpu(cpu, core.machine->instructionCount());
+			core.running = true;
+			if (interleaving == Smp::Interleaving::Threaded && !core.thread.joinable())
+				spawn(core);
+		}
+	}
+
+	void spawn(Core &core)
+	{
+		memory().setConcurrent(true);
+		++workers;
+		uint64_t seen = generation;
+		core.thread = std::thread([this, &core, seen]() { work(core, seen); });
+	}
+
+	void work(Core &core, uint64_t seen)
+	{
+		std::unique_lock<std::mutex> lock(quantumMutex);
+		for (;;)
+		{
+			quantumStarted.wait(lock, [this, seen]() { return quit || generation != seen; });
+			if (quit)
+				return;
+			seen = generation;
+			uint64_t budget = quantumBudget;
+			lock.unlock();
+			if (core.running)
+				runSecondary(core, budget);
+			lock.lock();
+			if (--busyWorkers == 0)
+				quantumFinished.notify_one();
+		}
+	}
+
+	void runSecondary(Core &core, uint64_t budget)
+	{
+		try
+		{
+			uint64_t executed = 0;
+			while (executed < budget)
+				executed += core.machine->run(budget - executed).executed;
+		}
+		catch (...)
+		{
+			core.error = std::current_exception();
+			core.running = false;
+		}
+	}
+
+	bool hasRunningSecondary() const
+	{
+		return std::any_of(cores.begin() + 1, cores.end(),
+			[](const std::unique_ptr<Core> &core) { return core->running; });
+	}
+
+	void rethrowSecondaryError()
+	{
+		for (auto &core : cores)
+		{
+			if (core->error)
+			{
+				std::exception_ptr error = core->error;
+				core->error = nullptr;
+				std::rethrow_exception(error);
+			}
+		}
+	}
+
+	void stopThreads()
+	{
+		{
+			std::lock_guard<std::mutex> lock(quantumMutex);
+			quit = true;
+		}
+		quantumStarted.notify_all();
+		for (auto &core : cores)
+		{
+			if (core->thread.joinable())
+				core->thread.join();
+		}
+		quit = false;
+		workers = 0;
+		memory().setConcurrent(false);
+	}
+};
+
+DPointeredNoCopy(Smp);
+}
+
+Smp::Smp(std::vector<Arm::Machine*> cores, std::function<void()> service)
+{
+	if (cores.empty())
+		throw std::invalid_argument("SMP needs at least one core");
+	for (Arm::Machine *machine : cores)
+	{
+		std::unique_ptr<PrivData<Smp>::Core> core(new PrivData<Smp>::Core);
+		core->machine = machine;
+		d->cores.push_back(std::move(core));
+	}
+	d->cores.front()->running = true;
+	d->service = service;
+}
+
+Smp::~Smp()
+{
+	d->stopThreads();
+}
+
+void Smp::setQuantum(uint64_t instructions)
+{
+	d->quantum = std::max<uint64_t>(instructions, 1);
+}
+
+void Smp::setInterleaving(Interleaving interleaving)
+{
+	if (interleaving == d->interleaving)
+		return;
+	d->interleaving = interleaving;
+	if (interleaving == Interleaving::Deterministic)
+	{
+		d->stopThreads();
+	}
+	else
+	{
+		for (size_t index = 1; index < d->cores.size(); ++index)
+		{
+			if (d->cores[index]->running)
+				d->spawn(*d->cores[index]);
+		}
+	}
+}
+
+void Smp::run(uint64_t instructions)
+{
+	Arm::Machine &boot = *d->cores.front()->machine;
+	d->service();
+	uint64_t remaining = instructions;
+	while (remaining > 0)
+	{
+		d->applyPendingStarts();
+		uint64_t budget = std::min(remaining, d->quantum);
+		bool parallel = d->workers > 0 && d->hasRunningSecondary();
+		if (parallel)
+		{
+			// Quantum ends when the next event is due, so that it's
+			// serviced on time and the other cores don't get ahead.
+			uint64_t now = boot.instructionCount();
+			uint64_t deadline = boot.requestedStopAt();
+			if (deadline > now)
+				budget = std::min(budget, deadline - now);
+		}
+		if (parallel)
+		{
+			std::lock_guard<std::mutex> lock(d->quantumMutex);
+			d->quantumBudget = budget;
+			d->busyWorkers = d->workers;
+			++d->generation;
+		}
+		if (parallel)
+			d->quantumStarted.notify_all();
+
+		// Peripherals must not be serviced while the other
+		// threads may poke them; that waits for the quantum end.
+		bool serviceDeferred = false;
+		std::exception_ptr bootError;
+		uint64_t executed = 0;
+		try
+		{
+			while (executed < budget)
+			{
+				Arm::RunResult result = boot.run(budget - executed);
+				executed += result.executed;
+				if (result.reason == Arm::StopReason::Requested)
+				{
+					// Until serviced, the stop stays due and the boot
+					// core can't move on; the rest of the budget is
+					// run in the next quantum.
+					if (parallel)
+					{
+						serviceDeferred = true;
+						break;
+					}
+					d->service();
+				}
+			}
+		}
+		catch (...)
+		{
+			bootError = std::current_exception();
+		}
+
+		if (parallel)
+		{
+			std::unique_lock<std::mutex> lock(d->quantumMutex);
+			d->quantumFinished.wait(lock, [this]() { return d->busyWorkers == 0; });
+		}
+		else
+		{
+			for (size_t index = 1; index < d->cores.size() && !bootError; ++index)
+			{
+				auto &core = *d->cores[index];
+				if (core.running)
+					d->runSecondary(core, budget);
+			}
+		}
+		if (bootError)
+			std::rethrow_exception(bootError);
+		if (serviceDeferred)
+			d->service();
+		d->rethrowSecondaryError();
+		remaining -= executed;
+	}
+}
+
+void Smp::start(size_t core, memsize address)
+{
+	if (core == 0 || core >= d->cores.size())
+		throw std::out_of_range("no such secondary core: " + std::to_string(core));
+	std::lock_guard<std::mutex> lock(d->startMutex);
+	d->pendingStarts.emplace_back(core, address);
+}
+
+bool Smp::isParked(size_t core) const
+{
+	return !d->cores.at(core)->running;
+}
+
+void Smp::reset()
+{
+	d->stopThreads();
+	for (size_t index = 1; index < d->cores.size(); ++index)
+	{
+		d->cores[index]->running = false;
+		d->cores[index]->error = nullptr;
+	}
+	std::lock_guard<std::mutex> lock(d->startMutex);
+	d->pendingStarts.clear();
+}
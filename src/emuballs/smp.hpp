@@ -0,0 +1,100 @@
+/*
+ * Copyright 2017 Zalewa <zalewapl@gmail.com>.
+ *
+ * This file is part of Emuballs.
+ *
+ * Emuballs is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Emuballs is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with Emuballs.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#pragma once
+
+#include "emuballs/memory.hpp"
+#include "dptr_impl.hpp"
+#include <cstdint>
+#include <functional>
+#include <vector>
+
+namespace Emuballs
+{
+
+namespace Arm
+{
+class Machine;
+}
+
+/**
+ * Runs the cores of a multi-core device, all sharing one Memory.
+ *
+ * The boot core runs from the start; the secondary cores are parked
+ * until start() is called for them. The cores run in quanta of
+ * the same amount of instructions and are synchronised after
+ * each quantum, so none of them gets ahead of the others by more
+ * than that.
+ *
+ * In threaded interleaving each started secondary core gets its own
+ * host thread and the Memory is switched to the concurrent mode.
+ * Peripherals are serviced between the quanta then. In
+ * deterministic interleaving the cores run one after another on the
+ * calling thread, so that the runs can be reproduced.
+ */
+class Smp
+{
+public:
+	enum class Interleaving
+	{
+		Threaded,
+		Deterministic
+	};
+
+	static const uint64_t DEFAULT_QUANTUM = 10000;
+
+	/**
+	 * @param cores
+	 *     Boot core first. All must share the same Memory.
+	 * @param service
+	 *     Services the peripherals; called when the boot core
+	 *     is stopped by Machine::requestStop().
+	 */
+	Smp(std::vector<Arm::Machine*> cores, std::function<void()> service);
+	~Smp();
+
+	void setQuantum(uint64_t instructions);
+	void setInterleaving(Interleaving interleaving);
+
+	/**
+	 * Run `instructions` on the boot core, with the started
+	 * secondary cores running alongside.
+	 *
+	 * An error of a secondary core parks that core
+	 * and is rethrown after the quantum.
+	 */
+	void run(uint64_t instructions);
+
+	/**
+	 * Make a parked core start executing from `address`
+	 * at the next quantum. Safe to call from any core,
+	 * like from a memory observer.
+	 */
+	void start(size_t core, memsize address);
+	bool isParked(size_t core) const;
+
+	/**
+	 * Park all secondary cores and stop their threads.
+	 */
+	void reset();
+
+private:
+	DPtr<Smp> d;
+};
+
+}
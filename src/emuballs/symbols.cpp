@@ -0,0 +1,206 @@
+/*
+ * Copyright 2017 Zalewa <zalewapl@gmail.com>.
+ *
+ * This file is part of Emuballs.
+ *
+ * Emuballs is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Emuballs is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with Emuballs.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include "emuballs/symbols.hpp"
+
+#include "emuballs/errors.hpp"
+#include "dptr_impl.hpp"
+
+#include <iterator>
+#include <map>
+#include <sstream>
+#include <vector>
+
+using namespace Emuballs;
+
+namespace Emuballs
+{
+DClass<SymbolTable>
+{
+public:
+	std::map<uint32_t, Symbol> symbols;
+};
+
+DPointered(SymbolTable)
+}
+
+namespace
+{
+const uint32_t SHT_SYMTAB = 2;
+const uint8_t STT_NOTYPE = 0;
+const uint8_t STT_FUNC = 2;
+const uint16_t SHN_UNDEF = 0;
+
+class ElfImage
+{
+public:
+	ElfImage(std::istream &input)
+		: bytes(std::istreambuf_iterator<char>(input), std::istreambuf_iterator<char>())
+	{
+	}
+
+	uint8_t u8(size_t offset) const
+	{
+		require(offset, 1);
+		return bytes[offset];
+	}
+
+	uint16_t u16(size_t offset) const
+	{
+		require(offset, 2);
+		return bytes[offset] | (bytes[offset + 1] << 8);
+	}
+
+	uint32_t u32(size_t offset) const
+	{
+		require(offset, 4);
+		return bytes[offset] | (bytes[offset + 1] << 8) | (bytes[offset + 2] << 16)
+			| (static_cast<uint32_t>(bytes[offset + 3]) << 24);
+	}
+
+	std::string str(size_t offset) const
+	{
+		std::string result;
+		for (char c; (c = u8(offset)) != 0; ++offset)
+			result += c;
+		return result;
+	}
+
+private:
+	std::vector<uint8_t> bytes;
+
+	void require(size_t offset, size_t length) const
+	{
+		if (offset + length > bytes.size() || offset + length < offset)
+			throw SymbolLoadError("ELF is truncated");
+	}
+};
+}
+
+SymbolTable::SymbolTable()
+{
+}
+
+SymbolTable::SymbolTable(const SymbolTable &other)
+{
+	d = other.d;
+}
+
+const SymbolTable &SymbolTable::operator=(const SymbolTable &other)
+{
+	if (this != &other)
+		d = other.d;
+	return *this;
+}
+
+SymbolTable::~SymbolTable()
+{
+}
+
+SymbolTable SymbolTable::fromElf(std::istream &input)
+{
+	ElfImage elf(input);
+	if (elf.u8(0) != 0x7f || elf.u8(1) != 'E' || elf.u8(2) != 'L' || elf.u8(3) != 'F')
+		throw SymbolLoadError("not an ELF file");
+	if (elf.u8(4) != 1 || elf.u8(5) != 1)
+		throw SymbolLoadError("only 32-bit little endian ELF is supported");
+
+	uint32_t shoff = elf.u32(32);
+	uint16_t shentsize = elf.u16(46);
+	uint16_t shnum = elf.u16(48);
+
+	SymbolTable table;
+	for (uint16_t section = 0; section < shnum; ++section)
+	{
+		size_t header = shoff + section * shentsize;
+		if (elf.u32(header + 4) != SHT_SYMTAB)
+			continue;
+		uint32_t offset = elf.u32(header + 16);
+		uint32_t size = elf.u32(header + 20);
+		uint32_t strtab = shoff + elf.u32(header + 24) * shentsize;
+		uint32_t strings = elf.u32(strtab + 16);
+		uint32_t entsize = elf.u32(header + 36);
+		if (entsize == 0)
+			throw SymbolLoadError("ELF symbol table has no entry size");
+
+		for (uint32_t entry = offset; entry + entsize <= offset + size; entry += entsize)
+		{
+			uint8_t type = elf.u8(entry + 12) & 0xf;
+			if ((type != STT_FUNC && type != STT_NOTYPE)
+				|| elf.u16(entry + 14) == SHN_UNDEF)
+			{
+				continue;
+			}
+			Symbol symbol;
+			symbol.name = elf.str(strings + elf.u32(entry));
+			// Skip nameless symbols and ARM mapping symbols ($a, $d, $t).
+			if (symbol.name.empty() || symbol.name[0] == '$')
+				continue;
+			symbol.address = elf.u32(entry + 4);
+			symbol.size = elf.u32(entry + 8);
+			if (type == STT_FUNC)
+				symbol.address &= ~1u; // Thumb bit
+			table.add(symbol);
+		}
+	}
+	return table;
+}
+
+void SymbolTable::add(const Symbol &symbol)
+{
+	// First symbol under an address wins, unless
+	// the newer one knows its size.
+	auto it = d->symbols.find(symbol.address);
+	if (it == d->symbols.end() || (it->second.size == 0 && symbol.size != 0))
+		d->symbols[symbol.address] = symbol;
+}
+
+bool SymbolTable::empty() const
+{
+	return d->symbols.empty();
+}
+
+size_t SymbolTable::size() const
+{
+	return d->symbols.size();
+}
+
+const Symbol *SymbolTable::find(uint32_t address) const
+{
+	auto it = d->symbols.upper_bound(address);
+	if (it == d->symbols.begin())
+		return nullptr;
+	--it;
+	const Symbol &symbol = it->second;
+	if (symbol.size != 0 && address - symbol.address >= symbol.size)
+		return nullptr;
+	return &symbol;
+}
+
+std::string SymbolTable::name(uint32_t address) const
+{
+	std::stringstream ss;
+	const Symbol *symbol = find(address);
+	if (symbol == nullptr)
+		ss << "0x" << std::hex << address;
+	else if (symbol->address == address)
+		ss << symbol->name;
+	else
+		ss << symbol->name << "+0x" << std::hex << (address - symbol->address);
+	return ss.str();
+}
@@ -18,10 +18,14 @@
  */
 #include "timer_pi.hpp"
 
+#include "inputlog.hpp"
 #include "memory.hpp"
+#include "scheduler.hpp"
 #include <algorithm>
 #include <chrono>
 #include <cstddef>
+#include <iterator>
+#include <stdexcept>
 
 using namespace Emuballs;
 using namespace Emuballs::Pi;
@@ -37,9 +41,9 @@ namespace Pi
 #pragma pack(1)
 struct Timebox
 {
-	static const auto NUM_COMPARES = 4;
+	static const auto NUM_COMPARES = Timer::NUM_COMPARES;
 
-	// TODO: How do `control` and `compare` work exactly?
+	/** Match bits M0-M3; writing 1 clears them. */
 	uint32_t control;
 	uint64_t counter;
 	uint32_t compare[NUM_COMPARES];
@@ -58,8 +62,32 @@ public:
 	Timepoint startingPoint;
 	Timebox *timebox;
 	Memory *memory;
+	InputLog *inputs;
 	bool isInit = false;
 
+	std::function<uint64_t()> cycles;
+	uint64_t clockRate = 0;
+	/** Counter and cycles when the virtual time was started. */
+	uint64_t virtualBase = 0;
+	uint64_t cyclesBase = 0;
+	/** Guest got the counter at least once. */
+	bool counted = false;
+
+	static const uint64_t COUNTER_WRAP = 1ull << 32;
+
+	Scheduler *scheduler = nullptr;
+	uint64_t estimatedRate = 0;
+	std::function<void(int, bool)> matchLine;
+	memobserver_id controlObserverId = Memory::NO_OBSERVER;
+	memobserver_id compareObserverId = Memory::NO_OBSERVER;
+	Scheduler::event_id matchEvent = Scheduler::NO_EVENT;
+	uint32_t status = 0;
+	/** Compares that were written, and so take part in matching. */
+	uint32_t armed = 0;
+	uint32_t compares[Timebox::NUM_COMPARES] = {};
+	/** Counter values of the next matches. */
+	uint64_t targets[Timebox::NUM_COMPARES] = {};
+
 	void init()
 	{
 		if (address == INVALID_ADDRESS)
@@ -84,10 +112,140 @@ public:
 	}
 
 	void writeToMemory()
+	{
+		timebox->counter = now();
+	}
+
+	uint64_t now()
+	{
+		counted = true;
+		if (cycles)
+		{
+			uint64_t current = cycles();
+			// Checkpoints may take the cycles back past the base.
+			uint64_t elapsed = current > cyclesBase ? current - cyclesBase : 0;
+			// Split to not overflow on long runs.
+			return virtualBase + (elapsed / clockRate) * 1000000
+				+ (elapsed % clockRate) * 1000000 / clockRate;
+		}
+		return inputs->input(InputSource::SystemTimer, wallTime());
+	}
+
+	void connectCompares()
+	{
+		memsize control = address + offsetof(Emuballs::Pi::Timebox, control);
+		controlObserverId = memory->observe(control, sizeof(Timebox::control),
+			[this](memsize, Access) { controlWritten(); },
+			Access::Write);
+		memsize compare = address + offsetof(Emuballs::Pi::Timebox, compare);
+		compareObserverId = memory->observe(compare, sizeof(Timebox::compare),
+			[this](memsize written, Access) { compareWritten(written); },
+			Access::Write);
+	}
+
+	void controlWritten()
+	{
+		uint32_t cleared = status & timebox->control;
+		status &= ~cleared;
+		writeControl();
+		for (int channel = 0; channel < Timebox::NUM_COMPARES; ++channel)
+		{
+			if (cleared & (1 << channel))
+				matchLine(channel, false);
+		}
+	}
+
+	/**
+	 * Goes through the Memory, not the timebox, so that
+	 * the page is marked dirty for the snapshots.
+	 */
+	void writeControl()
+	{
+		memory->putWord(address + offsetof(Emuballs::Pi::Timebox, control), status);
+	}
+
+	void compareWritten(memsize written)
+	{
+		uint64_t counter = now();
+		memsize compare = address + offsetof(Emuballs::Pi::Timebox, compare);
+		for (int channel = 0; channel < Timebox::NUM_COMPARES; ++channel)
+		{
+			memsize reg = compare + channel * sizeof(uint32_t);
+			uint32_t value = timebox->compare[channel];
+			bool touched = written >= reg && written < reg + sizeof(uint32_t);
+			if (!touched && value == compares[channel])
+				continue;
+			compares[channel] = value;
+			armed |= 1 << channel;
+			// The counter must tick into the compare value to match.
+			uint32_t delta = value - static_cast<uint32_t>(counter);
+			targets[channel] = counter + (delta != 0 ? delta : COUNTER_WRAP);
+		}
+		reschedule(counter);
+	}
+
+	void match()
+	{
+		matchEvent = Scheduler::NO_EVENT;
+		uint64_t counter = now();
+		for (int channel = 0; channel < Timebox::NUM_COMPARES; ++channel)
+		{
+			if (!(armed & (1 << channel)) || targets[channel] > counter)
+				continue;
+			while (targets[channel] <= counter)
+				targets[channel] += COUNTER_WRAP;
+			if (!(status & (1 << channel)))
+			{
+				status |= 1 << channel;
+				writeControl();
+				matchLine(channel, true);
+			}
+		}
+		reschedule(counter);
+	}
+
+	void reschedule(uint64_t counter)
+	{
+		if (matchEvent != Scheduler::NO_EVENT)
+			scheduler->cancel(matchEvent);
+		matchEvent = Scheduler::NO_EVENT;
+		if (armed == 0)
+			return;
+		uint64_t target = UINT64_MAX;
+		for (int channel = 0; channel < Timebox::NUM_COMPARES; ++channel)
+		{
+			if (armed & (1 << channel))
+				target = std::min(target, targets[channel]);
+		}
+		auto handler = [this]() { match(); };
+		if (cycles)
+		{
+			uint64_t elapsed = target > virtualBase ? target - virtualBase : 0;
+			matchEvent = scheduler->schedule(cyclesBase + cyclesFor(elapsed, clockRate), handler);
+		}
+		else
+		{
+			uint64_t remaining = target > counter ? target - counter : 0;
+			matchEvent = scheduler->scheduleIn(
+				std::max<uint64_t>(1, cyclesFor(remaining, estimatedRate)), handler);
+		}
+	}
+
+	/**
+	 * Least amount of cycles in which `microseconds` pass.
+	 */
+	static uint64_t cyclesFor(uint64_t microseconds, uint64_t rate)
+	{
+		// Split to not overflow on long runs.
+		return (microseconds / 1000000) * rate
+			+ ((microseconds % 1000000) * rate + 999999) / 1000000;
+	}
+
+	uint64_t wallTime() const
 	{
 		Timepoint now = Clock::now();
 		Resolution duration = std::chrono::duration_cast<Resolution>(now - startingPoint);
-		timebox->counter = duration.count();
+		return duration.count();
 	}
 };
 
@@ -95,10 +253,11 @@ DPointeredNoCopy(Emuballs::Pi::Timer);
 
 }
 
-Timer::Timer(Memory &memory, memsize address)
+Timer::Timer(Memory &memory, memsize address, InputLog &inputs)
 {
 	d->address = address;
 	d->memory = &memory;
+	d->inputs = &inputs;
 
 	d->init();
 }
@@ -107,4 +266,83 @@ Timer::~Timer()
 {
 	if (d->observerId != Memory::NO_OBSERVER)
 		d->memory->unobserve(d->observerId);
+	if (d->controlObserverId != Memory::NO_OBSERVER)
+		d->memory->unobserve(d->controlObserverId);
+	if (d->compareObserverId != Memory::NO_OBSERVER)
+		d->memory->unobserve(d->compareObserverId);
+	if (d->matchEvent != Scheduler::NO_EVENT)
+		d->scheduler->cancel(d->matchEvent);
+}
+
+void Timer::useVirtualTime(std::function<uint64_t()> cycles, uint64_t clockRate)
+{
+	if (clockRate == 0)
+		throw std::invalid_argument("timer clock rate must not be 0");
+	// Fresh timer starts from 0, so that the virtual time
+	// doesn't depend on when it was switched to.
+	d->virtualBase = d->counted ? d->now() : 0;
+	d->cycles = cycles;
+	d->cyclesBase = cycles();
+	d->clockRate = clockRate;
+	if (d->armed != 0)
+		d->reschedule(d->now());
+}
+
+void Timer::useWallClock()
+{
+	if (!d->cycles)
+		return;
+	uint64_t counter = d->now();
+	d->cycles = nullptr;
+	d->startingPoint = Clock::now()
+		- std::chrono::duration_cast<Clock::duration>(Resolution(counter));
+	if (d->armed != 0)
+		d->reschedule(counter);
+}
+
+bool Timer::isVirtualTime() const
+{
+	return static_cast<bool>(d->cycles);
+}
+
+void Timer::connectCompares(Scheduler &scheduler, uint64_t clockRate,
+	std::function<void(int, bool)> matchLine)
+{
+	if (d->scheduler != nullptr)
+		throw std::logic_error("timer compares are connected already");
+	if (clockRate == 0)
+		throw std::invalid_argument("timer clock rate must not be 0");
+	d->scheduler = &scheduler;
+	d->estimatedRate = clockRate;
+	d->matchLine = std::move(matchLine);
+	d->connectCompares();
+}
+
+uint64_t Timer::now()
+{
+	// Not a guest read, so it doesn't go to the InputLog.
+	return d->cycles ? d->now() : d->wallTime();
+}
+
+Timer::State Timer::state() const
+{
+	State state;
+	state.status = d->status;
+	state.armed = d->armed;
+	std::copy(std::begin(d->compares), std::end(d->compares), state.compares);
+	std::copy(std::begin(d->targets), std::end(d->targets), state.targets);
+	state.matchEvent = d->matchEvent;
+	state.counted = d->counted;
+	return state;
+}
+
+void Timer::restore(const State &state)
+{
+	d->status = state.status;
+	d->armed = state.armed;
+	std::copy(std::begin(state.compares), std::end(state.compares), d->compares);
+	std::copy(std::begin(state.targets), std::end(state.targets), d->targets);
+	d->matchEvent = state.matchEvent;
+	d->counted = state.counted;
+	d->writeControl();
 }
@@ -20,21 +20,93 @@
 
 #include "dptr_impl.hpp"
 #include "emuballs/memory.hpp"
+#include <cstdint>
+#include <functional>
 
 namespace Emuballs
 {
 
+class InputLog;
+class Scheduler;
+
 namespace Pi
 {
 
+/**
+ * Free-running microsecond counter. Counter is taken from the host
+ * clock and passed through the InputLog, so runs can be replayed.
+ *
+ * In virtual time the counter is computed from the cycles executed
+ * by the guest instead. It's reproducible by itself then, so it
+ * doesn't go through the InputLog, and it costs no host clock reads.
+ *
+ * Once connected to a Scheduler, the four compare registers are
+ * matched against the low 32 bits of the counter. A match sets its
+ * bit in the control register until the guest writes 1 to it.
+ */
 class Timer
 {
 public:
-	Timer(Memory &memory, memsize address);
+	static const int NUM_COMPARES = 4;
+
+	/**
+	 * Matching of the compares. The counter isn't part of it;
+	 * it follows the cycles or the InputLog on its own.
+	 */
+	struct State
+	{
+		uint32_t status;
+		uint32_t armed;
+		uint32_t compares[NUM_COMPARES];
+		uint64_t targets[NUM_COMPARES];
+		/** Scheduler event of the next match. */
+		uint64_t matchEvent;
+		bool counted;
+	};
+
+	Timer(Memory &memory, memsize address, InputLog &inputs);
 	Timer(const Timer &other) = delete;
 	Timer &operator=(const Timer &other) = delete;
 	~Timer();
 
+	/**
+	 * Count time from `cycles` of a `clockRate` Hz guest clock.
+	 * The counter continues from where it is.
+	 */
+	void useVirtualTime(std::function<uint64_t()> cycles, uint64_t clockRate);
+	/**
+	 * Count time from the host clock; this is the default.
+	 * The counter continues from where it is.
+	 */
+	void useWallClock();
+	bool isVirtualTime() const;
+
+	/**
+	 * Start matching the compare registers; `matchLine` follows
+	 * the match bits of the control register.
+	 *
+	 * Matches are found by the events of `scheduler`, whose
+	 * instruction count must be the cycles counted in virtual time.
+	 * In virtual time they come at the exact cycle. On the wall
+	 * clock the cycle is estimated from `clockRate` and the host
+	 * clock is checked again when the event comes.
+	 */
+	void connectCompares(Scheduler &scheduler, uint64_t clockRate,
+		std::function<void(int, bool)> matchLine);
+
+	/**
+	 * Current value of the counter, in microseconds, without
+	 * the guest reading it.
+	 */
+	uint64_t now();
+
+	State state() const;
+	/**
+	 * Put the matching back, along with the control register.
+	 * Match event is expected to be restored in the Scheduler.
+	 */
+	void restore(const State &state);
+
 private:
 	DPtr<Timer> d;
 };
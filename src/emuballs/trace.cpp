@@ -0,0 +1,258 @@
+/*
+ * Copyright 2017 Zalewa <zalewapl@gmail.com>.
+ *
+ * This file is part of Emuballs.
+ *
+ * Emuballs is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Emuballs is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with Emuballs.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include "trace.hpp"
+
+#include "emuballs/errors.hpp"
+#include "byte_ring.hpp"
+
+#include <atomic>
+#include <chrono>
+#include <cstring>
+#include <thread>
+
+namespace Emuballs
+{
+namespace
+{
+/*
+ * Trace layout, all integers little endian:
+ *
+ * Header:
+ *   char[8] magic "EMUTRACE"
+ *   u32     version
+ *
+ * Record:
+ *   u32     instruction address
+ *   u32     instruction word
+ *   u32     changed registers mask; bit 16 is CPSR
+ *   u8      memory accesses count
+ *   u8      memory access kinds; bit set for writes
+ *   u32[]   new values of changed registers, lowest first
+ *   u32[]   addresses of memory accesses
+ */
+const char MAGIC[8] = {'E', 'M', 'U', 'T', 'R', 'A', 'C', 'E'};
+const uint32_t VERSION = 1;
+const size_t RECORD_HEADER_SIZE = 14;
+const size_t MAX_RECORD_SIZE = RECORD_HEADER_SIZE
+	+ std::tuple_size<TraceRegisters>::value * 4
+	+ TraceRecorder::MAX_MEM_ACCESSES * 4;
+
+uint8_t *putUint32(uint8_t *out, uint32_t value)
+{
+	out[0] = value & 0xff;
+	out[1] = (value >> 8) & 0xff;
+	out[2] = (value >> 16) & 0xff;
+	out[3] = (value >> 24) & 0xff;
+	return out + 4;
+}
+
+uint32_t getUint32(const uint8_t *in)
+{
+	return in[0] | (in[1] << 8) | (in[2] << 16) | (static_cast<uint32_t>(in[3]) << 24);
+}
+}
+
+DClass<TraceRecorder>
+{
+public:
+	std::ostream *output;
+	std::unique_ptr<ByteRing> ring;
+	std::thread writer;
+	std::atomic<bool> finishing {false};
+	uint64_t recorded = 0;
+
+	std::array<uint32_t, TraceRecorder::MAX_MEM_ACCESSES> memAddresses;
+	uint8_t memCount = 0;
+	uint8_t memWrites = 0;
+
+	void write()
+	{
+		std::vector<uint8_t> chunk(64 * 1024);
+		for (;;)
+		{
+			// Read `finishing` first, so that everything pushed
+			// before finish() is surely drained.
+			bool last = finishing.load();
+			size_t length;
+			while ((length = ring->read(chunk.data(), chunk.size())) > 0)
+				output->write(reinterpret_cast<const char*>(chunk.data()), length);
+			if (last)
+				break;
+			std::this_thread::sleep_for(std::chrono::milliseconds(1));
+		}
+		output->flush();
+	}
+
+	void push(const uint8_t *record, size_t length)
+	{
+		while (!ring->write(record, length))
+			std::this_thread::yield();
+	}
+};
+
+DPointeredNoCopy(TraceRecorder);
+
+TraceRecorder::TraceRecorder(std::ostream &output, size_t ringSize)
+{
+	d->output = &output;
+	d->ring.reset(new ByteRing(std::max(ringSize, MAX_RECORD_SIZE)));
+	uint8_t header[sizeof(MAGIC) + 4];
+	std::memcpy(header, MAGIC, sizeof(MAGIC));
+	putUint32(header + sizeof(MAGIC), VERSION);
+	output.write(reinterpret_cast<const char*>(header), sizeof(header));
+	d->writer = std::thread([this]() { d->write(); });
+}
+
+TraceRecorder::~TraceRecorder()
+{
+	finish();
+}
+
+void TraceRecorder::memoryAccess(memsize address, Access access)
+{
+	if (access != Access::Read && access != Access::Write)
+		return;
+	if (d->memCount >= MAX_MEM_ACCESSES)
+		return;
+	if (access == Access::Write)
+		d->memWrites |= 1 << d->memCount;
+	d->memAddresses[d->memCount++] = address;
+}
+
+void TraceRecorder::instruction(memsize address, uint32_t code,
+	const TraceRegisters &before, const TraceRegisters &after,
+	bool pcChanged)
+{
+	uint8_t record[MAX_RECORD_SIZE];
+	uint32_t mask = 0;
+	uint8_t *values = record + RECORD_HEADER_SIZE;
+	for (size_t idx = 0; idx < after.size(); ++idx)
+	{
+		if (idx == 15 ? pcChanged : before[idx] != after[idx])
+		{
+			mask |= 1 << idx;
+			values = putUint32(values, after[idx]);
+		}
+	}
+	for (uint8_t idx = 0; idx < d->memCount; ++idx)
+		values = putUint32(values, d->memAddresses[idx]);
+
+	uint8_t *header = record;
+	header = putUint32(header, address);
+	header = putUint32(header, code);
+	header = putUint32(header, mask);
+	header[0] = d->memCount;
+	header[1] = d->memWrites;
+
+	d->push(record, values - record);
+	d->memCount = 0;
+	d->memWrites = 0;
+	++d->recorded;
+}
+
+void TraceRecorder::finish()
+{
+	if (d->writer.joinable())
+	{
+		d->finishing = true;
+		d->writer.join();
+	}
+}
+
+uint64_t TraceRecorder::recorded() const
+{
+	return d->recorded;
+}
+
+//////////////////////////////////////////////////////////////////////
+
+DClass<TraceReader>
+{
+public:
+	std::istream *input;
+
+	bool read(uint8_t *out, size_t length)
+	{
+		input->read(reinterpret_cast<char*>(out), length);
+		return static_cast<size_t>(input->gcount()) == length;
+	}
+
+	uint32_t readUint32()
+	{
+		uint8_t bytes[4];
+		if (!read(bytes, sizeof(bytes)))
+			throw TraceFormatError("trace is truncated");
+		return getUint32(bytes);
+	}
+};
+
+DPointeredNoCopy(TraceReader);
+
+TraceReader::TraceReader(std::istream &input)
+{
+	d->input = &input;
+	char magic[sizeof(MAGIC)];
+	if (!d->read(reinterpret_cast<uint8_t*>(magic), sizeof(magic))
+		|| std::memcmp(magic, MAGIC, sizeof(MAGIC)) != 0)
+	{
+		throw TraceFormatError("not a trace");
+	}
+	uint32_t version = d->readUint32();
+	if (version != VERSION)
+		throw TraceFormatError("unsupported trace version " + std::to_string(version));
+}
+
+TraceReader::~TraceReader()
+{
+}
+
+bool TraceReader::next(TraceEntry &entry)
+{
+	uint8_t header[RECORD_HEADER_SIZE];
+	d->input->read(reinterpret_cast<char*>(header), sizeof(header));
+	size_t got = d->input->gcount();
+	if (got == 0)
+		return false;
+	if (got != sizeof(header))
+		throw TraceFormatError("trace is truncated");
+
+	entry.address = getUint32(header);
+	entry.instruction = getUint32(header + 4);
+	uint32_t mask = getUint32(header + 8);
+	uint8_t memCount = header[12];
+	uint8_t memWrites = header[13];
+
+	entry.registers.clear();
+	for (int idx = 0; idx <= TRACE_CPSR_INDEX; ++idx)
+	{
+		if (mask & (1 << idx))
+			entry.registers.emplace_back(idx, d->readUint32());
+	}
+	entry.memory.clear();
+	for (int idx = 0; idx < memCount; ++idx)
+	{
+		TraceMemAccess access;
+		access.address = d->readUint32();
+		access.write = (memWrites >> idx) & 1;
+		entry.memory.push_back(access);
+	}
+	return true;
+}
+
+}
@@ -0,0 +1,92 @@
+/*
+ * Copyright 2017 Zalewa <zalewapl@gmail.com>.
+ *
+ * This file is part of Emuballs.
+ *
+ * Emuballs is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Emuballs is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with Emuballs.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#pragma once
+
+#include "emuballs/access.hpp"
+#include "emuballs/memory.hpp"
+#include "emuballs/trace.hpp"
+#include "dptr_impl.hpp"
+#include <array>
+#include <cstdint>
+#include <ostream>
+
+namespace Emuballs
+{
+
+/**
+ * r0 - r15 followed by CPSR.
+ */
+typedef std::array<uint32_t, 17> TraceRegisters;
+
+/**
+ * Encodes executed instructions into a binary trace.
+ *
+ * Records are put into a lock-free ring buffer by the emulation
+ * thread and written to the output stream by a separate writer
+ * thread. When the ring is full the emulation waits for the
+ * writer, so no records are lost.
+ *
+ * Trace can be decoded with TraceReader.
+ */
+class TraceRecorder
+{
+public:
+	static const size_t DEFAULT_RING_SIZE = 4 * 1024 * 1024;
+	/**
+	 * Any further memory accesses of a single instruction
+	 * are not recorded.
+	 */
+	static const size_t MAX_MEM_ACCESSES = 8;
+
+	/**
+	 * Writes trace header and starts the writer thread.
+	 * `output` must outlive the recorder.
+	 */
+	TraceRecorder(std::ostream &output, size_t ringSize = DEFAULT_RING_SIZE);
+	~TraceRecorder();
+
+	/**
+	 * Collect memory access of the instruction being executed.
+	 * Only Read and Write accesses are recorded.
+	 */
+	void memoryAccess(memsize address, Access access);
+	/**
+	 * Record executed instruction along with the memory
+	 * accesses collected since the previous instruction.
+	 *
+	 * r15 is recorded only if `pcChanged`, as it advances
+	 * on every instruction anyway.
+	 */
+	void instruction(memsize address, uint32_t code,
+		const TraceRegisters &before, const TraceRegisters &after,
+		bool pcChanged);
+
+	/**
+	 * Write out everything recorded so far and stop the writer
+	 * thread. Nothing can be recorded afterwards.
+	 */
+	void finish();
+
+	uint64_t recorded() const;
+
+private:
+	DPtr<TraceRecorder> d;
+};
+
+}
@@ -18,17 +18,109 @@
  */
 #include "cycler.hpp"
 
-#include <emuballs/errors.hpp>
-#include <QTimer>
+#include <emuballs/registerset.hpp>
+#include <emuballs/regval.hpp>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <algorithm>
+#include <deque>
+#include <exception>
+#include <future>
+#include <mutex>
+#include <thread>
 
 using namespace Emulens;
 
 DClass<Cycler>
 {
 public:
-	QTimer cycleTimer;
+	struct Task
+	{
+		std::function<void()> run;
+		/// Whether the device may change, which calls for a snapshot.
+		bool changes;
+	};
+
 	int deviceCyclesPerAutoRunCycle = 10000;
+	std::chrono::milliseconds refreshInterval = std::chrono::milliseconds(200);
 	std::shared_ptr<Emuballs::Device> device;
+
+	std::thread worker;
+	std::mutex mutex;
+	std::condition_variable wake;
+	std::deque<Task> tasks;
+	std::atomic<bool> autoRun{false};
+	bool quit = false;
+
+	/// Handoff to the GUI; the pointer is only ever swapped.
+	std::atomic<Snapshot*> latest{nullptr};
+	std::atomic<bool> notifyPending{false};
+
+	/// Drawn by the worker, read by the GUI.
+	Emuballs::FrameSurface frames;
+
+	// What the previous snapshot had; worker only.
+	std::vector<uint32_t> publishedRegisters;
+	std::vector<Emuballs::memsize> publishedPages;
+	uint64_t memorySince = 0;
+
+	void post(std::function<void()> task, bool changes = true)
+	{
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			tasks.push_back(Task {std::move(task), changes});
+		}
+		wake.notify_one();
+	}
+
+	void call(const std::function<void(Emuballs::Device&)> &task, bool changes)
+	{
+		std::promise<void> done;
+		post([this, &task, &done]() {
+				try
+				{
+					task(*device);
+					done.set_value();
+				}
+				catch (...)
+				{
+					done.set_exception(std::current_exception());
+				}
+			}, changes);
+		done.get_future().get();
+	}
+
+	uint64_t changedRegisters(const std::vector<uint32_t> &registers) const
+	{
+		// Registers past the 64th aren't tracked and are always marked.
+		uint64_t changed = 0;
+		for (size_t i = 0; i < registers.size() && i < 64; ++i)
+		{
+			if (i >= publishedRegisters.size() || registers[i] != publishedRegisters[i])
+				changed |= uint64_t(1) << i;
+		}
+		return changed;
+	}
+
+	/**
+	 * Carry over the changes of a snapshot that the GUI didn't take.
+	 */
+	static void fold(Snapshot &snapshot, const Snapshot &missed,
+		const std::vector<Emuballs::memsize> &pages)
+	{
+		snapshot.changedRegisters |= missed.changedRegisters;
+		if (missed.pagesChanged && !snapshot.pagesChanged)
+		{
+			snapshot.pagesChanged = true;
+			snapshot.pages = pages;
+		}
+		std::vector<Emuballs::memsize> written;
+		std::set_union(snapshot.writtenPages.begin(), snapshot.writtenPages.end(),
+			missed.writtenPages.begin(), missed.writtenPages.end(),
+			std::back_inserter(written));
+		snapshot.writtenPages.swap(written);
+	}
 };
 
 DPointeredNoCopy(Cycler);
@@ -37,42 +129,174 @@ Cycler::Cycler(std::shared_ptr<Emuballs::Device> device, QObject *parent)
 	: QObject(parent)
 {
 	d->device = device;
-	this->connect(&d->cycleTimer, &QTimer::timeout, this, &Cycler::cycle);
 }
 
-void Cycler::cycle()
+Cycler::~Cycler()
 {
-	try
+	if (d->worker.joinable())
 	{
-		if (isAutoRun())
 		{
-			d->device->cycle(d->deviceCyclesPerAutoRunCycle);
+			std::lock_guard<std::mutex> lock(d->mutex);
+			d->quit = true;
 		}
-		else
+		d->wake.notify_one();
+		d->worker.join();
+	}
+	delete d->latest.exchange(nullptr);
+}
+
+void Cycler::start()
+{
+	d->worker = std::thread(&Cycler::work, this);
+	// Give the views something to show right away.
+	d->post([]() {});
+}
+
+void Cycler::work()
+{
+	auto lastPublish = std::chrono::steady_clock::now();
+	for (;;)
+	{
+		std::deque<PrivData<Cycler>::Task> tasks;
 		{
-			d->device->cycle(1);
+			std::unique_lock<std::mutex> lock(d->mutex);
+			d->wake.wait(lock, [this]() {
+					return d->quit || !d->tasks.empty() || d->autoRun;
+				});
+			if (d->quit)
+				return;
+			tasks.swap(d->tasks);
+		}
+
+		bool changed = false;
+		for (auto &task : tasks)
+		{
+			// Tasks of invoke() hand their exceptions over
+			// to the caller; the others are reported here.
+			try
+			{
+				task.run();
+			}
+			catch (const std::exception &e)
+			{
+				fail(e);
+			}
+			changed |= task.changes;
+		}
+
+		if (d->autoRun)
+		{
+			try
+			{
+				d->device->cycle(d->deviceCyclesPerAutoRunCycle);
+			}
+			catch (const std::exception &e)
+			{
+				fail(e);
+				changed = true;
+			}
+		}
+
+		auto now = std::chrono::steady_clock::now();
+		if (changed || now - lastPublish >= d->refreshInterval)
+		{
+			publish();
+			lastPublish = now;
 		}
-		emit updated();
 	}
-	catch (const Emuballs::ProgramRuntimeError &e)
+}
+
+void Cycler::fail(const std::exception &e)
+{
+	d->autoRun = false;
+	emit error(QString("%1").arg(e.what()));
+}
+
+void Cycler::publish()
+{
+	std::unique_ptr<Snapshot> snapshot(new Snapshot());
+	d->device->registers().values(snapshot->registers);
+	snapshot->changedRegisters = d->changedRegisters(snapshot->registers);
+	d->publishedRegisters = snapshot->registers;
+
+	d->device->draw(d->frames);
+
+	Emuballs::Memory &memory = d->device->memory();
+	const uint64_t since = memory.advanceWriteGeneration();
+	snapshot->writtenPages = memory.pagesWrittenSince(d->memorySince);
+	d->memorySince = since;
+	std::vector<Emuballs::memsize> pages = memory.allocatedPages();
+	if (pages != d->publishedPages)
 	{
-		pauseAutoRun();
-		emit error(QString("%1").arg(e.what()));
-		emit updated();
+		snapshot->pagesChanged = true;
+		snapshot->pages = pages;
+		d->publishedPages.swap(pages);
 	}
+	snapshot->running = d->autoRun;
+
+	// Only the worker puts snapshots in, so once the one the GUI
+	// missed is taken back, the slot stays empty for the new one.
+	std::unique_ptr<Snapshot> missed(d->latest.exchange(nullptr));
+	if (missed)
+		PrivData<Cycler>::fold(*snapshot, *missed, d->publishedPages);
+	d->latest.store(snapshot.release());
+	if (!d->notifyPending.exchange(true))
+		emit updated();
+}
+
+std::unique_ptr<Snapshot> Cycler::takeSnapshot()
+{
+	// Cleared first, so that a snapshot published right after
+	// the exchange below is notified of again.
+	d->notifyPending = false;
+	return std::unique_ptr<Snapshot>(d->latest.exchange(nullptr));
+}
+
+Emuballs::FrameSurface &Cycler::frames()
+{
+	return d->frames;
+}
+
+void Cycler::invoke(std::function<void(Emuballs::Device&)> task)
+{
+	d->call(task, true);
+}
+
+void Cycler::query(std::function<void(Emuballs::Device&)> task)
+{
+	d->call(task, false);
+}
+
+void Cycler::cycle()
+{
+	d->post([this]() {
+			d->device->cycle(1);
+		});
 }
 
 bool Cycler::isAutoRun() const
 {
-	return d->cycleTimer.isActive();
+	return d->autoRun;
 }
 
 void Cycler::pauseAutoRun()
 {
-	d->cycleTimer.stop();
+	// The worker checks the flag in between the batches of cycles;
+	// the task makes it publish the state it stopped at.
+	d->autoRun = false;
+	d->post([]() {});
 }
 
 void Cycler::startAutoRun()
 {
-	d->cycleTimer.start();
+	d->autoRun = true;
+	d->post([]() {});
+}
+
+void Cycler::stepBack()
+{
+	d->autoRun = false;
+	d->post([this]() {
+			d->device->stepBack(1);
+		});
 }
@@ -19,33 +19,94 @@
 #pragma once
 
 #include <emuballs/device.hpp>
+#include <emuballs/framesurface.hpp>
 
 #include "dptr.hpp"
+#include "snapshot.hpp"
+#include <exception>
+#include <functional>
+#include <memory>
 #include <QObject>
 
 namespace Emulens
 {
 
+/**
+ * Runs the device on its own thread.
+ *
+ * While auto run is on, the worker cycles the device continuously
+ * and publishes a Snapshot every refresh interval; stepping, pausing
+ * and invoke() publish one as soon as they're done. Snapshots that
+ * the views didn't take in time are replaced by newer ones, so a
+ * slow GUI never holds the emulation back.
+ *
+ * Exceptions from cycling, stepping or auto run stop the auto run
+ * and are reported through error().
+ *
+ * The device must not be touched outside of invoke() after start().
+ */
 class Cycler : public QObject
 {
 	Q_OBJECT
 
 public:
 	Cycler(std::shared_ptr<Emuballs::Device> device, QObject *parent);
+	~Cycler();
+
+	/**
+	 * Start the worker. Connect to updated() first, or the first
+	 * notification may be missed.
+	 */
+	void start();
 
 	bool isAutoRun() const;
 
+	/**
+	 * Run `task` on the worker in between the cycles and wait for
+	 * it to finish. Exceptions thrown by the task are rethrown here.
+	 */
+	void invoke(std::function<void(Emuballs::Device&)> task);
+	/**
+	 * Like invoke(), for tasks that only read the device; no snapshot
+	 * is published after them.
+	 */
+	void query(std::function<void(Emuballs::Device&)> task);
+
+	/**
+	 * The most recent snapshot, or nullptr if there was no new
+	 * one since the last call.
+	 */
+	std::unique_ptr<Snapshot> takeSnapshot();
+
+	/**
+	 * The display, drawn by the worker whenever it publishes
+	 * a snapshot. Read it from the GUI thread only.
+	 */
+	Emuballs::FrameSurface &frames();
+
 public slots:
 	void cycle();
 	void pauseAutoRun();
 	void startAutoRun();
+	void stepBack();
 
 signals:
 	void error(const QString &e);
+	/**
+	 * A new snapshot is ready. Not emitted again until
+	 * takeSnapshot() is called.
+	 */
 	void updated();
 
 private:
 	DPtr<Cycler> d;
+
+	/**
+	 * Stop auto run and report the error; worker only.
+	 */
+	void fail(const std::exception &e);
+	void publish();
+	void work();
 };
 
 }
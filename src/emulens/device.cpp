@@ -22,6 +22,7 @@
 #include "display.hpp"
 #include "memory.hpp"
 #include "registers.hpp"
+#include "snapshot.hpp"
 #include "trackablemdiwindow.hpp"
 #include "ui_device.h"
 
@@ -29,7 +30,7 @@
 #include <emuballs/errors.hpp>
 #include <emuballs/programmer.hpp>
 #include <fstream>
-#include <QElapsedTimer>
+#include <stdexcept>
 #include <QFileDialog>
 #include <QFileInfo>
 #include <QMap>
@@ -40,6 +41,8 @@ namespace Emulens
 {
 static const auto SANE_FILE_SIZE = 64 * 1024 * 1024;
 static const QString SANE_FILE_SIZE_HUMAN_READABLE = "64 MB";
+static const auto CHECKPOINT_INTERVAL = 100000;
+static const auto CHECKPOINT_MEMORY_BUDGET = 256 * 1024 * 1024;
 }
 
 using namespace Emulens;
@@ -58,8 +61,6 @@ public:
 	Registers *registers;
 	std::shared_ptr<Emuballs::Device> device;
 	std::unique_ptr<DeviceToolBar> toolBar;
-	int refreshIntervalMs = 200;
-	QElapsedTimer refreshClock;
 };
 
 DPointeredNoCopy(Device);
@@ -69,13 +70,12 @@ Device::Device(std::shared_ptr<Emuballs::Device> device, QWidget *parent)
 {
 	d->setupUi(this);
 
-	d->refreshClock.start();
 	d->postInit = false;
 	d->device = device;
 	d->cycler.reset(new Cycler(device, this));
-	d->registers = new Registers(device, this);
-	d->memory = new Memory(device, this);
-	d->display = new Display(device, this);
+	d->registers = new Registers(device, d->cycler.get(), this);
+	d->memory = new Memory(device, d->cycler.get(), this);
+	d->display = new Display(d->cycler->frames(), this);
 
 	setupToolBar();
 	setupCycler();
@@ -156,10 +156,23 @@ void Device::loadProgram(const QString &path)
 	QFileInfo file(path);
 	if (checkProgramSize(file.size()))
 	{
-		d->device->reset();
+		bool checkpoints = false;
 		try
 		{
-			d->device->programmer().load(stream);
+			d->cycler->invoke([&](Emuballs::Device &device) {
+					device.reset();
+					device.programmer().load(stream);
+					// Multi-core devices can't go back; the program
+					// runs without reverse execution there.
+					try
+					{
+						device.startCheckpoints(CHECKPOINT_INTERVAL, CHECKPOINT_MEMORY_BUDGET);
+						checkpoints = true;
+					}
+					catch (const std::runtime_error &)
+					{
+					}
+				});
 			d->lastLoadedProgramPath = path;
 		}
 		catch (const Emuballs::ProgramLoadError &e)
@@ -167,7 +180,7 @@ void Device::loadProgram(const QString &path)
 			QMessageBox::critical(this, tr("Load Program Error"),
 				tr("Couldn't load program: %1").arg(e.what()));
 		}
-		updateViews();
+		d->toolBar->stepBackAction->setEnabled(checkpoints);
 	}
 }
 
@@ -186,6 +199,7 @@ void Device::setupCycler()
 		this, &Device::updateViews);
 	connect(d->cycler.get(), &Cycler::error,
 		this, &Device::showProgramRuntimeError);
+	d->cycler->start();
 }
 
 void Device::setupToolBar()
@@ -199,10 +213,10 @@ void Device::setupToolBar()
 		d->cycler.get(), &Cycler::startAutoRun);
 	connect(d->toolBar->pauseAction, &QAction::triggered,
 		d->cycler.get(), &Cycler::pauseAutoRun);
-	connect(d->toolBar->pauseAction, &QAction::triggered,
-		this, &Device::updateViewsForce);
 	connect(d->toolBar->stepAction, &QAction::triggered,
 		d->cycler.get(), &Cycler::cycle);
+	connect(d->toolBar->stepBackAction, &QAction::triggered,
+		d->cycler.get(), &Cycler::stepBack);
 }
 
 void Device::showEvent(QShowEvent *event)
@@ -236,20 +250,14 @@ void Device::updateActiveWindowAction()
 
 void Device::updateViews()
 {
-	if (d->cycler->isAutoRun())
-	{
-		if (d->refreshClock.elapsed() < d->refreshIntervalMs)
-			return;
-		d->refreshClock.start();
-	}
-	updateViewsForce();
-}
-
-void Device::updateViewsForce()
-{
+	// The Cycler publishes at the refresh rate and drops what
+	// wasn't taken, so there's at most one snapshot to show.
+	std::unique_ptr<Snapshot> snapshot = d->cycler->takeSnapshot();
+	if (!snapshot)
+		return;
 	Updateable* views[] = { d->registers, d->memory, d->display };
 	for (auto *view : views)
-		view->update();
+		view->update(*snapshot);
 }
 
 QList<QAction*> Device::windowActions()
@@ -278,4 +286,7 @@ DeviceToolBar::DeviceToolBar(Device *device)
 	startRunAction = addAction(tr("Run"));
 	pauseAction = addAction(tr("Pause"));
 	stepAction = addAction(tr("Step"));
+	stepBackAction = addAction(tr("Step back"));
+	// Enabled once a program is loaded with checkpoints.
+	stepBackAction->setEnabled(false);
 }
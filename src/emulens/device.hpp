@@ -66,7 +66,6 @@ private slots:
 	void showProgramRuntimeError(const QString &error);
 	void updateActiveWindowAction();
 	void updateViews();
-	void updateViewsForce();
 };
 
 class DeviceToolBar : public QToolBar
@@ -86,6 +85,7 @@ private:
 	QAction *startRunAction;
 	QAction *pauseAction;
 	QAction *stepAction;
+	QAction *stepBackAction;
 };
 
 }
@@ -18,97 +18,38 @@
  */
 #include "display.hpp"
 
-#include <emuballs/canvas.hpp>
-#include <emuballs/color.hpp>
+#include "snapshot.hpp"
+#include <QImage>
 #include <QGraphicsPixmapItem>
 #include <QGraphicsView>
 #include <QVBoxLayout>
 
-namespace Emulens
-{
-class Canvas : public Emuballs::Canvas
-{
-public:
-	Canvas(QGraphicsView *graphics, QGraphicsScene *scene)
-	{
-		this->graphics = graphics;
-		this->scene = scene;
-		this->drawTarget.reset(new QGraphicsPixmapItem());
-		scene->addItem(drawTarget.get());
-	}
-
-	void begin() override
-	{
-	}
-
-	void end() override
-	{
-		drawTarget->setPixmap(QPixmap::fromImage(image));
-		fitView();
-	}
-
-	void drawPicture(int32_t x, int32_t y, int32_t width, int32_t height,
-		int32_t bitsPerPixel, int32_t pitch, const std::vector<uint8_t> &pixels) override
-	{
-		std::copy(pixels.begin(), pixels.end(), image.bits());
-	}
-
-	void drawPixel(int32_t x, int32_t y, const Emuballs::Color &color) override
-	{
-		image.setPixel(x, y, 0xff000000 |
-			static_cast<uint32_t>(color.r) << 16 |
-			static_cast<uint32_t>(color.g) << 8 |
-			static_cast<uint32_t>(color.b));
-	}
-
-	void changeSize(int32_t width, int32_t height, Emuballs::BitDepth depth) override
-	{
-		auto format = QImage::Format_RGB32;
-		switch (depth)
-		{
-		case Emuballs::BitDepth::HighColor:
-			format = QImage::Format_RGB16;
-			break;
-		default:
-			// Stick with RAII value.
-			break;
-		}
-		image = QImage(width, height, format);
-	}
-
-	void fitView()
-	{
-		graphics->fitInView(scene->sceneRect(), Qt::KeepAspectRatio);
-	}
-
-private:
-	QGraphicsView *graphics;
-	QGraphicsScene *scene;
-	std::unique_ptr<QGraphicsPixmapItem> drawTarget;
-	QImage image;
-};
-
-}
-
 using namespace Emulens;
 
 DClass<Display>
 {
 public:
-	std::shared_ptr<Emuballs::Device> device;
+	Emuballs::FrameSurface *frames;
+	uint64_t shownSequence = 0;
 	QGraphicsScene scene;
 	QGraphicsView *graphics;
-	std::unique_ptr<Canvas> canvas;
+	std::unique_ptr<QGraphicsPixmapItem> drawTarget;
+
+	void fitView()
+	{
+		graphics->fitInView(scene.sceneRect(), Qt::KeepAspectRatio);
+	}
 };
 
 DPointeredNoCopy(Display)
 
-Display::Display(std::shared_ptr<Emuballs::Device> device, QWidget *parent)
+Display::Display(Emuballs::FrameSurface &frames, QWidget *parent)
 : QWidget(parent)
 {
-	d->device = device;
+	d->frames = &frames;
 	d->graphics = new QGraphicsView(&d->scene, this);
-	d->canvas.reset(new Canvas(d->graphics, &d->scene));
+	d->drawTarget.reset(new QGraphicsPixmapItem());
+	d->scene.addItem(d->drawTarget.get());
 	setLayout(new QVBoxLayout(this));
 	setWindowTitle(tr("Display"));
 	layout()->setContentsMargins(0, 0, 0, 0);
@@ -117,10 +58,20 @@ Display::Display(std::shared_ptr<Emuballs::Device> device, QWidget *parent)
 
 void Display::resizeEvent(QResizeEvent *)
 {
-	d->canvas->fitView();
+	d->fitView();
 }
 
-void Display::update()
+void Display::update(const Snapshot &)
 {
-	d->device->draw(*d->canvas);
+	const Emuballs::FrameSurface::Frame &frame = d->frames->latest();
+	if (frame.sequence == d->shownSequence)
+		return;
+	d->shownSequence = frame.sequence;
+	// The frame stays put until the next latest(), so it's wrapped
+	// rather than copied; the pixmap is the only copy made.
+	QImage image(reinterpret_cast<const uchar*>(frame.pixels.data()),
+		frame.width, frame.height, frame.width * sizeof(uint32_t),
+		QImage::Format_RGB32);
+	d->drawTarget->setPixmap(QPixmap::fromImage(image));
+	d->fitView();
 }
@@ -19,7 +19,7 @@
 #pragma once
 
 #include <QWidget>
-#include <emuballs/device.hpp>
+#include <emuballs/framesurface.hpp>
 #include "dptr.hpp"
 #include "updateable.hpp"
 
@@ -31,9 +31,9 @@ class Display : public QWidget, public Updateable
 	Q_OBJECT
 
 public:
-	Display(std::shared_ptr<Emuballs::Device> device, QWidget *parent);
+	Display(Emuballs::FrameSurface &frames, QWidget *parent);
 
-	void update() override;
+	void update(const Snapshot &snapshot) override;
 
 protected:
 	virtual void resizeEvent(QResizeEvent *event) override;
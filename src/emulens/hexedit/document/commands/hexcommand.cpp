@@ -1,6 +1,6 @@
 #include "hexcommand.h"
 
-HexCommand::HexCommand(GapBuffer *gapbuffer, QUndoCommand *parent): QUndoCommand(parent), _gapbuffer(gapbuffer), _offset(0), _length(0)
+HexCommand::HexCommand(HexBuffer *buffer, QUndoCommand *parent): QUndoCommand(parent), _buffer(buffer), _offset(0), _length(0)
 {
 
 }
@@ -2,15 +2,15 @@
 #define HEXCOMMAND_H
 
 #include <QUndoCommand>
-#include "../gapbuffer.h"
+#include "../hexbuffer.h"
 
 class HexCommand: public QUndoCommand
 {
     public:
-        HexCommand(GapBuffer* gapbuffer, QUndoCommand* parent = 0);
+        HexCommand(HexBuffer* buffer, QUndoCommand* parent = 0);
 
     protected:
-        GapBuffer* _gapbuffer;
+        HexBuffer* _buffer;
         integer_t _offset, _length;
         QByteArray _data;
 };
@@ -1,6 +1,6 @@
 #include "insertcommand.h"
 
-InsertCommand::InsertCommand(GapBuffer *gapbuffer, integer_t offset, const QByteArray &data, QUndoCommand *parent): HexCommand(gapbuffer, parent)
+InsertCommand::InsertCommand(HexBuffer *buffer, integer_t offset, const QByteArray &data, QUndoCommand *parent): HexCommand(buffer, parent)
 {
     this->_offset = offset;
     this->_data = data;
@@ -8,10 +8,10 @@ InsertCommand::InsertCommand(GapBuffer *gapbuffer, integer_t offset, const QByte
 
 void InsertCommand::undo()
 {
-    this->_gapbuffer->remove(this->_offset, this->_data.length());
+    this->_buffer->remove(this->_offset, this->_data.length());
 }
 
 void InsertCommand::redo()
 {
-    this->_gapbuffer->insert(this->_offset, this->_data);
+    this->_buffer->insert(this->_offset, this->_data);
 }
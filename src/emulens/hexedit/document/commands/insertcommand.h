@@ -6,7 +6,7 @@
 class InsertCommand: public HexCommand
 {
     public:
-        InsertCommand(GapBuffer* gapbuffer, integer_t offset, const QByteArray& data, QUndoCommand* parent = 0);
+        InsertCommand(HexBuffer* buffer, integer_t offset, const QByteArray& data, QUndoCommand* parent = 0);
         virtual void undo();
         virtual void redo();
 };
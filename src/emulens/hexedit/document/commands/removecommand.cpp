@@ -1,6 +1,6 @@
 #include "removecommand.h"
 
-RemoveCommand::RemoveCommand(GapBuffer *gapbuffer, integer_t offset, integer_t length, QUndoCommand *parent): HexCommand(gapbuffer, parent)
+RemoveCommand::RemoveCommand(HexBuffer *buffer, integer_t offset, integer_t length, QUndoCommand *parent): HexCommand(buffer, parent)
 {
     this->_offset = offset;
     this->_length = length;
@@ -8,11 +8,11 @@ RemoveCommand::RemoveCommand(GapBuffer *gapbuffer, integer_t offset, integer_t l
 
 void RemoveCommand::undo()
 {
-    this->_gapbuffer->insert(this->_offset, this->_data);
+    this->_buffer->insert(this->_offset, this->_data);
 }
 
 void RemoveCommand::redo()
 {
-    this->_data = this->_gapbuffer->read(this->_offset, this->_length); // Backup data
-    this->_gapbuffer->remove(this->_offset, this->_length);
+    this->_data = this->_buffer->read(this->_offset, this->_length); // Backup data
+    this->_buffer->remove(this->_offset, this->_length);
 }
@@ -1,6 +1,6 @@
 #include "replacecommand.h"
 
-ReplaceCommand::ReplaceCommand(GapBuffer *gapbuffer, integer_t offset, const QByteArray &data, QUndoCommand *parent): HexCommand(gapbuffer, parent)
+ReplaceCommand::ReplaceCommand(HexBuffer *buffer, integer_t offset, const QByteArray &data, QUndoCommand *parent): HexCommand(buffer, parent)
 {
     this->_offset = offset;
     this->_data = data;
@@ -8,11 +8,11 @@ ReplaceCommand::ReplaceCommand(GapBuffer *gapbuffer, integer_t offset, const QBy
 
 void ReplaceCommand::undo()
 {
-    this->_gapbuffer->replace(this->_offset, this->_olddata);
+    this->_buffer->replace(this->_offset, this->_olddata);
 }
 
 void ReplaceCommand::redo()
 {
-    this->_olddata = this->_gapbuffer->read(this->_offset, this->_data.length());
-    this->_gapbuffer->replace(this->_offset, this->_data);
+    this->_olddata = this->_buffer->read(this->_offset, this->_data.length());
+    this->_buffer->replace(this->_offset, this->_data);
 }
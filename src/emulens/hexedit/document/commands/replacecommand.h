@@ -6,7 +6,7 @@
 class ReplaceCommand: public HexCommand
 {
     public:
-        ReplaceCommand(GapBuffer* gapbuffer, integer_t offset, const QByteArray& data, QUndoCommand* parent = 0);
+        ReplaceCommand(HexBuffer* buffer, integer_t offset, const QByteArray& data, QUndoCommand* parent = 0);
         virtual void undo();
         virtual void redo();
 
@@ -1,15 +1,12 @@
 #ifndef GAPBUFFER_H
 #define GAPBUFFER_H
 
-#include <QByteArray>
 #include <QIODevice>
+#include "hexbuffer.h"
 
 //#define GAP_BUFFER_TIDY
 
-typedef int64_t  sinteger_t;
-typedef uint64_t integer_t;
-
-class GapBuffer
+class GapBuffer: public HexBuffer
 {
     public:
         GapBuffer();
@@ -17,13 +14,13 @@ class GapBuffer
         ~GapBuffer();
 
     public:
-        void insert(integer_t index, const QByteArray& data);
-        void replace(integer_t index, const QByteArray& data);
-        void remove(integer_t index, integer_t len);
-        char at(integer_t index) const;
-        QByteArray read(integer_t index, integer_t len = 0) const;
-        QByteArray toByteArray() const;
-        integer_t length() const;
+        void insert(integer_t index, const QByteArray& data) override;
+        void replace(integer_t index, const QByteArray& data) override;
+        void remove(integer_t index, integer_t len) override;
+        char at(integer_t index) const override;
+        QByteArray read(integer_t index, integer_t len = 0) const override;
+        QByteArray toByteArray() const override;
+        integer_t length() const override;
 
     private:
         integer_t gapLength() const;
@@ -0,0 +1,26 @@
+#ifndef HEXBUFFER_H
+#define HEXBUFFER_H
+
+#include <QByteArray>
+
+typedef int64_t  sinteger_t;
+typedef uint64_t integer_t;
+
+class HexBuffer
+{
+    public:
+        virtual ~HexBuffer() { }
+
+    public:
+        virtual void insert(integer_t index, const QByteArray& data) = 0;
+        virtual void replace(integer_t index, const QByteArray& data) = 0;
+        virtual void remove(integer_t index, integer_t len) = 0;
+        virtual char at(integer_t index) const = 0;
+        // Buffers too large to be held in memory at once may
+        // return an empty array for a read that's too long.
+        virtual QByteArray read(integer_t index, integer_t len = 0) const = 0;
+        virtual QByteArray toByteArray() const = 0;
+        virtual integer_t length() const = 0;
+};
+
+#endif // HEXBUFFER_H
@@ -4,7 +4,7 @@
 #include <QMap>
 #include <QObject>
 #include <QColor>
-#include "../gapbuffer.h"
+#include "../hexbuffer.h"
 
 class QHexMetadataItem : public QObject
 {
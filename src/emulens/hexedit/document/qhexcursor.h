@@ -2,7 +2,7 @@
 #define QHEXCURSOR_H
 
 #include <QObject>
-#include "gapbuffer.h"
+#include "hexbuffer.h"
 
 class QHexCursor : public QObject
 {
@@ -1,4 +1,5 @@
 #include "qhexdocument.h"
+#include "gapbuffer.h"
 #include "commands/insertcommand.h"
 #include "commands/removecommand.h"
 #include "commands/replacecommand.h"
@@ -8,9 +9,9 @@
 #include <QBuffer>
 #include <QFile>
 
-QHexDocument::QHexDocument(QIODevice *device, QObject *parent): QObject(parent), _baseaddress(0)
+QHexDocument::QHexDocument(HexBuffer *buffer, QObject *parent): QObject(parent), _baseaddress(0)
 {
-    this->_gapbuffer = new GapBuffer(device);
+    this->_buffer = buffer;
     this->_cursor = new QHexCursor(this);
     this->_metadata = new QHexMetadata(this);
 
@@ -21,8 +22,8 @@ QHexDocument::QHexDocument(QIODevice *device, QObject *parent): QObject(parent),
 
 QHexDocument::~QHexDocument()
 {
-    delete this->_gapbuffer;
-    this->_gapbuffer = NULL;
+    delete this->_buffer;
+    this->_buffer = NULL;
 }
 
 QHexCursor *QHexDocument::cursor() const
@@ -37,7 +38,7 @@ QHexMetadata *QHexDocument::metadata() const
 
 integer_t QHexDocument::length() const
 {
-    return this->_gapbuffer->length();
+    return this->_buffer->length();
 }
 
 integer_t QHexDocument::baseAddress() const
@@ -57,7 +58,7 @@ bool QHexDocument::canRedo() const
 
 QByteArray QHexDocument::read(integer_t offset, integer_t len)
 {
-    return this->_gapbuffer->read(offset, len);
+    return this->_buffer->read(offset, len);
 }
 
 QByteArray QHexDocument::selectedBytes() const
@@ -65,12 +66,12 @@ QByteArray QHexDocument::selectedBytes() const
     if(!this->_cursor->hasSelection())
         return QByteArray();
 
-    return this->_gapbuffer->read(this->_cursor->selectionStart(), this->_cursor->selectionEnd());
+    return this->_buffer->read(this->_cursor->selectionStart(), this->_cursor->selectionLength());
 }
 
 char QHexDocument::at(integer_t offset) const
 {
-    return this->_gapbuffer->at(offset);
+    return this->_buffer->at(offset);
 }
 
 void QHexDocument::setBaseAddress(integer_t baseaddress)
@@ -87,7 +88,7 @@ QHexDocument *QHexDocument::fromDevice(QIODevice *iodevice)
     if(!iodevice->isOpen())
         iodevice->open(QFile::ReadWrite);
 
-    return new QHexDocument(iodevice);
+    return new QHexDocument(new GapBuffer(iodevice));
 }
 
 QHexDocument *QHexDocument::fromFile(QString filename)
@@ -116,6 +117,11 @@ QHexDocument *QHexDocument::fromMemory(const QByteArray &ba)
     return document;
 }
 
+QHexDocument *QHexDocument::fromBuffer(HexBuffer *buffer)
+{
+    return new QHexDocument(buffer);
+}
+
 void QHexDocument::undo()
 {
     this->_undostack.undo();
@@ -133,8 +139,12 @@ void QHexDocument::cut()
     if(!this->_cursor->hasSelection())
         return;
 
+    QByteArray bytes = this->selectedBytes();
+    if(bytes.isEmpty()) // Selection too large for the buffer to read
+        return;
+
     QClipboard* c = qApp->clipboard();
-    c->setText(QString(this->selectedBytes()));
+    c->setText(QString(bytes));
     this->_cursor->removeSelection();
 }
 
@@ -143,8 +153,12 @@ void QHexDocument::copy()
     if(!this->_cursor->hasSelection())
         return;
 
+    QByteArray bytes = this->selectedBytes();
+    if(bytes.isEmpty()) // Selection too large for the buffer to read
+        return;
+
     QClipboard* c = qApp->clipboard();
-    c->setText(QString(this->selectedBytes()));
+    c->setText(QString(bytes));
 }
 
 void QHexDocument::paste()
@@ -177,19 +191,19 @@ void QHexDocument::replace(integer_t offset, uchar b)
 
 void QHexDocument::insert(integer_t offset, const QByteArray &data)
 {
-    this->_undostack.push(new InsertCommand(this->_gapbuffer, offset, data));
+    this->_undostack.push(new InsertCommand(this->_buffer, offset, data));
     emit documentChanged();
 }
 
 void QHexDocument::replace(integer_t offset, const QByteArray &data)
 {
-    this->_undostack.push(new ReplaceCommand(this->_gapbuffer, offset, data));
+    this->_undostack.push(new ReplaceCommand(this->_buffer, offset, data));
     emit documentChanged();
 }
 
 void QHexDocument::remove(integer_t offset, integer_t len)
 {
-    this->_undostack.push(new RemoveCommand(this->_gapbuffer, offset, len));
+    this->_undostack.push(new RemoveCommand(this->_buffer, offset, len));
     emit documentChanged();
 }
 
@@ -268,7 +282,7 @@ void QHexDocument::endMetadata()
 
 QByteArray QHexDocument::read(integer_t offset, integer_t len) const
 {
-    return this->_gapbuffer->read(offset, len);
+    return this->_buffer->read(offset, len);
 }
 
 bool QHexDocument::saveTo(QIODevice *device)
@@ -276,11 +290,20 @@ bool QHexDocument::saveTo(QIODevice *device)
     if(!device->isWritable())
         return false;
 
-    device->write(this->_gapbuffer->toByteArray());
+    QByteArray bytes = this->_buffer->toByteArray();
+    if(bytes.isEmpty() && this->_buffer->length() > 0)
+        return false;
+
+    device->write(bytes);
     return true;
 }
 
 bool QHexDocument::isEmpty() const
 {
-    return this->_gapbuffer->length() <= 0;
+    return this->_buffer->length() <= 0;
+}
+
+void QHexDocument::refresh()
+{
+    emit documentChanged();
 }
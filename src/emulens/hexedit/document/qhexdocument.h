@@ -3,7 +3,7 @@
 
 #include <QUndoStack>
 #include <QHash>
-#include "gapbuffer.h"
+#include "hexbuffer.h"
 #include "metadata/qhexmetadata.h"
 #include "qhexcursor.h"
 
@@ -15,7 +15,7 @@ class QHexDocument: public QObject
         typedef QHash<integer_t, QHexMetadata*> CommentHash;
 
     private:
-        explicit QHexDocument(QIODevice* device, QObject *parent = 0);
+        explicit QHexDocument(HexBuffer* buffer, QObject *parent = 0);
         ~QHexDocument();
 
     public:
@@ -34,6 +34,7 @@ class QHexDocument: public QObject
         static QHexDocument* fromDevice(QIODevice* iodevice);
         static QHexDocument* fromFile(QString filename);
         static QHexDocument* fromMemory(const QByteArray& ba);
+        static QHexDocument* fromBuffer(HexBuffer* buffer); // Takes ownership
 
     public slots:
         void undo();
@@ -60,6 +61,7 @@ class QHexDocument: public QObject
         QByteArray read(integer_t offset, integer_t len) const;
         bool saveTo(QIODevice* device);
         bool isEmpty() const;
+        void refresh(); // Data changed outside of the document
 
     signals:
         void canUndoChanged();
@@ -70,7 +72,7 @@ class QHexDocument: public QObject
     private:
         CommentHash _comments;
         QUndoStack _undostack;
-        GapBuffer* _gapbuffer;
+        HexBuffer* _buffer;
         QHexCursor* _cursor;
         QHexMetadata* _metadata;
         integer_t _baseaddress;
@@ -18,131 +18,192 @@
  */
 #include "memory.hpp"
 
+#include "cycler.hpp"
+#include "snapshot.hpp"
 #include "ui_memory.h"
 
 #include <emuballs/memory.hpp>
+#include <algorithm>
+#include <list>
+#include <utility>
+
 namespace Emulens
 {
-class MemoryIo : public QIODevice
+/**
+ * Guest memory as the hex editor sees it. Nothing is copied up
+ * front; pages are fetched from the worker as the editor paints
+ * them, and only the few most recently painted ones are kept.
+ */
+class MemoryBuffer : public HexBuffer
 {
 public:
-	MemoryIo(Emuballs::Memory &memory, Emuballs::memsize baseOffset, Emuballs::memsize length)
-		: memory(memory), _base(baseOffset), _length(length)
+	MemoryBuffer(Cycler *cycler, integer_t length, Emuballs::memsize pageSize)
+		: cycler(cycler), _length(length), pageSize(pageSize)
 	{
-		_pos = 0;
 	}
 
-	bool open(OpenMode mode) override
+	/**
+	 * Forget the fetched pages.
+	 */
+	void invalidate()
 	{
-		_pos = 0;
-		return QIODevice::open(mode);
+		pages.clear();
 	}
 
-	qint64 pos() const override
+	/**
+	 * Forget the fetched pages that were written.
+	 *
+	 * @param written
+	 *     Page addresses in ascending order.
+	 * @return true if any of the fetched pages was written.
+	 */
+	bool invalidate(const std::vector<Emuballs::memsize> &written)
 	{
-		return _pos;
+		const auto before = pages.size();
+		pages.remove_if([&](const std::pair<integer_t, QByteArray> &page) {
+				return std::binary_search(written.begin(), written.end(), page.first);
+			});
+		return pages.size() != before;
 	}
 
-	bool reset() override
+	// The memory can't grow or shrink.
+	void insert(integer_t, const QByteArray &) override {}
+	void remove(integer_t, integer_t) override {}
+
+	void replace(integer_t index, const QByteArray &data) override
 	{
-		_pos = 0;
-		return QIODevice::reset();
+		if (index >= _length)
+			return;
+		const auto length = std::min<integer_t>(data.size(), _length - index);
+		cycler->invoke([&](Emuballs::Device &device) {
+				device.memory().putChunk(index,
+					reinterpret_cast<const uint8_t*>(data.constData()), length);
+			});
+		invalidate();
 	}
 
-	qint64 size() const override
+	char at(integer_t index) const override
 	{
-		return _length;
+		return page(index)[static_cast<int>(index % pageSize)];
 	}
 
-	bool isSequential() const override
+	/**
+	 * Reads longer than MAX_READ, like a copy of the whole
+	 * address space, are refused with an empty array.
+	 */
+	QByteArray read(integer_t index, integer_t len = 0) const override
 	{
-		return false;
+		if (index >= _length)
+			return QByteArray();
+		if (len == 0 || len > _length - index)
+			len = _length - index;
+		if (len > MAX_READ)
+			return QByteArray();
+		QByteArray bytes;
+		bytes.reserve(len);
+		while (len > 0)
+		{
+			const integer_t offset = index % pageSize;
+			const integer_t count = std::min<integer_t>(len, pageSize - offset);
+			bytes.append(page(index).constData() + offset, count);
+			index += count;
+			len -= count;
+		}
+		return bytes;
 	}
 
-protected:
-	qint64 readData(char *data, qint64 maxSize) override
+	/**
+	 * Empty, unless the memory fits in MAX_READ.
+	 */
+	QByteArray toByteArray() const override
 	{
-		std::vector<uint8_t> chunk = memory.chunk(_base + _pos, maxSize);
-		_pos += chunk.size();
-		memcpy(data, chunk.data(), chunk.size());
-		return chunk.size();
+		return read(0);
 	}
 
-	qint64 writeData(const char *data, qint64 maxSize) override
+	integer_t length() const override
 	{
-		qint64 written = 0;
-		std::vector<uint8_t> chunk(
-			reinterpret_cast<const uint8_t*>(data),
-			reinterpret_cast<const uint8_t*>(data + maxSize));
-		written = memory.putChunk(_base + _pos, chunk);
-		_pos += written;
-		return written;
+		return _length;
 	}
 
 private:
-	Emuballs::Memory &memory;
-	qint64 _pos;
-	qint64 _base;
-	qint64 _length;
+	/// A screenful of rows spans two pages at most.
+	static const size_t MAX_PAGES = 4;
+	/// Each page of a read goes through the worker, one by one.
+	static const integer_t MAX_READ = 16 * 1024 * 1024;
+
+	Cycler *cycler;
+	integer_t _length;
+	Emuballs::memsize pageSize;
+	/// Most recently used first.
+	mutable std::list<std::pair<integer_t, QByteArray>> pages;
+
+	const QByteArray &page(integer_t index) const
+	{
+		const integer_t address = index - index % pageSize;
+		for (auto it = pages.begin(); it != pages.end(); ++it)
+		{
+			if (it->first == address)
+			{
+				pages.splice(pages.begin(), pages, it);
+				return pages.front().second;
+			}
+		}
+
+		QByteArray bytes(static_cast<int>(pageSize), '\0');
+		cycler->query([&](Emuballs::Device &device) {
+				device.memory().chunk(address, pageSize,
+					reinterpret_cast<uint8_t*>(bytes.data()));
+			});
+		pages.emplace_front(address, bytes);
+		if (pages.size() > MAX_PAGES)
+			pages.pop_back();
+		return pages.front().second;
+	}
 };
 }
 
 DClass<Emulens::Memory> : public Ui::Memory
 {
 public:
-	std::shared_ptr<Emuballs::Device> device;
-	Emuballs::memsize offset = 0;
+	Emulens::MemoryBuffer *buffer;
 	QHexDocument *document;
-
-	std::shared_ptr<QIODevice> io()
-	{
-		auto io = std::shared_ptr<QIODevice>(new Emulens::MemoryIo(
-				device->memory(), offset, device->memory().pageSize()));
-		io->open(QIODevice::ReadWrite);
-		return io;
-	}
-
-	std::shared_ptr<QIODevice> io(Emuballs::memsize offset)
-	{
-		this->offset = offset;
-		return io();
-	}
 };
 
 using namespace Emulens;
 
 DPointeredNoCopy(Memory);
 
-Memory::Memory(std::shared_ptr<Emuballs::Device> device, QWidget *parent)
+Memory::Memory(std::shared_ptr<Emuballs::Device> device, Cycler *cycler, QWidget *parent)
 	: QWidget(parent)
 {
 	d->setupUi(this);
-	d->device = device;
+	// The whole 32-bit address space is browsable.
+	const integer_t length = std::min<integer_t>(
+		device->memory().size(), integer_t(1) << 32);
+	d->buffer = new MemoryBuffer(cycler, length, device->memory().pageSize());
+	d->document = QHexDocument::fromBuffer(d->buffer);
+	d->document->setParent(this);
+	d->hexEdit->setDocument(d->document);
 	d->hexEdit->setOverwriteOnly(true);
 }
 
-void Memory::savePage()
-{
-	std::shared_ptr<QIODevice> device = d->io();
-	d->document->saveTo(device.get());
-}
-
 void Memory::showOffsetFromListItem(QListWidgetItem *item)
 {
 	Emuballs::memsize offset = item->text().toULongLong(Q_NULLPTR, 16);
-	// TODO: Something wicked is going on here: I can't find any place
-	// where document is deleted. It should be investigated further.
-	std::shared_ptr<QIODevice> device = d->io(offset);
-	d->document = QHexDocument::fromDevice(device.get());
-	d->document->setBaseAddress(offset);
-	connect(d->document, &QHexDocument::documentChanged, this, &Memory::savePage);
-	d->hexEdit->setDocument(d->document);
+	d->document->cursor()->setOffset(offset);
 }
 
-void Memory::update()
+void Memory::update(const Snapshot &snapshot)
 {
-	std::vector<Emuballs::memsize> pages = d->device->memory().allocatedPages();
-	d->pagesList->clear();
-	for (Emuballs::memsize page : pages)
-		d->pagesList->addItem(QString("%1").arg(static_cast<size_t>(page), 8, 16, QChar('0')));
+	if (snapshot.pagesChanged)
+	{
+		d->pagesList->clear();
+		for (Emuballs::memsize page : snapshot.pages)
+			d->pagesList->addItem(QString("%1").arg(static_cast<size_t>(page), 8, 16, QChar('0')));
+	}
+
+	// Only the pages on screen are cached, so unless the guest wrote
+	// to them, there's nothing to fetch or repaint.
+	if (d->buffer->invalidate(snapshot.writtenPages))
+		d->document->refresh();
 }
@@ -27,21 +27,22 @@
 namespace Emulens
 {
 
+class Cycler;
+
 class Memory : public QWidget, public Updateable
 {
 	Q_OBJECT
 
 public:
-	Memory(std::shared_ptr<Emuballs::Device> device, QWidget *parent);
+	Memory(std::shared_ptr<Emuballs::Device> device, Cycler *cycler, QWidget *parent);
 
-	void update() override;
+	void update(const Snapshot &snapshot) override;
 
 private:
 	DPtr<Memory> d;
 
 private slots:
 	void showOffsetFromListItem(QListWidgetItem *item);
-	void savePage();
 };
 
 }
@@ -18,19 +18,25 @@
  */
 #include "registers.hpp"
 
+#include "cycler.hpp"
+#include "snapshot.hpp"
 #include "ui_registers.h"
 
 #include <emuballs/registerset.hpp>
 #include <emuballs/regval.hpp>
 #include <strings.hpp>
 #include <QDebug>
+#include <algorithm>
+#include <vector>
 
 using namespace Emulens;
 
 DClass<Registers> : public Ui::Registers
 {
 public:
-	std::shared_ptr<Emuballs::Device> device;
+	Cycler *cycler;
+	/// In the order of RegisterSet::registers().
+	std::vector<QString> ids;
 
 	QString regId(const Emuballs::NamedRegister &reg)
 	{
@@ -40,34 +46,35 @@ public:
 
 DPointeredNoCopy(Registers)
 
-Registers::Registers(std::shared_ptr<Emuballs::Device> device, QWidget *parent)
+Registers::Registers(std::shared_ptr<Emuballs::Device> device, Cycler *cycler, QWidget *parent)
 	: QWidget(parent)
 {
 	d->setupUi(this);
 
-	d->device = device;
+	d->cycler = cycler;
 
 	d->editArray->setInputMask("hhhhhhhh");
-	Emuballs::RegisterSet &regs = d->device->registers();
+	Emuballs::RegisterSet &regs = device->registers();
 	for (const Emuballs::NamedRegister &reg : regs.registers())
 	{
 		d->editArray->addEditor(
 			QString::fromStdString(Strings::concat(reg.names(), ",")),
 			d->regId(reg));
+		d->ids.push_back(d->regId(reg));
 	}
-	update();
 }
 
 void Registers::setRegisterToHex(const QString &regName, const QString &hexValue)
 {
-	Emuballs::RegisterSet &regs = d->device->registers();
 	bool ok = false;
 	auto value = hexValue.toUInt(&ok, 16);
 	qDebug() << "Emulens::Registers - setting register" << regName << " to " << hexValue;
 	if (ok)
 	{
-		regs.setReg(regName.toStdString(), value);
-		update();
+		// The worker publishes a snapshot with the new value.
+		d->cycler->invoke([&](Emuballs::Device &device) {
+				device.registers().setReg(regName.toStdString(), value);
+			});
 	}
 	else
 	{
@@ -75,13 +82,15 @@ void Registers::setRegisterToHex(const QString &regName, const QString &hexValue
 	}
 }
 
-void Registers::update()
+void Registers::update(const Snapshot &snapshot)
 {
-	Emuballs::RegisterSet &regs = d->device->registers();
-	for (const Emuballs::NamedRegister &reg : regs.registers())
+	const size_t count = std::min(snapshot.registers.size(), d->ids.size());
+	for (size_t i = 0; i < count; ++i)
 	{
-		QString hexValue = QString::number(reg.value(), 16);
+		if (i < 64 && (snapshot.changedRegisters & (uint64_t(1) << i)) == 0)
+			continue;
+		QString hexValue = QString::number(snapshot.registers[i], 16);
 		hexValue = hexValue.rightJustified(8, '0');
-		d->editArray->setValue(d->regId(reg), hexValue);
+		d->editArray->setValue(d->ids[i], hexValue);
 	}
 }
@@ -27,14 +27,20 @@
 namespace Emulens
 {
 
+class Cycler;
+
 class Registers : public QWidget, public Updateable
 {
 	Q_OBJECT
 
 public:
-	Registers(std::shared_ptr<Emuballs::Device> device, QWidget *parent);
+	/**
+	 * Registers are listed as the `device` has them; it must not be
+	 * running on the `cycler` yet.
+	 */
+	Registers(std::shared_ptr<Emuballs::Device> device, Cycler *cycler, QWidget *parent);
 
-	void update() override;
+	void update(const Snapshot &snapshot) override;
 
 private:
 	DPtr<Registers> d;
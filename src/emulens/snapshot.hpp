@@ -0,0 +1,58 @@
+/*
+ * Copyright 2016 Zalewa <zalewapl@gmail.com>.
+ *
+ * This file is part of Emulens.
+ *
+ * Emulens is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Emulens is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Emulens.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#pragma once
+
+#include <emuballs/memory.hpp>
+#include <cstdint>
+#include <vector>
+
+namespace Emulens
+{
+
+/**
+ * State of the device as the views see it, taken by the Cycler
+ * in between the cycles. Views never touch the device directly
+ * while it runs on the worker thread; they get these instead.
+ * The display goes through Cycler::frames() and the memory
+ * contents are fetched by the Memory view as it paints them.
+ */
+struct Snapshot
+{
+	/**
+	 * Register values, in the order of RegisterSet::registers().
+	 */
+	std::vector<uint32_t> registers;
+	/**
+	 * Bit per register that changed since the previous snapshot;
+	 * registers past the 64th are always marked.
+	 */
+	uint64_t changedRegisters = 0;
+	/**
+	 * Allocated pages; only filled in when they changed.
+	 */
+	std::vector<Emuballs::memsize> pages;
+	bool pagesChanged = false;
+	/**
+	 * Pages written since the previous snapshot, in ascending order.
+	 */
+	std::vector<Emuballs::memsize> writtenPages;
+	bool running = false;
+};
+
+}
@@ -21,10 +21,12 @@
 namespace Emulens
 {
 
+struct Snapshot;
+
 class Updateable
 {
 public:
-	virtual void update() = 0;
+	virtual void update(const Snapshot &snapshot) = 0;
 };
 
 }
@@ -0,0 +1,352 @@
+/*
+ * Copyright 2017 Zalewa <zalewapl@gmail.com>.
+ *
+ * This file is part of Emuballs Emurun.
+ *
+ * Emuballs Emurun is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Emuballs Emurun is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Emuballs Emurun.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include "batch.hpp"
+
+#include <chrono>
+#include <fstream>
+#include <iomanip>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <sstream>
+#include <stdexcept>
+#include <thread>
+
+#include "emuballs/device.hpp"
+#include "emuballs/programmer.hpp"
+#include "emuballs/registerset.hpp"
+#include "emuballs/regval.hpp"
+
+namespace Batch
+{
+
+namespace
+{
+typedef std::shared_ptr<const std::string> Program;
+
+struct Result
+{
+	bool done = false;
+	std::string error;
+	int64_t cycles = 0;
+	int64_t wallMicroseconds = 0;
+	std::vector<std::pair<std::string, uint32_t>> registers;
+};
+
+std::vector<std::string> split(const std::string &line, char separator)
+{
+	std::vector<std::string> fields;
+	std::stringstream ss(line);
+	std::string field;
+	while (std::getline(ss, field, separator))
+		fields.push_back(field);
+	return fields;
+}
+
+std::string hex(uint32_t value)
+{
+	std::stringstream ss;
+	ss << "0x" << std::hex << value;
+	return ss.str();
+}
+
+std::string csvField(const std::string &value)
+{
+	if (value.find_first_of(",\"\n") == std::string::npos)
+		return value;
+	std::string quoted = "\"";
+	for (char c : value)
+	{
+		if (c == '"')
+			quoted += '"';
+		quoted += c;
+	}
+	return quoted + "\"";
+}
+
+std::string jsonString(const std::string &value)
+{
+	std::stringstream ss;
+	ss << '"';
+	for (char c : value)
+	{
+		switch (c)
+		{
+		case '"': ss << "\\\""; break;
+		case '\\': ss << "\\\\"; break;
+		case '\n': ss << "\\n"; break;
+		case '\t': ss << "\\t"; break;
+		default:
+			if (static_cast<unsigned char>(c) < 0x20)
+				ss << "\\u" << std::hex << std::setw(4) << std::setfill('0') << int(c) << std::dec;
+			else
+				ss << c;
+		}
+	}
+	ss << '"';
+	return ss.str();
+}
+
+Emuballs::DevicePtr createDevice(const std::string &name)
+{
+	for (auto factory : Emuballs::listDevices())
+	{
+		if (factory.name() == name)
+			return factory.create();
+	}
+	return nullptr;
+}
+
+void execute(const Job &job, const Program &program, Result &result,
+	const std::atomic<bool> &keepRunning)
+{
+	auto start = std::chrono::steady_clock::now();
+	if (program == nullptr)
+		throw std::runtime_error("program file cannot be opened");
+	Emuballs::DevicePtr device = createDevice(job.deviceName);
+	if (device == nullptr)
+		throw std::runtime_error("wrong device name");
+	std::stringstream stream(*program);
+	device->programmer().load(stream);
+	for (const auto &reg : job.registers)
+		device->registers().setReg(reg.first, reg.second);
+
+	while (keepRunning && result.cycles < job.cycles)
+	{
+		int cycles = 10000;
+		if (job.cycles - result.cycles < cycles)
+			cycles = job.cycles - result.cycles;
+		device->cycle(cycles);
+		result.cycles += cycles;
+	}
+
+	result.wallMicroseconds = std::chrono::duration_cast<std::chrono::microseconds>(
+		std::chrono::steady_clock::now() - start).count();
+	for (Emuballs::NamedRegister &reg : device->registers().registers())
+		result.registers.emplace_back(reg.names().front(), reg.value());
+}
+
+/**
+ * Names of the registers of the first job's device, or of the first
+ * job after it that names a known device. Jobs are expected to run
+ * devices of the same architecture.
+ */
+std::vector<std::string> registerColumns(const std::vector<Job> &jobs)
+{
+	std::vector<std::string> columns;
+	for (const Job &job : jobs)
+	{
+		Emuballs::DevicePtr device = createDevice(job.deviceName);
+		if (device == nullptr)
+			continue;
+		for (Emuballs::NamedRegister &reg : device->registers().registers())
+			columns.push_back(reg.names().front());
+		break;
+	}
+	return columns;
+}
+
+class Writer
+{
+public:
+	Writer(const std::vector<Job> &jobs, Format format, std::ostream &out)
+		: jobs(jobs), format(format), out(out)
+	{
+	}
+
+	/**
+	 * Write what comes before the first result: the CSV header.
+	 */
+	void begin()
+	{
+		if (format != Format::Csv)
+			return;
+		columns = registerColumns(jobs);
+		out << "job,device,program,status,error,cycles,wall_us";
+		for (const auto &column : columns)
+			out << "," << csvField(column);
+		out << std::endl;
+	}
+
+	void write(size_t index, const Result &result)
+	{
+		if (format == Format::Csv)
+			writeCsv(index, result);
+		else
+			writeJson(index, result);
+		out.flush();
+	}
+
+private:
+	const std::vector<Job> &jobs;
+	Format format;
+	std::ostream &out;
+	std::vector<std::string> columns;
+
+	void writeCsv(size_t index, const Result &result)
+	{
+		const Job &job = jobs[index];
+		out << index << "," << csvField(job.deviceName) << "," << csvField(job.programPath)
+			<< "," << (result.error.empty() ? "ok" : "error") << "," << csvField(result.error)
+			<< "," << result.cycles << "," << result.wallMicroseconds;
+		std::map<std::string, uint32_t> registers(result.registers.begin(), result.registers.end());
+		for (const auto &column : columns)
+		{
+			out << ",";
+			auto reg = registers.find(column);
+			if (reg != registers.end())
+				out << hex(reg->second);
+		}
+		out << std::endl;
+	}
+
+	void writeJson(size_t index, const Result &result)
+	{
+		const Job &job = jobs[index];
+		out << "{\"job\":" << index
+			<< ",\"device\":" << jsonString(job.deviceName)
+			<< ",\"program\":" << jsonString(job.programPath)
+			<< ",\"status\":" << (result.error.empty() ? "\"ok\"" : "\"error\"");
+		if (!result.error.empty())
+			out << ",\"error\":" << jsonString(result.error);
+		out << ",\"cycles\":" << result.cycles
+			<< ",\"wall_us\":" << result.wallMicroseconds
+			<< ",\"registers\":{";
+		bool first = true;
+		for (const auto &reg : result.registers)
+		{
+			if (!first)
+				out << ",";
+			out << jsonString(reg.first) << ":" << jsonString(hex(reg.second));
+			first = false;
+		}
+		out << "}}" << std::endl;
+	}
+};
+}
+
+std::vector<Job> loadManifest(std::istream &manifest)
+{
+	std::vector<Job> jobs;
+	std::string line;
+	for (size_t lineNumber = 1; std::getline(manifest, line); ++lineNumber)
+	{
+		if (!line.empty() && line.back() == '\r')
+			line.pop_back();
+		if (line.empty() || line[0] == '#')
+			continue;
+		auto error = [lineNumber](const std::string &what) {
+			return std::runtime_error("manifest line " + std::to_string(lineNumber)
+				+ ": " + what);
+		};
+		std::vector<std::string> fields = split(line, '\t');
+		if (fields.size() < 3 || fields.size() > 4)
+			throw error("expected 3 or 4 tab-separated fields");
+		Job job;
+		job.deviceName = fields[0];
+		job.programPath = fields[1];
+		try
+		{
+			job.cycles = std::stoll(fields[2]);
+			if (fields.size() == 4)
+			{
+				for (const auto &assignment : split(fields[3], ','))
+				{
+					size_t equals = assignment.find('=');
+					if (equals == std::string::npos)
+						throw error("register must be given as name=value");
+					job.registers.emplace_back(assignment.substr(0, equals),
+						std::stoul(assignment.substr(equals + 1), nullptr, 0));
+				}
+			}
+		}
+		catch (const std::logic_error &)
+		{
+			throw error("invalid number");
+		}
+		if (job.cycles < 0)
+			throw error("cycles can't be negative");
+		jobs.push_back(job);
+	}
+	return jobs;
+}
+
+size_t run(const std::vector<Job> &jobs, unsigned workers, Format format,
+	std::ostream &out, const std::atomic<bool> &keepRunning)
+{
+	std::map<std::string, Program> programs;
+	for (const Job &job : jobs)
+	{
+		if (programs.count(job.programPath) > 0)
+			continue;
+		Program &program = programs[job.programPath];
+		std::ifstream file(job.programPath, std::ios::in | std::ios::binary);
+		if (file.is_open())
+		{
+			program = std::make_shared<const std::string>(
+				std::istreambuf_iterator<char>(file), std::istreambuf_iterator<char>());
+		}
+	}
+
+	std::vector<Result> results(jobs.size());
+	std::atomic<size_t> nextJob {0};
+	std::mutex writeMutex;
+	size_t nextWrite = 0;
+	size_t failed = 0;
+	Writer writer(jobs, format, out);
+	writer.begin();
+
+	auto work = [&]() {
+		for (size_t index; (index = nextJob++) < jobs.size(); )
+		{
+			Result result;
+			try
+			{
+				execute(jobs[index], programs.at(jobs[index].programPath), result, keepRunning);
+			}
+			catch (const std::exception &e)
+			{
+				result.error = e.what();
+			}
+			result.done = true;
+
+			// Results are written in the manifest order, as soon
+			// as all the preceding ones are in.
+			std::lock_guard<std::mutex> lock(writeMutex);
+			results[index] = std::move(result);
+			for (; nextWrite < results.size() && results[nextWrite].done; ++nextWrite)
+			{
+				if (!results[nextWrite].error.empty())
+					++failed;
+				writer.write(nextWrite, results[nextWrite]);
+				results[nextWrite] = Result();
+				results[nextWrite].done = true;
+			}
+		}
+	};
+
+	std::vector<std::thread> threads;
+	for (unsigned i = 0; i < std::max(workers, 1u); ++i)
+		threads.emplace_back(work);
+	for (auto &thread : threads)
+		thread.join();
+	return failed;
+}
+
+}
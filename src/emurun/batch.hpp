@@ -0,0 +1,71 @@
+/*
+ * Copyright 2017 Zalewa <zalewapl@gmail.com>.
+ *
+ * This file is part of Emuballs Emurun.
+ *
+ * Emuballs Emurun is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Emuballs Emurun is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Emuballs Emurun.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <istream>
+#include <ostream>
+#include <string>
+#include <utility>
+#include <vector>
+
+namespace Batch
+{
+
+/**
+ * Single device run described by a manifest line.
+ */
+struct Job
+{
+	std::string deviceName;
+	std::string programPath;
+	int64_t cycles;
+	std::vector<std::pair<std::string, uint32_t>> registers;
+};
+
+enum class Format
+{
+	Csv,
+	JsonLines
+};
+
+/**
+ * Manifest has one job per line, with tab-separated fields:
+ *
+ *     <Device Name> <program_path> <cycles> [reg=value,reg=value...]
+ *
+ * Empty lines and lines starting with '#' are skipped.
+ * Register values can be given in decimal, hex or octal.
+ *
+ * @throw std::runtime_error if manifest is malformed.
+ */
+std::vector<Job> loadManifest(std::istream &manifest);
+
+/**
+ * Run all jobs on `workers` threads and write results to `out`
+ * in the manifest order. Each program is read from the disk
+ * only once, no matter how many jobs use it.
+ *
+ * @return Amount of failed jobs.
+ */
+size_t run(const std::vector<Job> &jobs, unsigned workers, Format format,
+	std::ostream &out, const std::atomic<bool> &keepRunning);
+
+}
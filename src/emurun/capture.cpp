@@ -0,0 +1,406 @@
+/*
+ * Copyright 2017 Zalewa <zalewapl@gmail.com>.
+ *
+ * This file is part of Emuballs Emurun.
+ *
+ * Emuballs Emurun is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Emuballs Emurun is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Emuballs Emurun.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include "capture.hpp"
+
+#include <algorithm>
+#include <cctype>
+#include <cstring>
+#include <iomanip>
+#include <sstream>
+#include <stdexcept>
+
+#include "emuballs/canvas.hpp"
+#include "emuballs/device.hpp"
+
+namespace Capture
+{
+
+/**
+ * Keeps the whole display as 0xAARRGGBB and notes whether
+ * a draw changed any of it.
+ */
+class FrameCanvas : public Emuballs::Canvas
+{
+public:
+	int32_t width = 0;
+	int32_t height = 0;
+	std::vector<uint32_t> pixels;
+	bool changed = false;
+
+	void begin() override
+	{
+	}
+
+	void end() override
+	{
+	}
+
+	void drawRow(int32_t x, int32_t y, int32_t width, const uint32_t *rgb32) override
+	{
+		if (y < 0 || y >= height || x < 0 || x + width > this->width)
+			return;
+		uint32_t *row = pixels.data() + y * this->width + x;
+		// Rows are redrawn when their pages are written, which
+		// doesn't always change them.
+		if (std::memcmp(row, rgb32, width * sizeof(uint32_t)) != 0)
+		{
+			std::copy(rgb32, rgb32 + width, row);
+			changed = true;
+		}
+	}
+
+	void drawPixel(int32_t x, int32_t y, const Emuballs::Color &color) override
+	{
+		uint32_t pixel = (static_cast<uint32_t>(color.a) << 24)
+			| (static_cast<uint32_t>(color.r) << 16)
+			| (static_cast<uint32_t>(color.g) << 8)
+			| color.b;
+		drawRow(x, y, 1, &pixel);
+	}
+
+	void changeSize(int32_t width, int32_t height, Emuballs::BitDepth) override
+	{
+		this->width = width;
+		this->height = height;
+		pixels.assign(static_cast<size_t>(width) * height, 0xff000000);
+		changed = true;
+	}
+};
+
+namespace
+{
+const std::string Y4M_EXTENSION = ".y4m";
+
+uint64_t gcd(uint64_t a, uint64_t b)
+{
+	while (b != 0)
+	{
+		uint64_t rest = a % b;
+		a = b;
+		b = rest;
+	}
+	return a;
+}
+
+uint8_t clampByte(int32_t value)
+{
+	return static_cast<uint8_t>(std::min(std::max(value, 0), 255));
+}
+
+/**
+ * Planar 4:2:0 frame; chroma is taken from the average colour
+ * of each 2x2 block. Integer full-range BT.601 coefficients.
+ */
+void encodeYuv420(int32_t width, int32_t height, const std::vector<uint32_t> &pixels,
+	std::vector<uint8_t> &yuv)
+{
+	const int32_t chromaWidth = (width + 1) / 2;
+	const int32_t chromaHeight = (height + 1) / 2;
+	const size_t lumaSize = static_cast<size_t>(width) * height;
+	const size_t chromaSize = static_cast<size_t>(chromaWidth) * chromaHeight;
+	yuv.resize(lumaSize + 2 * chromaSize);
+	uint8_t *luma = yuv.data();
+	uint8_t *cb = luma + lumaSize;
+	uint8_t *cr = cb + chromaSize;
+	for (size_t i = 0; i < lumaSize; ++i)
+	{
+		int32_t r = (pixels[i] >> 16) & 0xff;
+		int32_t g = (pixels[i] >> 8) & 0xff;
+		int32_t b = pixels[i] & 0xff;
+		luma[i] = clampByte((77 * r + 150 * g + 29 * b + 128) >> 8);
+	}
+	for (int32_t cy = 0; cy < chromaHeight; ++cy)
+	{
+		for (int32_t cx = 0; cx < chromaWidth; ++cx)
+		{
+			int32_t r = 0, g = 0, b = 0, count = 0;
+			for (int32_t y = cy * 2; y < std::min(cy * 2 + 2, height); ++y)
+			{
+				for (int32_t x = cx * 2; x < std::min(cx * 2 + 2, width); ++x)
+				{
+					uint32_t pixel = pixels[static_cast<size_t>(y) * width + x];
+					r += (pixel >> 16) & 0xff;
+					g += (pixel >> 8) & 0xff;
+					b += pixel & 0xff;
+					++count;
+				}
+			}
+			r /= count;
+			g /= count;
+			b /= count;
+			size_t i = static_cast<size_t>(cy) * chromaWidth + cx;
+			cb[i] = clampByte(((-43 * r - 85 * g + 128 * b + 128) >> 8) + 128);
+			cr[i] = clampByte(((128 * r - 107 * g - 21 * b + 128) >> 8) + 128);
+		}
+	}
+}
+}
+
+Recorder::Recorder(const std::string &path, uint64_t interval, size_t queueLength,
+	bool threaded)
+	: interval(interval), queueLength(queueLength), threaded(threaded)
+{
+	if (interval == 0)
+		throw std::runtime_error("capture interval must be above 0");
+	if (path.size() > Y4M_EXTENSION.size()
+		&& path.compare(path.size() - Y4M_EXTENSION.size(), Y4M_EXTENSION.size(), Y4M_EXTENSION) == 0)
+	{
+		format = Format::Y4m;
+		stream.open(path, std::ios::out | std::ios::binary | std::ios::trunc);
+		if (!stream.is_open())
+			throw std::runtime_error("capture file cannot be opened");
+	}
+	else
+	{
+		format = Format::Ppm;
+		size_t percent = path.find('%');
+		size_t pos = percent + 1;
+		if (percent != std::string::npos && pos < path.size() && path[pos] == '0')
+		{
+			numberFill = '0';
+			++pos;
+		}
+		size_t digits = pos;
+		while (digits < path.size() && std::isdigit(static_cast<unsigned char>(path[digits])))
+			++digits;
+		if (percent == std::string::npos || digits >= path.size() || path[digits] != 'd'
+			|| path.find('%', digits) != std::string::npos)
+		{
+			throw std::runtime_error("capture path must end with " + Y4M_EXTENSION
+				+ " or have a frame number, like frame%06d.ppm");
+		}
+		pathPrefix = path.substr(0, percent);
+		pathSuffix = path.substr(digits + 1);
+		if (digits > pos)
+			numberWidth = std::stoi(path.substr(pos, digits - pos));
+	}
+	canvas.reset(new FrameCanvas());
+	if (threaded)
+		writer = std::thread([this]() { write(); });
+}
+
+Recorder::~Recorder()
+{
+	finish();
+}
+
+void Recorder::capture(Emuballs::Device &device, uint64_t guestTime)
+{
+	capture([&device](Emuballs::Canvas &canvas) { device.draw(canvas); }, guestTime);
+}
+
+void Recorder::capture(const std::function<void(Emuballs::Canvas&)> &draw, uint64_t guestTime)
+{
+	uint64_t lastTick = guestTime / interval;
+	if (lastTick < nextTick)
+		return;
+	// Ticks that elapsed at once, like over a skipped idle loop,
+	// all show the same frame.
+	uint64_t ticks = lastTick - nextTick + 1;
+	uint64_t tick = nextTick;
+	nextTick = lastTick + 1;
+
+	canvas->changed = false;
+	draw(*canvas);
+	if (canvas->pixels.empty() || (!canvas->changed && anyQueued))
+	{
+		unchanged += ticks;
+		if (format == Format::Y4m)
+			owedHolds += ticks;
+		return;
+	}
+	unchanged += ticks - 1;
+	Frame frame;
+	frame.tick = tick;
+	frame.holdBefore = 0;
+	frame.count = ticks;
+	frame.width = canvas->width;
+	frame.height = canvas->height;
+	frame.pixels = std::make_shared<std::vector<uint32_t>>(canvas->pixels);
+	enqueue(std::move(frame));
+}
+
+void Recorder::enqueue(Frame frame)
+{
+	std::lock_guard<std::mutex> lock(queueLock);
+	if (finishing)
+		return;
+	if (queue.size() >= queueLength)
+	{
+		// Resent with the next capture, changed or not.
+		++dropped;
+		anyQueued = false;
+		if (format == Format::Y4m)
+			owedHolds += frame.count;
+		return;
+	}
+	frame.holdBefore = owedHolds;
+	owedHolds = 0;
+	queue.push_back(std::move(frame));
+	anyQueued = true;
+	++captured;
+	queueChanged.notify_one();
+}
+
+std::string Recorder::finish()
+{
+	{
+		std::lock_guard<std::mutex> lock(queueLock);
+		if (!finishing && owedHolds > 0)
+		{
+			Frame holds;
+			holds.tick = nextTick;
+			holds.holdBefore = owedHolds;
+			holds.count = 0;
+			holds.width = 0;
+			holds.height = 0;
+			queue.push_back(holds);
+			owedHolds = 0;
+		}
+		finishing = true;
+	}
+	queueChanged.notify_one();
+	if (writer.joinable())
+		writer.join();
+	else
+		while (writeNext(false)) {}
+	if (stream.is_open())
+		stream.close();
+	return error;
+}
+
+void Recorder::flush()
+{
+	if (threaded)
+		return;
+	while (writeNext(false)) {}
+}
+
+void Recorder::write()
+{
+	while (writeNext(true)) {}
+}
+
+bool Recorder::writeNext(bool wait)
+{
+	Frame frame;
+	{
+		std::unique_lock<std::mutex> lock(queueLock);
+		if (wait)
+			queueChanged.wait(lock, [this]() { return finishing || !queue.empty(); });
+		if (queue.empty())
+			return false;
+		frame = std::move(queue.front());
+		queue.pop_front();
+	}
+	try
+	{
+		writeFrame(frame);
+	}
+	catch (const std::exception &e)
+	{
+		std::lock_guard<std::mutex> lock(queueLock);
+		error = e.what();
+		finishing = true;
+		queue.clear();
+		return false;
+	}
+	return true;
+}
+
+void Recorder::writeFrame(const Frame &frame)
+{
+	switch (format)
+	{
+	case Format::Y4m:
+		writeY4m(frame);
+		break;
+	case Format::Ppm:
+		writePpm(frame);
+		break;
+	}
+}
+
+void Recorder::writeY4m(const Frame &frame)
+{
+	auto writeLast = [this](uint64_t times)
+	{
+		// Nothing to hold before the first frame.
+		for (uint64_t i = 0; i < times && !lastEncoded.empty(); ++i)
+		{
+			stream << "FRAME\n";
+			stream.write(reinterpret_cast<const char*>(lastEncoded.data()), lastEncoded.size());
+		}
+	};
+	writeLast(frame.holdBefore);
+	if (frame.pixels != nullptr)
+	{
+		if (lastEncoded.empty())
+		{
+			uint64_t divisor = gcd(1000000, interval);
+			stream << "YUV4MPEG2 W" << frame.width << " H" << frame.height
+				<< " F" << 1000000 / divisor << ":" << interval / divisor
+				<< " Ip A1:1 C420jpeg\n";
+			streamWidth = frame.width;
+			streamHeight = frame.height;
+		}
+		else if (frame.width != streamWidth || frame.height != streamHeight)
+		{
+			std::stringstream ss;
+			ss << "display changed to " << frame.width << "x" << frame.height
+				<< ", but Y4M stream must stay " << streamWidth << "x" << streamHeight;
+			throw std::runtime_error(ss.str());
+		}
+		encodeYuv420(frame.width, frame.height, *frame.pixels, lastEncoded);
+	}
+	writeLast(frame.count);
+	if (!stream)
+		throw std::runtime_error("capture file cannot be written");
+}
+
+void Recorder::writePpm(const Frame &frame)
+{
+	if (frame.pixels == nullptr)
+		return;
+	std::string path = ppmPath(frame.tick);
+	std::ofstream file(path, std::ios::out | std::ios::binary | std::ios::trunc);
+	if (!file.is_open())
+		throw std::runtime_error("capture file " + path + " cannot be opened");
+	file << "P6\n" << frame.width << " " << frame.height << "\n255\n";
+	std::vector<uint8_t> rgb(frame.pixels->size() * 3);
+	for (size_t i = 0; i < frame.pixels->size(); ++i)
+	{
+		uint32_t pixel = (*frame.pixels)[i];
+		rgb[i * 3] = pixel >> 16;
+		rgb[i * 3 + 1] = pixel >> 8;
+		rgb[i * 3 + 2] = pixel;
+	}
+	file.write(reinterpret_cast<const char*>(rgb.data()), rgb.size());
+	if (!file)
+		throw std::runtime_error("capture file " + path + " cannot be written");
+}
+
+std::string Recorder::ppmPath(uint64_t tick) const
+{
+	std::stringstream ss;
+	ss << pathPrefix << std::setw(numberWidth) << std::setfill(numberFill) << tick << pathSuffix;
+	return ss.str();
+}
+
+}
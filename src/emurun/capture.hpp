@@ -0,0 +1,184 @@
+/*
+ * Copyright 2017 Zalewa <zalewapl@gmail.com>.
+ *
+ * This file is part of Emuballs Emurun.
+ *
+ * Emuballs Emurun is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Emuballs Emurun is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Emuballs Emurun.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#pragma once
+
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <fstream>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace Emuballs
+{
+class Canvas;
+class Device;
+}
+
+namespace Capture
+{
+
+class FrameCanvas;
+
+enum class Format
+{
+	/** Single YUV4MPEG2 stream, 4:2:0 with full-range BT.601 colours. */
+	Y4m,
+	/** Sequence of binary PPM files. */
+	Ppm
+};
+
+/**
+ * Captures the display of a Device every `interval` of guest time.
+ *
+ * Frames are encoded and written by a writer thread. The queue of
+ * frames waiting for it is bounded; when it's full, frames are dropped
+ * rather than stalling the emulation. Frames in which nothing changed
+ * are not queued at all. The Y4M stream repeats the previous frame
+ * instead, to keep its frame rate, and the PPM sequence skips them;
+ * PPM files are numbered by the first capture tick they show,
+ * so the gaps show how long a frame was held.
+ *
+ * A dropped frame is sent again with the next capture, whether
+ * it changed or not. Y4M holds owed by the time of finish() are
+ * written as repeats of the last frame, so the stream covers
+ * all the captured time.
+ */
+class Recorder
+{
+public:
+	/**
+	 * @param path
+	 *     Path ending with ".y4m" gives a Y4M stream. Any other path
+	 *     is a pattern of PPM file names with a single printf-like
+	 *     frame number, like "frame%06d.ppm". As with printf, the
+	 *     number is padded to the width with spaces, or with zeros
+	 *     if the width starts with 0.
+	 * @param interval
+	 *     Guest time between the frames, in microseconds.
+	 * @param threaded
+	 *     Without the writer thread, the queued frames are only
+	 *     written by flush() and finish(), on the calling thread.
+	 * @throw std::runtime_error on bad path or interval.
+	 */
+	Recorder(const std::string &path, uint64_t interval, size_t queueLength = 8,
+		bool threaded = true);
+	~Recorder();
+
+	/**
+	 * Capture the frames due by `guestTime`. Call between the device
+	 * cycles, on the thread that runs them.
+	 */
+	void capture(Emuballs::Device &device, uint64_t guestTime);
+	/**
+	 * Capture the frames due by `guestTime`, as drawn
+	 * by `draw` on the capture canvas.
+	 */
+	void capture(const std::function<void(Emuballs::Canvas&)> &draw, uint64_t guestTime);
+	/**
+	 * Write the queued frames on the calling thread; does
+	 * nothing if the Recorder has the writer thread.
+	 */
+	void flush();
+	/**
+	 * Wait for the queued frames to be written and stop the writer.
+	 *
+	 * @return Error that stopped the writer, or an empty string.
+	 */
+	std::string finish();
+
+	uint64_t capturedFrames() const
+	{
+		return captured;
+	}
+
+	uint64_t unchangedFrames() const
+	{
+		return unchanged;
+	}
+
+	uint64_t droppedFrames() const
+	{
+		return dropped;
+	}
+
+private:
+	struct Frame
+	{
+		/** Capture tick of the frame. */
+		uint64_t tick;
+		/** Times to repeat the previously written frame first. */
+		uint64_t holdBefore;
+		/** Times to write this frame. */
+		uint64_t count;
+		int32_t width;
+		int32_t height;
+		/** 0xAARRGGBB pixels; nullptr repeats the previous frame. */
+		std::shared_ptr<const std::vector<uint32_t>> pixels;
+	};
+
+	Format format;
+	std::string pathPrefix;
+	std::string pathSuffix;
+	int numberWidth = 0;
+	char numberFill = ' ';
+	uint64_t interval;
+	size_t queueLength;
+	uint64_t nextTick = 0;
+	/** Held frames of the Y4M stream that didn't fit in the queue. */
+	uint64_t owedHolds = 0;
+	bool anyQueued = false;
+	uint64_t captured = 0;
+	uint64_t unchanged = 0;
+	uint64_t dropped = 0;
+	std::unique_ptr<FrameCanvas> canvas;
+
+	std::deque<Frame> queue;
+	std::mutex queueLock;
+	std::condition_variable queueChanged;
+	bool finishing = false;
+	std::string error;
+	bool threaded;
+	std::thread writer;
+
+	// Writer thread only.
+	std::ofstream stream;
+	int32_t streamWidth = 0;
+	int32_t streamHeight = 0;
+	std::vector<uint8_t> lastEncoded;
+
+	void enqueue(Frame frame);
+	void write();
+	/**
+	 * Write the oldest queued frame, waiting for one if `wait`.
+	 *
+	 * @return false if there's nothing more to write.
+	 */
+	bool writeNext(bool wait);
+	void writeFrame(const Frame &frame);
+	void writeY4m(const Frame &frame);
+	void writePpm(const Frame &frame);
+	std::string ppmPath(uint64_t tick) const;
+};
+
+}
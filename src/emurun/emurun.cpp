@@ -16,23 +16,137 @@
  * You should have received a copy of the GNU General Public License
  * along with Emuballs Emurun.  If not, see <http://www.gnu.org/licenses/>.
  */
+#include <algorithm>
+#include <atomic>
+#include <chrono>
 #include <csignal>
 #include <cstdint>
 #include <codecvt>
 #include <locale>
+#include <memory>
 #include <fstream>
 #include <iostream>
+#include <limits>
 #include <sstream>
 #include <string>
+#include <thread>
+#include <type_traits>
+#include <vector>
 
+#include "batch.hpp"
+#include "capture.hpp"
 #include "emuballs/device.hpp"
+#include "emuballs/errors.hpp"
 #include "emuballs/programmer.hpp"
 #include "emuballs/registerset.hpp"
 #include "emuballs/regval.hpp"
+#include "emuballs/symbols.hpp"
 
 const std::string VERSION = "0.0-alpha";
 
-bool keepRunning = true;
+std::atomic<bool> keepRunning {true};
+
+struct Options
+{
+	std::string tracePath;
+	std::string profilePath;
+	uint32_t profilePeriod = 1;
+	std::string symbolsPath;
+	std::string recordPath;
+	std::string replayPath;
+	std::string batchPath;
+	unsigned batchJobs = std::thread::hardware_concurrency();
+	Batch::Format batchFormat = Batch::Format::Csv;
+	std::string outputPath;
+	uint32_t coreQuantum = 10000;
+	bool deterministicCores = false;
+	bool virtualTime = false;
+	uint64_t clockRate = 0;
+	bool skipIdle = false;
+	std::string capturePath;
+	uint64_t captureInterval = 40000;
+	bool expectFrameHash = false;
+	uint64_t expectedFrameHash = 0;
+	std::vector<int64_t> frameHashPoints;
+	std::vector<int32_t> frameRegion;
+};
+
+std::vector<std::string> splitList(const std::string &list)
+{
+	std::vector<std::string> items;
+	std::stringstream ss(list);
+	std::string item;
+	while (std::getline(ss, item, ','))
+		items.push_back(item);
+	return items;
+}
+
+/**
+ * Parses `text`, the argument of `option`, into `value`.
+ *
+ * The whole text must be a number that fits `T`; a minus sign
+ * is rejected for unsigned `T`. Reports a bad argument on stderr
+ * and returns false.
+ */
+template<typename T>
+bool parseNumber(const std::string &option, const std::string &text, T &value,
+	int base = 10)
+{
+	typedef typename std::conditional<std::is_signed<T>::value,
+		long long, unsigned long long>::type Parsed;
+	try
+	{
+		if (std::is_unsigned<T>::value && text.find('-') != std::string::npos)
+			throw std::out_of_range(text);
+		size_t end = 0;
+		Parsed parsed = std::is_signed<T>::value
+			? static_cast<Parsed>(std::stoll(text, &end, base))
+			: static_cast<Parsed>(std::stoull(text, &end, base));
+		if (end != text.size())
+			throw std::invalid_argument(text);
+		if (parsed < static_cast<Parsed>(std::numeric_limits<T>::min())
+			|| parsed > static_cast<Parsed>(std::numeric_limits<T>::max()))
+			throw std::out_of_range(text);
+		value = static_cast<T>(parsed);
+		return true;
+	}
+	catch (const std::logic_error &)
+	{
+		std::cerr << option << " got invalid number \"" << text << "\"" << std::endl;
+		return false;
+	}
+}
+
+/**
+ * Region given as x, y, width and height, which the hash
+ * can clip without overflowing.
+ */
+bool isRegionValid(const std::vector<int32_t> &region)
+{
+	for (int axis = 0; axis < 2; ++axis)
+	{
+		int64_t origin = region[axis];
+		int64_t size = region[axis + 2];
+		if (size < 0 || origin + size > std::numeric_limits<int32_t>::max())
+			return false;
+	}
+	return true;
+}
+
+std::string hex(uint64_t value)
+{
+	std::stringstream ss;
+	ss << "0x" << std::hex << value;
+	return ss.str();
+}
+
+uint64_t frameHash(Emuballs::Device &device, const Options &options)
+{
+	if (options.frameRegion.empty())
+		return device.frameHash();
+	return device.frameHash(options.frameRegion[0], options.frameRegion[1],
+		options.frameRegion[2], options.frameRegion[3]);
+}
 
 void term(int param)
 {
@@ -47,7 +161,7 @@ void listDevices()
 }
 
 int execute(const std::string &deviceName, const std::string &programPath,
-	int64_t maxCycles = -1)
+	int64_t maxCycles, const Options &options)
 {
 	Emuballs::DevicePtr device = nullptr;
 
@@ -76,19 +190,130 @@ int execute(const std::string &deviceName, const std::string &programPath,
 	device->programmer().load(program);
 	program.close();
 
+	// Symbols are loaded up-front so that a bad file is
+	// reported before the run, not after it.
+	Emuballs::SymbolTable symbols;
+	if (!options.symbolsPath.empty())
+	{
+		std::ifstream elf(options.symbolsPath, std::ios::in | std::ios::binary);
+		if (!elf.is_open())
+		{
+			std::cerr << "symbols file cannot be opened" << std::endl;
+			return 4;
+		}
+		try
+		{
+			symbols = Emuballs::SymbolTable::fromElf(elf);
+		}
+		catch (const Emuballs::SymbolLoadError &error)
+		{
+			std::cerr << "symbols cannot be loaded: " << error.what() << std::endl;
+			return 4;
+		}
+	}
+	std::ofstream profile;
+	if (!options.profilePath.empty())
+	{
+		profile.open(options.profilePath, std::ios::out | std::ios::trunc);
+		if (!profile.is_open())
+		{
+			std::cerr << "profile file cannot be opened" << std::endl;
+			return 4;
+		}
+		device->startProfile(options.profilePeriod);
+	}
+	device->setCoreScheduling(options.coreQuantum, options.deterministicCores);
+	device->setVirtualTime(options.virtualTime, options.clockRate);
+	device->setIdleLoopSkipping(options.skipIdle);
+	std::unique_ptr<Capture::Recorder> recorder;
+	try
+	{
+		if (!options.capturePath.empty())
+			recorder.reset(new Capture::Recorder(options.capturePath, options.captureInterval));
+		if (!options.tracePath.empty())
+			device->startTrace(options.tracePath);
+		if (!options.recordPath.empty())
+			device->startRecording(options.recordPath);
+		else if (!options.replayPath.empty())
+			device->startReplay(options.replayPath);
+	}
+	catch (const std::exception &error)
+	{
+		std::cerr << error.what() << std::endl;
+		return 4;
+	}
+
 	// Execute.
+	auto wallStart = std::chrono::steady_clock::now();
+	uint64_t guestStart = device->guestTime();
 	int64_t cycleIdx = 0;
+	size_t nextHashPoint = 0;
+	bool frameHashReached = false;
 	while (keepRunning && (maxCycles < 0 || cycleIdx < maxCycles))
 	{
 		int cycles = 10000;
 		if (maxCycles > 0 && maxCycles - cycleIdx < cycles)
 			cycles = maxCycles - cycleIdx;
-		device->cycle(cycles);
+		if (nextHashPoint < options.frameHashPoints.size()
+			&& options.frameHashPoints[nextHashPoint] - cycleIdx < cycles)
+		{
+			cycles = options.frameHashPoints[nextHashPoint] - cycleIdx;
+		}
+		try
+		{
+			device->cycle(cycles);
+		}
+		catch (const Emuballs::ReplayError &error)
+		{
+			std::cerr << error.what() << std::endl;
+			return 6;
+		}
 		cycleIdx += cycles;
+		if (recorder != nullptr)
+			recorder->capture(*device, device->guestTime() - guestStart);
+		for (; nextHashPoint < options.frameHashPoints.size()
+			&& options.frameHashPoints[nextHashPoint] <= cycleIdx; ++nextHashPoint)
+		{
+			std::cout << "frame_hash@" << options.frameHashPoints[nextHashPoint]
+				<< "=" << hex(frameHash(*device, options)) << std::endl;
+		}
+		// The whole frame hash is cached, so polling it is cheap
+		// while the guest doesn't draw.
+		if (options.expectFrameHash
+			&& frameHash(*device, options) == options.expectedFrameHash)
+		{
+			frameHashReached = true;
+			break;
+		}
 	}
+	std::string captureError = recorder != nullptr ? recorder->finish() : "";
+	uint64_t guestTime = device->guestTime() - guestStart;
+	uint64_t wallTime = std::chrono::duration_cast<std::chrono::microseconds>(
+		std::chrono::steady_clock::now() - wallStart).count();
+	device->stopRecordReplay();
+	device->stopTrace();
+	if (profile.is_open())
+		device->stopProfile(profile, symbols);
 
 	// Summary.
 	std::cout << "cycles=" << cycleIdx << std::endl;
+	std::cout << "guest_time_us=" << guestTime << std::endl;
+	std::cout << "wall_time_us=" << wallTime << std::endl;
+	if (wallTime > 0)
+	{
+		std::cout << "time_ratio=" << static_cast<double>(guestTime) / wallTime
+			<< std::endl;
+	}
+	if (options.skipIdle)
+		std::cout << "skipped_instructions=" << device->skippedInstructions() << std::endl;
+	if (options.expectFrameHash || !options.frameHashPoints.empty())
+		std::cout << "frame_hash=" << hex(frameHash(*device, options)) << std::endl;
+	if (recorder != nullptr)
+	{
+		std::cout << "captured_frames=" << recorder->capturedFrames() << std::endl;
+		std::cout << "unchanged_frames=" << recorder->unchangedFrames() << std::endl;
+		std::cout << "dropped_frames=" << recorder->droppedFrames() << std::endl;
+	}
 	for (Emuballs::NamedRegister &reg : device->registers().registers())
 	{
 		bool firstName = true;
@@ -103,35 +328,269 @@ int execute(const std::string &deviceName, const std::string &programPath,
 		ss << "=0x" << std::hex << reg.value();
 		std::cout << ss.str() << std::endl;
 	}
+	if (!captureError.empty())
+	{
+		std::cerr << "capture failed: " << captureError << std::endl;
+		return 4;
+	}
+	if (options.expectFrameHash && !frameHashReached)
+	{
+		std::cerr << "frame hash " << hex(options.expectedFrameHash)
+			<< " not reached" << std::endl;
+		return 8;
+	}
 	return 0;
 }
 
+int executeBatch(const Options &options)
+{
+	std::ifstream manifest(options.batchPath);
+	if (!manifest.is_open())
+	{
+		std::cerr << "manifest file cannot be opened" << std::endl;
+		return 4;
+	}
+	std::vector<Batch::Job> jobs;
+	try
+	{
+		jobs = Batch::loadManifest(manifest);
+	}
+	catch (const std::runtime_error &error)
+	{
+		std::cerr << error.what() << std::endl;
+		return 4;
+	}
+
+	std::ofstream outputFile;
+	if (!options.outputPath.empty())
+	{
+		outputFile.open(options.outputPath, std::ios::out | std::ios::trunc);
+		if (!outputFile.is_open())
+		{
+			std::cerr << "output file cannot be opened" << std::endl;
+			return 4;
+		}
+	}
+	std::ostream &output = outputFile.is_open() ? outputFile : std::cout;
+	size_t failed = Batch::run(jobs, options.batchJobs, options.batchFormat,
+		output, keepRunning);
+	std::cerr << "jobs=" << jobs.size() << " failed=" << failed << std::endl;
+	return failed > 0 ? 7 : 0;
+}
+
+void printUsage(const char *program)
+{
+	std::cerr << "Usage: " << std::endl;
+	std::cerr << "    " << program << " [options] \"<Device Name>\" <program_path> [max_cycles]"
+		<< std::endl;
+	std::cerr << "    " << program << " -l       -- list devices" << std::endl;
+	std::cerr << "    " << program << " --batch <manifest> [--jobs N] [--format csv|jsonl]"
+		" [--output <path>]" << std::endl;
+	std::cerr << "Options:" << std::endl;
+	std::cerr << "    --trace <path>        -- record binary execution trace; see emutrace"
+		<< std::endl;
+	std::cerr << "    --profile <path>      -- write callgrind profile of the guest" << std::endl;
+	std::cerr << "    --profile-every <N>   -- sample profile every N instructions" << std::endl;
+	std::cerr << "    --symbols <elf>       -- name profiled functions with ELF symbols"
+		<< std::endl;
+	std::cerr << "    --record <path>       -- log nondeterministic inputs for replay"
+		<< std::endl;
+	std::cerr << "    --replay <path>       -- reproduce run recorded with --record"
+		<< std::endl;
+	std::cerr << "    --quantum <N>         -- synchronise guest cores every N instructions"
+		<< std::endl;
+	std::cerr << "    --deterministic-cores -- interleave guest cores on one thread"
+		<< std::endl;
+	std::cerr << "    --virtual-time        -- derive guest time from executed instructions"
+		<< std::endl;
+	std::cerr << "    --clock-rate <Hz>     -- guest clock rate in virtual time" << std::endl;
+	std::cerr << "    --skip-idle           -- fast-forward timer busy-waits; implies"
+		" --virtual-time" << std::endl;
+	std::cerr << "    --capture <path>      -- capture display to .y4m stream or PPM files"
+		" named like frame%06d.ppm" << std::endl;
+	std::cerr << "    --capture-every <us>  -- guest time between captured frames;"
+		" default 40000" << std::endl;
+	std::cerr << "    --expect-frame-hash <hex> -- stop once the display has this hash;"
+		" fail if not within max_cycles" << std::endl;
+	std::cerr << "    --print-frame-hash <N,...> -- print display hash after N cycles"
+		<< std::endl;
+	std::cerr << "    --frame-region <x,y,w,h> -- hash only this part of the display"
+		<< std::endl;
+	std::cerr << "Batch manifest lines, tab-separated:" << std::endl;
+	std::cerr << "    <Device Name> <program_path> <cycles> [reg=value,...]" << std::endl;
+}
 
 int main(int argc, char **argv)
 {
 	std::string deviceName;
 	std::string programPath;
 	int64_t maxCycles = -1;
+	Options options;
 
 	// Args
 	std::cerr << "Emuballs Emurun " << VERSION << std::endl;
-	if (argc < 2)
+	std::vector<std::string> args;
+	for (int i = 1; i < argc; ++i)
 	{
-		std::cerr << "Usage: " << std::endl;
-		std::cerr << "    " << argv[0] << " \"<Device Name>\" <program_path> [max_cycles]"
-			<< std::endl;
-		std::cerr << "    " << argv[0] << " -l       -- list devices" << std::endl;
+		std::string arg = argv[i];
+		if (arg == "--trace")
+		{
+			if (++i >= argc)
+			{
+				std::cerr << "--trace requires a path" << std::endl;
+				return 2;
+			}
+			options.tracePath = argv[i];
+		}
+		else if (arg == "--deterministic-cores")
+		{
+			options.deterministicCores = true;
+		}
+		else if (arg == "--virtual-time")
+		{
+			options.virtualTime = true;
+		}
+		else if (arg == "--skip-idle")
+		{
+			options.virtualTime = true;
+			options.skipIdle = true;
+		}
+		else if (arg == "--profile" || arg == "--profile-every" || arg == "--symbols"
+			|| arg == "--record" || arg == "--replay" || arg == "--batch"
+			|| arg == "--jobs" || arg == "--format" || arg == "--output"
+			|| arg == "--quantum" || arg == "--clock-rate"
+			|| arg == "--capture" || arg == "--capture-every"
+			|| arg == "--expect-frame-hash" || arg == "--print-frame-hash"
+			|| arg == "--frame-region")
+		{
+			if (++i >= argc)
+			{
+				std::cerr << arg << " requires an argument" << std::endl;
+				return 2;
+			}
+			bool parsed = true;
+			if (arg == "--profile")
+				options.profilePath = argv[i];
+			else if (arg == "--profile-every")
+				parsed = parseNumber(arg, argv[i], options.profilePeriod);
+			else if (arg == "--symbols")
+				options.symbolsPath = argv[i];
+			else if (arg == "--record")
+				options.recordPath = argv[i];
+			else if (arg == "--replay")
+				options.replayPath = argv[i];
+			else if (arg == "--batch")
+				options.batchPath = argv[i];
+			else if (arg == "--jobs")
+				parsed = parseNumber(arg, argv[i], options.batchJobs);
+			else if (arg == "--output")
+				options.outputPath = argv[i];
+			else if (arg == "--quantum")
+				parsed = parseNumber(arg, argv[i], options.coreQuantum);
+			else if (arg == "--capture")
+				options.capturePath = argv[i];
+			else if (arg == "--capture-every")
+				parsed = parseNumber(arg, argv[i], options.captureInterval);
+			else if (arg == "--expect-frame-hash")
+			{
+				options.expectFrameHash = true;
+				parsed = parseNumber(arg, argv[i], options.expectedFrameHash, 16);
+			}
+			else if (arg == "--print-frame-hash")
+			{
+				for (const auto &text : splitList(argv[i]))
+				{
+					int64_t point = 0;
+					parsed = parsed && parseNumber(arg, text, point);
+					if (parsed && point < 0)
+					{
+						std::cerr << arg << " points can't be negative" << std::endl;
+						parsed = false;
+					}
+					options.frameHashPoints.push_back(point);
+				}
+				// Points are run to in order, each one once.
+				auto &points = options.frameHashPoints;
+				std::sort(points.begin(), points.end());
+				points.erase(std::unique(points.begin(), points.end()), points.end());
+			}
+			else if (arg == "--frame-region")
+			{
+				options.frameRegion.clear();
+				for (const auto &text : splitList(argv[i]))
+				{
+					int32_t coord = 0;
+					parsed = parsed && parseNumber(arg, text, coord);
+					options.frameRegion.push_back(coord);
+				}
+				if (parsed && options.frameRegion.size() != 4)
+				{
+					std::cerr << "--frame-region requires x,y,width,height" << std::endl;
+					return 2;
+				}
+				if (parsed && !isRegionValid(options.frameRegion))
+				{
+					std::cerr << "--frame-region width and height must be"
+						" non-negative and fit the coordinate range" << std::endl;
+					parsed = false;
+				}
+			}
+			else if (arg == "--clock-rate")
+			{
+				options.virtualTime = true;
+				parsed = parseNumber(arg, argv[i], options.clockRate);
+			}
+			else
+			{
+				std::string format = argv[i];
+				if (format == "csv")
+					options.batchFormat = Batch::Format::Csv;
+				else if (format == "jsonl")
+					options.batchFormat = Batch::Format::JsonLines;
+				else
+				{
+					std::cerr << "unknown format " << format << std::endl;
+					return 2;
+				}
+			}
+			if (!parsed)
+			{
+				printUsage(argv[0]);
+				return 2;
+			}
+		}
+		else
+		{
+			args.push_back(arg);
+		}
+	}
+	if (args.size() < 1 && options.batchPath.empty())
+	{
+		printUsage(argv[0]);
 		return 2;
 	}
-	deviceName = argv[1];
-	if (argc >= 3)
-		programPath = argv[2];
-	if (argc >= 4)
-		maxCycles = std::stoll(argv[3]);
+	// Signals.
+	signal(SIGINT, term);
+	signal(SIGTERM, term);
+
+	if (!options.batchPath.empty())
+	{
+		std::cerr << "Batch: " << options.batchPath << std::endl;
+		return executeBatch(options);
+	}
+
+	deviceName = args[0];
+	if (args.size() >= 2)
+		programPath = args[1];
+	if (args.size() >= 3)
+	{
+		if (!parseNumber("max_cycles", args[2], maxCycles))
+			return 2;
+	}
 
 	if (deviceName != "-l")
 	{
-		if (argc < 3)
+		if (args.size() < 2)
 		{
 			std::cerr << "not enough arguments" << std::endl;
 			return 2;
@@ -140,17 +599,23 @@ int main(int argc, char **argv)
 		std::cerr << "Program path: " << programPath << std::endl;
 		if (maxCycles != -1)
 			std::cerr << "Max. cycles: " << maxCycles << std::endl;
+		if (!options.tracePath.empty())
+			std::cerr << "Trace: " << options.tracePath << std::endl;
+		if (!options.profilePath.empty())
+			std::cerr << "Profile: " << options.profilePath << std::endl;
+		if (!options.recordPath.empty())
+			std::cerr << "Record: " << options.recordPath << std::endl;
+		if (!options.replayPath.empty())
+			std::cerr << "Replay: " << options.replayPath << std::endl;
+		if (!options.capturePath.empty())
+			std::cerr << "Capture: " << options.capturePath << std::endl;
 	}
 
-	// Signals.
-	signal(SIGINT, term);
-	signal(SIGTERM, term);
-
 	// Run.
 	int ec = 0;
 	if (deviceName == "-l")
 		listDevices();
 	else
-		ec = execute(deviceName, programPath, maxCycles);
+		ec = execute(deviceName, programPath, maxCycles, options);
 	return ec;
 }
@@ -0,0 +1,87 @@
+/*
+ * Copyright 2017 Zalewa <zalewapl@gmail.com>.
+ *
+ * This file is part of Emuballs Emurun.
+ *
+ * Emuballs Emurun is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Emuballs Emurun is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Emuballs Emurun.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <sstream>
+#include <string>
+
+#include "emuballs/errors.hpp"
+#include "emuballs/trace.hpp"
+
+std::string hex(uint32_t value, int width = 0)
+{
+	std::stringstream ss;
+	ss << std::hex << std::setfill('0') << std::setw(width) << value;
+	return ss.str();
+}
+
+std::string regName(int idx)
+{
+	switch (idx)
+	{
+	case 13: return "sp";
+	case 14: return "lr";
+	case 15: return "pc";
+	case Emuballs::TRACE_CPSR_INDEX: return "cpsr";
+	default: return "r" + std::to_string(idx);
+	}
+}
+
+int decode(std::istream &input)
+{
+	Emuballs::TraceReader reader(input);
+	Emuballs::TraceEntry entry;
+	while (reader.next(entry))
+	{
+		std::cout << hex(entry.address, 8) << ": " << hex(entry.instruction, 8);
+		for (const auto &reg : entry.registers)
+			std::cout << " " << regName(reg.first) << "=0x" << hex(reg.second);
+		for (const auto &access : entry.memory)
+			std::cout << " [" << (access.write ? "W" : "R") << " 0x" << hex(access.address) << "]";
+		std::cout << std::endl;
+	}
+	return 0;
+}
+
+int main(int argc, char **argv)
+{
+	if (argc < 2)
+	{
+		std::cerr << "Usage: " << std::endl;
+		std::cerr << "    " << argv[0] << " <trace_path>" << std::endl;
+		return 2;
+	}
+
+	std::ifstream input(argv[1], std::ios::in | std::ios::binary);
+	if (!input.is_open())
+	{
+		std::cerr << "trace file cannot be opened" << std::endl;
+		return 4;
+	}
+	try
+	{
+		return decode(input);
+	}
+	catch (const Emuballs::TraceFormatError &error)
+	{
+		std::cerr << "bad trace: " << error.what() << std::endl;
+		return 5;
+	}
+}
@@ -72,12 +72,11 @@ struct ArmProgramFixture
 	void runProgram(int limit = STEP_LIMIT)
 	{
 		auto endAddress = machine.cpu().regs().lr();
-		for (; limit > 0 && machine.cpu().regs().pc() < endAddress; --limit)
-		{
-			machine.cycle();
-		}
+		Emuballs::Arm::StopConditions stop;
+		stop.pcRangeEnd = endAddress;
+		auto result = machine.run(limit, stop);
 		BOOST_WARN_EQUAL(machine.cpu().regs().pc(), endAddress);
-		BOOST_REQUIRE_NE(0, limit);
+		BOOST_REQUIRE(result.reason == Emuballs::Arm::StopReason::PcRangeExit);
 	}
 };
 
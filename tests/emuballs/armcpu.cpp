@@ -0,0 +1,106 @@
+/*
+ * Copyright 2017 Zalewa <zalewapl@gmail.com>.
+ *
+ * This file is part of Emuballs.
+ *
+ * Emuballs is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Emuballs is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with Emuballs.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#define BOOST_TEST_MODULE machine_armcpu
+#include <boost/test/unit_test.hpp>
+#include "src/emuballs/armcpu.hpp"
+
+using namespace Emuballs::Arm;
+
+BOOST_AUTO_TEST_CASE(defaultBankIsUser)
+{
+	Cpu cpu;
+	BOOST_CHECK(cpu.regs().bank() == Bank::User);
+	for (int i = 0; i < NUM_CPU_REGS; ++i)
+		BOOST_CHECK_EQUAL(cpu.regs()[i], 0);
+}
+
+BOOST_AUTO_TEST_CASE(irqBanksSpLr)
+{
+	Cpu cpu;
+	auto &regs = cpu.regs();
+	for (int i = 0; i < NUM_CPU_REGS; ++i)
+		regs.set(i, 100 + i);
+	cpu.switchMode(MODE_IRQ);
+	BOOST_CHECK(regs.bank() == Bank::Irq);
+	for (int i = 0; i < 13; ++i)
+		BOOST_CHECK_EQUAL(regs[i], 100 + i);
+	BOOST_CHECK_EQUAL(regs.sp(), 0);
+	BOOST_CHECK_EQUAL(regs.lr(), 0);
+	BOOST_CHECK_EQUAL(regs.pc(), 115);
+	regs.sp(0x4000);
+	regs.lr(0x8004);
+	cpu.switchMode(MODE_USER);
+	BOOST_CHECK_EQUAL(regs.sp(), 113);
+	BOOST_CHECK_EQUAL(regs.lr(), 114);
+	BOOST_CHECK_EQUAL(regs.banked(Bank::Irq, 13), 0x4000);
+	BOOST_CHECK_EQUAL(regs.banked(Bank::Irq, 14), 0x8004);
+}
+
+BOOST_AUTO_TEST_CASE(fiqBanksHighRegs)
+{
+	Cpu cpu;
+	auto &regs = cpu.regs();
+	for (int i = 0; i < NUM_CPU_REGS; ++i)
+		regs.set(i, i);
+	cpu.switchMode(MODE_FIQ);
+	for (int i = 0; i < 8; ++i)
+		BOOST_CHECK_EQUAL(regs[i], i);
+	for (int i = 8; i < 15; ++i)
+	{
+		BOOST_CHECK_EQUAL(regs[i], 0);
+		regs.set(i, 0xf00 + i);
+	}
+	cpu.switchMode(MODE_SYSTEM);
+	BOOST_CHECK(regs.bank() == Bank::User);
+	for (int i = 8; i < 15; ++i)
+		BOOST_CHECK_EQUAL(regs[i], i);
+}
+
+BOOST_AUTO_TEST_CASE(modeSwitchKeepsFlags)
+{
+	Cpu cpu;
+	cpu.cpsr(0xf0000000 | MODE_USER);
+	cpu.switchMode(MODE_SUPERVISOR);
+	BOOST_CHECK_EQUAL(cpu.flags().dump(), 0xf0000000 | MODE_SUPERVISOR);
+	BOOST_CHECK_EQUAL(cpu.flags().cpuMode(), MODE_SUPERVISOR);
+}
+
+BOOST_AUTO_TEST_CASE(spsrPerBank)
+{
+	Cpu cpu;
+	cpu.flagsSpsr(MODE_IRQ).store(0x12);
+	cpu.flagsSpsr(MODE_SUPERVISOR).store(0x13);
+	cpu.switchMode(MODE_IRQ);
+	BOOST_CHECK_EQUAL(cpu.flagsSpsr().dump(), 0x12);
+	cpu.switchMode(MODE_SUPERVISOR);
+	BOOST_CHECK_EQUAL(cpu.flagsSpsr().dump(), 0x13);
+	BOOST_CHECK_THROW(cpu.flagsSpsr(32), std::out_of_range);
+}
+
+BOOST_AUTO_TEST_CASE(copyKeepsBank)
+{
+	Cpu cpu;
+	cpu.switchMode(MODE_IRQ);
+	cpu.regs().sp(0x1234);
+	Cpu copy = cpu;
+	cpu.regs().sp(0x5678);
+	BOOST_CHECK(copy.regs().bank() == Bank::Irq);
+	BOOST_CHECK_EQUAL(copy.regs().sp(), 0x1234);
+	BOOST_CHECK_EQUAL(cpu.regs().sp(), 0x5678);
+}
@@ -0,0 +1,282 @@
+/*
+ * Copyright 2017 Zalewa <zalewapl@gmail.com>.
+ *
+ * This file is part of Emuballs.
+ *
+ * Emuballs is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Emuballs is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with Emuballs.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#define BOOST_TEST_MODULE armgpu
+#include <boost/test/unit_test.hpp>
+#include "emuballs/canvas.hpp"
+#include "emuballs/framesurface.hpp"
+#include "src/emuballs/armgpu.hpp"
+#include "src/emuballs/memory.hpp"
+
+#include <chrono>
+#include <thread>
+#include <vector>
+
+using namespace Emuballs;
+
+namespace
+{
+constexpr memsize MAILBOX = 0x2000b880;
+constexpr memsize MAILBOX_READ = MAILBOX;
+constexpr memsize MAILBOX_STATUS = MAILBOX + 0x18;
+constexpr memsize MAILBOX_WRITE = MAILBOX + 0x20;
+constexpr uint32_t READ_EMPTY = 1u << 30;
+constexpr memsize FRAME_BUFFER_END = 0x20000000;
+constexpr memsize INFO = 0x1000;
+
+struct GpuFixture
+{
+	Memory memory;
+	TrackedMemory cpu {memory};
+	Arm::Gpu gpu {memory};
+
+	GpuFixture()
+	{
+		gpu.setMailboxAddress(MAILBOX);
+		gpu.setFrameBufferPointerEnd(FRAME_BUFFER_END);
+		gpu.cycle();
+
+		MemoryStreamWriter writer(memory, INFO);
+		writer.writeUint32(640);
+		writer.writeUint32(480);
+		writer.writeUint32(320);
+		writer.writeUint32(240);
+		writer.writeUint32(0);
+		writer.writeUint32(16);
+	}
+
+	/**
+	 * Poll the status like a guest would.
+	 */
+	bool waitForReply()
+	{
+		auto deadline = std::chrono::steady_clock::now() + std::chrono::seconds(10);
+		while ((cpu.word(MAILBOX_STATUS) & READ_EMPTY) != 0)
+		{
+			if (std::chrono::steady_clock::now() > deadline)
+				return false;
+			std::this_thread::yield();
+		}
+		return true;
+	}
+
+	struct FrameCanvas : public Canvas
+	{
+		std::vector<std::vector<uint32_t>> rows;
+		std::vector<int32_t> drawnRows;
+		int resized = 0;
+
+		void begin() override {}
+		void end() override {}
+		void drawPixel(int32_t, int32_t, const Color &) override {}
+
+		void drawRow(int32_t x, int32_t y, int32_t width, const uint32_t *rgb32) override
+		{
+			rows.at(y).assign(rgb32, rgb32 + width);
+			drawnRows.push_back(y);
+		}
+
+		void changeSize(int32_t width, int32_t height, BitDepth) override
+		{
+			++resized;
+			rows.assign(height, std::vector<uint32_t>(width, 0));
+		}
+	};
+
+	void checkFrameBufferInfo()
+	{
+		BOOST_CHECK_EQUAL(memory.word(INFO + 4 * 4), 320 * 2);
+		BOOST_CHECK_EQUAL(memory.word(INFO + 9 * 4), 320 * 2 * 240);
+		BOOST_CHECK_EQUAL(memory.word(INFO + 8 * 4), FRAME_BUFFER_END - 320 * 2 * 240);
+	}
+};
+}
+
+BOOST_FIXTURE_TEST_CASE(gpu_initial_status, GpuFixture)
+{
+	BOOST_CHECK_EQUAL(cpu.word(MAILBOX_STATUS), READ_EMPTY);
+}
+
+BOOST_FIXTURE_TEST_CASE(gpu_threaded_reply, GpuFixture)
+{
+	BOOST_REQUIRE(gpu.isThreaded());
+	cpu.putWord(MAILBOX_WRITE, 0x40000000 | INFO | 1);
+	BOOST_REQUIRE(waitForReply());
+	BOOST_CHECK_EQUAL(cpu.word(MAILBOX_READ), 1);
+	checkFrameBufferInfo();
+	BOOST_CHECK_EQUAL(cpu.word(MAILBOX_STATUS), READ_EMPTY);
+}
+
+BOOST_FIXTURE_TEST_CASE(gpu_synchronous_reply, GpuFixture)
+{
+	gpu.setThreaded(false);
+	cpu.putWord(MAILBOX_WRITE, INFO | 1);
+	// Answered right away.
+	BOOST_CHECK_EQUAL(memory.word(MAILBOX_STATUS), 0);
+	BOOST_CHECK_EQUAL(cpu.word(MAILBOX_READ), 1);
+	checkFrameBufferInfo();
+	BOOST_CHECK_EQUAL(cpu.word(MAILBOX_STATUS), READ_EMPTY);
+}
+
+BOOST_FIXTURE_TEST_CASE(gpu_replies_queued, GpuFixture)
+{
+	gpu.setThreaded(false);
+	cpu.putWord(MAILBOX_WRITE, INFO | 1);
+	// Reply not read yet; the next one waits in the queue.
+	cpu.putWord(MAILBOX_WRITE, INFO | 2);
+	BOOST_CHECK_EQUAL(cpu.word(MAILBOX_READ), 1);
+	BOOST_CHECK_EQUAL(cpu.word(MAILBOX_STATUS), 0);
+	BOOST_CHECK_EQUAL(cpu.word(MAILBOX_READ), 2);
+	BOOST_CHECK_EQUAL(cpu.word(MAILBOX_STATUS), READ_EMPTY);
+}
+
+BOOST_FIXTURE_TEST_CASE(gpu_switch_to_synchronous, GpuFixture)
+{
+	cpu.putWord(MAILBOX_WRITE, INFO | 1);
+	// Waits for the worker.
+	gpu.setThreaded(false);
+	gpu.cycle();
+	BOOST_CHECK_EQUAL(memory.word(MAILBOX_STATUS) & READ_EMPTY, 0);
+	BOOST_CHECK_EQUAL(cpu.word(MAILBOX_READ), 1);
+	checkFrameBufferInfo();
+}
+
+BOOST_FIXTURE_TEST_CASE(gpu_draw_from_memory, GpuFixture)
+{
+	gpu.setThreaded(false);
+	cpu.putWord(MAILBOX_WRITE, INFO | 1);
+	BOOST_CHECK_EQUAL(cpu.word(MAILBOX_READ), 1);
+	const memsize frameBuffer = FRAME_BUFFER_END - 320 * 2 * 240;
+	// Row 3 crosses a page boundary between pixels 63 and 64.
+	memory.putWord(frameBuffer + 320 * 2 * 3 + 63 * 2, 0x07e0f800);
+
+	FrameCanvas canvas;
+	gpu.draw(canvas);
+	BOOST_REQUIRE_EQUAL(canvas.rows.size(), 240);
+	BOOST_CHECK_EQUAL(canvas.rows[3][62], 0xff000000);
+	BOOST_CHECK_EQUAL(canvas.rows[3][63], 0xffff0000);
+	BOOST_CHECK_EQUAL(canvas.rows[3][64], 0xff00ff00);
+}
+
+BOOST_FIXTURE_TEST_CASE(gpu_draw_dirty_rows, GpuFixture)
+{
+	gpu.setThreaded(false);
+	cpu.putWord(MAILBOX_WRITE, INFO | 1);
+	BOOST_CHECK_EQUAL(cpu.word(MAILBOX_READ), 1);
+	const memsize frameBuffer = FRAME_BUFFER_END - 320 * 2 * 240;
+
+	FrameCanvas canvas;
+	gpu.draw(canvas);
+	BOOST_CHECK_EQUAL(canvas.drawnRows.size(), 240);
+	BOOST_CHECK_EQUAL(canvas.resized, 1);
+
+	// Nothing written, nothing drawn.
+	canvas.drawnRows.clear();
+	gpu.draw(canvas);
+	BOOST_CHECK(canvas.drawnRows.empty());
+	BOOST_CHECK_EQUAL(canvas.resized, 1);
+
+	// Row 100 is on the page of rows 99-105.
+	memory.putWord(frameBuffer + 320 * 2 * 100, 0xf800f800);
+	gpu.draw(canvas);
+	BOOST_CHECK(canvas.drawnRows == std::vector<int32_t>({99, 100, 101, 102, 103, 104, 105}));
+	BOOST_CHECK_EQUAL(canvas.rows[100][1], 0xffff0000);
+
+	// Another canvas gets everything.
+	FrameCanvas other;
+	gpu.draw(other);
+	BOOST_CHECK_EQUAL(other.drawnRows.size(), 240);
+	BOOST_CHECK_EQUAL(other.rows[100][1], 0xffff0000);
+
+	// So does one that asks for it.
+	canvas.drawnRows.clear();
+	canvas.setDrawnFrame(Canvas::DrawnFrame());
+	gpu.draw(canvas);
+	BOOST_CHECK_EQUAL(canvas.drawnRows.size(), 240);
+	BOOST_CHECK_EQUAL(canvas.resized, 2);
+}
+
+BOOST_FIXTURE_TEST_CASE(gpu_draw_on_frame_surface, GpuFixture)
+{
+	gpu.setThreaded(false);
+	cpu.putWord(MAILBOX_WRITE, INFO | 1);
+	BOOST_CHECK_EQUAL(cpu.word(MAILBOX_READ), 1);
+	const memsize frameBuffer = FRAME_BUFFER_END - 320 * 2 * 240;
+
+	// Each frame of the surface is brought up to date with
+	// the writes made since it was drawn last.
+	FrameSurface surface;
+	const uint16_t colors[] = {0xf800, 0x07e0, 0x001f, 0xffff, 0x0000};
+	const uint32_t expected[] = {0xffff0000, 0xff00ff00, 0xff0000ff, 0xffffffff, 0xff000000};
+	for (int i = 0; i < 5; ++i)
+	{
+		memory.putWord(frameBuffer + 320 * 2 * (10 * i), colors[i]);
+		gpu.draw(surface);
+		const FrameSurface::Frame &frame = surface.latest();
+		BOOST_REQUIRE_EQUAL(frame.pixels.size(), 320 * 240);
+		BOOST_CHECK_EQUAL(frame.sequence, i + 1);
+		for (int row = 0; row <= i; ++row)
+			BOOST_CHECK_EQUAL(frame.pixels[320 * 10 * row], expected[row]);
+	}
+}
+
+BOOST_FIXTURE_TEST_CASE(gpu_draw_true_color, GpuFixture)
+{
+	memory.putWord(INFO + 5 * 4, 24);
+	gpu.setThreaded(false);
+	cpu.putWord(MAILBOX_WRITE, INFO | 1);
+	BOOST_CHECK_EQUAL(cpu.word(MAILBOX_READ), 1);
+	BOOST_CHECK_EQUAL(memory.word(INFO + 4 * 4), 320 * 3);
+	const memsize frameBuffer = memory.word(INFO + 8 * 4);
+	BOOST_CHECK_EQUAL(frameBuffer, FRAME_BUFFER_END - 320 * 3 * 240);
+	memory.putChunk(frameBuffer + 320 * 3 * 2 + 3, {0x11, 0x22, 0x33});
+
+	FrameCanvas canvas;
+	gpu.draw(canvas);
+	BOOST_REQUIRE_EQUAL(canvas.rows.size(), 240);
+	BOOST_CHECK_EQUAL(canvas.rows[2][0], 0xff000000);
+	BOOST_CHECK_EQUAL(canvas.rows[2][1], 0xff332211);
+}
+
+BOOST_FIXTURE_TEST_CASE(gpu_frame_hash, GpuFixture)
+{
+	BOOST_CHECK_EQUAL(gpu.frameHash(), 0);
+	gpu.setThreaded(false);
+	cpu.putWord(MAILBOX_WRITE, INFO | 1);
+	BOOST_CHECK_EQUAL(cpu.word(MAILBOX_READ), 1);
+	const memsize frameBuffer = FRAME_BUFFER_END - 320 * 2 * 240;
+
+	const uint64_t blank = gpu.frameHash();
+	BOOST_CHECK_NE(blank, 0);
+	BOOST_CHECK_EQUAL(gpu.frameHash(), blank);
+	const uint64_t corner = gpu.frameHash(0, 0, 10, 10);
+	const uint64_t elsewhere = gpu.frameHash(100, 100, 10, 10);
+	BOOST_CHECK_EQUAL(corner, elsewhere);
+
+	memory.putWord(frameBuffer + 320 * 2 * 105 + 100 * 2, 0xffff);
+	const uint64_t drawn = gpu.frameHash();
+	BOOST_CHECK_NE(drawn, blank);
+	BOOST_CHECK_EQUAL(gpu.frameHash(0, 0, 10, 10), corner);
+	BOOST_CHECK_NE(gpu.frameHash(100, 100, 10, 10), elsewhere);
+	// Clipped to the frame.
+	BOOST_CHECK_EQUAL(gpu.frameHash(-10, -10, 1000, 1000), drawn);
+	BOOST_CHECK_EQUAL(gpu.frameHash(0, 0, INT32_MAX, INT32_MAX), drawn);
+
+	memory.putWord(frameBuffer + 320 * 2 * 105 + 100 * 2, 0);
+	BOOST_CHECK_EQUAL(gpu.frameHash(), blank);
+}
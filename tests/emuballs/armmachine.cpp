@@ -49,3 +49,270 @@ BOOST_AUTO_TEST_CASE(machine_copy_ctor)
 	BOOST_CHECK_EQUAL(machine2r0, machine2.cpu().regs()[0]);
 	BOOST_CHECK_EQUAL(machine2.memory().word(0x1234), 0xcafe);
 }
+
+BOOST_AUTO_TEST_CASE(run_budget)
+{
+	ArmProgramFixture fixture;
+	fixture.load(std::begin(fibonacciCode), std::end(fibonacciCode));
+	fixture.r(0, 18);
+	auto result = fixture.machine.run(25);
+	BOOST_CHECK(result.reason == Emuballs::Arm::StopReason::Budget);
+	BOOST_CHECK_EQUAL(result.executed, 25);
+
+	// Must be the same as cycling one by one.
+	ArmProgramFixture cycled;
+	cycled.load(std::begin(fibonacciCode), std::end(fibonacciCode));
+	cycled.r(0, 18);
+	for (int i = 0; i < 25; ++i)
+		cycled.machine.cycle();
+	BOOST_CHECK_EQUAL(fixture.machine.nextInstructionAddress(),
+		cycled.machine.nextInstructionAddress());
+	for (int i = 0; i < Emuballs::Arm::NUM_CPU_REGS; ++i)
+		BOOST_CHECK_EQUAL(fixture.r(i), cycled.r(i));
+}
+
+BOOST_AUTO_TEST_CASE(run_breakpoint)
+{
+	constexpr auto LOOP_ADDRESS = 0x24;
+	ArmProgramFixture fixture;
+	fixture.load(std::begin(fibonacciCode), std::end(fibonacciCode));
+	fixture.r(0, 10);
+	Emuballs::Arm::StopConditions stop;
+	stop.breakpoints.insert(LOOP_ADDRESS);
+
+	auto result = fixture.machine.run(1000, stop);
+	BOOST_CHECK(result.reason == Emuballs::Arm::StopReason::Breakpoint);
+	BOOST_CHECK_EQUAL(result.executed, 9);
+	BOOST_CHECK_EQUAL(fixture.machine.nextInstructionAddress(), LOOP_ADDRESS);
+
+	// Resuming from a breakpoint must go through the whole loop once.
+	result = fixture.machine.run(1000, stop);
+	BOOST_CHECK(result.reason == Emuballs::Arm::StopReason::Breakpoint);
+	BOOST_CHECK_EQUAL(result.executed, 7);
+	BOOST_CHECK_EQUAL(fixture.machine.nextInstructionAddress(), LOOP_ADDRESS);
+	BOOST_CHECK_EQUAL(fixture.r(3), 9);
+}
+
+BOOST_AUTO_TEST_CASE(run_pc_range)
+{
+	ArmProgramFixture fixture;
+	fixture.load(std::begin(fibonacciCode), std::end(fibonacciCode));
+	fixture.r(0, 10);
+	fixture.runProgram();
+	BOOST_CHECK_EQUAL(fixture.r(0), 55);
+}
+
+BOOST_AUTO_TEST_CASE(run_requested_stop)
+{
+	constexpr uint32_t code[] = {
+		0xe3a01c01, // mov	r1, #256
+		0xe5810000, // str	r0, [r1]
+		0xe3a00001, // mov	r0, #1
+		0xe1a0f00e, // mov	pc, lr
+	};
+	ArmProgramFixture fixture;
+	fixture.load(std::begin(code), std::end(code));
+	fixture.machine.untrackedMemory().observe(0x100, 4,
+		[&fixture](Emuballs::memsize, Emuballs::Access) { fixture.machine.requestStop(); },
+		Emuballs::Access::Write);
+	auto result = fixture.machine.run(1000);
+	BOOST_CHECK(result.reason == Emuballs::Arm::StopReason::Requested);
+	BOOST_CHECK_EQUAL(result.executed, 2);
+	BOOST_CHECK_EQUAL(fixture.machine.nextInstructionAddress(), 8);
+}
+
+BOOST_AUTO_TEST_CASE(machine_breakpoints)
+{
+	constexpr auto LOOP_ADDRESS = 0x24;
+	ArmProgramFixture fixture;
+	fixture.load(std::begin(fibonacciCode), std::end(fibonacciCode));
+	fixture.r(0, 10);
+	fixture.machine.breakpoints().insert(LOOP_ADDRESS);
+	int hits = 0;
+	Emuballs::Arm::RunResult result;
+	while ((result = fixture.machine.run(1000)).reason == Emuballs::Arm::StopReason::Breakpoint)
+		++hits;
+	BOOST_CHECK_EQUAL(hits, 10);
+	BOOST_CHECK_EQUAL(fixture.r(0), 55);
+
+	// Breakpoints travel with the machine.
+	fixture.reset();
+	fixture.r(0, 10);
+	fixture.machine.breakpoints().insert(LOOP_ADDRESS);
+	Emuballs::Arm::Machine copy = fixture.machine;
+	result = copy.run(1000);
+	BOOST_CHECK(result.reason == Emuballs::Arm::StopReason::Breakpoint);
+	BOOST_CHECK_EQUAL(copy.nextInstructionAddress(), LOOP_ADDRESS);
+}
+
+BOOST_AUTO_TEST_CASE(machine_watchpoint)
+{
+	constexpr uint32_t code[] = {
+		0xe3a01c01, // mov	r1, #256
+		0xe5910000, // ldr	r0, [r1]
+		0xe5810004, // str	r0, [r1, #4]
+		0xe3a00007, // mov	r0, #7
+		0xe5810004, // str	r0, [r1, #4]
+		0xe3a00001, // mov	r0, #1
+		0xe1a0f00e, // mov	pc, lr
+	};
+	ArmProgramFixture fixture;
+	fixture.load(std::begin(code), std::end(code));
+	auto id = fixture.machine.addWatchpoint(0x104, 4, Emuballs::Access::Write);
+	auto result = fixture.machine.run(1000);
+	BOOST_CHECK(result.reason == Emuballs::Arm::StopReason::Watchpoint);
+	BOOST_CHECK_EQUAL(result.executed, 3);
+	BOOST_CHECK_EQUAL(fixture.machine.lastWatchpointHit().id, id);
+	BOOST_CHECK_EQUAL(fixture.machine.lastWatchpointHit().address, 0x104);
+
+	// The second store to 0x104 goes through once the watchpoint is gone.
+	fixture.machine.removeWatchpoint(id);
+	result = fixture.machine.run(2);
+	BOOST_CHECK(result.reason == Emuballs::Arm::StopReason::Budget);
+	BOOST_CHECK_EQUAL(result.executed, 2);
+	BOOST_CHECK_EQUAL(fixture.machine.memory().word(0x104), 7);
+}
+
+namespace
+{
+using namespace Emuballs::Arm;
+
+constexpr uint32_t NOP = 0xe1a00000; // mov	r0, r0
+constexpr auto CODE_ADDRESS = 0x20;
+
+/**
+ * Vector table with the handlers of `vectors` in their slots,
+ * followed by `code`.
+ */
+std::vector<uint32_t> withVectors(std::initializer_list<std::pair<uint32_t, uint32_t>> vectors,
+	std::initializer_list<uint32_t> code)
+{
+	std::vector<uint32_t> program(CODE_ADDRESS / INSTRUCTION_SIZE, NOP);
+	for (auto &vector : vectors)
+		program[vector.first / INSTRUCTION_SIZE] = vector.second;
+	program.insert(program.end(), code);
+	return program;
+}
+
+void start(ArmProgramFixture &fixture, regval cpsr)
+{
+	fixture.machine.cpu().cpsr(cpsr);
+	fixture.machine.cpu().regs().pc(CODE_ADDRESS);
+}
+}
+
+BOOST_AUTO_TEST_CASE(irq_exception_entry_and_return)
+{
+	ArmProgramFixture fixture;
+	fixture.load(withVectors({
+			{VECTOR_IRQ, 0xe3a01001}, // mov	r1, #1
+			{VECTOR_IRQ + 4, 0xe25ef004}, // subs	pc, lr, #4
+		}, {
+		0xe2800001, // add	r0, r0, #1
+		0xe2800001, // add	r0, r0, #1
+		0xe2800001, // add	r0, r0, #1
+		0xeafffffe, // b	.
+	}));
+	const regval cpsr = MODE_SUPERVISOR | Flags::F_CARRY;
+	start(fixture, cpsr);
+	fixture.machine.cpu().regs().lr(0x1234);
+	fixture.machine.run(2);
+
+	fixture.machine.setIrq(true);
+	fixture.machine.cycle();
+	const Cpu &cpu = fixture.machine.cpu();
+	BOOST_CHECK_EQUAL(cpu.flags().cpuMode(), MODE_IRQ);
+	BOOST_CHECK(cpu.flags().dump() & PSR_IRQ_DISABLE);
+	BOOST_CHECK_EQUAL(cpu.flagsSpsr(MODE_IRQ).dump(), cpsr);
+	BOOST_CHECK_EQUAL(cpu.regs().banked(Bank::Irq, 14), CODE_ADDRESS + 8 + 4);
+	BOOST_CHECK_EQUAL(cpu.regs().banked(Bank::Supervisor, 14), 0x1234);
+	BOOST_CHECK_EQUAL(fixture.r(0), 2);
+	BOOST_CHECK_EQUAL(fixture.r(1), 1);
+
+	// Handler returns with the line still raised, but masked.
+	fixture.machine.setIrq(false);
+	fixture.machine.cycle();
+	BOOST_CHECK_EQUAL(cpu.flags().dump(), cpsr);
+	BOOST_CHECK_EQUAL(fixture.machine.nextInstructionAddress(), CODE_ADDRESS + 8);
+	fixture.machine.cycle();
+	BOOST_CHECK_EQUAL(fixture.r(0), 3);
+}
+
+BOOST_AUTO_TEST_CASE(irq_masked_until_cpsie)
+{
+	ArmProgramFixture fixture;
+	fixture.load(withVectors({{VECTOR_IRQ, 0xeafffffe}}, { // b	.
+		0xe2800001, // add	r0, r0, #1
+		0xf1080080, // cpsie	i
+		0xe2800001, // add	r0, r0, #1
+	}));
+	start(fixture, MODE_SUPERVISOR | PSR_IRQ_DISABLE);
+	fixture.machine.setIrq(true);
+	fixture.machine.run(2);
+	BOOST_CHECK_EQUAL(fixture.r(0), 1);
+	BOOST_CHECK_EQUAL(fixture.machine.cpu().flags().cpuMode(), MODE_SUPERVISOR);
+	fixture.machine.cycle();
+	BOOST_CHECK_EQUAL(fixture.r(0), 1);
+	BOOST_CHECK_EQUAL(fixture.machine.cpu().flags().cpuMode(), MODE_IRQ);
+	BOOST_CHECK_EQUAL(fixture.machine.cpu().regs().lr(), CODE_ADDRESS + 8 + 4);
+}
+
+BOOST_AUTO_TEST_CASE(software_interrupt)
+{
+	ArmProgramFixture fixture;
+	fixture.load(withVectors({{VECTOR_SOFTWARE_INTERRUPT, 0xe1b0f00e}}, { // movs	pc, lr
+		0xef000000, // svc	0x00000000
+		0xe2800001, // add	r0, r0, #1
+	}));
+	start(fixture, MODE_USER);
+	fixture.machine.cycle();
+	const Cpu &cpu = fixture.machine.cpu();
+	BOOST_CHECK_EQUAL(cpu.flags().cpuMode(), MODE_SUPERVISOR);
+	BOOST_CHECK_EQUAL(cpu.flagsSpsr(MODE_SUPERVISOR).dump(), MODE_USER);
+	BOOST_CHECK_EQUAL(cpu.regs().lr(), CODE_ADDRESS + 4);
+	BOOST_CHECK_EQUAL(fixture.machine.nextInstructionAddress(), VECTOR_SOFTWARE_INTERRUPT);
+	fixture.machine.run(2);
+	BOOST_CHECK_EQUAL(cpu.flags().dump(), MODE_USER);
+	BOOST_CHECK_EQUAL(fixture.r(0), 1);
+}
+
+BOOST_AUTO_TEST_CASE(wait_for_interrupt)
+{
+	ArmProgramFixture fixture;
+	fixture.load(withVectors({}, {
+		0xe320f003, // wfi
+		0xe2800001, // add	r0, r0, #1
+		0xeafffffe, // b	.
+	}));
+	start(fixture, MODE_SUPERVISOR | PSR_IRQ_DISABLE);
+	uint64_t idle = 0;
+	fixture.machine.setIdleHandler([&idle](uint64_t instructions) { idle += instructions; });
+
+	RunResult result = fixture.machine.run(100);
+	BOOST_CHECK(result.reason == StopReason::Requested);
+	BOOST_CHECK_EQUAL(result.executed, 1);
+	BOOST_CHECK(fixture.machine.isWaitingForInterrupt());
+
+	// Time passes, but nothing is executed.
+	result = fixture.machine.run(1000);
+	BOOST_CHECK(result.reason == StopReason::Budget);
+	BOOST_CHECK_EQUAL(result.executed, 1000);
+	BOOST_CHECK_EQUAL(idle, 1000);
+	BOOST_CHECK_EQUAL(fixture.machine.instructionCount(), 1001);
+	BOOST_CHECK_EQUAL(fixture.r(0), 0);
+
+	// Masked interrupt wakes the core up all the same.
+	fixture.machine.setIrq(true);
+	BOOST_CHECK(!fixture.machine.isWaitingForInterrupt());
+	fixture.machine.cycle();
+	BOOST_CHECK_EQUAL(fixture.r(0), 1);
+	BOOST_CHECK_EQUAL(fixture.machine.cpu().flags().cpuMode(), MODE_SUPERVISOR);
+
+	// WFI with the line up doesn't sleep at all.
+	fixture.reset();
+	start(fixture, MODE_SUPERVISOR | PSR_IRQ_DISABLE);
+	fixture.machine.setIrq(true);
+	result = fixture.machine.run(2);
+	BOOST_CHECK(result.reason == StopReason::Budget);
+	BOOST_CHECK_EQUAL(fixture.r(0), 1);
+}
@@ -0,0 +1,147 @@
+/*
+ * Copyright 2017 Zalewa <zalewapl@gmail.com>.
+ *
+ * This file is part of Emuballs.
+ *
+ * Emuballs is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Emuballs is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with Emuballs.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#define BOOST_TEST_MODULE armopcode_exclusive
+#include <boost/test/unit_test.hpp>
+#include "arm_program_fixture.hpp"
+#include "src/emuballs/armopcode_impl.hpp"
+#include "src/emuballs/errors_private.hpp"
+
+static Emuballs::Arm::OpcodePtr decode(uint32_t code)
+{
+	auto op = Emuballs::Arm::opcodeSynchronization(code);
+	BOOST_REQUIRE(op != nullptr);
+	return op;
+}
+
+constexpr uint32_t MEM_ADDR = 0x40000;
+
+BOOST_FIXTURE_TEST_SUITE(suite, ArmProgramFixture)
+
+BOOST_AUTO_TEST_CASE(ldrex_strex)
+{
+	auto ldrex = decode(0xe1910f9f); // ldrex r0, [r1]
+	auto strex = decode(0xe1812f93); // strex r2, r3, [r1]
+	machine.memory().putWord(MEM_ADDR, 0xbcde1234);
+	r(1, MEM_ADDR);
+	r(3, 0xcafebeba);
+	ldrex->execute(machine);
+	BOOST_CHECK_EQUAL(r(0), 0xbcde1234);
+	strex->execute(machine);
+	BOOST_CHECK_EQUAL(r(2), 0);
+	BOOST_CHECK_EQUAL(machine.memory().word(MEM_ADDR), 0xcafebeba);
+
+	// Monitor is consumed by the store.
+	r(3, 0x1);
+	strex->execute(machine);
+	BOOST_CHECK_EQUAL(r(2), 1);
+	BOOST_CHECK_EQUAL(machine.memory().word(MEM_ADDR), 0xcafebeba);
+}
+
+BOOST_AUTO_TEST_CASE(strex_fails_after_change)
+{
+	auto ldrex = decode(0xe1910f9f); // ldrex r0, [r1]
+	auto strex = decode(0xe1812f93); // strex r2, r3, [r1]
+	machine.memory().putWord(MEM_ADDR, 5);
+	r(1, MEM_ADDR);
+	r(3, 6);
+	ldrex->execute(machine);
+	// Another core got there first.
+	machine.memory().putWord(MEM_ADDR, 7);
+	strex->execute(machine);
+	BOOST_CHECK_EQUAL(r(2), 1);
+	BOOST_CHECK_EQUAL(machine.memory().word(MEM_ADDR), 7);
+}
+
+BOOST_AUTO_TEST_CASE(strex_fails_on_other_address)
+{
+	auto ldrex = decode(0xe1910f9f); // ldrex r0, [r1]
+	auto strex = decode(0xe1842f93); // strex r2, r3, [r4]
+	r(1, MEM_ADDR);
+	r(4, MEM_ADDR + 4);
+	r(3, 6);
+	ldrex->execute(machine);
+	strex->execute(machine);
+	BOOST_CHECK_EQUAL(r(2), 1);
+	BOOST_CHECK_EQUAL(machine.memory().word(MEM_ADDR + 4), 0);
+}
+
+BOOST_AUTO_TEST_CASE(clrex)
+{
+	auto ldrex = decode(0xe1910f9f); // ldrex r0, [r1]
+	auto strex = decode(0xe1812f93); // strex r2, r3, [r1]
+	auto clrex = decode(0xf57ff01f); // clrex
+	r(1, MEM_ADDR);
+	r(3, 6);
+	ldrex->execute(machine);
+	clrex->execute(machine);
+	strex->execute(machine);
+	BOOST_CHECK_EQUAL(r(2), 1);
+	BOOST_CHECK_EQUAL(machine.memory().word(MEM_ADDR), 0);
+}
+
+BOOST_AUTO_TEST_CASE(byte_halfword_doubleword)
+{
+	machine.memory().putDword(MEM_ADDR, 0x1122334455667788);
+	r(1, MEM_ADDR);
+
+	decode(0xe1d10f9f)->execute(machine); // ldrexb r0, [r1]
+	BOOST_CHECK_EQUAL(r(0), 0x88);
+	r(3, 0xffffff99);
+	decode(0xe1c12f93)->execute(machine); // strexb r2, r3, [r1]
+	BOOST_CHECK_EQUAL(r(2), 0);
+	BOOST_CHECK_EQUAL(machine.memory().word(MEM_ADDR), 0x55667799);
+
+	decode(0xe1f10f9f)->execute(machine); // ldrexh r0, [r1]
+	BOOST_CHECK_EQUAL(r(0), 0x7799);
+	r(3, 0xaabb);
+	decode(0xe1e12f93)->execute(machine); // strexh r2, r3, [r1]
+	BOOST_CHECK_EQUAL(r(2), 0);
+	BOOST_CHECK_EQUAL(machine.memory().word(MEM_ADDR), 0x5566aabb);
+
+	decode(0xe1b14f9f)->execute(machine); // ldrexd r4, r5, [r1]
+	BOOST_CHECK_EQUAL(r(4), 0x5566aabb);
+	BOOST_CHECK_EQUAL(r(5), 0x11223344);
+	r(4, 0xdeadbeef);
+	r(5, 0xcafebeba);
+	decode(0xe1a12f94)->execute(machine); // strexd r2, r4, r5, [r1]
+	BOOST_CHECK_EQUAL(r(2), 0);
+	BOOST_CHECK_EQUAL(machine.memory().dword(MEM_ADDR), 0xcafebebadeadbeef);
+}
+
+BOOST_AUTO_TEST_CASE(barriers)
+{
+	decode(0xf57ff05b)->execute(machine); // dmb ish
+	decode(0xf57ff04f)->execute(machine); // dsb sy
+	decode(0xf57ff06f)->execute(machine); // isb sy
+	BOOST_CHECK(Emuballs::Arm::opcodeSynchronization(0xf57ff07f) == nullptr);
+}
+
+BOOST_AUTO_TEST_CASE(illegal)
+{
+	// strex r1, r3, [r1]
+	BOOST_CHECK_THROW(decode(0xe1811f93)->validate(), Emuballs::IllegalOpcodeError);
+	// ldrexd r3, r4, [r1]
+	BOOST_CHECK_THROW(decode(0xe1b13f9f)->validate(), Emuballs::IllegalOpcodeError);
+
+	auto ldrex = decode(0xe1910f9f); // ldrex r0, [r1]
+	r(1, MEM_ADDR + 2);
+	BOOST_CHECK_THROW(ldrex->execute(machine), Emuballs::ProgramRuntimeError);
+}
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -43,6 +43,7 @@ struct Fixture
 		opcodeCoprocessorRegisterTransfer,
 		opcodeSoftwareInterrupt,
 		opcodeByteReverse,
+		opcodeProcessorState,
 	};
 
 	struct Code
@@ -521,6 +522,16 @@ struct Fixture
 					{0xe6ff9fba}, // revsh r9, sl
 						}});
 
+		codes.emplace(Factory::opcodeProcessorState,
+			CodeSet {
+				Emuballs::Arm::opcodeProcessorState, std::list<Code> {
+					{0xe320f000}, // nop
+					{0xe320f003}, // wfi
+					{0xee070f90}, // mcr 15, 0, r0, cr7, cr0, {4}
+					{0xf1080080}, // cpsie i
+					{0xf10c0080}, // cpsid i
+						}});
+
 		fillInConditionals();
 	}
 
@@ -581,6 +592,10 @@ std::ostream& operator<< (std::ostream & os, Fixture::Factory factory)
 		return os << "opcodeCoprocessorRegisterTransfer";
 	case Fixture::Factory::opcodeSoftwareInterrupt:
 		return os << "opcodeSoftwareInterrupt";
+	case Fixture::Factory::opcodeByteReverse:
+		return os << "opcodeByteReverse";
+	case Fixture::Factory::opcodeProcessorState:
+		return os << "opcodeProcessorState";
 	default:
 		return os << "unknown Fixture::Factory" << static_cast<int>(factory);
 	}
@@ -46,6 +46,27 @@ BOOST_AUTO_TEST_CASE(allNamedRegs)
 	}
 }
 
+BOOST_AUTO_TEST_CASE(allRegValues)
+{
+	auto &regs = machine.cpu().regs();
+	for (int i = 0; i < NUM_CPU_REGS; ++i)
+		regs.set(i, (i + 1) * 4);
+	NamedRegisterSet namedRegs(machine);
+	std::vector<uint32_t> values;
+	namedRegs.values(values);
+	BOOST_REQUIRE_EQUAL(values.size(), namedRegs.registers().size());
+	int index = 0;
+	for (auto &namedReg : namedRegs.registers())
+	{
+		BOOST_CHECK_EQUAL(values[index], static_cast<regval>(namedReg.value()));
+		++index;
+	}
+	// Same as the generic implementation.
+	std::vector<uint32_t> generic;
+	namedRegs.Emuballs::RegisterSet::values(generic);
+	BOOST_CHECK(values == generic);
+}
+
 BOOST_AUTO_TEST_CASE(specificRegGet)
 {
 	auto &regs = machine.cpu().regs();
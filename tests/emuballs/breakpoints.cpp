@@ -0,0 +1,85 @@
+/*
+ * Copyright 2017 Zalewa <zalewapl@gmail.com>.
+ *
+ * This file is part of Emuballs.
+ *
+ * Emuballs is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Emuballs is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with Emuballs.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#define BOOST_TEST_MODULE breakpoints
+#include <boost/test/unit_test.hpp>
+#include "src/emuballs/breakpoints.hpp"
+
+using namespace Emuballs::Arm;
+
+BOOST_AUTO_TEST_CASE(empty)
+{
+	BreakpointMap breakpoints;
+	BOOST_CHECK(breakpoints.empty());
+	BOOST_CHECK(!breakpoints.contains(0));
+	BOOST_CHECK(!breakpoints.contains(0x8000));
+}
+
+BOOST_AUTO_TEST_CASE(insertErase)
+{
+	BreakpointMap breakpoints;
+	breakpoints.insert(0x8004);
+	breakpoints.insert(0x20000);
+	breakpoints.insert(0x8004);
+	BOOST_CHECK_EQUAL(breakpoints.size(), 2);
+	BOOST_CHECK(breakpoints.contains(0x8004));
+	BOOST_CHECK(!breakpoints.contains(0x8000));
+	BOOST_CHECK(!breakpoints.contains(0x8008));
+	BOOST_CHECK(breakpoints.contains(0x20000));
+	BOOST_CHECK(breakpoints.contains(0x8004));
+
+	breakpoints.erase(0x8004);
+	BOOST_CHECK_EQUAL(breakpoints.size(), 1);
+	BOOST_CHECK(!breakpoints.contains(0x8004));
+	breakpoints.erase(0x8004);
+	BOOST_CHECK_EQUAL(breakpoints.size(), 1);
+
+	breakpoints.clear();
+	BOOST_CHECK(breakpoints.empty());
+	BOOST_CHECK(!breakpoints.contains(0x20000));
+}
+
+BOOST_AUTO_TEST_CASE(unalignedIsRoundedDown)
+{
+	BreakpointMap breakpoints;
+	breakpoints.insert(0x8006);
+	BOOST_CHECK(breakpoints.contains(0x8004));
+}
+
+BOOST_AUTO_TEST_CASE(addresses)
+{
+	BreakpointMap breakpoints;
+	breakpoints.insert(0x30000);
+	breakpoints.insert(0x100);
+	breakpoints.insert(0x104);
+	std::vector<Emuballs::memsize> expected = { 0x100, 0x104, 0x30000 };
+	auto addresses = breakpoints.addresses();
+	BOOST_CHECK_EQUAL_COLLECTIONS(addresses.begin(), addresses.end(),
+		expected.begin(), expected.end());
+}
+
+BOOST_AUTO_TEST_CASE(copyIsIndependent)
+{
+	BreakpointMap breakpoints;
+	breakpoints.insert(0x100);
+	BOOST_CHECK(breakpoints.contains(0x100));
+	BreakpointMap copy = breakpoints;
+	breakpoints.erase(0x100);
+	BOOST_CHECK(copy.contains(0x100));
+	BOOST_CHECK(!breakpoints.contains(0x100));
+}
@@ -0,0 +1,195 @@
+/*
+ * Copyright 2017 Zalewa <zalewapl@gmail.com>.
+ *
+ * This file is part of Emuballs.
+ *
+ * Emuballs is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Emuballs is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with Emuballs.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#define BOOST_TEST_MODULE checkpoints
+#include <boost/test/unit_test.hpp>
+#include "device_program.hpp"
+#include "emuballs/memory.hpp"
+
+#include <chrono>
+#include <string>
+#include <thread>
+
+using namespace DeviceProgram;
+
+namespace
+{
+constexpr uint32_t STORED_ADDRESS = 0x10000;
+constexpr uint32_t STORED_SIZE = 1000 * 4;
+
+/*
+ * Stores the system timer readings one after another.
+ */
+const std::vector<uint32_t> timerCode = {
+	0xe3a00202, // mov	r0, #0x20000000
+	0xe3800a03, // orr	r0, r0, #0x3000
+	0xe3a04801, // mov	r4, #0x10000
+	// loop:
+	0xe5901004, // ldr	r1, [r0, #4]
+	0xe4841004, // str	r1, [r4], #4
+	0xeafffffc, // b	loop
+};
+constexpr uint32_t STR_ADDRESS = PROGRAM_START + 4 * 4;
+
+/*
+ * Takes a timer compare IRQ every 100 microseconds
+ * and stores the loop counter at each of them.
+ */
+const std::vector<uint32_t> irqCode = {
+	0xe3a00202, // mov	r0, #0x20000000
+	0xe3800a03, // orr	r0, r0, #0x3000
+	0xe3a01202, // mov	r1, #0x20000000
+	0xe3811cb2, // orr	r1, r1, #0xb200
+	0xe3a06801, // mov	r6, #0x10000
+	0xe3a02002, // mov	r2, #2
+	0xe5812010, // str	r2, [r1, #0x10]
+	0xe5903004, // ldr	r3, [r0, #4]
+	0xe2833064, // add	r3, r3, #100
+	0xe5803010, // str	r3, [r0, #0x10]
+	0xf1080080, // cpsie	i
+	// loop:
+	0xe2855001, // add	r5, r5, #1
+	0xeafffffd, // b	loop
+	// handler:
+	0xe3a02002, // mov	r2, #2
+	0xe5802000, // str	r2, [r0]
+	0xe5903004, // ldr	r3, [r0, #4]
+	0xe2833064, // add	r3, r3, #100
+	0xe5803010, // str	r3, [r0, #0x10]
+	0xe4865004, // str	r5, [r6], #4
+	0xe25ef004, // subs	pc, lr, #4
+};
+constexpr uint32_t IRQ_VECTOR = 0x18;
+constexpr uint32_t BRANCH_TO_HANDLER = 0xea002005;
+constexpr uint32_t TIMER_CONTROL = 0x20003000;
+
+/*
+ * Registers, the loop counters stored by the IRQ handler
+ * and the timer match bits.
+ */
+std::vector<uint32_t> irqState(Emuballs::Device &device)
+{
+	std::vector<uint32_t> state;
+	for (int index = 0; index < 16; ++index)
+		state.push_back(reg(device, "r" + std::to_string(index)));
+	for (uint32_t offset = 0; offset < 64 * 4; offset += 4)
+		state.push_back(device.memory().word(STORED_ADDRESS + offset));
+	state.push_back(device.memory().word(TIMER_CONTROL));
+	return state;
+}
+
+void sleep()
+{
+	std::this_thread::sleep_for(std::chrono::milliseconds(2));
+}
+}
+
+BOOST_AUTO_TEST_CASE(step_back_replays_inputs)
+{
+	auto device = createDevice(timerCode);
+	BOOST_CHECK_EQUAL(device->stepBack(1), 0);
+	device->startCheckpoints(256, 1024 * 1024);
+
+	device->cycle(1501);
+	auto halfway = device->memory().chunk(STORED_ADDRESS, STORED_SIZE);
+	uint32_t halfwayR4 = reg(*device, "r4");
+	sleep();
+	device->cycle(1499);
+	auto end = device->memory().chunk(STORED_ADDRESS, STORED_SIZE);
+	// The sleep must show in the timer reads.
+	BOOST_REQUIRE(end[0] != end[end.size() - 4] || end[1] != end[end.size() - 3]);
+
+	BOOST_CHECK_EQUAL(device->stepBack(1499), 1499);
+	BOOST_CHECK(device->memory().chunk(STORED_ADDRESS, STORED_SIZE) == halfway);
+	BOOST_CHECK_EQUAL(reg(*device, "r4"), halfwayR4);
+
+	// Running forward again takes the same inputs.
+	sleep();
+	device->cycle(1499);
+	BOOST_CHECK(device->memory().chunk(STORED_ADDRESS, STORED_SIZE) == end);
+
+	// To the very beginning.
+	BOOST_CHECK_EQUAL(device->stepBack(100000), 3000);
+	BOOST_CHECK_EQUAL(reg(*device, "r4"), 0);
+	BOOST_CHECK_EQUAL(device->memory().word(STORED_ADDRESS), 0);
+}
+
+BOOST_AUTO_TEST_CASE(step_back_within_budget)
+{
+	auto device = createDevice(timerCode);
+	// Each checkpoint dirties at least one page; the budget
+	// fits only a few of them.
+	const size_t pageSize = device->memory().pageSize();
+	device->startCheckpoints(100, pageSize * 4);
+	device->cycle(3000);
+	uint64_t back = device->stepBack(3000);
+	BOOST_CHECK_GT(back, 0);
+	BOOST_CHECK_LT(back, 3000);
+	// Stepping back past the oldest checkpoint
+	// stays at the oldest checkpoint.
+	BOOST_CHECK_EQUAL(device->stepBack(1), 0);
+
+	device->reset();
+	BOOST_CHECK_EQUAL(device->stepBack(1), 0);
+}
+
+BOOST_AUTO_TEST_CASE(run_back_to_breakpoint)
+{
+	auto device = createDevice(timerCode);
+	device->startCheckpoints(256, 1024 * 1024);
+	device->cycle(3000);
+
+	// Loop stores at instruction count 4 + 3 * i.
+	BOOST_CHECK(device->runBackToBreakpoint({ STR_ADDRESS }));
+	BOOST_CHECK_EQUAL(reg(*device, "r4"), STORED_ADDRESS + 4 * 998);
+	BOOST_CHECK_EQUAL(device->memory().word(STORED_ADDRESS + 4 * 998), 0);
+	BOOST_CHECK(device->memory().word(STORED_ADDRESS + 4 * 997) != 0);
+
+	BOOST_CHECK(device->runBackToBreakpoint({ STR_ADDRESS }));
+	BOOST_CHECK_EQUAL(reg(*device, "r4"), STORED_ADDRESS + 4 * 997);
+
+	// Breakpoint never hit takes the run to the oldest checkpoint.
+	BOOST_CHECK(!device->runBackToBreakpoint({ 0x100 }));
+	BOOST_CHECK_EQUAL(reg(*device, "r4"), 0);
+	BOOST_CHECK(!device->runBackToBreakpoint({ STR_ADDRESS }));
+}
+
+BOOST_AUTO_TEST_CASE(step_back_across_timer_irqs)
+{
+	auto device = createDevice(irqCode);
+	device->memory().putWord(IRQ_VECTOR, BRANCH_TO_HANDLER);
+	device->setVirtualTime(true, 1000000);
+	device->startCheckpoints(256, 1024 * 1024);
+
+	device->cycle(2000);
+	auto halfway = irqState(*device);
+	device->cycle(1000);
+	auto end = irqState(*device);
+	// IRQs were taken between the two states.
+	BOOST_REQUIRE_GT(reg(*device, "r6"), STORED_ADDRESS + 4 * 20);
+	BOOST_REQUIRE(halfway != end);
+
+	BOOST_CHECK_EQUAL(device->stepBack(1000), 1000);
+	auto stepped = irqState(*device);
+	BOOST_CHECK_EQUAL_COLLECTIONS(stepped.begin(), stepped.end(),
+		halfway.begin(), halfway.end());
+	device->cycle(1000);
+	auto replayed = irqState(*device);
+	BOOST_CHECK_EQUAL_COLLECTIONS(replayed.begin(), replayed.end(),
+		end.begin(), end.end());
+}
@@ -0,0 +1,82 @@
+/*
+ * Copyright 2017 Zalewa <zalewapl@gmail.com>.
+ *
+ * This file is part of Emuballs.
+ *
+ * Emuballs is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Emuballs is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with Emuballs.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#pragma once
+#include "emuballs/device.hpp"
+#include "emuballs/programmer.hpp"
+#include "emuballs/registerset.hpp"
+#include "emuballs/regval.hpp"
+
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <utility>
+#include <vector>
+
+namespace DeviceProgram
+{
+constexpr uint32_t PROGRAM_START = 0x8000;
+
+/**
+ * Program words placed at their addresses; the gaps are zero-filled.
+ */
+typedef std::vector<std::pair<uint32_t, std::vector<uint32_t>>> Code;
+
+/**
+ * Creates the named device and loads the code blocks into it.
+ */
+inline Emuballs::DevicePtr createDevice(const Code &code,
+	const std::string &name = "Raspberry Pi 1")
+{
+	for (auto &factory : Emuballs::listDevices())
+	{
+		if (factory.name() == name)
+		{
+			Emuballs::DevicePtr device = factory.create();
+			std::string bytes;
+			for (auto &block : code)
+			{
+				bytes.resize(block.first - PROGRAM_START, '\0');
+				for (uint32_t word : block.second)
+				{
+					for (int i = 0; i < 4; ++i)
+						bytes += static_cast<char>((word >> (i * 8)) & 0xff);
+				}
+			}
+			std::stringstream stream(bytes);
+			device->programmer().load(stream);
+			return device;
+		}
+	}
+	throw std::runtime_error("no device " + name);
+}
+
+/**
+ * Creates the named device with the program loaded at PROGRAM_START.
+ */
+inline Emuballs::DevicePtr createDevice(const std::vector<uint32_t> &program,
+	const std::string &name = "Raspberry Pi 1")
+{
+	return createDevice(Code{{PROGRAM_START, program}}, name);
+}
+
+inline uint32_t reg(Emuballs::Device &device, const std::string &name)
+{
+	return device.registers().reg(name);
+}
+}
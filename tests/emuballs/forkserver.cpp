@@ -0,0 +1,257 @@
+/*
+ * Copyright 2017 Zalewa <zalewapl@gmail.com>.
+ *
+ * This file is part of Emuballs.
+ *
+ * Emuballs is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Emuballs is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with Emuballs.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#define BOOST_TEST_MODULE forkserver
+#include <boost/test/unit_test.hpp>
+#include "arm_program_fixture.hpp"
+#include "device_program.hpp"
+#include "emuballs/memory.hpp"
+#include "src/emuballs/armregisterset.hpp"
+#include "src/emuballs/forkserver.hpp"
+#include <algorithm>
+#include <string>
+
+using namespace Emuballs;
+
+namespace
+{
+constexpr uint32_t parserCode[] = {
+	// warmup
+	0xe3a05000, // 00: mov	r5, #0
+	0xe3a06a02, // 04: mov	r6, #0x2000
+	0xe2855001, // 08: add	r5, r5, #1
+	0xe355000a, // 0c: cmp	r5, #10
+	0x1afffffc, // 10: bne	08
+	// parse(r0 = input, r1 = length)
+	0xe3a03000, // 14: mov	r3, #0
+	0xe3510000, // 18: cmp	r1, #0
+	0x0a00000b, // 1c: beq	50
+	0xe4d02001, // 20: ldrb	r2, [r0], #1
+	0xe2411001, // 24: sub	r1, r1, #1
+	0xe5967000, // 28: ldr	r7, [r6]
+	0xe2877001, // 2c: add	r7, r7, #1
+	0xe5867000, // 30: str	r7, [r6]
+	0xe3520041, // 34: cmp	r2, #'A'
+	0x02833001, // 38: addeq	r3, r3, #1
+	0xe3520058, // 3c: cmp	r2, #'X'
+	0x0a000003, // 40: beq	54
+	0xe3520048, // 44: cmp	r2, #'H'
+	0x0afffffe, // 48: beq	48
+	0xeafffff1, // 4c: b	18
+	0xe1a00000, // 50: nop
+	0xe7f000f0, // 54: udf
+};
+
+/*
+ * Input starting with 'I' arms a timer compare IRQ 100 microseconds
+ * ahead and returns at once; 'W' arms it and waits through it.
+ * The IRQ handler counts in r4.
+ */
+const std::vector<uint32_t> irqCode = {
+	0xe3a00202, // 8000: mov	r0, #0x20000000
+	0xe3800a03, // 8004: orr	r0, r0, #0x3000
+	0xe3a01202, // 8008: mov	r1, #0x20000000
+	0xe3811cb2, // 800c: orr	r1, r1, #0xb200
+	0xe3a04000, // 8010: mov	r4, #0
+	0xf1080080, // 8014: cpsie	i
+	// parse(r8 = input, r9 = length)
+	0xe3590000, // 8018: cmp	r9, #0
+	0x0a00000a, // 801c: beq	804c
+	0xe5d82000, // 8020: ldrb	r2, [r8]
+	0xe3520049, // 8024: cmp	r2, #'I'
+	0x13520057, // 8028: cmpne	r2, #'W'
+	0x1a000006, // 802c: bne	804c
+	0xe3a06002, // 8030: mov	r6, #2
+	0xe5816010, // 8034: str	r6, [r1, #0x10]
+	0xe5903004, // 8038: ldr	r3, [r0, #4]
+	0xe2833064, // 803c: add	r3, r3, #100
+	0xe5803010, // 8040: str	r3, [r0, #0x10]
+	0xe3520049, // 8044: cmp	r2, #'I'
+	0x0a000002, // 8048: beq	8058
+	0xe3a050c8, // 804c: mov	r5, #200
+	0xe2555001, // 8050: subs	r5, r5, #1
+	0x1afffffd, // 8054: bne	8050
+	0xe1a00000, // 8058: nop
+	0xeafffffd, // 805c: b	8058
+	// handler
+	0xe2844001, // 8060: add	r4, r4, #1
+	0xe3a06002, // 8064: mov	r6, #2
+	0xe5806000, // 8068: str	r6, [r0]
+	0xe25ef004, // 806c: subs	pc, lr, #4
+};
+
+struct ForkServerFixture : ArmProgramFixture
+{
+	std::unique_ptr<Arm::NamedRegisterSet> regs;
+	std::unique_ptr<ForkServer> server;
+	int serviced = 0;
+
+	ForkServerFixture()
+	{
+		load(std::begin(parserCode), std::end(parserCode));
+		regs.reset(new Arm::NamedRegisterSet(machine));
+		FuzzTarget target;
+		target.snapshotAddress = 0x14;
+		target.inputAddress = 0x1000;
+		target.inputCapacity = 16;
+		target.inputAddressRegister = "r0";
+		target.inputLengthRegister = "r1";
+		target.returnAddress = 0x50;
+		target.budget = 1000;
+		server.reset(new ForkServer(machine, *regs, [this]() { ++serviced; }, target));
+	}
+
+	FuzzResult run(const std::string &input)
+	{
+		return server->run(reinterpret_cast<const uint8_t*>(input.data()), input.size());
+	}
+};
+}
+
+BOOST_FIXTURE_TEST_CASE(forkserver_restores_state, ForkServerFixture)
+{
+	BOOST_CHECK_EQUAL(r(5), 10);
+	auto result = run("AAbA");
+	BOOST_CHECK(result.outcome == FuzzOutcome::Returned);
+	BOOST_CHECK_EQUAL(r(3), 3);
+	BOOST_CHECK_EQUAL(machine.untrackedMemory().word(0x2000), 4);
+
+	result = run("A");
+	BOOST_CHECK(result.outcome == FuzzOutcome::Returned);
+	BOOST_CHECK_EQUAL(result.executed, 17);
+	BOOST_CHECK_EQUAL(r(3), 1);
+	BOOST_CHECK_EQUAL(machine.untrackedMemory().word(0x2000), 1);
+
+	// Input is truncated to capacity.
+	result = run(std::string(100, 'A'));
+	BOOST_CHECK_EQUAL(r(3), 16);
+}
+
+BOOST_FIXTURE_TEST_CASE(forkserver_outcomes, ForkServerFixture)
+{
+	auto result = run("AH");
+	BOOST_CHECK(result.outcome == FuzzOutcome::Hang);
+	BOOST_CHECK_EQUAL(result.executed, 1000);
+
+	result = run("AX");
+	BOOST_CHECK(result.outcome == FuzzOutcome::Crash);
+	BOOST_CHECK(!result.error.empty());
+	BOOST_TEST_MESSAGE(result.error);
+
+	result = run("");
+	BOOST_CHECK(result.outcome == FuzzOutcome::Returned);
+	BOOST_CHECK_EQUAL(result.executed, 3);
+	BOOST_CHECK_EQUAL(machine.nextInstructionAddress(), 0x50);
+}
+
+BOOST_FIXTURE_TEST_CASE(forkserver_machine_stops, ForkServerFixture)
+{
+	// A watchpoint on the counter stops the run before it returns.
+	auto id = machine.addWatchpoint(0x2000, 4, Access::Write);
+	auto result = run("A");
+	BOOST_CHECK(result.outcome == FuzzOutcome::Stopped);
+	BOOST_CHECK_EQUAL(result.executed, 8);
+	BOOST_CHECK_EQUAL(result.error, "watchpoint hit at 0x2000");
+	machine.removeWatchpoint(id);
+
+	// So does a breakpoint that isn't the return address.
+	machine.breakpoints().insert(0x38);
+	result = run("A");
+	BOOST_CHECK(result.outcome == FuzzOutcome::Stopped);
+	BOOST_CHECK_EQUAL(result.error, "breakpoint at 0x38");
+	machine.breakpoints().clear();
+
+	result = run("A");
+	BOOST_CHECK(result.outcome == FuzzOutcome::Returned);
+	BOOST_CHECK(result.error.empty());
+}
+
+BOOST_FIXTURE_TEST_CASE(forkserver_coverage, ForkServerFixture)
+{
+	std::vector<uint8_t> first(1024, 0), second(1024, 0);
+	server->setCoverageMap(first.data(), first.size());
+	run("AAA");
+	server->setCoverageMap(second.data(), second.size());
+	run("AAX");
+	server->setCoverageMap(nullptr, 0);
+
+	auto edges = [](const std::vector<uint8_t> &map) {
+		return std::count_if(map.begin(), map.end(), [](uint8_t hits) { return hits != 0; });
+	};
+	BOOST_CHECK_GT(edges(first), 0);
+	BOOST_CHECK_GT(edges(second), 0);
+	BOOST_CHECK(first != second);
+
+	// Same input, same coverage.
+	std::vector<uint8_t> again(1024, 0);
+	server->setCoverageMap(again.data(), again.size());
+	run("AAA");
+	BOOST_CHECK(first == again);
+
+	BOOST_CHECK_THROW(server->setCoverageMap(again.data(), 1000), std::invalid_argument);
+}
+
+BOOST_AUTO_TEST_CASE(forkserver_snapshot_not_reached)
+{
+	ArmProgramFixture fixture;
+	fixture.load(std::begin(parserCode), std::end(parserCode));
+	Arm::NamedRegisterSet regs(fixture.machine);
+	FuzzTarget target;
+	target.snapshotAddress = 0x14;
+	target.warmupBudget = 5;
+	BOOST_CHECK_THROW(ForkServer(fixture.machine, regs, []() {}, target), std::runtime_error);
+}
+
+BOOST_AUTO_TEST_CASE(forkserver_restores_peripherals)
+{
+	auto device = DeviceProgram::createDevice(irqCode);
+	device->memory().putWord(0x18, 0xea002010); // b	8060
+	// Wall clock is asked for, but fuzzing runs in virtual time.
+	device->setVirtualTime(false, 1000000);
+	FuzzTarget target;
+	target.snapshotAddress = 0x8018;
+	target.inputAddress = 0x10000;
+	target.inputCapacity = 16;
+	target.inputAddressRegister = "r8";
+	target.inputLengthRegister = "r9";
+	target.returnAddress = 0x8058;
+	target.budget = 10000;
+	auto fuzzer = device->fuzz(target);
+	auto run = [&fuzzer](const std::string &input) {
+		return fuzzer->run(reinterpret_cast<const uint8_t*>(input.data()), input.size());
+	};
+
+	auto result = run("W");
+	BOOST_REQUIRE(result.outcome == FuzzOutcome::Returned);
+	BOOST_CHECK_EQUAL(DeviceProgram::reg(*device, "r4"), 1);
+
+	// IRQ armed by one input doesn't come in the next one.
+	result = run("I");
+	BOOST_REQUIRE(result.outcome == FuzzOutcome::Returned);
+	BOOST_CHECK_EQUAL(DeviceProgram::reg(*device, "r4"), 0);
+	result = run("");
+	BOOST_REQUIRE(result.outcome == FuzzOutcome::Returned);
+	BOOST_CHECK_EQUAL(DeviceProgram::reg(*device, "r4"), 0);
+	BOOST_CHECK_EQUAL(device->memory().word(0x20003000), 0);
+
+	// Same input, same run.
+	auto first = run("W");
+	auto second = run("W");
+	BOOST_CHECK_EQUAL(first.executed, second.executed);
+	BOOST_CHECK_EQUAL(DeviceProgram::reg(*device, "r4"), 1);
+}
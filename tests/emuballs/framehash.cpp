@@ -0,0 +1,76 @@
+/*
+ * Copyright 2017 Zalewa <zalewapl@gmail.com>.
+ *
+ * This file is part of Emuballs.
+ *
+ * Emuballs is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Emuballs is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with Emuballs.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#define BOOST_TEST_MODULE framehash
+#include <boost/test/unit_test.hpp>
+#include "src/emuballs/framehash.hpp"
+
+#include <algorithm>
+#include <vector>
+
+using namespace Emuballs;
+
+namespace
+{
+std::vector<uint8_t> sequence(size_t length)
+{
+	std::vector<uint8_t> bytes(length);
+	for (size_t i = 0; i < length; ++i)
+		bytes[i] = static_cast<uint8_t>(i * 7 + 3);
+	return bytes;
+}
+
+uint64_t hashOf(const std::vector<uint8_t> &bytes, uint64_t seed = 0)
+{
+	FrameHash hash(seed);
+	hash.update(bytes.data(), bytes.size());
+	return hash.digest();
+}
+}
+
+BOOST_AUTO_TEST_CASE(split_doesnt_matter)
+{
+	const auto bytes = sequence(100);
+	const uint64_t whole = hashOf(bytes);
+	for (size_t chunk : {1, 3, 7, 8, 9, 64})
+	{
+		FrameHash hash;
+		for (size_t offset = 0; offset < bytes.size(); offset += chunk)
+			hash.update(bytes.data() + offset, std::min(chunk, bytes.size() - offset));
+		BOOST_CHECK_EQUAL(hash.digest(), whole);
+	}
+}
+
+BOOST_AUTO_TEST_CASE(inputs_tell_apart)
+{
+	auto bytes = sequence(100);
+	const uint64_t original = hashOf(bytes);
+	BOOST_CHECK_NE(hashOf(bytes, 1), original);
+	bytes[99] ^= 1;
+	BOOST_CHECK_NE(hashOf(bytes), original);
+	// Trailing zeros aren't lost in the padding.
+	BOOST_CHECK_NE(hashOf(std::vector<uint8_t>(3, 0)), hashOf(std::vector<uint8_t>(4, 0)));
+	BOOST_CHECK_NE(hashOf({}), hashOf(std::vector<uint8_t>(8, 0)));
+}
+
+BOOST_AUTO_TEST_CASE(digest_is_stable)
+{
+	// Golden values depend on these; the algorithm must not change.
+	BOOST_CHECK_EQUAL(hashOf({}), 0xe220a8397b1dcdafull);
+	BOOST_CHECK_EQUAL(hashOf(sequence(100), 42), 0x83c9f7db8da1e3ccull);
+}
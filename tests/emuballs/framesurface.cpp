@@ -0,0 +1,119 @@
+/*
+ * Copyright 2017 Zalewa <zalewapl@gmail.com>.
+ *
+ * This file is part of Emuballs.
+ *
+ * Emuballs is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Emuballs is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with Emuballs.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#define BOOST_TEST_MODULE framesurface
+#include <boost/test/unit_test.hpp>
+#include "emuballs/framesurface.hpp"
+
+#include <atomic>
+#include <thread>
+#include <vector>
+
+using namespace Emuballs;
+
+namespace
+{
+void drawFilled(FrameSurface &surface, int32_t width, int32_t height, uint32_t rgb32)
+{
+	surface.begin();
+	if (surface.drawnFrame().source == 0)
+		surface.changeSize(width, height, BitDepth::Rgba32);
+	std::vector<uint32_t> row(width, rgb32);
+	for (int32_t y = 0; y < height; ++y)
+		surface.drawRow(0, y, width, row.data());
+	Canvas::DrawnFrame drawn;
+	drawn.source = 1;
+	surface.setDrawnFrame(drawn);
+	surface.end();
+}
+}
+
+BOOST_AUTO_TEST_CASE(nothing_published)
+{
+	FrameSurface surface;
+	const FrameSurface::Frame &frame = surface.latest();
+	BOOST_CHECK_EQUAL(frame.sequence, 0);
+	BOOST_CHECK(frame.pixels.empty());
+}
+
+BOOST_AUTO_TEST_CASE(latest_frame)
+{
+	FrameSurface surface;
+	drawFilled(surface, 4, 3, 0xff112233);
+	const FrameSurface::Frame &frame = surface.latest();
+	BOOST_CHECK_EQUAL(frame.sequence, 1);
+	BOOST_CHECK_EQUAL(frame.width, 4);
+	BOOST_CHECK_EQUAL(frame.height, 3);
+	BOOST_CHECK(frame.pixels == std::vector<uint32_t>(12, 0xff112233));
+
+	// Nothing new; the same frame again.
+	BOOST_CHECK_EQUAL(&surface.latest(), &frame);
+	BOOST_CHECK_EQUAL(surface.latest().sequence, 1);
+}
+
+BOOST_AUTO_TEST_CASE(frames_not_taken_are_skipped)
+{
+	FrameSurface surface;
+	for (uint32_t i = 1; i <= 5; ++i)
+		drawFilled(surface, 2, 2, 0xff000000 | i);
+	const FrameSurface::Frame &frame = surface.latest();
+	BOOST_CHECK_EQUAL(frame.sequence, 5);
+	BOOST_CHECK_EQUAL(frame.pixels[0], 0xff000005);
+}
+
+BOOST_AUTO_TEST_CASE(frames_keep_their_drawn_frame)
+{
+	FrameSurface surface;
+	// Every frame starts out needing a full draw.
+	for (int i = 0; i < 3; ++i)
+	{
+		BOOST_CHECK_EQUAL(surface.drawnFrame().source, 0);
+		drawFilled(surface, 2, 2, 0xff000000);
+		surface.latest();
+	}
+	BOOST_CHECK_EQUAL(surface.drawnFrame().source, 1);
+}
+
+BOOST_AUTO_TEST_CASE(no_tearing)
+{
+	constexpr uint32_t FRAMES = 2000;
+	FrameSurface surface;
+	std::atomic<bool> done {false};
+	std::thread drawer([&]() {
+			for (uint32_t i = 1; i <= FRAMES; ++i)
+				drawFilled(surface, 64, 64, i);
+			done = true;
+		});
+
+	uint64_t previous = 0;
+	bool torn = false;
+	bool backwards = false;
+	while (!done || surface.latest().sequence != FRAMES)
+	{
+		const FrameSurface::Frame &frame = surface.latest();
+		if (frame.sequence == 0)
+			continue;
+		backwards |= frame.sequence < previous;
+		previous = frame.sequence;
+		for (uint32_t pixel : frame.pixels)
+			torn |= pixel != frame.sequence;
+	}
+	drawer.join();
+	BOOST_CHECK(!torn);
+	BOOST_CHECK(!backwards);
+}
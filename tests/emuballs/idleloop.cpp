@@ -0,0 +1,108 @@
+/*
+ * Copyright 2017 Zalewa <zalewapl@gmail.com>.
+ *
+ * This file is part of Emuballs.
+ *
+ * Emuballs is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Emuballs is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with Emuballs.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#define BOOST_TEST_MODULE idleloop
+#include <boost/test/unit_test.hpp>
+#include "device_program.hpp"
+
+using DeviceProgram::reg;
+
+namespace
+{
+constexpr uint64_t CLOCK_RATE = 1000000;
+
+/*
+ * Waits for 0xf0000 microseconds.
+ */
+const std::vector<uint32_t> waitCode = {
+	0xe3a00202, // mov	r0, #0x20000000
+	0xe3800a03, // orr	r0, r0, #0x3000
+	0xe5901004, // ldr	r1, [r0, #4]
+	0xe281280f, // add	r2, r1, #0xf0000
+	// wait:
+	0xe5903004, // ldr	r3, [r0, #4]
+	0xe1530002, // cmp	r3, r2
+	0x3afffffc, // bcc	wait
+	0xe3a04001, // mov	r4, #1
+	0xeafffffe, // b	.
+};
+
+/*
+ * Counts how many times it polled the timer while waiting
+ * for 0x10000 microseconds.
+ */
+const std::vector<uint32_t> countingCode = {
+	0xe3a00202, // mov	r0, #0x20000000
+	0xe3800a03, // orr	r0, r0, #0x3000
+	0xe5901004, // ldr	r1, [r0, #4]
+	0xe2812801, // add	r2, r1, #0x10000
+	// wait:
+	0xe5903004, // ldr	r3, [r0, #4]
+	0xe2855001, // add	r5, r5, #1
+	0xe1530002, // cmp	r3, r2
+	0x3afffffb, // bcc	wait
+	0xe3a04001, // mov	r4, #1
+	0xeafffffe, // b	.
+};
+
+Emuballs::DevicePtr createDevice(const std::vector<uint32_t> &code, bool skipping)
+{
+	Emuballs::DevicePtr device = DeviceProgram::createDevice(code);
+	device->setVirtualTime(true, CLOCK_RATE);
+	device->setIdleLoopSkipping(skipping);
+	return device;
+}
+}
+
+BOOST_AUTO_TEST_CASE(wait_is_skipped)
+{
+	auto skipping = createDevice(waitCode, true);
+	skipping->cycle(1000);
+	BOOST_REQUIRE_EQUAL(reg(*skipping, "r4"), 1);
+	BOOST_CHECK_GT(skipping->skippedInstructions(), 0xf0000 - 1000);
+	BOOST_CHECK_GE(skipping->guestTime(), 0xf0000);
+
+	auto running = createDevice(waitCode, false);
+	running->cycle(0xf0000 + 1000);
+	BOOST_REQUIRE_EQUAL(reg(*running, "r4"), 1);
+	BOOST_CHECK_EQUAL(running->skippedInstructions(), 0);
+	// Guest sees the same timer reading at the end of the wait.
+	BOOST_CHECK_EQUAL(reg(*skipping, "r3"), reg(*running, "r3"));
+}
+
+BOOST_AUTO_TEST_CASE(loop_with_state_is_run)
+{
+	auto skipping = createDevice(countingCode, true);
+	skipping->cycle(0x10000 + 1000);
+	BOOST_REQUIRE_EQUAL(reg(*skipping, "r4"), 1);
+	BOOST_CHECK_EQUAL(skipping->skippedInstructions(), 0);
+
+	auto running = createDevice(countingCode, false);
+	running->cycle(0x10000 + 1000);
+	BOOST_CHECK_EQUAL(reg(*skipping, "r5"), reg(*running, "r5"));
+	BOOST_CHECK_EQUAL(reg(*skipping, "r3"), reg(*running, "r3"));
+}
+
+BOOST_AUTO_TEST_CASE(wall_clock_is_not_skipped)
+{
+	auto device = createDevice(waitCode, true);
+	device->setVirtualTime(false, 0);
+	device->cycle(10000);
+	BOOST_CHECK_EQUAL(device->skippedInstructions(), 0);
+	BOOST_CHECK_EQUAL(reg(*device, "r4"), 0);
+}
@@ -0,0 +1,124 @@
+/*
+ * Copyright 2017 Zalewa <zalewapl@gmail.com>.
+ *
+ * This file is part of Emuballs.
+ *
+ * Emuballs is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Emuballs is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with Emuballs.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#define BOOST_TEST_MODULE inputlog
+#include <boost/test/unit_test.hpp>
+#include "device_program.hpp"
+#include "emuballs/errors.hpp"
+#include "emuballs/memory.hpp"
+#include "src/emuballs/inputlog.hpp"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <sstream>
+#include <thread>
+
+using DeviceProgram::createDevice;
+
+BOOST_AUTO_TEST_CASE(inputlog_roundtrip)
+{
+	uint64_t instructions = 0;
+	auto counter = [&instructions]() { return instructions; };
+	const std::vector<std::pair<uint64_t, uint64_t>> inputs = {
+		{3, 100}, {3, 90}, {700, 1ull << 40}, {100000, 5},
+	};
+
+	std::stringstream log;
+	Emuballs::InputLog recorder(counter);
+	recorder.record(log);
+	for (const auto &input : inputs)
+	{
+		instructions = input.first;
+		BOOST_CHECK_EQUAL(recorder.input(Emuballs::InputSource::SystemTimer, input.second),
+			input.second);
+	}
+	recorder.stop();
+
+	instructions = 0;
+	Emuballs::InputLog player(counter);
+	player.replay(log);
+	BOOST_CHECK(player.isReplaying());
+	for (const auto &input : inputs)
+	{
+		instructions = input.first;
+		BOOST_CHECK_EQUAL(player.input(Emuballs::InputSource::SystemTimer, 0), input.second);
+	}
+	BOOST_CHECK_THROW(player.input(Emuballs::InputSource::SystemTimer, 0),
+		Emuballs::ReplayError);
+}
+
+BOOST_AUTO_TEST_CASE(inputlog_divergence)
+{
+	uint64_t instructions = 10;
+	auto counter = [&instructions]() { return instructions; };
+	std::stringstream log;
+	Emuballs::InputLog recorder(counter);
+	recorder.record(log);
+	instructions = 20;
+	recorder.input(Emuballs::InputSource::SystemTimer, 1);
+	recorder.stop();
+
+	instructions = 10;
+	Emuballs::InputLog player(counter);
+	player.replay(log);
+	instructions = 21;
+	BOOST_CHECK_THROW(player.input(Emuballs::InputSource::SystemTimer, 0),
+		Emuballs::ReplayError);
+
+	std::stringstream garbage("garbage");
+	BOOST_CHECK_THROW(player.replay(garbage), Emuballs::ReplayError);
+}
+
+BOOST_AUTO_TEST_CASE(device_replay)
+{
+	const std::vector<uint32_t> program = {
+		0xe3a00202, // mov	r0, #0x20000000
+		0xe3800a03, // orr	r0, r0, #0x3000
+		0xe3a04801, // mov	r4, #0x10000
+		// loop:
+		0xe5901004, // ldr	r1, [r0, #4]
+		0xe4841004, // str	r1, [r4], #4
+		0xeafffffc, // b	loop
+	};
+	const std::string path = "emuballs_inputlog_device_replay.log";
+	constexpr auto CYCLES = 3000;
+	constexpr auto STORED = 1000 * 4;
+
+	auto recorded = createDevice(program);
+	recorded->startRecording(path);
+	recorded->cycle(CYCLES / 2);
+	std::this_thread::sleep_for(std::chrono::milliseconds(2));
+	recorded->cycle(CYCLES / 2);
+	recorded->stopRecordReplay();
+	auto expected = recorded->memory().chunk(0x10000, STORED);
+	// The sleep must show in the timer reads.
+	BOOST_REQUIRE(!std::equal(expected.begin(), expected.begin() + 4, expected.end() - 4));
+
+	std::this_thread::sleep_for(std::chrono::milliseconds(2));
+	auto replayed = createDevice(program);
+	replayed->startReplay(path);
+	replayed->cycle(CYCLES);
+	auto actual = replayed->memory().chunk(0x10000, STORED);
+	BOOST_CHECK(expected == actual);
+
+	// Going past the recording is divergence, too.
+	BOOST_CHECK_THROW(replayed->cycle(CYCLES), Emuballs::ReplayError);
+	replayed->stopRecordReplay();
+	std::remove(path.c_str());
+}
@@ -0,0 +1,185 @@
+/*
+ * Copyright 2017 Zalewa <zalewapl@gmail.com>.
+ *
+ * This file is part of Emuballs.
+ *
+ * Emuballs is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Emuballs is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with Emuballs.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#define BOOST_TEST_MODULE interrupts_pi
+#include <boost/test/unit_test.hpp>
+#include "device_program.hpp"
+#include "src/emuballs/armmachine.hpp"
+#include "src/emuballs/inputlog.hpp"
+#include "src/emuballs/interrupts_pi.hpp"
+#include "emuballs/memory.hpp"
+#include "src/emuballs/memory.hpp"
+#include "src/emuballs/scheduler.hpp"
+#include "src/emuballs/timer_pi.hpp"
+
+#include <vector>
+
+using namespace Emuballs;
+using Emuballs::Pi::InterruptController;
+
+namespace
+{
+constexpr memsize CONTROLLER = 0x2000;
+constexpr memsize BASIC_PENDING = CONTROLLER;
+constexpr memsize PENDING_1 = CONTROLLER + 0x04;
+constexpr memsize PENDING_2 = CONTROLLER + 0x08;
+constexpr memsize ENABLE_1 = CONTROLLER + 0x10;
+constexpr memsize ENABLE_2 = CONTROLLER + 0x14;
+constexpr memsize DISABLE_1 = CONTROLLER + 0x1c;
+
+struct ControllerFixture
+{
+	Memory memory;
+	TrackedMemory cpu {memory};
+	std::vector<bool> irqs;
+	InterruptController controller {memory, CONTROLLER,
+		[this](bool raised) { irqs.push_back(raised); }};
+};
+}
+
+BOOST_FIXTURE_TEST_CASE(enabled_lines_raise_irq, ControllerFixture)
+{
+	BOOST_CHECK(irqs == std::vector<bool>({false}));
+	controller.setLine(1, true);
+	BOOST_CHECK(!controller.isPending());
+	BOOST_CHECK_EQUAL(cpu.word(PENDING_1), 0);
+
+	cpu.putWord(ENABLE_1, 1 << 1);
+	BOOST_CHECK(controller.isPending());
+	BOOST_CHECK_EQUAL(cpu.word(PENDING_1), 1 << 1);
+	BOOST_CHECK_EQUAL(cpu.word(BASIC_PENDING), 1 << 8);
+	BOOST_CHECK(irqs == std::vector<bool>({false, true}));
+
+	// Writing 0s to the enable registers changes nothing.
+	cpu.putWord(ENABLE_1, 0);
+	cpu.putWord(ENABLE_2, 1 << (40 - 32));
+	BOOST_CHECK_EQUAL(cpu.word(ENABLE_1), 1 << 1);
+	controller.setLine(40, true);
+	BOOST_CHECK_EQUAL(cpu.word(PENDING_2), 1 << (40 - 32));
+	BOOST_CHECK_EQUAL(cpu.word(BASIC_PENDING), (1 << 8) | (1 << 9));
+
+	controller.setLine(1, false);
+	cpu.putWord(DISABLE_1, 1 << 1);
+	controller.setLine(1, true);
+	BOOST_CHECK_EQUAL(cpu.word(PENDING_1), 0);
+	BOOST_CHECK(irqs == std::vector<bool>({false, true}));
+	controller.setLine(40, false);
+	BOOST_CHECK(!controller.isPending());
+	BOOST_CHECK(irqs == std::vector<bool>({false, true, false}));
+}
+
+BOOST_AUTO_TEST_CASE(timer_irq_wakes_wfi)
+{
+	constexpr memsize TIMER = 0x1000;
+	const std::vector<uint32_t> vectors = {
+		0xe1a00000, 0xe1a00000, 0xe1a00000, 0xe1a00000,
+		0xe1a00000, 0xe1a00000,
+		0xea000010, // b	60 <handler>
+		0xe1a00000,
+	};
+	const std::vector<uint32_t> code = {
+		// 00000020 <main>:
+		0xe3a00a01, // mov	r0, #0x1000
+		0xe3a01a02, // mov	r1, #0x2000
+		0xe3a02002, // mov	r2, #2
+		0xe5812010, // str	r2, [r1, #16]
+		0xe5903004, // ldr	r3, [r0, #4]
+		0xe2833ffa, // add	r3, r3, #1000
+		0xe5803010, // str	r3, [r0, #16]
+		0xf1080080, // cpsie	i
+		0xe320f003, // wfi
+		0xeafffffe, // b	.
+		0xe1a00000, 0xe1a00000, 0xe1a00000, 0xe1a00000,
+		0xe1a00000, 0xe1a00000,
+		// 00000060 <handler>:
+		0xe3a02002, // mov	r2, #2
+		0xe5802000, // str	r2, [r0]
+		0xe2844001, // add	r4, r4, #1
+		0xe25ef004, // subs	pc, lr, #4
+	};
+	Arm::Machine machine;
+	memsize address = 0;
+	for (const auto *words : {&vectors, &code})
+	{
+		for (uint32_t word : *words)
+		{
+			machine.memory().putWord(address, word);
+			address += 4;
+		}
+	}
+	machine.cpu().cpsr(Arm::MODE_SUPERVISOR | Arm::PSR_IRQ_DISABLE);
+	machine.cpu().regs().pc(0x20);
+
+	Scheduler scheduler {machine};
+	InputLog inputs {[&machine]() { return machine.instructionCount(); }};
+	Memory &memory = machine.untrackedMemory();
+	InterruptController controller {memory, CONTROLLER,
+		[&machine](bool raised) { machine.setIrq(raised); }};
+	Pi::Timer timer {memory, TIMER, inputs};
+	timer.useVirtualTime([&machine]() { return machine.instructionCount(); }, 1000000);
+	std::vector<uint64_t> matches;
+	timer.connectCompares(scheduler, 1000000, [&](int channel, bool raised) {
+			if (raised)
+				matches.push_back(machine.instructionCount());
+			controller.setLine(InterruptController::SYSTEM_TIMER_MATCH + channel, raised);
+		});
+
+	scheduler.run(5000);
+	// Counter was read at 4 microseconds.
+	BOOST_CHECK(matches == std::vector<uint64_t>({1004}));
+	BOOST_CHECK_EQUAL(machine.cpu().regs()[4], 1);
+	BOOST_CHECK_EQUAL(machine.instructionCount(), 5000);
+	BOOST_CHECK_EQUAL(memory.word(TIMER), 0);
+	BOOST_CHECK(!machine.isIrqRaised());
+	BOOST_CHECK_EQUAL(machine.cpu().flags().cpuMode(), Arm::MODE_SUPERVISOR);
+	BOOST_CHECK_EQUAL(machine.nextInstructionAddress(), 0x44);
+}
+
+BOOST_AUTO_TEST_CASE(pi2_timer_compare_raises_irq)
+{
+	const std::vector<uint32_t> code = {
+		0xe3a0043f, // mov	r0, #0x3f000000
+		0xe3800a03, // orr	r0, r0, #0x3000
+		0xe3a0143f, // mov	r1, #0x3f000000
+		0xe3811cb2, // orr	r1, r1, #0xb200
+		0xe3a02002, // mov	r2, #2
+		0xe5812010, // str	r2, [r1, #0x10]
+		0xe5903004, // ldr	r3, [r0, #4]
+		0xe2833064, // add	r3, r3, #100
+		0xe5803010, // str	r3, [r0, #0x10]
+		0xf1080080, // cpsie	i
+		// 00008028 <loop>:
+		0xe2855001, // add	r5, r5, #1
+		0xeafffffd, // b	loop
+		// 00008030 <handler>:
+		0xe3a02002, // mov	r2, #2
+		0xe5802000, // str	r2, [r0]
+		0xe5903004, // ldr	r3, [r0, #4]
+		0xe2833064, // add	r3, r3, #100
+		0xe5803010, // str	r3, [r0, #0x10]
+		0xe2844001, // add	r4, r4, #1
+		0xe25ef004, // subs	pc, lr, #4
+	};
+	auto device = DeviceProgram::createDevice(code, "Raspberry Pi 2");
+	device->memory().putWord(0x18, 0xea002004); // b	handler
+	device->setVirtualTime(true, 1000000);
+	device->cycle(10000);
+	// Compare 1 matches every 100 microseconds plus the handler.
+	BOOST_CHECK_GE(DeviceProgram::reg(*device, "r4"), 90);
+	BOOST_CHECK_LE(DeviceProgram::reg(*device, "r4"), 100);
+}
@@ -263,3 +263,181 @@ BOOST_AUTO_TEST_CASE(memoryMaxSize)
 	BOOST_CHECK_NO_THROW(m.putByte(511, 1));
 	BOOST_CHECK_THROW(m.putByte(512, 1), std::out_of_range);
 }
+
+BOOST_AUTO_TEST_CASE(memoryObserverPageFilter)
+{
+	Memory m(64 * 1024, 128);
+	TrackedMemory tracked(m);
+	int calls = 0;
+	auto id = m.observe(300, 4, [&calls](memsize, Access) { ++calls; }, Access::Write);
+	tracked.putWord(300, 1);
+	BOOST_CHECK_EQUAL(calls, 1);
+	// Same page, outside of zone.
+	tracked.putWord(260, 1);
+	BOOST_CHECK_EQUAL(calls, 1);
+	// Chunk that spans the zone.
+	std::vector<uint8_t> bytes(512, 0);
+	tracked.putChunk(0, bytes);
+	BOOST_CHECK_EQUAL(calls, 2);
+	// Chunk that doesn't.
+	tracked.putChunk(1024, bytes);
+	BOOST_CHECK_EQUAL(calls, 2);
+	m.unobserve(id);
+	tracked.putWord(300, 1);
+	BOOST_CHECK_EQUAL(calls, 2);
+}
+
+BOOST_AUTO_TEST_CASE(memoryWatch)
+{
+	Memory m(64 * 1024, 128);
+	TrackedMemory tracked(m);
+	std::vector<MemWatchHit> hits;
+	m.setWatchListener([&hits](const MemWatchHit &hit) { hits.push_back(hit); });
+	auto readId = m.watch(0x1000, 8, Access::Read);
+	auto writeId = m.watch(0x2000, 4, Access::Write);
+
+	tracked.putWord(0x1000, 5);
+	BOOST_CHECK_EQUAL(hits.size(), 0);
+	tracked.word(0x1004);
+	BOOST_REQUIRE_EQUAL(hits.size(), 1);
+	BOOST_CHECK_EQUAL(hits[0].id, readId);
+	BOOST_CHECK_EQUAL(hits[0].address, 0x1004);
+	BOOST_CHECK(hits[0].access == Access::Read);
+
+	std::vector<uint8_t> bytes(16, 0xff);
+	tracked.putChunk(0x1ff8, bytes);
+	BOOST_REQUIRE_EQUAL(hits.size(), 2);
+	BOOST_CHECK_EQUAL(hits[1].id, writeId);
+	BOOST_CHECK_EQUAL(hits[1].address, 0x2000);
+
+	// Untracked access isn't caught.
+	m.putWord(0x2000, 1);
+	BOOST_CHECK_EQUAL(hits.size(), 2);
+
+	m.unwatch(writeId);
+	tracked.putWord(0x2000, 1);
+	BOOST_CHECK_EQUAL(hits.size(), 2);
+}
+
+BOOST_AUTO_TEST_CASE(memoryObserveZeroLength)
+{
+	Memory m(64 * 1024, 128);
+	TrackedMemory tracked(m);
+	BOOST_CHECK_THROW(m.observe(0x100, 0, [](memsize, Access) {}, Access::Write),
+		std::runtime_error);
+	BOOST_CHECK_THROW(m.watch(0x100, 0, Access::Write), std::runtime_error);
+	// Rejected zones don't poison later calls.
+	int calls = 0;
+	auto id = m.observe(0x100, 4, [&calls](memsize, Access) { ++calls; }, Access::Write);
+	auto watchId = m.watch(0x200, 4, Access::Write);
+	tracked.putWord(0x100, 1);
+	BOOST_CHECK_EQUAL(calls, 1);
+	BOOST_CHECK_NO_THROW(m.unobserve(id));
+	BOOST_CHECK_NO_THROW(m.unwatch(watchId));
+}
+
+BOOST_AUTO_TEST_CASE(memoryDirtyPages)
+{
+	Memory m(64 * 1024, 128);
+	m.putWord(0x100, 1);
+	m.putWord(0x104, 2);
+	m.putChunk(0x17e, std::vector<uint8_t>(4, 3));
+	BOOST_REQUIRE_EQUAL(m.dirtyPages().size(), 2);
+	BOOST_CHECK_EQUAL(m.dirtyPages()[0], 0x100);
+	BOOST_CHECK_EQUAL(m.dirtyPages()[1], 0x180);
+	// Reading doesn't dirty anything.
+	m.word(0x2000);
+	static_cast<const Memory&>(m).ptr(0x3000);
+	BOOST_CHECK_EQUAL(m.dirtyPages().size(), 2);
+	m.clearDirtyPages();
+	BOOST_CHECK(m.dirtyPages().empty());
+	m.putByte(0x100, 1);
+	BOOST_CHECK_EQUAL(m.dirtyPages().size(), 1);
+}
+
+BOOST_AUTO_TEST_CASE(memoryRestoreDirtyPages)
+{
+	Memory m(64 * 1024, 128);
+	m.putWord(0x100, 0xdeadbeef);
+	m.clearDirtyPages();
+	Memory snapshot = m;
+	m.putWord(0x100, 1);
+	m.putWord(0x1000, 2);
+	m.restoreDirtyPages(snapshot);
+	BOOST_CHECK_EQUAL(m.word(0x100), 0xdeadbeef);
+	BOOST_CHECK_EQUAL(m.word(0x1000), 0);
+	BOOST_CHECK(m.dirtyPages().empty());
+
+	Memory other(64 * 1024, 256);
+	BOOST_CHECK_THROW(m.restoreDirtyPages(other), std::invalid_argument);
+}
+
+BOOST_AUTO_TEST_CASE(memorySpans)
+{
+	Memory m(0x1000, 128);
+	m.putWord(0x104, 0x04030201);
+	auto spans = m.spans(0x100, 0x200);
+	BOOST_REQUIRE_EQUAL(spans.size(), 4);
+	BOOST_CHECK_EQUAL(spans[0].length, 128);
+	BOOST_CHECK_EQUAL(spans[0].data[4], 1);
+	BOOST_CHECK_EQUAL(spans[0].data[7], 4);
+	// Not allocated, but readable.
+	BOOST_CHECK_EQUAL(spans[1].data[0], 0);
+	BOOST_CHECK_EQUAL(m.allocatedPages().size(), 1);
+	// Views of allocated pages see later writes.
+	m.putByte(0x105, 9);
+	BOOST_CHECK_EQUAL(spans[0].data[5], 9);
+
+	spans = m.spans(0x17e, 4);
+	BOOST_REQUIRE_EQUAL(spans.size(), 2);
+	BOOST_CHECK_EQUAL(spans[0].length, 2);
+	BOOST_CHECK_EQUAL(spans[1].length, 2);
+
+	spans = m.spans(0xff0, 0x100);
+	BOOST_REQUIRE_EQUAL(spans.size(), 1);
+	BOOST_CHECK_EQUAL(spans[0].length, 0x10);
+	BOOST_CHECK(m.spans(0x1000, 1).empty());
+}
+
+BOOST_AUTO_TEST_CASE(memoryWriteGenerations)
+{
+	Memory m(64 * 1024, 128);
+	BOOST_CHECK_EQUAL(m.pageWriteGeneration(0x100), 0);
+	m.putWord(0x100, 1);
+	uint64_t since = m.advanceWriteGeneration();
+	BOOST_CHECK(m.pageWriteGeneration(0x100) >= since);
+	m.putWord(0x200, 1);
+	since = m.advanceWriteGeneration();
+	BOOST_CHECK(m.pageWriteGeneration(0x100) < since);
+	BOOST_CHECK(m.pageWriteGeneration(0x200) >= since);
+	// Generations don't interfere with the dirty pages.
+	BOOST_CHECK_EQUAL(m.dirtyPages().size(), 2);
+	m.clearDirtyPages();
+	Memory snapshot = m;
+	m.putByte(0x300, 1);
+	m.advanceWriteGeneration();
+	// Restoring is a write, too.
+	since = m.advanceWriteGeneration();
+	BOOST_CHECK(m.pageWriteGeneration(0x300) < since);
+	m.restoreDirtyPages(snapshot);
+	BOOST_CHECK(m.pageWriteGeneration(0x300) >= since);
+	BOOST_CHECK(m.pageWriteGeneration(0x100) < since);
+}
+
+BOOST_AUTO_TEST_CASE(memoryPagesWrittenSince)
+{
+	Memory m(64 * 1024, 128);
+	BOOST_CHECK(m.pagesWrittenSince(0).empty());
+	m.putWord(0x300, 1);
+	m.putWord(0x100, 1);
+	BOOST_CHECK(m.pagesWrittenSince(0) == std::vector<memsize>({0x100, 0x300}));
+	// Writes of the generation that ended count, too.
+	m.advanceWriteGeneration();
+	const uint64_t since = m.advanceWriteGeneration();
+	BOOST_CHECK(m.pagesWrittenSince(since).empty());
+	m.putByte(0x280, 1);
+	BOOST_CHECK(m.pagesWrittenSince(since) == std::vector<memsize>({0x280}));
+	// Reads don't count.
+	m.byte(0x400);
+	BOOST_CHECK(m.pagesWrittenSince(since) == std::vector<memsize>({0x280}));
+}
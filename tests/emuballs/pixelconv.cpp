@@ -0,0 +1,236 @@
+/*
+ * Copyright 2017 Zalewa <zalewapl@gmail.com>.
+ *
+ * This file is part of Emuballs.
+ *
+ * Emuballs is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Emuballs is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with Emuballs.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#define BOOST_TEST_MODULE pixelconv
+#include <boost/test/unit_test.hpp>
+#include "emuballs/canvas.hpp"
+#include "src/emuballs/pixelconv.hpp"
+
+#include <algorithm>
+#include <vector>
+
+using namespace Emuballs;
+using namespace Emuballs::PixelConv;
+
+namespace
+{
+struct RecordingCanvas : public Canvas
+{
+	std::vector<std::vector<uint32_t>> image;
+
+	void begin() override {}
+	void end() override {}
+
+	void drawPixel(int32_t x, int32_t y, const Color &color) override
+	{
+		image.at(y).at(x) = (static_cast<uint32_t>(color.a) << 24)
+			| (color.r << 16) | (color.g << 8) | color.b;
+	}
+
+	void changeSize(int32_t width, int32_t height, BitDepth) override
+	{
+		image.assign(height, std::vector<uint32_t>(width, 0));
+	}
+};
+
+std::vector<uint8_t> allRgb565()
+{
+	std::vector<uint8_t> pixels;
+	for (uint32_t pixel = 0; pixel <= 0xffff; ++pixel)
+	{
+		pixels.push_back(pixel & 0xff);
+		pixels.push_back(pixel >> 8);
+	}
+	return pixels;
+}
+
+std::vector<uint8_t> noise(size_t length)
+{
+	std::vector<uint8_t> bytes(length);
+	uint32_t state = 12345;
+	for (auto &byte : bytes)
+	{
+		state = state * 1103515245 + 12345;
+		byte = state >> 16;
+	}
+	return bytes;
+}
+
+void checkSimdMatchesScalar(RowConverter (*converter)(Simd), int bytesPerPixel);
+
+std::vector<Simd> availableSimd()
+{
+	std::vector<Simd> levels;
+	for (auto simd : {Simd::Scalar, Simd::Sse2, Simd::Ssse3, Simd::Avx2})
+	{
+		if (static_cast<int>(simd) <= static_cast<int>(detectSimd()))
+			levels.push_back(simd);
+	}
+	return levels;
+}
+}
+
+BOOST_AUTO_TEST_CASE(rgb565_scalar)
+{
+	// Little-endian: 0xf800 is pure red.
+	const uint8_t pixels[] = {0x00, 0xf8, 0xe0, 0x07, 0x1f, 0x00, 0x10, 0x84};
+	uint32_t rgb32[4];
+	rgb565(Simd::Scalar)(pixels, 4, rgb32);
+	BOOST_CHECK_EQUAL(rgb32[0], 0xffff0000);
+	BOOST_CHECK_EQUAL(rgb32[1], 0xff00ff00);
+	BOOST_CHECK_EQUAL(rgb32[2], 0xff0000ff);
+	BOOST_CHECK_EQUAL(rgb32[3], 0xff838183);
+}
+
+BOOST_AUTO_TEST_CASE(rgb565_simd_matches_scalar)
+{
+	const auto pixels = allRgb565();
+	const int32_t count = pixels.size() / 2;
+	std::vector<uint32_t> expected(count);
+	rgb565(Simd::Scalar)(pixels.data(), count, expected.data());
+	for (auto simd : availableSimd())
+	{
+		BOOST_TEST_CONTEXT("simd " << static_cast<int>(simd))
+		{
+			BOOST_REQUIRE(rgb565(simd) != nullptr);
+			std::vector<uint32_t> converted(count);
+			rgb565(simd)(pixels.data(), count, converted.data());
+			BOOST_CHECK(converted == expected);
+
+			// Widths that leave a tail for the scalar loop.
+			for (int32_t width : {1, 7, 9, 15, 17, 31})
+			{
+				std::vector<uint32_t> row(width + 1, 0);
+				rgb565(simd)(pixels.data() + 2 * 1000, width, row.data());
+				BOOST_CHECK(std::equal(row.begin(), row.begin() + width,
+						expected.begin() + 1000));
+				BOOST_CHECK_EQUAL(row[width], 0);
+			}
+		}
+	}
+}
+
+BOOST_AUTO_TEST_CASE(rgb888_and_xrgb8888_scalar)
+{
+	const uint8_t rgb888Pixels[] = {0x11, 0x22, 0x33, 0xff, 0x00, 0x80};
+	uint32_t rgb32[2];
+	rgb888(Simd::Scalar)(rgb888Pixels, 2, rgb32);
+	BOOST_CHECK_EQUAL(rgb32[0], 0xff332211);
+	BOOST_CHECK_EQUAL(rgb32[1], 0xff8000ff);
+
+	const uint8_t xrgb8888Pixels[] = {0x11, 0x22, 0x33, 0x00, 0xff, 0x00, 0x80, 0x7f};
+	xrgb8888(Simd::Scalar)(xrgb8888Pixels, 2, rgb32);
+	BOOST_CHECK_EQUAL(rgb32[0], 0xff332211);
+	BOOST_CHECK_EQUAL(rgb32[1], 0xff8000ff);
+}
+
+BOOST_AUTO_TEST_CASE(rgb888_simd_matches_scalar)
+{
+	checkSimdMatchesScalar(rgb888, 3);
+}
+
+BOOST_AUTO_TEST_CASE(xrgb8888_simd_matches_scalar)
+{
+	checkSimdMatchesScalar(xrgb8888, 4);
+}
+
+BOOST_AUTO_TEST_CASE(draw_picture_honours_pitch)
+{
+	RecordingCanvas canvas;
+	canvas.changeSize(3, 2, BitDepth::HighColor);
+	// Rows of 3 pixels padded to 8 bytes.
+	const std::vector<uint8_t> pixels = {
+		0x00, 0xf8, 0xe0, 0x07, 0x1f, 0x00, 0xaa, 0xaa,
+		0xff, 0xff, 0x00, 0x00, 0x00, 0xf8, 0xaa, 0xaa
+	};
+	canvas.drawPicture(0, 0, 3, 2, 16, 8, pixels);
+	BOOST_CHECK(canvas.image[0] == std::vector<uint32_t>({0xffff0000, 0xff00ff00, 0xff0000ff}));
+	BOOST_CHECK(canvas.image[1] == std::vector<uint32_t>({0xffffffff, 0xff000000, 0xffff0000}));
+}
+
+BOOST_AUTO_TEST_CASE(draw_picture_stops_at_end_of_pixels)
+{
+	RecordingCanvas canvas;
+	canvas.changeSize(2, 2, BitDepth::HighColor);
+	const std::vector<uint8_t> pixels = {0xff, 0xff, 0xff, 0xff, 0xff};
+	canvas.drawPicture(0, 0, 2, 2, 16, 0, pixels);
+	BOOST_CHECK(canvas.image[0] == std::vector<uint32_t>({0xffffffff, 0xffffffff}));
+	BOOST_CHECK(canvas.image[1] == std::vector<uint32_t>({0, 0}));
+}
+
+BOOST_AUTO_TEST_CASE(draw_spans_across_boundaries)
+{
+	RecordingCanvas canvas;
+	canvas.changeSize(2, 3, BitDepth::HighColor);
+	const std::vector<uint8_t> pixels = {
+		0x00, 0xf8, 0xe0, 0x07,
+		0x1f, 0x00, 0xff, 0xff,
+		0x00, 0x00, 0x00, 0xf8
+	};
+	// Second row starts in the first span and is split three ways.
+	const std::vector<MemorySpan> spans = {
+		{pixels.data(), 5},
+		{pixels.data() + 5, 1},
+		{pixels.data() + 6, 6}
+	};
+	canvas.drawSpans(0, 0, 2, 3, 16, 4, spans);
+	BOOST_CHECK(canvas.image[0] == std::vector<uint32_t>({0xffff0000, 0xff00ff00}));
+	BOOST_CHECK(canvas.image[1] == std::vector<uint32_t>({0xff0000ff, 0xffffffff}));
+	BOOST_CHECK(canvas.image[2] == std::vector<uint32_t>({0xff000000, 0xffff0000}));
+
+	// Rows past the spans are left alone.
+	canvas.changeSize(2, 3, BitDepth::HighColor);
+	canvas.drawSpans(0, 0, 2, 3, 16, 4, {spans[0], spans[1]});
+	BOOST_CHECK(canvas.image[0] == std::vector<uint32_t>({0xffff0000, 0xff00ff00}));
+	BOOST_CHECK(canvas.image[1] == std::vector<uint32_t>({0, 0}));
+}
+
+BOOST_AUTO_TEST_CASE(draw_picture_unhandled_depth)
+{
+	RecordingCanvas canvas;
+	BOOST_CHECK_THROW(canvas.drawPicture(0, 0, 1, 1, 12, 0, {0, 0}), std::logic_error);
+}
+
+namespace
+{
+void checkSimdMatchesScalar(RowConverter (*converter)(Simd), int bytesPerPixel)
+{
+	const int32_t count = 1000;
+	const auto pixels = noise(count * bytesPerPixel);
+	std::vector<uint32_t> expected(count);
+	converter(Simd::Scalar)(pixels.data(), count, expected.data());
+	for (auto simd : availableSimd())
+	{
+		BOOST_TEST_CONTEXT("simd " << static_cast<int>(simd))
+		{
+			BOOST_REQUIRE(converter(simd) != nullptr);
+			// Every width up to a few vectors, so that the loops
+			// never read past the end of the row.
+			for (int32_t width = 0; width <= 40; ++width)
+			{
+				const int32_t offset = count - width;
+				std::vector<uint32_t> row(width + 1, 0);
+				converter(simd)(pixels.data() + offset * bytesPerPixel, width, row.data());
+				BOOST_CHECK(std::equal(row.begin(), row.begin() + width,
+						expected.begin() + offset));
+				BOOST_CHECK_EQUAL(row[width], 0);
+			}
+		}
+	}
+}
+}
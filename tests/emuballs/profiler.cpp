@@ -0,0 +1,178 @@
+/*
+ * Copyright 2017 Zalewa <zalewapl@gmail.com>.
+ *
+ * This file is part of Emuballs.
+ *
+ * Emuballs is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Emuballs is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with Emuballs.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#define BOOST_TEST_MODULE profiler
+#include <boost/test/unit_test.hpp>
+#include "arm_program_fixture.hpp"
+#include "emuballs/errors.hpp"
+#include "emuballs/symbols.hpp"
+#include "src/emuballs/profiler.hpp"
+#include <sstream>
+
+namespace
+{
+constexpr uint32_t callsCode[] = {
+	// 00000000 <main>:
+	0xe1a0400e, // mov	r4, lr
+	0xeb000003, // bl	18 <func>
+	0xeb000002, // bl	18 <func>
+	0xe3a01001, // mov	r1, #1
+	0xe1a0f004, // mov	pc, r4
+	0xe1a00000, // nop
+	// 00000018 <func>:
+	0xe2800001, // add	r0, r0, #1
+	0xe1a0f00e, // mov	pc, lr
+};
+
+Emuballs::SymbolTable callsSymbols()
+{
+	Emuballs::SymbolTable symbols;
+	symbols.add(Emuballs::Symbol { "main", 0x0, 0x18 });
+	symbols.add(Emuballs::Symbol { "func", 0x18, 0x8 });
+	return symbols;
+}
+
+std::string profile(uint32_t samplePeriod)
+{
+	ArmProgramFixture fixture;
+	fixture.load(std::begin(callsCode), std::end(callsCode));
+	Emuballs::Profiler profiler(0, samplePeriod);
+	fixture.machine.setProfiler(&profiler);
+	fixture.runProgram();
+	fixture.machine.setProfiler(nullptr);
+	BOOST_CHECK_EQUAL(fixture.r(0), 2);
+	BOOST_CHECK_EQUAL(profiler.executed(), 9);
+	std::stringstream ss;
+	profiler.writeCallgrind(ss, callsSymbols());
+	return ss.str();
+}
+
+void putLe(std::string &out, uint32_t value, int size)
+{
+	for (int i = 0; i < size; ++i)
+		out += static_cast<char>((value >> (i * 8)) & 0xff);
+}
+}
+
+BOOST_AUTO_TEST_CASE(profile_exact)
+{
+	std::string out = profile(1);
+	BOOST_TEST_MESSAGE(out);
+	BOOST_CHECK(out.find("events: Ir\n") != std::string::npos);
+	BOOST_CHECK(out.find("summary: 9\n") != std::string::npos);
+	BOOST_CHECK(out.find(
+			"fn=main\n"
+			"0 1\n0x4 1\n0x8 1\n0xc 1\n0x10 1\n"
+			"cfn=func\ncalls=1 0x18\n0x4 2\n"
+			"cfn=func\ncalls=1 0x18\n0x8 2\n") != std::string::npos);
+	BOOST_CHECK(out.find("fn=func\n0x18 2\n0x1c 2\n") != std::string::npos);
+}
+
+BOOST_AUTO_TEST_CASE(profile_sampled)
+{
+	std::string out = profile(4);
+	BOOST_TEST_MESSAGE(out);
+	// Self costs are sampled, call edges stay exact.
+	BOOST_CHECK(out.find(
+			"fn=main\n"
+			"0xc 4\n"
+			"cfn=func\ncalls=1 0x18\n0x4 2\n") != std::string::npos);
+	BOOST_CHECK(out.find("fn=func\n0x1c 4\n") != std::string::npos);
+}
+
+BOOST_AUTO_TEST_CASE(symbols_find)
+{
+	auto symbols = callsSymbols();
+	BOOST_CHECK_EQUAL(symbols.name(0x18), "func");
+	BOOST_CHECK_EQUAL(symbols.name(0x1c), "func+0x4");
+	BOOST_CHECK_EQUAL(symbols.name(0x20), "0x20");
+	BOOST_CHECK(symbols.find(0x20) == nullptr);
+}
+
+BOOST_AUTO_TEST_CASE(symbols_from_elf)
+{
+	const std::string strtab = std::string("\0main\0$a\0loop\0ext\0", 18);
+	std::string symtab;
+	auto sym = [&symtab](uint32_t name, uint32_t value, uint32_t size,
+		uint8_t info, uint16_t shndx)
+	{
+		putLe(symtab, name, 4);
+		putLe(symtab, value, 4);
+		putLe(symtab, size, 4);
+		putLe(symtab, info, 1);
+		putLe(symtab, 0, 1);
+		putLe(symtab, shndx, 2);
+	};
+	sym(0, 0, 0, 0, 0);
+	sym(1, 0x8000, 0x10, 0x12, 1); // main, global func
+	sym(6, 0x8000, 0, 0x00, 1); // $a, mapping symbol
+	sym(9, 0x8008, 0, 0x00, 1); // loop, local label
+	sym(14, 0x9000, 0, 0x12, 0); // ext, undefined
+
+	const uint32_t shoff = 52;
+	const uint32_t dataOffset = shoff + 3 * 40;
+	std::string elf("\x7f" "ELF\x01\x01\x01", 7);
+	elf.resize(16, '\0');
+	putLe(elf, 2, 2); // e_type
+	putLe(elf, 40, 2); // e_machine
+	putLe(elf, 1, 4); // e_version
+	putLe(elf, 0x8000, 4); // e_entry
+	putLe(elf, 0, 4); // e_phoff
+	putLe(elf, shoff, 4);
+	putLe(elf, 0, 4); // e_flags
+	putLe(elf, 52, 2); // e_ehsize
+	putLe(elf, 0, 2); // e_phentsize
+	putLe(elf, 0, 2); // e_phnum
+	putLe(elf, 40, 2); // e_shentsize
+	putLe(elf, 3, 2); // e_shnum
+	putLe(elf, 0, 2); // e_shstrndx
+	auto section = [&elf](uint32_t type, uint32_t offset, uint32_t size,
+		uint32_t link, uint32_t entsize)
+	{
+		putLe(elf, 0, 4); // sh_name
+		putLe(elf, type, 4);
+		putLe(elf, 0, 4); // sh_flags
+		putLe(elf, 0, 4); // sh_addr
+		putLe(elf, offset, 4);
+		putLe(elf, size, 4);
+		putLe(elf, link, 4);
+		putLe(elf, 0, 4); // sh_info
+		putLe(elf, 4, 4); // sh_addralign
+		putLe(elf, entsize, 4);
+	};
+	section(0, 0, 0, 0, 0);
+	section(2, dataOffset, symtab.size(), 2, 16);
+	section(3, dataOffset + symtab.size(), strtab.size(), 0, 0);
+	elf += symtab;
+	elf += strtab;
+
+	std::stringstream stream(elf);
+	auto symbols = Emuballs::SymbolTable::fromElf(stream);
+	BOOST_CHECK_EQUAL(symbols.size(), 2);
+	BOOST_CHECK_EQUAL(symbols.name(0x8004), "main+0x4");
+	BOOST_CHECK_EQUAL(symbols.name(0x8008), "loop");
+	BOOST_CHECK_EQUAL(symbols.name(0x7ff0), "0x7ff0");
+}
+
+BOOST_AUTO_TEST_CASE(symbols_from_garbage)
+{
+	std::stringstream stream("not an elf at all");
+	BOOST_CHECK_THROW(Emuballs::SymbolTable::fromElf(stream), Emuballs::SymbolLoadError);
+	std::stringstream truncated(std::string("\x7f" "ELF\x01\x01", 6));
+	BOOST_CHECK_THROW(Emuballs::SymbolTable::fromElf(truncated), Emuballs::SymbolLoadError);
+}
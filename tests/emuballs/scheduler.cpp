@@ -0,0 +1,197 @@
+/*
+ * Copyright 2017 Zalewa <zalewapl@gmail.com>.
+ *
+ * This file is part of Emuballs.
+ *
+ * Emuballs is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Emuballs is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with Emuballs.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#define BOOST_TEST_MODULE scheduler
+#include <boost/test/unit_test.hpp>
+#include "src/emuballs/armmachine.hpp"
+#include "src/emuballs/scheduler.hpp"
+
+#include <vector>
+
+using namespace Emuballs;
+
+namespace
+{
+constexpr memsize STORE_ADDRESS = 0x1000;
+
+const std::vector<uint32_t> loopCode = {
+	0xe2800001, // add	r0, r0, #1
+	0xe5810000, // str	r0, [r1]
+	0xeafffffc, // b	0
+};
+
+struct SchedulerFixture
+{
+	Arm::Machine machine;
+	Scheduler scheduler {machine};
+	std::vector<uint64_t> fired;
+
+	SchedulerFixture()
+	{
+		memsize address = 0;
+		for (uint32_t word : loopCode)
+		{
+			machine.memory().putWord(address, word);
+			address += 4;
+		}
+		machine.cpu().regs().pc(0);
+		machine.cpu().regs().set(1, STORE_ADDRESS);
+	}
+
+	Scheduler::Handler record()
+	{
+		return [this]() { fired.push_back(machine.instructionCount()); };
+	}
+};
+}
+
+BOOST_AUTO_TEST_CASE(machine_request_stop_at)
+{
+	SchedulerFixture fixture;
+	fixture.machine.requestStopAt(10);
+	auto result = fixture.machine.run(100);
+	BOOST_CHECK(result.reason == Arm::StopReason::Requested);
+	BOOST_CHECK_EQUAL(result.executed, 10);
+	result = fixture.machine.run(100);
+	BOOST_CHECK(result.reason == Arm::StopReason::Requested);
+	BOOST_CHECK_EQUAL(result.executed, 0);
+	fixture.machine.requestStopAt(UINT64_MAX);
+	result = fixture.machine.run(100);
+	BOOST_CHECK(result.reason == Arm::StopReason::Budget);
+	BOOST_CHECK_EQUAL(result.executed, 100);
+}
+
+BOOST_FIXTURE_TEST_CASE(events_fire_on_time, SchedulerFixture)
+{
+	std::vector<int> order;
+	scheduler.schedule(100, [this, &order]() {
+			order.push_back(1);
+			fired.push_back(machine.instructionCount());
+		});
+	scheduler.schedule(50, [&order]() { order.push_back(2); });
+	scheduler.schedule(50, [&order]() { order.push_back(3); });
+	BOOST_CHECK_EQUAL(scheduler.nextEvent(), 50);
+	auto result = scheduler.run(1000);
+	BOOST_CHECK(result.reason == Arm::StopReason::Budget);
+	BOOST_CHECK_EQUAL(result.executed, 1000);
+	BOOST_CHECK_EQUAL(machine.instructionCount(), 1000);
+	BOOST_REQUIRE_EQUAL(order.size(), 3);
+	BOOST_CHECK_EQUAL(order[0], 2);
+	BOOST_CHECK_EQUAL(order[1], 3);
+	BOOST_CHECK_EQUAL(order[2], 1);
+	BOOST_REQUIRE_EQUAL(fired.size(), 1);
+	BOOST_CHECK_EQUAL(fired[0], 100);
+	BOOST_CHECK_EQUAL(scheduler.nextEvent(), UINT64_MAX);
+}
+
+BOOST_FIXTURE_TEST_CASE(periodic_event, SchedulerFixture)
+{
+	std::function<void()> tick = [this, &tick]() {
+		fired.push_back(machine.instructionCount());
+		scheduler.scheduleIn(100, tick);
+	};
+	scheduler.scheduleIn(100, tick);
+	scheduler.run(1050);
+	BOOST_REQUIRE_EQUAL(fired.size(), 10);
+	for (size_t i = 0; i < fired.size(); ++i)
+		BOOST_CHECK_EQUAL(fired[i], (i + 1) * 100);
+}
+
+BOOST_FIXTURE_TEST_CASE(cancel, SchedulerFixture)
+{
+	auto id = scheduler.schedule(10, record());
+	scheduler.schedule(20, record());
+	scheduler.cancel(id);
+	BOOST_CHECK_EQUAL(scheduler.nextEvent(), 20);
+	scheduler.run(100);
+	BOOST_REQUIRE_EQUAL(fired.size(), 1);
+	BOOST_CHECK_EQUAL(fired[0], 20);
+
+	scheduler.schedule(150, record());
+	scheduler.clear();
+	scheduler.run(100);
+	BOOST_CHECK_EQUAL(fired.size(), 1);
+}
+
+BOOST_FIXTURE_TEST_CASE(post_from_observer, SchedulerFixture)
+{
+	machine.untrackedMemory().observe(STORE_ADDRESS, 4, [this](memsize, Access) {
+			scheduler.post(record());
+		}, Access::Write);
+	scheduler.run(30);
+	// Stores are every third instruction, starting with the second.
+	BOOST_REQUIRE_EQUAL(fired.size(), 10);
+	for (size_t i = 0; i < fired.size(); ++i)
+		BOOST_CHECK_EQUAL(fired[i], 2 + i * 3);
+}
+
+BOOST_FIXTURE_TEST_CASE(schedule_from_observer_before_deadline, SchedulerFixture)
+{
+	// The run starts with the deadline at 1000.
+	scheduler.schedule(1000, record());
+	bool scheduled = false;
+	machine.untrackedMemory().observe(STORE_ADDRESS, 4, [this, &scheduled](memsize, Access) {
+			if (!scheduled)
+				scheduler.scheduleIn(5, record());
+			scheduled = true;
+		}, Access::Write);
+	auto result = scheduler.run(2000);
+	BOOST_CHECK(result.reason == Arm::StopReason::Budget);
+	BOOST_CHECK_EQUAL(result.executed, 2000);
+	// The first store is the second instruction; the count
+	// doesn't include it yet while it's being executed.
+	BOOST_REQUIRE_EQUAL(fired.size(), 2);
+	BOOST_CHECK_EQUAL(fired[0], 1 + 5);
+	BOOST_CHECK_EQUAL(fired[1], 1000);
+}
+
+BOOST_FIXTURE_TEST_CASE(run_stops_for_breakpoint, SchedulerFixture)
+{
+	scheduler.schedule(2, record());
+	Arm::StopConditions stop;
+	stop.breakpoints.insert(0);
+	auto result = scheduler.run(100, stop);
+	BOOST_CHECK(result.reason == Arm::StopReason::Breakpoint);
+	BOOST_CHECK_EQUAL(result.executed, 3);
+	BOOST_REQUIRE_EQUAL(fired.size(), 1);
+	BOOST_CHECK_EQUAL(fired[0], 2);
+}
+
+BOOST_FIXTURE_TEST_CASE(state_restores_pending_events, SchedulerFixture)
+{
+	scheduler.schedule(10, record());
+	auto cancelled = scheduler.schedule(20, record());
+	scheduler.schedule(30, record());
+	scheduler.cancel(cancelled);
+	Scheduler::State state = scheduler.state();
+	BOOST_CHECK_EQUAL(state.events.size(), 2);
+
+	scheduler.run(50);
+	BOOST_CHECK(fired == std::vector<uint64_t>({10, 30}));
+	scheduler.schedule(60, record());
+
+	Arm::Cpu cpu = machine.cpuSnapshot();
+	machine.restoreCpu(cpu, 0);
+	scheduler.restore(state);
+	BOOST_CHECK_EQUAL(scheduler.nextEvent(), 10);
+	fired.clear();
+	scheduler.run(100);
+	BOOST_CHECK(fired == std::vector<uint64_t>({10, 30}));
+	// Ids go on from where they were.
+	BOOST_CHECK_EQUAL(scheduler.schedule(200, record()), state.nextId);
+}
@@ -0,0 +1,176 @@
+/*
+ * Copyright 2017 Zalewa <zalewapl@gmail.com>.
+ *
+ * This file is part of Emuballs.
+ *
+ * Emuballs is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Emuballs is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with Emuballs.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#define BOOST_TEST_MODULE smp
+#include <boost/test/unit_test.hpp>
+#include "device_program.hpp"
+#include "emuballs/memory.hpp"
+
+#include <algorithm>
+#include <stdexcept>
+
+using namespace DeviceProgram;
+
+namespace
+{
+constexpr uint32_t COUNTER = 0x9000;
+constexpr uint32_t LOG_INDEX = 0x9004;
+constexpr uint32_t DONE_FLAGS = 0x9010;
+constexpr uint32_t LOG = 0x9100;
+constexpr int CORES = 4;
+constexpr int ITERATIONS = 200;
+
+/*
+ * Boot core starts the other three through their mailboxes. Each
+ * core then increments a shared counter and appends its number
+ * to a shared log with LDREX/STREX, and raises its done flag.
+ */
+const Code smpCode = {
+	{ 0x8000, {
+		0xe3a00000, // mov	r0, #0
+		0xe3a04101, // mov	r4, #0x40000000
+		0xe3a05c81, // mov	r5, #0x8100
+		0xe584509c, // str	r5, [r4, #0x9c]
+		0xe2855008, // add	r5, r5, #8
+		0xe58450ac, // str	r5, [r4, #0xac]
+		0xe2855008, // add	r5, r5, #8
+		0xe58450bc, // str	r5, [r4, #0xbc]
+		0xea00003e, // b	8120 <worker>
+	}},
+	{ 0x8100, {
+		0xe3a00001, // mov	r0, #1
+		0xea000005, // b	8120 <worker>
+		0xe3a00002, // mov	r0, #2
+		0xea000003, // b	8120 <worker>
+		0xe3a00003, // mov	r0, #3
+		0xea000001, // b	8120 <worker>
+	}},
+	{ 0x8120, {
+		// worker:
+		0xe3a06a09, // mov	r6, #0x9000
+		0xe3a070c8, // mov	r7, #200
+		// loop:
+		0xe1961f9f, // ldrex	r1, [r6]
+		0xe2811001, // add	r1, r1, #1
+		0xe1862f91, // strex	r2, r1, [r6]
+		0xe3520000, // cmp	r2, #0
+		0x1afffffa, // bne	8128 <loop>
+		0xe2868004, // add	r8, r6, #4
+		// append:
+		0xe1981f9f, // ldrex	r1, [r8]
+		0xe2813001, // add	r3, r1, #1
+		0xe1882f93, // strex	r2, r3, [r8]
+		0xe3520000, // cmp	r2, #0
+		0x1afffffa, // bne	8140 <append>
+		0xe2869c01, // add	r9, r6, #0x100
+		0xe7c90001, // strb	r0, [r9, r1]
+		0xe2577001, // subs	r7, r7, #1
+		0x1afffff0, // bne	8128 <loop>
+		0xe2869010, // add	r9, r6, #0x10
+		0xe3a03001, // mov	r3, #1
+		0xe7893100, // str	r3, [r9, r0, lsl #2]
+		0xeafffffe, // b	8170
+	}},
+};
+
+Emuballs::DevicePtr createPi2(const Code &code = smpCode)
+{
+	return createDevice(code, "Raspberry Pi 2");
+}
+
+std::vector<uint8_t> runSmp(bool deterministic)
+{
+	auto device = createPi2();
+	device->setCoreScheduling(1000, deterministic);
+	device->cycle(50000);
+
+	Emuballs::Memory &memory = device->memory();
+	BOOST_CHECK_EQUAL(memory.word(COUNTER), CORES * ITERATIONS);
+	BOOST_CHECK_EQUAL(memory.word(LOG_INDEX), CORES * ITERATIONS);
+	for (int core = 0; core < CORES; ++core)
+		BOOST_CHECK_EQUAL(memory.word(DONE_FLAGS + core * 4), 1);
+	auto log = memory.chunk(LOG, CORES * ITERATIONS);
+	for (int core = 0; core < CORES; ++core)
+		BOOST_CHECK_EQUAL(std::count(log.begin(), log.end(), core), ITERATIONS);
+	return log;
+}
+}
+
+BOOST_AUTO_TEST_CASE(smp_threaded)
+{
+	runSmp(false);
+}
+
+BOOST_AUTO_TEST_CASE(smp_deterministic)
+{
+	auto first = runSmp(true);
+	auto second = runSmp(true);
+	BOOST_CHECK(first == second);
+}
+
+BOOST_AUTO_TEST_CASE(smp_secondary_cores_parked)
+{
+	auto device = createPi2();
+	// Skip starting the other cores.
+	device->memory().putWord(0x8000 + 3 * 4, 0xe1a00000);
+	device->memory().putWord(0x8000 + 5 * 4, 0xe1a00000);
+	device->memory().putWord(0x8000 + 7 * 4, 0xe1a00000);
+	device->cycle(20000);
+	BOOST_CHECK_EQUAL(device->memory().word(COUNTER), ITERATIONS);
+	BOOST_CHECK_EQUAL(device->memory().word(DONE_FLAGS), 1);
+	BOOST_CHECK_EQUAL(device->memory().word(DONE_FLAGS + 4), 0);
+}
+
+BOOST_AUTO_TEST_CASE(smp_timer_event_while_secondary_runs)
+{
+	constexpr uint32_t TIMER_CONTROL = 0x3f003000;
+	const Code code = {
+		{ 0x8000, {
+			0xe3a04101, // mov	r4, #0x40000000
+			0xe3a05c81, // mov	r5, #0x8100
+			0xe584509c, // str	r5, [r4, #0x9c]
+			0xe3a0643f, // mov	r6, #0x3f000000
+			0xe2866a03, // add	r6, r6, #0x3000
+			0xe5960004, // ldr	r0, [r6, #4]
+			0xe2800002, // add	r0, r0, #2
+			0xe5860010, // str	r0, [r6, #0x10]
+			0xe2877001, // add	r7, r7, #1
+			0xeafffffd, // b	8020
+		}},
+		{ 0x8100, {
+			0xe2888001, // add	r8, r8, #1
+			0xeafffffd, // b	8100
+		}},
+	};
+	// Compare 1 matches 2 us after it's written, in the middle
+	// of a quantum with core 1 running on its own thread.
+	auto device = createPi2(code);
+	device->setVirtualTime(true, 0);
+	device->setCoreScheduling(1000, false);
+	device->cycle(20000);
+	BOOST_CHECK_EQUAL(device->memory().word(TIMER_CONTROL) & 0x2, 0x2);
+	device->cycle(20000);
+	BOOST_CHECK_EQUAL(device->memory().word(TIMER_CONTROL) & 0x2, 0x2);
+}
+
+BOOST_AUTO_TEST_CASE(smp_unsupported_features)
+{
+	auto device = createPi2();
+	BOOST_CHECK_THROW(device->startCheckpoints(1000, 1000), std::runtime_error);
+	BOOST_CHECK_THROW(device->startRecording("emuballs_smp_unsupported.log"), std::runtime_error);
+}
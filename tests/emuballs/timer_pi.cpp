@@ -0,0 +1,140 @@
+/*
+ * Copyright 2017 Zalewa <zalewapl@gmail.com>.
+ *
+ * This file is part of Emuballs.
+ *
+ * Emuballs is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Emuballs is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with Emuballs.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#define BOOST_TEST_MODULE timer_pi
+#include <boost/test/unit_test.hpp>
+#include "src/emuballs/armmachine.hpp"
+#include "src/emuballs/inputlog.hpp"
+#include "src/emuballs/memory.hpp"
+#include "src/emuballs/scheduler.hpp"
+#include "src/emuballs/timer_pi.hpp"
+
+#include <sstream>
+#include <vector>
+
+using namespace Emuballs;
+
+namespace
+{
+constexpr memsize TIMER = 0x20003000;
+constexpr memsize COUNTER_LOW = TIMER + 4;
+constexpr memsize COMPARE_1 = TIMER + 0x10;
+
+struct TimerFixture
+{
+	uint64_t cycles = 0;
+	Memory memory;
+	TrackedMemory cpu {memory};
+	InputLog inputs {[this]() { return cycles; }};
+	Pi::Timer timer {memory, TIMER, inputs};
+
+	uint64_t counter()
+	{
+		uint64_t low = cpu.word(COUNTER_LOW);
+		return low | (static_cast<uint64_t>(memory.word(COUNTER_LOW + 4)) << 32);
+	}
+};
+}
+
+BOOST_FIXTURE_TEST_CASE(virtual_time_follows_cycles, TimerFixture)
+{
+	timer.useVirtualTime([this]() { return cycles; }, 700000000);
+	BOOST_CHECK(timer.isVirtualTime());
+	BOOST_CHECK_EQUAL(counter(), 0);
+	cycles = 700;
+	BOOST_CHECK_EQUAL(counter(), 1);
+	cycles = 699;
+	BOOST_CHECK_EQUAL(counter(), 0);
+	cycles = 700000000ull * 3600;
+	BOOST_CHECK_EQUAL(counter(), 3600ull * 1000000);
+	cycles = 700000000ull * 1000000000;
+	BOOST_CHECK_EQUAL(counter(), 1000000000ull * 1000000);
+	BOOST_CHECK_EQUAL(timer.now(), 1000000000ull * 1000000);
+}
+
+BOOST_FIXTURE_TEST_CASE(virtual_time_skips_input_log, TimerFixture)
+{
+	std::stringstream log;
+	inputs.record(log);
+	std::string header = log.str();
+	timer.useVirtualTime([this]() { return cycles; }, 1000000);
+	for (cycles = 0; cycles < 100; ++cycles)
+		BOOST_CHECK_EQUAL(counter(), cycles);
+	inputs.stop();
+	BOOST_CHECK_EQUAL(log.str(), header);
+}
+
+BOOST_FIXTURE_TEST_CASE(switching_keeps_counting, TimerFixture)
+{
+	cycles = 1000;
+	timer.useVirtualTime([this]() { return cycles; }, 1000000);
+	BOOST_CHECK_EQUAL(counter(), 0);
+	cycles = 6000;
+	BOOST_CHECK_EQUAL(counter(), 5000);
+	timer.useWallClock();
+	BOOST_CHECK(!timer.isVirtualTime());
+	uint64_t wall = counter();
+	BOOST_CHECK_GE(wall, 5000);
+	BOOST_CHECK_LT(wall, 5000 + 10000000);
+	timer.useVirtualTime([this]() { return cycles; }, 1000000);
+	uint64_t resumed = counter();
+	BOOST_CHECK_GE(resumed, wall);
+	cycles += 10;
+	BOOST_CHECK_EQUAL(counter(), resumed + 10);
+}
+
+BOOST_AUTO_TEST_CASE(compare_match)
+{
+	Arm::Machine machine;
+	// b .
+	machine.memory().putWord(0, 0xeafffffe);
+	machine.cpu().regs().pc(0);
+	Scheduler scheduler {machine};
+	Memory &memory = machine.untrackedMemory();
+	TrackedMemory cpu = machine.memory();
+	InputLog inputs {[&machine]() { return machine.instructionCount(); }};
+	Pi::Timer timer {memory, TIMER, inputs};
+	timer.useVirtualTime([&machine]() { return machine.instructionCount(); }, 2000000);
+	std::vector<std::pair<int, bool>> lines;
+	timer.connectCompares(scheduler, 2000000, [&lines](int channel, bool raised) {
+			lines.emplace_back(channel, raised);
+		});
+
+	// Compares that weren't written don't match.
+	cpu.putWord(COMPARE_1, 100);
+	scheduler.run(199);
+	BOOST_CHECK(lines.empty());
+	scheduler.run(2);
+	BOOST_REQUIRE_EQUAL(lines.size(), 1);
+	BOOST_CHECK(lines[0] == std::make_pair(1, true));
+	BOOST_CHECK_EQUAL(cpu.word(TIMER), 1 << 1);
+
+	// Writing 0 leaves the match bit alone.
+	cpu.putWord(TIMER, 0);
+	BOOST_CHECK_EQUAL(cpu.word(TIMER), 1 << 1);
+	cpu.putWord(TIMER, 1 << 1);
+	BOOST_CHECK_EQUAL(cpu.word(TIMER), 0);
+	BOOST_REQUIRE_EQUAL(lines.size(), 2);
+	BOOST_CHECK(lines[1] == std::make_pair(1, false));
+
+	// Compare equal to the counter matches after the wrap only.
+	cpu.putWord(COMPARE_1, 100);
+	scheduler.run(10000);
+	BOOST_CHECK_EQUAL(lines.size(), 2);
+	BOOST_CHECK_EQUAL(scheduler.nextEvent(), 200 + (1ull << 32) * 2);
+}
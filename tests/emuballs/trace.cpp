@@ -0,0 +1,126 @@
+/*
+ * Copyright 2017 Zalewa <zalewapl@gmail.com>.
+ *
+ * This file is part of Emuballs.
+ *
+ * Emuballs is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Emuballs is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with Emuballs.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#define BOOST_TEST_MODULE trace
+#include <boost/test/unit_test.hpp>
+#include "arm_program_fixture.hpp"
+#include "emuballs/errors.hpp"
+#include "src/emuballs/byte_ring.hpp"
+#include "src/emuballs/trace.hpp"
+#include <sstream>
+#include <thread>
+
+BOOST_AUTO_TEST_CASE(byte_ring_wraparound)
+{
+	Emuballs::ByteRing ring(6);
+	BOOST_CHECK_EQUAL(ring.capacity(), 8);
+	const uint8_t in[] = {1, 2, 3, 4, 5};
+	uint8_t out[8] = {};
+	BOOST_CHECK(ring.write(in, 5));
+	BOOST_CHECK(!ring.write(in, 5));
+	BOOST_CHECK_EQUAL(ring.read(out, 3), 3);
+	BOOST_CHECK(ring.write(in, 5));
+	BOOST_CHECK_EQUAL(ring.read(out, sizeof(out)), 7);
+	const uint8_t expected[] = {4, 5, 1, 2, 3, 4, 5};
+	BOOST_CHECK_EQUAL_COLLECTIONS(out, out + 7, std::begin(expected), std::end(expected));
+	BOOST_CHECK(ring.empty());
+}
+
+BOOST_AUTO_TEST_CASE(byte_ring_threads)
+{
+	constexpr uint32_t COUNT = 10000;
+	Emuballs::ByteRing ring(64);
+	std::thread producer([&ring]() {
+			for (uint32_t i = 0; i < COUNT; ++i)
+			{
+				while (!ring.write(reinterpret_cast<const uint8_t*>(&i), sizeof(i)))
+					std::this_thread::yield();
+			}
+		});
+	uint32_t expected = 0;
+	bool ordered = true;
+	while (expected < COUNT)
+	{
+		uint32_t value;
+		if (ring.read(reinterpret_cast<uint8_t*>(&value), sizeof(value)) == sizeof(value))
+		{
+			ordered = ordered && value == expected;
+			++expected;
+		}
+		else
+		{
+			std::this_thread::yield();
+		}
+	}
+	producer.join();
+	BOOST_CHECK(ordered);
+}
+
+BOOST_AUTO_TEST_CASE(trace_machine)
+{
+	constexpr uint32_t code[] = {
+		0xe3a01c01, // mov	r1, #256
+		0xe5910000, // ldr	r0, [r1]
+		0xe5810004, // str	r0, [r1, #4]
+		0xe3a00001, // mov	r0, #1
+		0xe1a0f00e, // mov	pc, lr
+	};
+	ArmProgramFixture fixture;
+	fixture.load(std::begin(code), std::end(code));
+	fixture.machine.untrackedMemory().putWord(0x100, 0xcafe);
+
+	std::stringstream stream;
+	{
+		Emuballs::TraceRecorder recorder(stream, 64);
+		fixture.machine.setTraceRecorder(&recorder);
+		fixture.runProgram();
+		fixture.machine.setTraceRecorder(nullptr);
+		BOOST_CHECK_EQUAL(recorder.recorded(), 5);
+	}
+
+	Emuballs::TraceReader reader(stream);
+	Emuballs::TraceEntry entry;
+	std::vector<Emuballs::TraceEntry> entries;
+	while (reader.next(entry))
+		entries.push_back(entry);
+	BOOST_REQUIRE_EQUAL(entries.size(), 5);
+	for (size_t idx = 0; idx < entries.size(); ++idx)
+	{
+		BOOST_CHECK_EQUAL(entries[idx].address, idx * 4);
+		BOOST_CHECK_EQUAL(entries[idx].instruction, code[idx]);
+	}
+	typedef std::vector<std::pair<int, uint32_t>> Regs;
+	BOOST_CHECK(entries[0].registers == (Regs {{1, 0x100}}));
+	BOOST_CHECK(entries[0].memory.empty());
+	BOOST_CHECK(entries[1].registers == (Regs {{0, 0xcafe}}));
+	BOOST_REQUIRE_EQUAL(entries[1].memory.size(), 1);
+	BOOST_CHECK_EQUAL(entries[1].memory[0].address, 0x100);
+	BOOST_CHECK(!entries[1].memory[0].write);
+	BOOST_CHECK(entries[2].registers.empty());
+	BOOST_REQUIRE_EQUAL(entries[2].memory.size(), 1);
+	BOOST_CHECK_EQUAL(entries[2].memory[0].address, 0x104);
+	BOOST_CHECK(entries[2].memory[0].write);
+	BOOST_CHECK(entries[3].registers == (Regs {{0, 1}}));
+	BOOST_CHECK(entries[4].registers == (Regs {{15, fixture.machine.cpu().regs().lr()}}));
+}
+
+BOOST_AUTO_TEST_CASE(trace_reader_rejects_garbage)
+{
+	std::stringstream stream("NOTATRACE");
+	BOOST_CHECK_THROW(Emuballs::TraceReader reader(stream), Emuballs::TraceFormatError);
+}
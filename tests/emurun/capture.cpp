@@ -0,0 +1,254 @@
+/*
+ * Copyright 2017 Zalewa <zalewapl@gmail.com>.
+ *
+ * This file is part of Emuballs Emurun.
+ *
+ * Emuballs Emurun is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Emuballs Emurun is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Emuballs Emurun.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#define BOOST_TEST_MODULE capture
+#include <boost/test/unit_test.hpp>
+#include "src/emurun/capture.hpp"
+#include "emuballs/canvas.hpp"
+
+#include <cstdio>
+#include <fstream>
+#include <iterator>
+#include <string>
+#include <vector>
+
+using Capture::Recorder;
+
+namespace
+{
+constexpr int32_t WIDTH = 4;
+constexpr int32_t HEIGHT = 2;
+/** 4:2:0 frame of WIDTH x HEIGHT. */
+constexpr size_t FRAME_SIZE = WIDTH * HEIGHT + 2 * (WIDTH / 2) * (HEIGHT / 2);
+constexpr uint64_t INTERVAL = 1000;
+const std::string Y4M_PATH = "emurun_capture_test.y4m";
+
+/**
+ * Display filled with a single colour; redrawn whole each time,
+ * like the GPU does with the rows on the written pages.
+ */
+struct Display
+{
+	uint32_t colour = 0xff000000;
+	bool sized = false;
+
+	void draw(Emuballs::Canvas &canvas)
+	{
+		if (!sized)
+			canvas.changeSize(WIDTH, HEIGHT, Emuballs::BitDepth::TrueColor);
+		sized = true;
+		std::vector<uint32_t> row(WIDTH, colour);
+		for (int32_t y = 0; y < HEIGHT; ++y)
+			canvas.drawRow(0, y, WIDTH, row.data());
+	}
+};
+
+void capture(Recorder &recorder, Display &display, uint64_t guestTime)
+{
+	recorder.capture([&display](Emuballs::Canvas &canvas) { display.draw(canvas); },
+		guestTime);
+}
+
+std::string readFile(const std::string &path)
+{
+	std::ifstream file(path, std::ios::in | std::ios::binary);
+	return std::string(std::istreambuf_iterator<char>(file), std::istreambuf_iterator<char>());
+}
+
+bool exists(const std::string &path)
+{
+	return std::ifstream(path).is_open();
+}
+
+/**
+ * Frames of the Y4M stream, in order.
+ */
+std::vector<std::string> y4mFrames(const std::string &path)
+{
+	std::string stream = readFile(path);
+	std::vector<std::string> frames;
+	size_t pos = stream.find('\n');
+	BOOST_REQUIRE(pos != std::string::npos);
+	for (++pos; pos < stream.size(); pos += FRAME_SIZE)
+	{
+		BOOST_REQUIRE_EQUAL(stream.substr(pos, 6), "FRAME\n");
+		pos += 6;
+		BOOST_REQUIRE_LE(pos + FRAME_SIZE, stream.size());
+		frames.push_back(stream.substr(pos, FRAME_SIZE));
+	}
+	return frames;
+}
+}
+
+BOOST_AUTO_TEST_CASE(y4m_repeats_unchanged_frames)
+{
+	Display display;
+	Recorder recorder(Y4M_PATH, INTERVAL, 8, false);
+	capture(recorder, display, 0);
+	capture(recorder, display, 1000);
+	// Ticks 2 and 3 come at once.
+	capture(recorder, display, 3500);
+	display.colour = 0xffffffff;
+	capture(recorder, display, 4000);
+	// Same tick again.
+	capture(recorder, display, 4999);
+	BOOST_CHECK_EQUAL(recorder.finish(), "");
+	BOOST_CHECK_EQUAL(recorder.capturedFrames(), 2);
+	BOOST_CHECK_EQUAL(recorder.unchangedFrames(), 3);
+	BOOST_CHECK_EQUAL(recorder.droppedFrames(), 0);
+
+	auto frames = y4mFrames(Y4M_PATH);
+	BOOST_REQUIRE_EQUAL(frames.size(), 5);
+	for (int frame = 1; frame < 4; ++frame)
+		BOOST_CHECK(frames[frame] == frames[0]);
+	BOOST_CHECK(frames[4] != frames[0]);
+	const std::string header = "YUV4MPEG2 W4 H2 F1000:1 Ip ";
+	BOOST_CHECK_EQUAL(readFile(Y4M_PATH).substr(0, header.size()), header);
+	std::remove(Y4M_PATH.c_str());
+}
+
+BOOST_AUTO_TEST_CASE(y4m_writes_frame_once_per_tick)
+{
+	Display display;
+	Recorder recorder(Y4M_PATH, INTERVAL, 8, false);
+	capture(recorder, display, 0);
+	display.colour = 0xff00ff00;
+	// Changed frame covers the ticks 1 and 2.
+	capture(recorder, display, 2500);
+	BOOST_CHECK_EQUAL(recorder.finish(), "");
+	BOOST_CHECK_EQUAL(recorder.capturedFrames(), 2);
+	BOOST_CHECK_EQUAL(recorder.unchangedFrames(), 1);
+
+	auto frames = y4mFrames(Y4M_PATH);
+	BOOST_REQUIRE_EQUAL(frames.size(), 3);
+	BOOST_CHECK(frames[1] != frames[0]);
+	BOOST_CHECK(frames[2] == frames[1]);
+	std::remove(Y4M_PATH.c_str());
+}
+
+BOOST_AUTO_TEST_CASE(y4m_resends_dropped_frame)
+{
+	Display display;
+	Recorder recorder(Y4M_PATH, INTERVAL, 1, false);
+	capture(recorder, display, 0);
+	display.colour = 0xffff0000;
+	// Queue is full until flushed.
+	capture(recorder, display, 1000);
+	capture(recorder, display, 2000);
+	BOOST_CHECK_EQUAL(recorder.droppedFrames(), 2);
+	recorder.flush();
+	// Unchanged, but the last change was dropped.
+	capture(recorder, display, 3000);
+	BOOST_CHECK_EQUAL(recorder.finish(), "");
+	BOOST_CHECK_EQUAL(recorder.capturedFrames(), 2);
+	BOOST_CHECK_EQUAL(recorder.droppedFrames(), 2);
+
+	// Dropped ticks hold the previous frame.
+	auto frames = y4mFrames(Y4M_PATH);
+	BOOST_REQUIRE_EQUAL(frames.size(), 4);
+	BOOST_CHECK(frames[1] == frames[0]);
+	BOOST_CHECK(frames[2] == frames[0]);
+	BOOST_CHECK(frames[3] != frames[0]);
+	std::remove(Y4M_PATH.c_str());
+}
+
+BOOST_AUTO_TEST_CASE(y4m_finish_writes_held_frames)
+{
+	Display display;
+	Recorder recorder(Y4M_PATH, INTERVAL, 8, false);
+	capture(recorder, display, 0);
+	capture(recorder, display, 3000);
+	BOOST_CHECK_EQUAL(recorder.finish(), "");
+	BOOST_CHECK_EQUAL(recorder.capturedFrames(), 1);
+	BOOST_CHECK_EQUAL(recorder.unchangedFrames(), 3);
+
+	auto frames = y4mFrames(Y4M_PATH);
+	BOOST_REQUIRE_EQUAL(frames.size(), 4);
+	BOOST_CHECK(frames[3] == frames[0]);
+	std::remove(Y4M_PATH.c_str());
+}
+
+BOOST_AUTO_TEST_CASE(ppm_files_are_numbered_by_tick)
+{
+	Display display;
+	Recorder recorder("emurun_capture_%03d.ppm", INTERVAL, 8, false);
+	capture(recorder, display, 0);
+	display.colour = 0xff0000ff;
+	// Ticks 1 and 2 come at once and the frame is numbered
+	// by the first of them.
+	capture(recorder, display, 2500);
+	capture(recorder, display, 3000);
+	display.colour = 0xffffffff;
+	capture(recorder, display, 5000);
+	BOOST_CHECK_EQUAL(recorder.finish(), "");
+	BOOST_CHECK_EQUAL(recorder.capturedFrames(), 3);
+	BOOST_CHECK_EQUAL(recorder.unchangedFrames(), 3);
+
+	for (const char *path : { "emurun_capture_000.ppm", "emurun_capture_001.ppm",
+		"emurun_capture_004.ppm" })
+	{
+		BOOST_CHECK_MESSAGE(exists(path), path);
+		std::remove(path);
+	}
+	for (const char *path : { "emurun_capture_002.ppm", "emurun_capture_003.ppm",
+		"emurun_capture_005.ppm" })
+	{
+		BOOST_CHECK_MESSAGE(!exists(path), path);
+	}
+}
+
+BOOST_AUTO_TEST_CASE(ppm_number_padded_like_printf)
+{
+	Display display;
+	Recorder recorder("emurun_capture_%4d.ppm", INTERVAL, 8, false);
+	capture(recorder, display, 0);
+	display.colour = 0xffffffff;
+	capture(recorder, display, 12000);
+	BOOST_CHECK_EQUAL(recorder.finish(), "");
+	std::remove("emurun_capture_   0.ppm");
+	const std::string path = "emurun_capture_   1.ppm";
+	BOOST_REQUIRE(exists(path));
+	std::string ppm = readFile(path);
+	BOOST_CHECK_EQUAL(ppm.substr(0, 11), "P6\n4 2\n255\n");
+	BOOST_CHECK_EQUAL(ppm.size(), 11 + WIDTH * HEIGHT * 3);
+	BOOST_CHECK_EQUAL(static_cast<uint8_t>(ppm[11]), 0xff);
+	std::remove(path.c_str());
+}
+
+BOOST_AUTO_TEST_CASE(threaded_recorder_writes_everything)
+{
+	Display display;
+	Recorder recorder(Y4M_PATH, INTERVAL);
+	for (uint64_t tick = 0; tick < 100; ++tick)
+	{
+		display.colour = 0xff000000 | (tick % 2 ? 0xffffff : 0);
+		capture(recorder, display, tick * INTERVAL);
+	}
+	BOOST_CHECK_EQUAL(recorder.finish(), "");
+	BOOST_CHECK_EQUAL(recorder.capturedFrames() + recorder.droppedFrames(), 100);
+	// Dropped frames are held, so the stream doesn't lose any time.
+	BOOST_CHECK_EQUAL(y4mFrames(Y4M_PATH).size(), 100);
+	std::remove(Y4M_PATH.c_str());
+}
+
+BOOST_AUTO_TEST_CASE(bad_capture_path)
+{
+	BOOST_CHECK_THROW(Recorder("frames.ppm", INTERVAL), std::runtime_error);
+	BOOST_CHECK_THROW(Recorder("frame%d%d.ppm", INTERVAL), std::runtime_error);
+	BOOST_CHECK_THROW(Recorder(Y4M_PATH, 0), std::runtime_error);
+}